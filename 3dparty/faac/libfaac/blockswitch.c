@@ -28,7 +28,11 @@
 #include "util.h"
 #include <faac.h>
 
+#ifdef FAAC_FIXED_POINT
+typedef enrg_t psyfloat;
+#else
 typedef float psyfloat;
+#endif
 
 typedef struct
 {
@@ -45,7 +49,7 @@ typedef struct
 psydata_t;
 
 
-static void Hann(GlobalPsyInfo * gpsyInfo, double *inSamples, int size)
+static void Hann(GlobalPsyInfo * gpsyInfo, real_t *inSamples, int size)
 {
   int i;
 
@@ -53,12 +57,12 @@ static void Hann(GlobalPsyInfo * gpsyInfo, double *inSamples, int size)
   if (size == BLOCK_LEN_LONG * 2)
   {
     for (i = 0; i < size; i++)
-      inSamples[i] *= gpsyInfo->hannWindow[i];
+      inSamples[i] = MUL_C(inSamples[i], gpsyInfo->hannWindow[i]);
   }
   else
   {
     for (i = 0; i < size; i++)
-      inSamples[i] *= gpsyInfo->hannWindowS[i];
+      inSamples[i] = MUL_C(inSamples[i], gpsyInfo->hannWindowS[i]);
   }
 }
 
@@ -78,6 +82,9 @@ static void PsyCheckShort(PsyInfo * psyInfo, double quality)
   int firstband = 2;
   int sfb, win;
   psyfloat *lasteng;
+#ifdef FAAC_FIXED_POINT
+  uint32_t qual = (uint32_t)(quality * 65536.0);
+#endif
 
   psyInfo->block_type = ONLY_LONG_WINDOW;
 
@@ -95,6 +102,27 @@ static void PsyCheckShort(PsyInfo * psyInfo, double quality)
 
       if (lasteng)
       {
+#ifdef FAAC_FIXED_POINT
+          enrg_t toteng = 0;
+          enrg_t volchg = 0;
+
+          for (sfb = firstband; sfb < lastband; sfb++)
+          {
+              if (eng[sfb] < lasteng[sfb])
+              {
+                  toteng += eng[sfb];
+                  volchg += lasteng[sfb] - eng[sfb];
+              }
+              else
+              {
+                  toteng += lasteng[sfb];
+                  volchg += eng[sfb] - lasteng[sfb];
+              }
+          }
+
+          /* volchg / toteng * quality > 3 without the division */
+          if (fix_mul_q16(volchg, qual) > 3 * toteng)
+#else
           double toteng = 0.0;
           double volchg = 0.0;
 
@@ -105,6 +133,7 @@ static void PsyCheckShort(PsyInfo * psyInfo, double quality)
           }
 
           if ((volchg / toteng * quality) > 3.0)
+#endif
           {
               psyInfo->block_type = ONLY_SHORT_WINDOW;
               break;
@@ -128,16 +157,16 @@ static void PsyInit(GlobalPsyInfo * gpsyInfo, PsyInfo * psyInfo, unsigned int nu
   int i, j, size;
 
   gpsyInfo->hannWindow =
-    (double *) AllocMemory(2 * BLOCK_LEN_LONG * sizeof(double));
+    (coef_t *) AllocMemory(2 * BLOCK_LEN_LONG * sizeof(coef_t));
   gpsyInfo->hannWindowS =
-    (double *) AllocMemory(2 * BLOCK_LEN_SHORT * sizeof(double));
+    (coef_t *) AllocMemory(2 * BLOCK_LEN_SHORT * sizeof(coef_t));
 
   for (i = 0; i < BLOCK_LEN_LONG * 2; i++)
-    gpsyInfo->hannWindow[i] = 0.5 * (1 - cos(2.0 * M_PI * (i + 0.5) /
-					     (BLOCK_LEN_LONG * 2)));
+    gpsyInfo->hannWindow[i] = COEF_CONST(0.5 * (1 - cos(2.0 * M_PI * (i + 0.5) /
+					     (BLOCK_LEN_LONG * 2))));
   for (i = 0; i < BLOCK_LEN_SHORT * 2; i++)
-    gpsyInfo->hannWindowS[i] = 0.5 * (1 - cos(2.0 * M_PI * (i + 0.5) /
-					      (BLOCK_LEN_SHORT * 2)));
+    gpsyInfo->hannWindowS[i] = COEF_CONST(0.5 * (1 - cos(2.0 * M_PI * (i + 0.5) /
+					      (BLOCK_LEN_SHORT * 2))));
   gpsyInfo->sampleRate = (double) sampleRate;
 
   for (channel = 0; channel < numChannels; channel++)
@@ -152,8 +181,8 @@ static void PsyInit(GlobalPsyInfo * gpsyInfo, PsyInfo * psyInfo, unsigned int nu
     psyInfo[channel].size = size;
 
     psyInfo[channel].prevSamples =
-      (double *) AllocMemory(size * sizeof(double));
-    memset(psyInfo[channel].prevSamples, 0, size * sizeof(double));
+      (real_t *) AllocMemory(size * sizeof(real_t));
+    memset(psyInfo[channel].prevSamples, 0, size * sizeof(real_t));
   }
 
   size = BLOCK_LEN_SHORT;
@@ -269,21 +298,34 @@ static void PsyCalculate(ChannelInfo * channelInfo, GlobalPsyInfo * gpsyInfo,
 }
 
 // imported from filtbank.c
-static void mdct( FFT_Tables *fft_tables, double *data, int N )
+static void mdct( FFT_Tables *fft_tables, real_t *data, int N )
 {
-    double tempr, tempi, c, s, cold, cfreq, sfreq; /* temps for pre and post twiddle */
-    double freq = 2.0 * M_PI / N;
-    double cosfreq8, sinfreq8;
+    real_t tempr, tempi; /* temps for pre and post twiddle */
+    coef_t c, s, cold, cfreq, sfreq;
+    coef_t cosfreq8, sinfreq8;
     int i, n;
 
-    double xi[BLOCK_LEN_LONG / 2];
-    double xr[BLOCK_LEN_LONG / 2];
+    real_t xi[BLOCK_LEN_LONG / 2];
+    real_t xr[BLOCK_LEN_LONG / 2];
 
     /* prepare for recurrence relation in pre-twiddle */
+#ifdef FAAC_FIXED_POINT
+    {
+        const coef_t *rot = fft_tables->mdct_rot[N == 2 * BLOCK_LEN_LONG];
+
+        cfreq = rot[0];
+        sfreq = rot[1];
+        cosfreq8 = rot[2];
+        sinfreq8 = rot[3];
+    }
+#else
+    double freq = 2.0 * M_PI / N;
+
     cfreq = cos (freq);
     sfreq = sin (freq);
     cosfreq8 = cos (freq * 0.125);
     sinfreq8 = sin (freq * 0.125);
+#endif
     c = cosfreq8;
     s = sinfreq8;
 
@@ -302,13 +344,13 @@ static void mdct( FFT_Tables *fft_tables, double *data, int N )
             tempi = data [(N>>2) + n] + data [N + (N>>2) - 1 - n];
 
         /* calculate pre-twiddled FFT input */
-        xr[i] = tempr * c + tempi * s;
-        xi[i] = tempi * c - tempr * s;
+        xr[i] = MUL_C(tempr, c) + MUL_C(tempi, s);
+        xi[i] = MUL_C(tempi, c) - MUL_C(tempr, s);
 
         /* use recurrence to prepare cosine and sine for next value of i */
         cold = c;
-        c = c * cfreq - s * sfreq;
-        s = s * cfreq + cold * sfreq;
+        c = MUL_C(c, cfreq) - MUL_C(s, sfreq);
+        s = MUL_C(s, cfreq) + MUL_C(cold, sfreq);
     }
 
     /* Perform in-place complex FFT of length N/4 */
@@ -327,8 +369,8 @@ static void mdct( FFT_Tables *fft_tables, double *data, int N )
     /* post-twiddle FFT output and then get output data */
     for (i = 0; i < (N >> 2); i++) {
         /* get post-twiddled FFT output  */
-        tempr = 2. * (xr[i] * c + xi[i] * s);
-        tempi = 2. * (xi[i] * c - xr[i] * s);
+        tempr = 2 * (MUL_C(xr[i], c) + MUL_C(xi[i], s));
+        tempi = 2 * (MUL_C(xi[i], c) - MUL_C(xr[i], s));
 
         /* fill in output values */
         data [2 * i] = -tempr;   /* first half even */
@@ -338,27 +380,27 @@ static void mdct( FFT_Tables *fft_tables, double *data, int N )
 
         /* use recurrence to prepare cosine and sine for next value of i */
         cold = c;
-        c = c * cfreq - s * sfreq;
-        s = s * cfreq + cold * sfreq;
+        c = MUL_C(c, cfreq) - MUL_C(s, sfreq);
+        s = MUL_C(s, cfreq) + MUL_C(cold, sfreq);
     }
 }
 
 
 static void PsyBufferUpdate( FFT_Tables *fft_tables, GlobalPsyInfo * gpsyInfo, PsyInfo * psyInfo,
-			    double *newSamples, unsigned int bandwidth,
+			    real_t *newSamples, unsigned int bandwidth,
 			    int *cb_width_short, int num_cb_short)
 {
   int win;
-  double transBuff[2 * BLOCK_LEN_LONG];
-  double transBuffS[2 * BLOCK_LEN_SHORT];
+  real_t transBuff[2 * BLOCK_LEN_LONG];
+  real_t transBuffS[2 * BLOCK_LEN_SHORT];
   psydata_t *psydata = psyInfo->data;
   psyfloat *tmp;
   int sfb;
 
   psydata->bandS = psyInfo->sizeS * bandwidth * 2 / gpsyInfo->sampleRate;
 
-  memcpy(transBuff, psyInfo->prevSamples, psyInfo->size * sizeof(double));
-  memcpy(transBuff + psyInfo->size, newSamples, psyInfo->size * sizeof(double));
+  memcpy(transBuff, psyInfo->prevSamples, psyInfo->size * sizeof(real_t));
+  memcpy(transBuff + psyInfo->size, newSamples, psyInfo->size * sizeof(real_t));
 
   for (win = 0; win < 8; win++)
   {
@@ -366,7 +408,7 @@ static void PsyBufferUpdate( FFT_Tables *fft_tables, GlobalPsyInfo * gpsyInfo, P
     int last = 0;
 
     memcpy(transBuffS, transBuff + (win * BLOCK_LEN_SHORT) + (BLOCK_LEN_LONG - BLOCK_LEN_SHORT) / 2,
-	   2 * psyInfo->sizeS * sizeof(double));
+	   2 * psyInfo->sizeS * sizeof(real_t));
 
     Hann(gpsyInfo, transBuffS, 2 * psyInfo->sizeS);
     mdct( fft_tables, transBuffS, 2 * psyInfo->sizeS);
@@ -380,7 +422,7 @@ static void PsyBufferUpdate( FFT_Tables *fft_tables, GlobalPsyInfo * gpsyInfo, P
 
     for (sfb = 0; sfb < num_cb_short; sfb++)
     {
-      double e;
+      enrg_t e;
       int l;
 
       first = last;
@@ -392,9 +434,9 @@ static void PsyBufferUpdate( FFT_Tables *fft_tables, GlobalPsyInfo * gpsyInfo, P
       if (first >= psydata->bandS) // band out of range
           break;
 
-      e = 0.0;
+      e = 0;
       for (l = first; l < last; l++)
-          e += transBuffS[l] * transBuffS[l];
+          e += ENRG(transBuffS[l]);
 
       psydata->engNext2[win][sfb] = e;
     }
@@ -405,7 +447,7 @@ static void PsyBufferUpdate( FFT_Tables *fft_tables, GlobalPsyInfo * gpsyInfo, P
     }
   }
 
-  memcpy(psyInfo->prevSamples, newSamples, psyInfo->size * sizeof(double));
+  memcpy(psyInfo->prevSamples, newSamples, psyInfo->size * sizeof(real_t));
 }
 
 static void BlockSwitch(CoderInfo * coderInfo, PsyInfo * psyInfo, unsigned int numChannels)
@@ -39,7 +39,7 @@ typedef struct {
 	int sizeS;
 
 	/* Previous input samples */
-	double *prevSamples;
+	real_t *prevSamples;
 
 	int block_type;
 
@@ -50,8 +50,8 @@ typedef struct {
 	double sampleRate;
 
 	/* Hann window */
-	double *hannWindow;
-	double *hannWindowS;
+	coef_t *hannWindow;
+	coef_t *hannWindowS;
 
         void *data;
 } GlobalPsyInfo;
@@ -69,7 +69,7 @@ void (*PsyCalculate) (ChannelInfo *channelInfo, GlobalPsyInfo *gpsyInfo,
 		int *cb_width_short, int num_cb_short,
 		unsigned int numChannels, double quality);
 void (*PsyBufferUpdate) ( FFT_Tables *fft_tables, GlobalPsyInfo * gpsyInfo, PsyInfo * psyInfo,
-		double *newSamples, unsigned int bandwidth,
+		real_t *newSamples, unsigned int bandwidth,
 		int *cb_width_short, int num_cb_short);
 void (*BlockSwitch) (CoderInfo *coderInfo, PsyInfo *psyInfo,
 		unsigned int numChannels);
@@ -22,6 +22,8 @@
 #ifndef CODER_H
 #define CODER_H
 
+#include "fixed.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
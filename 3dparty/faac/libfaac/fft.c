@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "coder.h"
 #include "fft.h"
 #include "util.h"
 
@@ -242,6 +243,18 @@ void fft_initialize( FFT_Tables *fft_tables )
 		fft_tables->negsintbl[i]	= NULL;
 		fft_tables->reordertbl[i]	= NULL;
 	}
+
+#ifdef FAAC_FIXED_POINT
+	for( i = 0; i < 2; i++ )
+	{
+		double freq = 2.0 * M_PI / (i ? 2 * BLOCK_LEN_LONG : 2 * BLOCK_LEN_SHORT);
+
+		fft_tables->mdct_rot[i][0] = COEF_CONST( cos( freq ) );
+		fft_tables->mdct_rot[i][1] = COEF_CONST( sin( freq ) );
+		fft_tables->mdct_rot[i][2] = COEF_CONST( cos( freq * 0.125 ) );
+		fft_tables->mdct_rot[i][3] = COEF_CONST( sin( freq * 0.125 ) );
+	}
+#endif
 }
 
 void fft_terminate( FFT_Tables *fft_tables )
@@ -269,7 +282,7 @@ void fft_terminate( FFT_Tables *fft_tables )
 	fft_tables->reordertbl	= NULL;
 }
 
-static void reorder( FFT_Tables *fft_tables, double *x, int logm)
+static void reorder( FFT_Tables *fft_tables, real_t *x, int logm)
 {
 	int i;
 	int size = 1 << logm;
@@ -300,7 +313,7 @@ static void reorder( FFT_Tables *fft_tables, double *x, int logm)
 	for (i = 0; i < size; i++)
 	{
 		int j = r[i];
-		double tmp;
+		real_t tmp;
 
 		if (j <= i)
 			continue;
@@ -312,8 +325,8 @@ static void reorder( FFT_Tables *fft_tables, double *x, int logm)
 }
 
 static void fft_proc(
-		double *xr, 
-		double *xi,
+		real_t *xr, 
+		real_t *xi,
 		fftfloat *refac, 
 		fftfloat *imfac, 
 		int size)	
@@ -334,10 +347,10 @@ static void fft_proc(
 			exp = 0;
 			for (shift = 0; shift < step; shift++)
 			{
-				double v2r, v2i;
+				real_t v2r, v2i;
 
-				v2r = xr[x2] * refac[exp] - xi[x2] * imfac[exp];
-				v2i = xr[x2] * imfac[exp] + xi[x2] * refac[exp];
+				v2r = MUL_C(xr[x2], refac[exp]) - MUL_C(xi[x2], imfac[exp]);
+				v2i = MUL_C(xr[x2], imfac[exp]) + MUL_C(xi[x2], refac[exp]);
 
 				xr[x2] = xr[x1] - v2r;
 				xr[x1] += v2r;
@@ -371,13 +384,13 @@ static void check_tables( FFT_Tables *fft_tables, int logm)
 		for (i = 0; i < (size >> 1); i++)
 		{
 			double theta = 2.0 * M_PI * ((double) i) / (double) size;
-			fft_tables->costbl[logm][i]		= cos(theta);
-			fft_tables->negsintbl[logm][i]	= -sin(theta);
+			fft_tables->costbl[logm][i]		= COEF_CONST(cos(theta));
+			fft_tables->negsintbl[logm][i]	= COEF_CONST(-sin(theta));
 		}
 	}
 }
 
-void fft( FFT_Tables *fft_tables, double *xr, double *xi, int logm)
+void fft( FFT_Tables *fft_tables, real_t *xr, real_t *xi, int logm)
 {
 	if (logm > MAXLOGM)
 	{
@@ -399,6 +412,7 @@ void fft( FFT_Tables *fft_tables, double *xr, double *xi, int logm)
 	fft_proc( xr, xi, fft_tables->costbl[logm], fft_tables->negsintbl[logm], 1 << logm );
 }
 
+#ifndef FAAC_FIXED_POINT
 void rfft( FFT_Tables *fft_tables, double *x, int logm)
 {
 	double xi[1 << MAXLOGR];
@@ -435,5 +449,6 @@ void ffti( FFT_Tables *fft_tables, double *xr, double *xi, int logm)
 		*xip++ *= fac;
 	}
 }
+#endif /* !FAAC_FIXED_POINT */
 
 #endif /* defined DRM && !defined DRM_1024 */
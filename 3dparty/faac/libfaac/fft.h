@@ -22,10 +22,20 @@
 #ifndef _FFT_H_
 #define _FFT_H_
 
+#include "fixed.h"
+
+#ifdef FAAC_FIXED_POINT
+typedef coef_t fftfloat;
+#else
 typedef float fftfloat;
+#endif
 
 #if defined DRM && !defined DRM_1024
 
+#ifdef FAAC_FIXED_POINT
+#error "FAAC_FIXED_POINT is not supported with the DRM transform lengths"
+#endif
+
 #define MAX_FFT 10
 
 typedef struct
@@ -41,6 +51,11 @@ typedef struct
     fftfloat **costbl;
     fftfloat **negsintbl;
     unsigned short **reordertbl;
+#ifdef FAAC_FIXED_POINT
+    /* cos/sin of 2pi/N and 2pi/8N seeding the MDCT twiddle recurrence,
+       short and long blocks */
+    coef_t mdct_rot[2][4];
+#endif
 } FFT_Tables;
 
 #endif /* defined DRM && !defined DRM_1024 */
@@ -48,8 +63,10 @@ typedef struct
 void fft_initialize		( FFT_Tables *fft_tables );
 void fft_terminate	( FFT_Tables *fft_tables );
 
+void fft			( FFT_Tables *fft_tables, real_t *xr, real_t *xi, int logm );
+#ifndef FAAC_FIXED_POINT
 void rfft			( FFT_Tables *fft_tables, double *x, int logm );
-void fft			( FFT_Tables *fft_tables, double *xr, double *xi, int logm );
 void ffti			( FFT_Tables *fft_tables, double *xr, double *xi, int logm );
+#endif
 
 #endif
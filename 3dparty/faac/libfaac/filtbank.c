@@ -44,10 +44,12 @@ Copyright(c)1996.
 #define  TWOPI       2*M_PI
 
 
-static void		CalculateKBDWindow	( double* win, double alpha, int length );
+static void		CalculateKBDWindow	( coef_t* win, double alpha, int length );
 static double	Izero				( double x);
-static void		MDCT				( FFT_Tables *fft_tables, double *data, int N, double *xr, double *xi );
+static void		MDCT				( FFT_Tables *fft_tables, real_t *data, int N, real_t *xr, real_t *xi );
+#ifndef FAAC_FIXED_POINT
 static void		IMDCT				( FFT_Tables *fft_tables, double *data, int N, double *xr, double *xi );
+#endif
 
 
 
@@ -56,29 +58,29 @@ void FilterBankInit(faacEncStruct* hEncoder)
     unsigned int i, channel;
 
     for (channel = 0; channel < hEncoder->numChannels; channel++) {
-        hEncoder->freqBuff[channel] = (double*)AllocMemory(2*FRAME_LEN*sizeof(double));
-        hEncoder->overlapBuff[channel] = (double*)AllocMemory(FRAME_LEN*sizeof(double));
-        SetMemory(hEncoder->overlapBuff[channel], 0, FRAME_LEN*sizeof(double));
+        hEncoder->freqBuff[channel] = (real_t*)AllocMemory(2*FRAME_LEN*sizeof(real_t));
+        hEncoder->overlapBuff[channel] = (real_t*)AllocMemory(FRAME_LEN*sizeof(real_t));
+        SetMemory(hEncoder->overlapBuff[channel], 0, FRAME_LEN*sizeof(real_t));
     }
 
-    hEncoder->sin_window_long = (double*)AllocMemory(BLOCK_LEN_LONG*sizeof(double));
-    hEncoder->sin_window_short = (double*)AllocMemory(BLOCK_LEN_SHORT*sizeof(double));
-    hEncoder->kbd_window_long = (double*)AllocMemory(BLOCK_LEN_LONG*sizeof(double));
-    hEncoder->kbd_window_short = (double*)AllocMemory(BLOCK_LEN_SHORT*sizeof(double));
+    hEncoder->sin_window_long = (coef_t*)AllocMemory(BLOCK_LEN_LONG*sizeof(coef_t));
+    hEncoder->sin_window_short = (coef_t*)AllocMemory(BLOCK_LEN_SHORT*sizeof(coef_t));
+    hEncoder->kbd_window_long = (coef_t*)AllocMemory(BLOCK_LEN_LONG*sizeof(coef_t));
+    hEncoder->kbd_window_short = (coef_t*)AllocMemory(BLOCK_LEN_SHORT*sizeof(coef_t));
 
     for( i=0; i<BLOCK_LEN_LONG; i++ )
-        hEncoder->sin_window_long[i] = sin((M_PI/(2*BLOCK_LEN_LONG)) * (i + 0.5));
+        hEncoder->sin_window_long[i] = COEF_CONST(sin((M_PI/(2*BLOCK_LEN_LONG)) * (i + 0.5)));
     for( i=0; i<BLOCK_LEN_SHORT; i++ )
-        hEncoder->sin_window_short[i] = sin((M_PI/(2*BLOCK_LEN_SHORT)) * (i + 0.5));
+        hEncoder->sin_window_short[i] = COEF_CONST(sin((M_PI/(2*BLOCK_LEN_SHORT)) * (i + 0.5)));
 
     CalculateKBDWindow(hEncoder->kbd_window_long, 4, BLOCK_LEN_LONG*2);
     CalculateKBDWindow(hEncoder->kbd_window_short, 6, BLOCK_LEN_SHORT*2);
 
     /* Scratch buffers (allocated once per encoder instance). */
-    hEncoder->fb_transf_buf = (double*)AllocMemory(2*BLOCK_LEN_LONG*sizeof(double));
-    hEncoder->fb_overlap_buf = (double*)AllocMemory(2*BLOCK_LEN_LONG*sizeof(double));
-    hEncoder->mdct_xr = (double*)AllocMemory((BLOCK_LEN_LONG/2)*sizeof(double));
-    hEncoder->mdct_xi = (double*)AllocMemory((BLOCK_LEN_LONG/2)*sizeof(double));
+    hEncoder->fb_transf_buf = (real_t*)AllocMemory(2*BLOCK_LEN_LONG*sizeof(real_t));
+    hEncoder->fb_overlap_buf = (real_t*)AllocMemory(2*BLOCK_LEN_LONG*sizeof(real_t));
+    hEncoder->mdct_xr = (real_t*)AllocMemory((BLOCK_LEN_LONG/2)*sizeof(real_t));
+    hEncoder->mdct_xi = (real_t*)AllocMemory((BLOCK_LEN_LONG/2)*sizeof(real_t));
 }
 
 void FilterBankEnd(faacEncStruct* hEncoder)
@@ -107,28 +109,29 @@ void FilterBankEnd(faacEncStruct* hEncoder)
 
 void FilterBank(faacEncStruct* hEncoder,
                 CoderInfo *coderInfo,
-                double *p_in_data,
-                double *p_out_mdct,
-                double *p_overlap,
+                real_t *p_in_data,
+                real_t *p_out_mdct,
+                real_t *p_overlap,
                 int overlap_select)
 {
-    double *p_o_buf, *first_window, *second_window;
-    double *transf_buf;
+    real_t *p_o_buf;
+    coef_t *first_window, *second_window;
+    real_t *transf_buf;
     int k, i;
     int block_type = coderInfo->block_type;
 
     transf_buf = hEncoder->fb_transf_buf;
     if (!transf_buf)
-        transf_buf = (double*)AllocMemory(2*BLOCK_LEN_LONG*sizeof(double));
+        transf_buf = (real_t*)AllocMemory(2*BLOCK_LEN_LONG*sizeof(real_t));
 
     /* create / shift old values */
     /* We use p_overlap here as buffer holding the last frame time signal*/
     if(overlap_select != MNON_OVERLAPPED) {
-        memcpy(transf_buf, p_overlap, FRAME_LEN*sizeof(double));
-        memcpy(transf_buf+BLOCK_LEN_LONG, p_in_data, FRAME_LEN*sizeof(double));
-        memcpy(p_overlap, p_in_data, FRAME_LEN*sizeof(double));
+        memcpy(transf_buf, p_overlap, FRAME_LEN*sizeof(real_t));
+        memcpy(transf_buf+BLOCK_LEN_LONG, p_in_data, FRAME_LEN*sizeof(real_t));
+        memcpy(p_overlap, p_in_data, FRAME_LEN*sizeof(real_t));
     } else {
-        memcpy(transf_buf, p_in_data, 2*FRAME_LEN*sizeof(double));
+        memcpy(transf_buf, p_in_data, 2*FRAME_LEN*sizeof(real_t));
     }
 
     /*  Window shape processing */
@@ -177,29 +180,29 @@ void FilterBank(faacEncStruct* hEncoder,
     switch (block_type) {
     case ONLY_LONG_WINDOW :
         for ( i = 0 ; i < BLOCK_LEN_LONG ; i++){
-            p_out_mdct[i] = p_o_buf[i] * first_window[i];
-            p_out_mdct[i+BLOCK_LEN_LONG] = p_o_buf[i+BLOCK_LEN_LONG] * second_window[BLOCK_LEN_LONG-i-1];
+            p_out_mdct[i] = MUL_C(p_o_buf[i], first_window[i]);
+            p_out_mdct[i+BLOCK_LEN_LONG] = MUL_C(p_o_buf[i+BLOCK_LEN_LONG], second_window[BLOCK_LEN_LONG-i-1]);
         }
         MDCT( &hEncoder->fft_tables, p_out_mdct, 2*BLOCK_LEN_LONG, hEncoder->mdct_xr, hEncoder->mdct_xi );
         break;
 
     case LONG_SHORT_WINDOW :
         for ( i = 0 ; i < BLOCK_LEN_LONG ; i++)
-            p_out_mdct[i] = p_o_buf[i] * first_window[i];
-        memcpy(p_out_mdct+BLOCK_LEN_LONG,p_o_buf+BLOCK_LEN_LONG,NFLAT_LS*sizeof(double));
+            p_out_mdct[i] = MUL_C(p_o_buf[i], first_window[i]);
+        memcpy(p_out_mdct+BLOCK_LEN_LONG,p_o_buf+BLOCK_LEN_LONG,NFLAT_LS*sizeof(real_t));
         for ( i = 0 ; i < BLOCK_LEN_SHORT ; i++)
-            p_out_mdct[i+BLOCK_LEN_LONG+NFLAT_LS] = p_o_buf[i+BLOCK_LEN_LONG+NFLAT_LS] * second_window[BLOCK_LEN_SHORT-i-1];
-        SetMemory(p_out_mdct+BLOCK_LEN_LONG+NFLAT_LS+BLOCK_LEN_SHORT,0,NFLAT_LS*sizeof(double));
+            p_out_mdct[i+BLOCK_LEN_LONG+NFLAT_LS] = MUL_C(p_o_buf[i+BLOCK_LEN_LONG+NFLAT_LS], second_window[BLOCK_LEN_SHORT-i-1]);
+        SetMemory(p_out_mdct+BLOCK_LEN_LONG+NFLAT_LS+BLOCK_LEN_SHORT,0,NFLAT_LS*sizeof(real_t));
         MDCT( &hEncoder->fft_tables, p_out_mdct, 2*BLOCK_LEN_LONG, hEncoder->mdct_xr, hEncoder->mdct_xi );
         break;
 
     case SHORT_LONG_WINDOW :
-        SetMemory(p_out_mdct,0,NFLAT_LS*sizeof(double));
+        SetMemory(p_out_mdct,0,NFLAT_LS*sizeof(real_t));
         for ( i = 0 ; i < BLOCK_LEN_SHORT ; i++)
-            p_out_mdct[i+NFLAT_LS] = p_o_buf[i+NFLAT_LS] * first_window[i];
-        memcpy(p_out_mdct+NFLAT_LS+BLOCK_LEN_SHORT,p_o_buf+NFLAT_LS+BLOCK_LEN_SHORT,NFLAT_LS*sizeof(double));
+            p_out_mdct[i+NFLAT_LS] = MUL_C(p_o_buf[i+NFLAT_LS], first_window[i]);
+        memcpy(p_out_mdct+NFLAT_LS+BLOCK_LEN_SHORT,p_o_buf+NFLAT_LS+BLOCK_LEN_SHORT,NFLAT_LS*sizeof(real_t));
         for ( i = 0 ; i < BLOCK_LEN_LONG ; i++)
-            p_out_mdct[i+BLOCK_LEN_LONG] = p_o_buf[i+BLOCK_LEN_LONG] * second_window[BLOCK_LEN_LONG-i-1];
+            p_out_mdct[i+BLOCK_LEN_LONG] = MUL_C(p_o_buf[i+BLOCK_LEN_LONG], second_window[BLOCK_LEN_LONG-i-1]);
         MDCT( &hEncoder->fft_tables, p_out_mdct, 2*BLOCK_LEN_LONG, hEncoder->mdct_xr, hEncoder->mdct_xi );
         break;
 
@@ -207,8 +210,8 @@ void FilterBank(faacEncStruct* hEncoder,
         p_o_buf += NFLAT_LS;
         for ( k=0; k < MAX_SHORT_WINDOWS; k++ ) {
             for ( i = 0 ; i < BLOCK_LEN_SHORT ; i++ ){
-                p_out_mdct[i] = p_o_buf[i] * first_window[i];
-                p_out_mdct[i+BLOCK_LEN_SHORT] = p_o_buf[i+BLOCK_LEN_SHORT] * second_window[BLOCK_LEN_SHORT-i-1];
+                p_out_mdct[i] = MUL_C(p_o_buf[i], first_window[i]);
+                p_out_mdct[i+BLOCK_LEN_SHORT] = MUL_C(p_o_buf[i+BLOCK_LEN_SHORT], second_window[BLOCK_LEN_SHORT-i-1]);
             }
             MDCT( &hEncoder->fft_tables, p_out_mdct, 2*BLOCK_LEN_SHORT, hEncoder->mdct_xr, hEncoder->mdct_xi );
             p_out_mdct += BLOCK_LEN_SHORT;
@@ -221,6 +224,7 @@ void FilterBank(faacEncStruct* hEncoder,
     if (transf_buf && transf_buf != hEncoder->fb_transf_buf) FreeMemory(transf_buf);
 }
 
+#ifndef FAAC_FIXED_POINT
 void IFilterBank(faacEncStruct* hEncoder,
                  CoderInfo *coderInfo,
                  double *p_in_data,
@@ -379,8 +383,9 @@ void IFilterBank(faacEncStruct* hEncoder,
     if (overlap_buf && overlap_buf != hEncoder->fb_overlap_buf) FreeMemory(overlap_buf);
     if (transf_buf && transf_buf != hEncoder->fb_transf_buf) FreeMemory(transf_buf);
 }
+#endif /* !FAAC_FIXED_POINT */
 
-void specFilter(double *freqBuff,
+void specFilter(real_t *freqBuff,
                 int sampleRate,
                 int lowpassFreq,
                 int specLen
@@ -392,7 +397,7 @@ void specFilter(double *freqBuff,
     lowpass = (lowpassFreq * specLen) / (sampleRate>>1) + 1;
     xlowpass = (lowpass < specLen) ? lowpass : specLen ;
 
-    SetMemory(freqBuff+xlowpass,0,(specLen-xlowpass)*sizeof(double));
+    SetMemory(freqBuff+xlowpass,0,(specLen-xlowpass)*sizeof(real_t));
 }
 
 static double Izero(double x)
@@ -414,12 +419,13 @@ static double Izero(double x)
     return(sum);
 }
 
-static void CalculateKBDWindow(double* win, double alpha, int length)
+static void CalculateKBDWindow(coef_t* win, double alpha, int length)
 {
     int i;
     double IBeta;
     double tmp;
     double sum = 0.0;
+    double *kbd = (double*)AllocMemory((length>>1)*sizeof(double));
 
     alpha *= M_PI;
     IBeta = 1.0/Izero(alpha);
@@ -427,8 +433,8 @@ static void CalculateKBDWindow(double* win, double alpha, int length)
     /* calculate lower half of Kaiser Bessel window */
     for(i=0; i<(length>>1); i++) {
         tmp = 4.0*(double)i/(double)length - 1.0;
-        win[i] = Izero(alpha*sqrt(1.0-tmp*tmp))*IBeta;
-        sum += win[i];
+        kbd[i] = Izero(alpha*sqrt(1.0-tmp*tmp))*IBeta;
+        sum += kbd[i];
     }
 
     sum = 1.0/sum;
@@ -436,30 +442,45 @@ static void CalculateKBDWindow(double* win, double alpha, int length)
 
     /* calculate lower half of window */
     for(i=0; i<(length>>1); i++) {
-        tmp += win[i];
-        win[i] = sqrt(tmp*sum);
+        tmp += kbd[i];
+        win[i] = COEF_CONST(sqrt(tmp*sum));
     }
+
+    FreeMemory(kbd);
 }
 
-static void MDCT( FFT_Tables *fft_tables, double *data, int N, double *xr, double *xi )
+static void MDCT( FFT_Tables *fft_tables, real_t *data, int N, real_t *xr, real_t *xi )
 {
-    double tempr, tempi, c, s, cold, cfreq, sfreq; /* temps for pre and post twiddle */
-    double freq = TWOPI / N;
-    double cosfreq8, sinfreq8;
+    real_t tempr, tempi; /* temps for pre and post twiddle */
+    coef_t c, s, cold, cfreq, sfreq;
+    coef_t cosfreq8, sinfreq8;
     int i, n;
-    double *xi_local = NULL, *xr_local = NULL;
+    real_t *xi_local = NULL, *xr_local = NULL;
     if (!xr || !xi) {
-        xi_local = (double*)AllocMemory((N >> 2)*sizeof(double));
-        xr_local = (double*)AllocMemory((N >> 2)*sizeof(double));
+        xi_local = (real_t*)AllocMemory((N >> 2)*sizeof(real_t));
+        xr_local = (real_t*)AllocMemory((N >> 2)*sizeof(real_t));
         xi = xi_local;
         xr = xr_local;
     }
 
     /* prepare for recurrence relation in pre-twiddle */
+#ifdef FAAC_FIXED_POINT
+    {
+        const coef_t *rot = fft_tables->mdct_rot[N == 2 * BLOCK_LEN_LONG];
+
+        cfreq = rot[0];
+        sfreq = rot[1];
+        cosfreq8 = rot[2];
+        sinfreq8 = rot[3];
+    }
+#else
+    double freq = TWOPI / N;
+
     cfreq = cos (freq);
     sfreq = sin (freq);
     cosfreq8 = cos (freq * 0.125);
     sinfreq8 = sin (freq * 0.125);
+#endif
     c = cosfreq8;
     s = sinfreq8;
 
@@ -479,13 +500,13 @@ static void MDCT( FFT_Tables *fft_tables, double *data, int N, double *xr, doubl
             tempi = data [(N >> 2) + n] + data [N + (N >> 2) - 1 - n]; /* use second form of e(n) for n=2i*/
 
         /* calculate pre-twiddled FFT input */
-        xr[i] = tempr * c + tempi * s;
-        xi[i] = tempi * c - tempr * s;
+        xr[i] = MUL_C(tempr, c) + MUL_C(tempi, s);
+        xi[i] = MUL_C(tempi, c) - MUL_C(tempr, s);
 
         /* use recurrence to prepare cosine and sine for next value of i */
         cold = c;
-        c = c * cfreq - s * sfreq;
-        s = s * cfreq + cold * sfreq;
+        c = MUL_C(c, cfreq) - MUL_C(s, sfreq);
+        s = MUL_C(s, cfreq) + MUL_C(cold, sfreq);
     }
 
     /* Perform in-place complex FFT of length N/4 */
@@ -504,8 +525,8 @@ static void MDCT( FFT_Tables *fft_tables, double *data, int N, double *xr, doubl
     /* post-twiddle FFT output and then get output data */
     for (i = 0; i < (N >> 2); i++) {
         /* get post-twiddled FFT output  */
-        tempr = 2. * (xr[i] * c + xi[i] * s);
-        tempi = 2. * (xi[i] * c - xr[i] * s);
+        tempr = 2 * (MUL_C(xr[i], c) + MUL_C(xi[i], s));
+        tempi = 2 * (MUL_C(xi[i], c) - MUL_C(xr[i], s));
 
         /* fill in output values */
         data [2 * i] = -tempr;   /* first half even */
@@ -515,14 +536,15 @@ static void MDCT( FFT_Tables *fft_tables, double *data, int N, double *xr, doubl
 
         /* use recurrence to prepare cosine and sine for next value of i */
         cold = c;
-        c = c * cfreq - s * sfreq;
-        s = s * cfreq + cold * sfreq;
+        c = MUL_C(c, cfreq) - MUL_C(s, sfreq);
+        s = MUL_C(s, cfreq) + MUL_C(cold, sfreq);
     }
 
     if (xr_local) FreeMemory(xr_local);
     if (xi_local) FreeMemory(xi_local);
 }
 
+#ifndef FAAC_FIXED_POINT
 static void IMDCT( FFT_Tables *fft_tables, double *data, int N, double *xr, double *xi )
 {
     double tempr, tempi, c, s, cold, cfreq, sfreq; /* temps for pre and post twiddle */
@@ -605,3 +627,4 @@ static void IMDCT( FFT_Tables *fft_tables, double *data, int N, double *xr, doub
     if (xr_local) FreeMemory(xr_local);
     if (xi_local) FreeMemory(xi_local);
 }
+#endif /* !FAAC_FIXED_POINT */
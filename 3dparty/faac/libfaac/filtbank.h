@@ -47,19 +47,21 @@ void			FilterBankEnd		( faacEncStruct* hEncoder );
 
 void			FilterBank( faacEncStruct* hEncoder,
 						CoderInfo *coderInfo,
-						double *p_in_data,
-						double *p_out_mdct,
-						double *p_overlap,
+						real_t *p_in_data,
+						real_t *p_out_mdct,
+						real_t *p_overlap,
 						int overlap_select );
 
+#ifndef FAAC_FIXED_POINT
 void			IFilterBank( faacEncStruct* hEncoder,
 						CoderInfo *coderInfo,
 						double *p_in_data,
 						double *p_out_mdct,
 						double *p_overlap,
 						int overlap_select );
+#endif
 
-void			specFilter(	double *freqBuff,
+void			specFilter(	real_t *freqBuff,
 						int sampleRate,
 						int lowpassFreq,
 						int specLen );
@@ -0,0 +1,272 @@
+/*
+ * FAAC - Freeware Advanced Audio Coder
+ * Fixed-point arithmetic for targets without an FPU
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "fixed.h"
+
+#ifdef FAAC_FIXED_POINT
+
+/* log2(1 + i/256), Q16 */
+static const uint32_t log2tab[257] = {
+    0, 369, 736, 1102, 1466, 1829, 2190, 2551,
+    2909, 3267, 3623, 3978, 4331, 4683, 5034, 5384,
+    5732, 6079, 6425, 6769, 7112, 7454, 7795, 8134,
+    8473, 8810, 9146, 9480, 9814, 10146, 10477, 10807,
+    11136, 11464, 11791, 12116, 12440, 12764, 13086, 13407,
+    13727, 14046, 14363, 14680, 14996, 15310, 15624, 15937,
+    16248, 16559, 16868, 17177, 17484, 17791, 18096, 18401,
+    18704, 19007, 19308, 19609, 19909, 20207, 20505, 20802,
+    21098, 21393, 21687, 21980, 22272, 22564, 22854, 23144,
+    23433, 23720, 24007, 24293, 24579, 24863, 25146, 25429,
+    25711, 25992, 26272, 26551, 26830, 27108, 27384, 27660,
+    27936, 28210, 28484, 28757, 29029, 29300, 29571, 29840,
+    30109, 30378, 30645, 30912, 31178, 31443, 31707, 31971,
+    32234, 32496, 32758, 33019, 33279, 33538, 33797, 34055,
+    34312, 34569, 34825, 35080, 35334, 35588, 35841, 36094,
+    36346, 36597, 36847, 37097, 37346, 37595, 37842, 38090,
+    38336, 38582, 38827, 39072, 39316, 39559, 39802, 40044,
+    40286, 40527, 40767, 41006, 41246, 41484, 41722, 41959,
+    42196, 42432, 42667, 42902, 43137, 43370, 43603, 43836,
+    44068, 44300, 44530, 44761, 44990, 45220, 45448, 45676,
+    45904, 46131, 46357, 46583, 46809, 47034, 47258, 47482,
+    47705, 47928, 48150, 48372, 48593, 48813, 49034, 49253,
+    49472, 49691, 49909, 50127, 50344, 50560, 50776, 50992,
+    51207, 51422, 51636, 51850, 52063, 52276, 52488, 52700,
+    52911, 53122, 53332, 53542, 53751, 53960, 54169, 54377,
+    54584, 54791, 54998, 55204, 55410, 55615, 55820, 56025,
+    56229, 56432, 56635, 56838, 57040, 57242, 57443, 57644,
+    57845, 58045, 58245, 58444, 58643, 58841, 59039, 59237,
+    59434, 59631, 59827, 60023, 60219, 60414, 60609, 60803,
+    60997, 61190, 61384, 61576, 61769, 61961, 62152, 62343,
+    62534, 62725, 62915, 63104, 63294, 63483, 63671, 63859,
+    64047, 64234, 64421, 64608, 64794, 64980, 65166, 65351,
+    65536
+};
+
+/* 2^(i/256), Q30 */
+static const uint32_t exp2tab[257] = {
+    1073741824, 1076653033, 1079572136, 1082499153, 1085434106, 1088377016,
+    1091327906, 1094286796, 1097253708, 1100228665, 1103211687, 1106202798,
+    1109202018, 1112209370, 1115224875, 1118248556, 1121280436, 1124320536,
+    1127368878, 1130425485, 1133490379, 1136563583, 1139645120, 1142735011,
+    1145833280, 1148939949, 1152055042, 1155178580, 1158310587, 1161451085,
+    1164600099, 1167757650, 1170923762, 1174098458, 1177281762, 1180473697,
+    1183674286, 1186883552, 1190101520, 1193328213, 1196563654, 1199807867,
+    1203060876, 1206322705, 1209593378, 1212872918, 1216161350, 1219458698,
+    1222764986, 1226080238, 1229404479, 1232737732, 1236080024, 1239431376,
+    1242791816, 1246161366, 1249540052, 1252927899, 1256324931, 1259731174,
+    1263146652, 1266571390, 1270005413, 1273448747, 1276901417, 1280363448,
+    1283834865, 1287315695, 1290805962, 1294305692, 1297814910, 1301333643,
+    1304861917, 1308399756, 1311947188, 1315504238, 1319070932, 1322647296,
+    1326233356, 1329829140, 1333434672, 1337049980, 1340675091, 1344310030,
+    1347954824, 1351609500, 1355274085, 1358948606, 1362633090, 1366327563,
+    1370032052, 1373746586, 1377471191, 1381205894, 1384950723, 1388705706,
+    1392470869, 1396246240, 1400031848, 1403827719, 1407633882, 1411450365,
+    1415277195, 1419114401, 1422962010, 1426820052, 1430688553, 1434567544,
+    1438457051, 1442357104, 1446267730, 1450188960, 1454120821, 1458063343,
+    1462016553, 1465980482, 1469955159, 1473940611, 1477936870, 1481943963,
+    1485961921, 1489990772, 1494030547, 1498081275, 1502142985, 1506215708,
+    1510299473, 1514394310, 1518500250, 1522617322, 1526745556, 1530884983,
+    1535035634, 1539197537, 1543370725, 1547555228, 1551751076, 1555958300,
+    1560176931, 1564406999, 1568648537, 1572901575, 1577166143, 1581442275,
+    1585730000, 1590029350, 1594340357, 1598663052, 1602997467, 1607343634,
+    1611701585, 1616071351, 1620452965, 1624846459, 1629251865, 1633669214,
+    1638098541, 1642539877, 1646993254, 1651458706, 1655936265, 1660425963,
+    1664927835, 1669441912, 1673968228, 1678506817, 1683057710, 1687620943,
+    1692196547, 1696784557, 1701385007, 1705997930, 1710623359, 1715261330,
+    1719911875, 1724575029, 1729250827, 1733939301, 1738640488, 1743354420,
+    1748081133, 1752820662, 1757573041, 1762338305, 1767116489, 1771907628,
+    1776711757, 1781528911, 1786359126, 1791202437, 1796058879, 1800928489,
+    1805811301, 1810707353, 1815616678, 1820539314, 1825475297, 1830424663,
+    1835387448, 1840363688, 1845353420, 1850356681, 1855373507, 1860403934,
+    1865448001, 1870505744, 1875577199, 1880662405, 1885761398, 1890874216,
+    1896000896, 1901141476, 1906295993, 1911464486, 1916646992, 1921843549,
+    1927054196, 1932278970, 1937517909, 1942771053, 1948038440, 1953320108,
+    1958616096, 1963926443, 1969251188, 1974590370, 1979944027, 1985312200,
+    1990694927, 1996092249, 2001504204, 2006930832, 2012372174, 2017828268,
+    2023299156, 2028784876, 2034285470, 2039800978, 2045331439, 2050876895,
+    2056437387, 2062012954, 2067603638, 2073209480, 2078830522, 2084466803,
+    2090118366, 2095785251, 2101467502, 2107165158, 2112878262, 2118606857,
+    2124350982, 2130110682, 2135885998, 2141676973, 2147483648
+};
+
+/* (1 + i/256)^(3/4), Q30 */
+static const uint32_t pow34tab[257] = {
+    1073741824, 1076886018, 1080027156, 1083165251, 1086300319, 1089432373,
+    1092561429, 1095687501, 1098810602, 1101930747, 1105047950, 1108162225,
+    1111273585, 1114382045, 1117487616, 1120590314, 1123690150, 1126787139,
+    1129881292, 1132972624, 1136061147, 1139146874, 1142229817, 1145309989,
+    1148387402, 1151462068, 1154534000, 1157603210, 1160669710, 1163733512,
+    1166794628, 1169853068, 1172908846, 1175961972, 1179012459, 1182060317,
+    1185105557, 1188148191, 1191188231, 1194225686, 1197260568, 1200292888,
+    1203322657, 1206349885, 1209374583, 1212396762, 1215416431, 1218433602,
+    1221448284, 1224460488, 1227470224, 1230477502, 1233482332, 1236484725,
+    1239484689, 1242482234, 1245477371, 1248470110, 1251460458, 1254448427,
+    1257434025, 1260417263, 1263398148, 1266376691, 1269352900, 1272326786,
+    1275298356, 1278267619, 1281234586, 1284199264, 1287161662, 1290121790,
+    1293079655, 1296035267, 1298988633, 1301939763, 1304888665, 1307835347,
+    1310779818, 1313722086, 1316662159, 1319600045, 1322535752, 1325469289,
+    1328400663, 1331329883, 1334256956, 1337181889, 1340104692, 1343025372,
+    1345943936, 1348860391, 1351774747, 1354687009, 1357597186, 1360505285,
+    1363411314, 1366315279, 1369217189, 1372117049, 1375014869, 1377910654,
+    1380804412, 1383696149, 1386585874, 1389473593, 1392359312, 1395243040,
+    1398124782, 1401004545, 1403882337, 1406758164, 1409632032, 1412503949,
+    1415373920, 1418241953, 1421108054, 1423972230, 1426834486, 1429694830,
+    1432553268, 1435409805, 1438264449, 1441117206, 1443968082, 1446817082,
+    1449664214, 1452509483, 1455352895, 1458194457, 1461034174, 1463872053,
+    1466708099, 1469542318, 1472374717, 1475205300, 1478034074, 1480861044,
+    1483686217, 1486509598, 1489331192, 1492151006, 1494969044, 1497785313,
+    1500599818, 1503412564, 1506223558, 1509032803, 1511840307, 1514646074,
+    1517450109, 1520252418, 1523053006, 1525851879, 1528649042, 1531444500,
+    1534238257, 1537030320, 1539820694, 1542609382, 1545396392, 1548181727,
+    1550965392, 1553747394, 1556527736, 1559306423, 1562083461, 1564858854,
+    1567632607, 1570404726, 1573175214, 1575944077, 1578711319, 1581476945,
+    1584240960, 1587003368, 1589764175, 1592523384, 1595281001, 1598037030,
+    1600791475, 1603544342, 1606295634, 1609045356, 1611793512, 1614540108,
+    1617285147, 1620028633, 1622770572, 1625510968, 1628249824, 1630987146,
+    1633722937, 1636457202, 1639189945, 1641921170, 1644650881, 1647379083,
+    1650105780, 1652830976, 1655554675, 1658276881, 1660997598, 1663716831,
+    1666434583, 1669150858, 1671865660, 1674578994, 1677290864, 1680001272,
+    1682710224, 1685417723, 1688123773, 1690828377, 1693531540, 1696233266,
+    1698933558, 1701632421, 1704329857, 1707025871, 1709720466, 1712413647,
+    1715105416, 1717795778, 1720484736, 1723172294, 1725858455, 1728543224,
+    1731226603, 1733908597, 1736589208, 1739268441, 1741946299, 1744622786,
+    1747297904, 1749971658, 1752644051, 1755315086, 1757984767, 1760653098,
+    1763320081, 1765985720, 1768650019, 1771312980, 1773974608, 1776634905,
+    1779293875, 1781951521, 1784607847, 1787262855, 1789916550, 1792568933,
+    1795220009, 1797869781, 1800518251, 1803165424, 1805811301
+};
+
+/* 2^(i/16), Q30 */
+static const uint32_t pow2tab[16] = {
+    1073741824, 1121280436, 1170923762, 1222764986,
+    1276901417, 1333434672, 1392470869, 1454120821,
+    1518500250, 1585730000, 1655936265, 1729250827,
+    1805811301, 1885761398, 1969251188, 2056437387
+};
+
+/* MAGIC_NUMBER, Q16 */
+#define MAGIC_Q16 26568
+
+#ifdef __GNUC__
+# define clz32(x) __builtin_clz(x)
+# define clz64(x) __builtin_clzll(x)
+#else
+static int clz32(uint32_t x)
+{
+    int n = 0;
+
+    while (!(x & 0x80000000u)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+}
+
+static int clz64(uint64_t x)
+{
+    return (x >> 32) ? clz32(x >> 32) : 32 + clz32((uint32_t)x);
+}
+#endif
+
+/* Linear interpolation between the two table entries around the mantissa m
+   (most significant bit set) */
+static uint32_t interp(const uint32_t *tab, uint32_t m)
+{
+    uint32_t i = (m >> 23) & 0xFF;
+    uint32_t f = (m >> 7) & 0xFFFF;
+
+    return tab[i] + (uint32_t)(((uint64_t)(tab[i + 1] - tab[i]) * f) >> 16);
+}
+
+int32_t fix_log2(uint64_t x)
+{
+    int lz;
+
+    if (!x)
+        return INT32_MIN / 2;
+
+    lz = clz64(x);
+    return ((63 - lz) << 16) + (int32_t)interp(log2tab, (uint32_t)((x << lz) >> 32));
+}
+
+uint32_t fix_exp2(int32_t y)
+{
+    int ip = y >> 16;
+    uint32_t m;
+
+    if (ip >= 16)
+        return UINT32_MAX;
+    if (ip < -30)
+        return 0;
+
+    m = interp(exp2tab, 0x80000000u | ((uint32_t)(y & 0xFFFF) << 15));
+    return ip >= 14 ? m << (ip - 14) : m >> (14 - ip);
+}
+
+uint32_t fix_sqrt(uint64_t x)
+{
+    uint64_t res = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > x)
+        bit >>= 2;
+
+    while (bit) {
+        if (x >= res + bit) {
+            x -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+uint64_t fix_mul_q16(uint64_t e, uint32_t q)
+{
+    return (e >> 16) * q + (((e & 0xFFFF) * q) >> 16);
+}
+
+int fix_quant(uint32_t x, int sfac)
+{
+    int lz, e16, sh;
+    uint64_t v;
+
+    if (!x)
+        return 0;
+
+    /* x = m * 2^(31 - lz - REAL_BITS) with m in [1, 2): raise the mantissa
+       with the table and the exponent, in sixteenths, with 2^(i/16) */
+    lz = clz32(x);
+    e16 = 12 * (31 - lz - REAL_BITS) + 3 * sfac;
+    v = (uint64_t)interp(pow34tab, x << lz) * pow2tab[e16 & 15];
+
+    /* v is Q60, bring it to Q16 */
+    sh = 44 - (e16 >> 4);
+    if (sh >= 64)
+        return 0;
+    if (sh < 20)
+        return 1 << 24;
+
+    return (int)(((v >> sh) + MAGIC_Q16) >> 16);
+}
+
+#endif /* FAAC_FIXED_POINT */
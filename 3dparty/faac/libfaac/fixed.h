@@ -0,0 +1,79 @@
+/*
+ * FAAC - Freeware Advanced Audio Coder
+ * Fixed-point arithmetic for targets without an FPU
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stdint.h>
+
+/*
+ * With FAAC_FIXED_POINT defined, the time signal and the MDCT spectrum are
+ * kept as integers and the psychoacoustic, stereo and quantizer decisions
+ * are taken in the log2 domain, so a soft-float target only runs floating
+ * point code at init and once per frame for the rate control.
+ */
+#ifdef FAAC_FIXED_POINT
+
+/* Samples and spectral lines: the float scale (16-bit PCM range) with
+   REAL_BITS fractional bits, leaving room for the FFT growth of a long block */
+#define REAL_BITS 3
+typedef int32_t real_t;
+/* Windows and twiddle factors, Q31 */
+typedef int32_t coef_t;
+/* Energies: squared real_t, 2 * REAL_BITS fractional bits */
+typedef uint64_t enrg_t;
+
+#define REAL_PCM16(x)   ((real_t)(x) * (1 << REAL_BITS))
+#define COEF_CONST(x)   ((coef_t)lrint((x) >= 1.0 ? 2147483647.0 : (x) * 2147483648.0))
+#define MUL_C(a, b)     ((int32_t)(((int64_t)(a) * (b)) >> 31))
+#define ENRG(x)         ((enrg_t)((int64_t)(x) * (x)))
+
+/* log2(x) in Q16, x > 0 */
+int32_t fix_log2(uint64_t x);
+/* 2^(y / 65536) in Q16, saturating */
+uint32_t fix_exp2(int32_t y);
+uint32_t fix_sqrt(uint64_t x);
+/* e * q / 65536 for a Q16 factor q without overflowing e * q */
+uint64_t fix_mul_q16(uint64_t e, uint32_t q);
+/* AAC quantizer: (|x| * 2^(sfac / 4))^(3/4) + MAGIC_NUMBER, truncated */
+int fix_quant(uint32_t x, int sfac);
+
+#else
+
+typedef double real_t;
+typedef double coef_t;
+typedef double enrg_t;
+
+#define REAL_PCM16(x)   ((double)(x))
+#define COEF_CONST(x)   (x)
+#define MUL_C(a, b)     ((a) * (b))
+#define ENRG(x)         ((x) * (x))
+
+#endif /* FAAC_FIXED_POINT */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* FIXED_H */
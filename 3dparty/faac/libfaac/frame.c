@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 
 #if defined(__ARM_NEON) || defined(__ARM_NEON__)
 #include <arm_neon.h>
@@ -167,7 +168,12 @@ int FAACAPI faacEncSetConfiguration(faacEncHandle hpEncoder,
 
     hEncoder->config.jointmode = config->jointmode;
     hEncoder->config.useLfe = config->useLfe;
+#ifdef FAAC_FIXED_POINT
+    /* TNS filters the spectrum in floating point */
+    hEncoder->config.useTns = 0;
+#else
     hEncoder->config.useTns = config->useTns;
+#endif
     hEncoder->config.aacObjectType = config->aacObjectType;
     hEncoder->config.mpegVersion = config->mpegVersion;
     hEncoder->config.outputFormat = config->outputFormat;
@@ -423,7 +429,9 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
     CoderInfo *coderInfo = hEncoder->coderInfo;
     unsigned int numChannels = hEncoder->numChannels;
     unsigned int useLfe = hEncoder->config.useLfe;
+#ifndef FAAC_FIXED_POINT
     unsigned int useTns = hEncoder->config.useTns;
+#endif
     unsigned int jointmode = hEncoder->config.jointmode;
     unsigned int bandWidth = hEncoder->config.bandWidth;
     unsigned int shortctl = hEncoder->config.shortctl;
@@ -448,11 +456,11 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
     /* Update current sample buffers */
     for (channel = 0; channel < numChannels; channel++)
 	{
-		double *tmp;
+		real_t *tmp;
 
 
 		if (!hEncoder->sampleBuff[channel])
-			hEncoder->sampleBuff[channel] = (double*)AllocMemory(FRAME_LEN*sizeof(double));
+			hEncoder->sampleBuff[channel] = (real_t*)AllocMemory(FRAME_LEN*sizeof(real_t));
 
 		tmp = hEncoder->sampleBuff[channel];
 
@@ -463,7 +471,7 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
         {
             /* start flushing*/
             for (i = 0; i < FRAME_LEN; i++)
-                hEncoder->next3SampleBuff[channel][i] = 0.0;
+                hEncoder->next3SampleBuff[channel][i] = 0;
         }
         else
         {
@@ -475,7 +483,7 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
                 case FAAC_INPUT_16BIT:
 					{
 						const int map = hEncoder->config.channel_map[channel];
-#if FAAC_HAVE_NEON
+#if FAAC_HAVE_NEON && !defined(FAAC_FIXED_POINT)
 						// Fast-path only for stereo deinterleave.
 						// For mono, the scalar loop is often as fast or faster (and auto-vectorizes well).
 						if (numChannels == 2 && (map == 0 || map == 1)) {
@@ -490,7 +498,7 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
 							short *input_channel = (short*)inputBuffer + map;
 							for (i = 0; i < samples_per_channel; i++)
 							{
-								hEncoder->next3SampleBuff[channel][i] = (double)*input_channel;
+								hEncoder->next3SampleBuff[channel][i] = REAL_PCM16(*input_channel);
 								input_channel += numChannels;
 							}
 						}
@@ -503,7 +511,11 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
 
 						for (i = 0; i < samples_per_channel; i++)
 						{
+#ifdef FAAC_FIXED_POINT
+							hEncoder->next3SampleBuff[channel][i] = *input_channel >> (8 - REAL_BITS);
+#else
 							hEncoder->next3SampleBuff[channel][i] = (1.0/256) * (double)*input_channel;
+#endif
 							input_channel += numChannels;
 						}
 					}
@@ -515,7 +527,11 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
 
 						for (i = 0; i < samples_per_channel; i++)
 						{
+#ifdef FAAC_FIXED_POINT
+							hEncoder->next3SampleBuff[channel][i] = (real_t)lrintf(*input_channel * (1 << REAL_BITS));
+#else
 							hEncoder->next3SampleBuff[channel][i] = (double)*input_channel;
+#endif
 							input_channel += numChannels;
 						}
 					}
@@ -527,7 +543,7 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
             }
 
             for (i = (int)(samplesInput/numChannels); i < FRAME_LEN; i++)
-                hEncoder->next3SampleBuff[channel][i] = 0.0;
+                hEncoder->next3SampleBuff[channel][i] = 0;
 		}
 
 		/* Psychoacoustics */
@@ -613,6 +629,7 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
 
     /* Perform TNS analysis and filtering */
     for (channel = 0; channel < numChannels; channel++) {
+#ifndef FAAC_FIXED_POINT
         if ((!channelInfo[channel].lfe) && (useTns)) {
             TnsEncode(&(coderInfo[channel].tnsInfo),
                       coderInfo[channel].sfbn,
@@ -620,7 +637,9 @@ int FAACAPI faacEncEncode(faacEncHandle hpEncoder,
                       coderInfo[channel].block_type,
                       coderInfo[channel].sfb_offset,
                       hEncoder->freqBuff[channel]);
-        } else {
+        } else
+#endif
+        {
             coderInfo[channel].tnsInfo.tnsDataPresent = 0;      /* TNS not used for LFE */
         }
     }
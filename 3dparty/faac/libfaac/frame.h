@@ -57,26 +57,26 @@ typedef struct {
     SR_INFO *srInfo;
 
     /* sample buffers of current next and next next frame*/
-    double *sampleBuff[MAX_CHANNELS];
-    double *next3SampleBuff[MAX_CHANNELS];
+    real_t *sampleBuff[MAX_CHANNELS];
+    real_t *next3SampleBuff[MAX_CHANNELS];
 
     /* Filterbank buffers */
-    double *sin_window_long;
-    double *sin_window_short;
-    double *kbd_window_long;
-    double *kbd_window_short;
-    double *freqBuff[MAX_CHANNELS];
-    double *overlapBuff[MAX_CHANNELS];
+    coef_t *sin_window_long;
+    coef_t *sin_window_short;
+    coef_t *kbd_window_long;
+    coef_t *kbd_window_short;
+    real_t *freqBuff[MAX_CHANNELS];
+    real_t *overlapBuff[MAX_CHANNELS];
 
     /*
      * Scratch buffers for filterbank/MDCT.
      * Upstream FAAC allocates/frees these per-frame; on embedded targets this is
      * a measurable CPU cost. We allocate once per encoder instance instead.
      */
-    double *fb_transf_buf;   /* 2*BLOCK_LEN_LONG */
-    double *fb_overlap_buf;  /* 2*BLOCK_LEN_LONG (used by IFilterBank) */
-    double *mdct_xr;         /* max (N/4) = BLOCK_LEN_LONG/2 for N=2*BLOCK_LEN_LONG */
-    double *mdct_xi;         /* max (N/4) = BLOCK_LEN_LONG/2 for N=2*BLOCK_LEN_LONG */
+    real_t *fb_transf_buf;   /* 2*BLOCK_LEN_LONG */
+    real_t *fb_overlap_buf;  /* 2*BLOCK_LEN_LONG (used by IFilterBank) */
+    real_t *mdct_xr;         /* max (N/4) = BLOCK_LEN_LONG/2 for N=2*BLOCK_LEN_LONG */
+    real_t *mdct_xi;         /* max (N/4) = BLOCK_LEN_LONG/2 for N=2*BLOCK_LEN_LONG */
 
     double *msSpectrum[MAX_CHANNELS];
 
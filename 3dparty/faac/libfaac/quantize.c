@@ -62,6 +62,192 @@
 #define MAGIC_NUMBER  0.4054
 #define NOISEFLOOR 0.4
 
+#ifdef FAAC_FIXED_POINT
+/* n * NOISEFLOOR^2 in squared real_t units */
+#define NOISEFLOOR_ENRG(n) ((enrg_t)(n) * (4 << REAL_BITS) * (4 << REAL_BITS) / 100)
+/* round a Q16 value to an integer */
+#define Q16_ROUND(x) (((x) + 32768) >> 16)
+
+/* ratio^0.4 with ratio = 2^(l / 65536), Q16 */
+static uint64_t powm(int32_t l)
+{
+    return fix_exp2((int32_t)(((int64_t)l * 26214) >> 16));
+}
+
+// band sound masking; bandqual is Q16
+static void bmask(CoderInfo *coderInfo, real_t *xr0, uint32_t *bandqual,
+                  int gnum, double quality)
+{
+  int sfb, start, end, cnt;
+  int *cb_offset = coderInfo->sfb_offset;
+  int last;
+  enrg_t totenrg = 0;
+  int32_t lavg;
+  uint32_t qual = (uint32_t)(quality * 65536.0);
+  int gsize = coderInfo->groups.len[gnum];
+  real_t *xr;
+  int win;
+  int enrgcnt = 0;
+
+
+  for (sfb = 0; sfb < coderInfo->sfbn; sfb++)
+  {
+      start = coderInfo->sfb_offset[sfb];
+      end = coderInfo->sfb_offset[sfb + 1];
+
+      xr = xr0;
+      for (win = 0; win < gsize; win++)
+      {
+          for (cnt = start; cnt < end; cnt++)
+          {
+              totenrg += ENRG(xr[cnt]);
+              enrgcnt++;
+          }
+
+          xr += BLOCK_LEN_SHORT;
+      }
+  }
+
+  if (totenrg < NOISEFLOOR_ENRG(enrgcnt))
+  {
+      for (sfb = 0; sfb < coderInfo->sfbn; sfb++)
+          bandqual[sfb] = 0;
+
+      return;
+  }
+
+  last = (coderInfo->block_type == ONLY_SHORT_WINDOW) ? BLOCK_LEN_SHORT : BLOCK_LEN_LONG;
+  lavg = fix_log2(totenrg) - fix_log2(last);
+
+  for (sfb = 0; sfb < coderInfo->sfbn; sfb++)
+  {
+    enrg_t avge, maxe;
+    int32_t lband;
+    uint64_t target;
+
+    start = cb_offset[sfb];
+    end = cb_offset[sfb + 1];
+
+    avge = 0;
+    maxe = 0;
+    xr = xr0;
+    for (win = 0; win < gsize; win++)
+    {
+        for (cnt = start; cnt < end; cnt++)
+        {
+            enrg_t e = ENRG(xr[cnt]);
+            avge += e;
+            if (maxe < e)
+                maxe = e;
+        }
+        xr += BLOCK_LEN_SHORT;
+    }
+
+    /* the float path compares against avgenrg = totenrg / last * (end - start)
+       with powm = 0.4; work on log2 of the ratios instead */
+    lband = lavg + fix_log2(end - start);
+    target = 13107 * powm(fix_log2(avge) - lband);        /* NOISETONE */
+    target += 23593 * powm(fix_log2(maxe) + fix_log2(gsize) - lband); /* (1 - NOISETONE) * 0.45 */
+    target >>= 16;
+
+    if (coderInfo->block_type == ONLY_SHORT_WINDOW)
+        target = target * 3 / 2;
+
+    target = target * 10 * last / (last + start + end);
+    target = fix_mul_q16(target, qual);
+
+    bandqual[sfb] = (target > UINT32_MAX) ? UINT32_MAX : (uint32_t)target;
+  }
+}
+
+enum {MAXSHORTBAND = 36};
+// use band quality levels to quantize a group of windows
+static void qlevel(CoderInfo *coderInfo,
+                   const real_t *xr0,
+                   const uint32_t *bandqual,
+                   int gnum,
+                   int pnslevel
+                  )
+{
+    int sb, cnt;
+    int gsize = coderInfo->groups.len[gnum];
+
+    for (sb = 0; sb < coderInfo->sfbn; sb++)
+    {
+      int sfac, silent;
+      enrg_t etot;
+      int32_t lrms;
+      int xitab[8 * MAXSHORTBAND];
+      int *xi;
+      int start, end;
+      const real_t *xr;
+      int win;
+
+      if (coderInfo->book[coderInfo->bandcnt] != HCB_NONE)
+      {
+          coderInfo->bandcnt++;
+          continue;
+      }
+
+      start = coderInfo->sfb_offset[sb];
+      end = coderInfo->sfb_offset[sb+1];
+
+      etot = 0;
+      xr = xr0;
+      for (win = 0; win < gsize; win++)
+      {
+          for (cnt = start; cnt < end; cnt++)
+              etot += ENRG(xr[cnt]);
+          xr += BLOCK_LEN_SHORT;
+      }
+
+      if ((etot < NOISEFLOOR_ENRG(gsize * (end - start))) || (!bandqual[sb]))
+      {
+          coderInfo->book[coderInfo->bandcnt++] = HCB_ZERO;
+          continue;
+      }
+
+      /* log2 of the band energy per window, in float units */
+      lrms = fix_log2(etot) - fix_log2(gsize) - ((2 * REAL_BITS) << 16);
+
+#ifndef DRM
+      if ((uint64_t)bandqual[sb] * 10 < (uint64_t)pnslevel << 16)
+      {
+          /* lrint(log10(etot) * 0.5 * sfstep) */
+          coderInfo->book[coderInfo->bandcnt] = HCB_PNS;
+          coderInfo->sf[coderInfo->bandcnt] += Q16_ROUND(2 * lrms);
+          coderInfo->bandcnt++;
+          continue;
+      }
+#endif
+
+      /* lrint(log10(bandqual / rmsx) * sfstep) */
+      lrms -= fix_log2(end - start);
+      sfac = Q16_ROUND(4 * (fix_log2(bandqual[sb]) - (16 << 16)) - 2 * lrms);
+      silent = (SF_OFFSET - sfac) < 10;
+
+      xr = xr0 + start;
+      end -= start;
+      xi = xitab;
+      for (win = 0; win < gsize; win++)
+      {
+          for (cnt = 0; cnt < end; cnt++)
+          {
+              if (silent)
+                  xi[cnt] = 0;
+              else if (xr[cnt] < 0)
+                  xi[cnt] = -fix_quant(-(uint32_t)xr[cnt], sfac);
+              else
+                  xi[cnt] = fix_quant(xr[cnt], sfac);
+          }
+          xi += cnt;
+          xr += BLOCK_LEN_SHORT;
+      }
+      huffbook(coderInfo, xitab, gsize * end);
+      coderInfo->sf[coderInfo->bandcnt++] += SF_OFFSET - sfac;
+    }
+}
+#else
 // band sound masking
 static void bmask(CoderInfo *coderInfo, double *xr0, double *bandqual,
                   int gnum, double quality)
@@ -301,12 +487,17 @@ static void qlevel(CoderInfo *coderInfo,
       coderInfo->sf[coderInfo->bandcnt++] += SF_OFFSET - sfac;
     }
 }
+#endif /* FAAC_FIXED_POINT */
 
-int BlocQuant(CoderInfo *coder, double *xr, AACQuantCfg *aacquantCfg)
+int BlocQuant(CoderInfo *coder, real_t *xr, AACQuantCfg *aacquantCfg)
 {
+#ifdef FAAC_FIXED_POINT
+    uint32_t bandlvl[MAX_SCFAC_BANDS];
+#else
     double bandlvl[MAX_SCFAC_BANDS];
+#endif
     int cnt;
-    double *gxr;
+    real_t *gxr;
 
     coder->global_gain = 0;
 
@@ -415,7 +606,7 @@ void CalcBW(unsigned *bw, int rate, SR_INFO *sr, AACQuantCfg *aacquantCfg)
 
 enum {MINSFB = 2};
 
-static void calce(double *xr, int *bands, double e[NSFB_SHORT], int maxsfb,
+static void calce(real_t *xr, int *bands, enrg_t e[NSFB_SHORT], int maxsfb,
                   int maxl)
 {
     int sfb;
@@ -423,18 +614,18 @@ static void calce(double *xr, int *bands, double e[NSFB_SHORT], int maxsfb,
 
     // mute lines above cutoff freq
     for (l = maxl; l < bands[maxsfb]; l++)
-        xr[l] = 0.0;
+        xr[l] = 0;
 
     for (sfb = MINSFB; sfb < maxsfb; sfb++)
     {
         e[sfb] = 0;
         for (l = bands[sfb]; l < bands[sfb + 1]; l++)
-            e[sfb] += xr[l] * xr[l];
+            e[sfb] += ENRG(xr[l]);
     }
 }
 
-static void resete(double min[NSFB_SHORT], double max[NSFB_SHORT],
-                   double e[NSFB_SHORT], int maxsfb)
+static void resete(enrg_t min[NSFB_SHORT], enrg_t max[NSFB_SHORT],
+                   enrg_t e[NSFB_SHORT], int maxsfb)
 {
     int sfb;
     for (sfb = MINSFB; sfb < maxsfb; sfb++)
@@ -446,13 +637,13 @@ static void resete(double min[NSFB_SHORT], double max[NSFB_SHORT],
 static int groups = 0;
 static int frames = 0;
 #endif
-void BlocGroup(double *xr, CoderInfo *coderInfo, AACQuantCfg *cfg)
+void BlocGroup(real_t *xr, CoderInfo *coderInfo, AACQuantCfg *cfg)
 {
     int win, sfb;
-    double e[NSFB_SHORT];
-    double min[NSFB_SHORT];
-    double max[NSFB_SHORT];
-    const double thr = 3.0;
+    enrg_t e[NSFB_SHORT];
+    enrg_t min[NSFB_SHORT];
+    enrg_t max[NSFB_SHORT];
+    const enrg_t thr = 3;
     int win0;
     int fastmin;
     int maxsfb, maxl;
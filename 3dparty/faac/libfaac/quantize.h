@@ -40,9 +40,9 @@ enum {
     SF_OFFSET = 100,
 };
 
-int BlocQuant(CoderInfo *coderInfo, double *xr, AACQuantCfg *aacquantCfg);
+int BlocQuant(CoderInfo *coderInfo, real_t *xr, AACQuantCfg *aacquantCfg);
 void CalcBW(unsigned *bw, int rate, SR_INFO *sr, AACQuantCfg *aacquantCfg);
-void BlocGroup(double *xr, CoderInfo *coderInfo, AACQuantCfg *aacquantCfg);
+void BlocGroup(real_t *xr, CoderInfo *coderInfo, AACQuantCfg *aacquantCfg);
 void BlocStat(void);
 
 #endif
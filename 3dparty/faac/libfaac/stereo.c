@@ -24,6 +24,235 @@
 #include "huff2.h"
 
 
+#ifdef FAAC_FIXED_POINT
+/* round(2 * l / 65536): 10 * log10(x) / 1.50515 is 2 * log2(x) */
+#define SF_LOG2(l) (((l) + 16384) >> 15)
+
+static void stereo(CoderInfo *cl, CoderInfo *cr,
+                   real_t *sl0, real_t *sr0, int *sfcnt,
+                   int wstart, int wend, double phthr
+                  )
+{
+    int sfb;
+    int win;
+    int sfmin;
+    uint32_t phq;
+
+    if (!phthr)
+        return;
+
+    phq = (uint32_t)(65536.0 / phthr);
+
+    if (cl->block_type == ONLY_SHORT_WINDOW)
+        sfmin = 1;
+    else
+        sfmin = 8;
+
+    (*sfcnt) += sfmin;
+
+    for (sfb = sfmin; sfb < cl->sfbn; sfb++)
+    {
+        int l, start, end;
+        int64_t sum, diff;
+        enrg_t enrgs, enrgd, enrgl, enrgr;
+        int hcb = HCB_NONE;
+        enrg_t ethr;
+        uint32_t vfix = 0;
+        enrg_t efix;
+
+        start = cl->sfb_offset[sfb];
+        end = cl->sfb_offset[sfb + 1];
+
+        enrgs = enrgd = enrgl = enrgr = 0;
+        for (win = wstart; win < wend; win++)
+        {
+            real_t *sl = sl0 + win * BLOCK_LEN_SHORT;
+            real_t *sr = sr0 + win * BLOCK_LEN_SHORT;
+
+            for (l = start; l < end; l++)
+            {
+                real_t lx = sl[l];
+                real_t rx = sr[l];
+
+                sum = (int64_t)lx + rx;
+                diff = (int64_t)lx - rx;
+
+                enrgs += ENRG(sum);
+                enrgd += ENRG(diff);
+                enrgl += ENRG(lx);
+                enrgr += ENRG(rx);
+            }
+        }
+
+        ethr = (enrg_t)fix_sqrt(enrgl) + fix_sqrt(enrgr);
+        ethr = fix_mul_q16(ethr * ethr, phq);
+        efix = enrgl + enrgr;
+        /* vfix = sqrt(efix / enrg), Q16; silent bands stay as they are */
+        if (efix && enrgs >= ethr)
+        {
+            hcb = HCB_INTENSITY;
+            vfix = fix_exp2((fix_log2(efix) - fix_log2(enrgs)) / 2);
+        }
+        else if (efix && enrgd >= ethr)
+        {
+            hcb = HCB_INTENSITY2;
+            vfix = fix_exp2((fix_log2(efix) - fix_log2(enrgd)) / 2);
+        }
+
+        if (hcb != HCB_NONE)
+        {
+            int32_t lefix = fix_log2(efix);
+            int sf = SF_LOG2(fix_log2(enrgl) - lefix);
+            int pan = SF_LOG2(fix_log2(enrgr) - lefix) - sf;
+
+            if (pan > 30)
+            {
+                cl->book[*sfcnt] = HCB_ZERO;
+                (*sfcnt)++;
+                continue;
+            }
+            if (pan < -30)
+            {
+                cr->book[*sfcnt] = HCB_ZERO;
+                (*sfcnt)++;
+                continue;
+            }
+            cl->sf[*sfcnt] = sf;
+            cr->sf[*sfcnt] = -pan;
+            cr->book[*sfcnt] = hcb;
+
+            for (win = wstart; win < wend; win++)
+            {
+                real_t *sl = sl0 + win * BLOCK_LEN_SHORT;
+                real_t *sr = sr0 + win * BLOCK_LEN_SHORT;
+                for (l = start; l < end; l++)
+                {
+                    if (hcb == HCB_INTENSITY)
+                        sum = (int64_t)sl[l] + sr[l];
+                    else
+                        sum = (int64_t)sl[l] - sr[l];
+
+                    sl[l] = (real_t)((sum * vfix) >> 16);
+                }
+            }
+        }
+        (*sfcnt)++;
+    }
+}
+
+static void midside(CoderInfo *coder, ChannelInfo *channel,
+                    real_t *sl0, real_t *sr0, int *sfcnt,
+                    int wstart, int wend,
+                    double thrmid, double thrside
+                   )
+{
+    int sfb;
+    int win;
+    int sfmin;
+    uint32_t qmid = (uint32_t)(thrmid * 65536.0);
+    uint32_t qside = (uint32_t)(thrside * 65536.0);
+
+    if (coder->block_type == ONLY_SHORT_WINDOW)
+        sfmin = 1;
+    else
+        sfmin = 8;
+
+    for (sfb = 0; sfb < sfmin; sfb++)
+    {
+        channel->msInfo.ms_used[*sfcnt] = 0;
+        (*sfcnt)++;
+    }
+    for (sfb = sfmin; sfb < coder->sfbn; sfb++)
+    {
+        int ms = 0;
+        int l, start, end;
+        real_t sum, diff;
+        enrg_t enrgs, enrgd, enrgl, enrgr;
+
+        start = coder->sfb_offset[sfb];
+        end = coder->sfb_offset[sfb + 1];
+
+        enrgs = enrgd = enrgl = enrgr = 0;
+        for (win = wstart; win < wend; win++)
+        {
+            real_t *sl = sl0 + win * BLOCK_LEN_SHORT;
+            real_t *sr = sr0 + win * BLOCK_LEN_SHORT;
+
+            for (l = start; l < end; l++)
+            {
+                real_t lx = sl[l];
+                real_t rx = sr[l];
+
+                sum = (real_t)(((int64_t)lx + rx) >> 1);
+                diff = (real_t)(((int64_t)lx - rx) >> 1);
+
+                enrgs += ENRG(sum);
+                enrgd += ENRG(diff);
+                enrgl += ENRG(lx);
+                enrgr += ENRG(rx);
+            }
+        }
+
+        if (fix_mul_q16(min(enrgl, enrgr), qmid) >= max(enrgs, enrgd))
+        {
+            enum {PH_NONE, PH_IN, PH_OUT};
+            int phase = PH_NONE;
+
+            if (fix_mul_q16(enrgs, qmid) * 2 >= (enrgl + enrgr))
+            {
+                ms = 1;
+                phase = PH_IN;
+            }
+            else if (fix_mul_q16(enrgd, qmid) * 2 >= (enrgl + enrgr))
+            {
+                ms = 1;
+                phase = PH_OUT;
+            }
+
+            if (ms)
+            {
+                for (win = wstart; win < wend; win++)
+                {
+                    real_t *sl = sl0 + win * BLOCK_LEN_SHORT;
+                    real_t *sr = sr0 + win * BLOCK_LEN_SHORT;
+                    for (l = start; l < end; l++)
+                    {
+                        if (phase == PH_IN)
+                        {
+                            sl[l] = (real_t)(((int64_t)sl[l] + sr[l]) >> 1);
+                            sr[l] = 0;
+                        }
+                        else
+                        {
+                            sr[l] = (real_t)(((int64_t)sl[l] - sr[l]) >> 1);
+                            sl[l] = 0;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (min(enrgl, enrgr) <= fix_mul_q16(max(enrgl, enrgr), qside))
+        {
+            for (win = wstart; win < wend; win++)
+            {
+                real_t *sl = sl0 + win * BLOCK_LEN_SHORT;
+                real_t *sr = sr0 + win * BLOCK_LEN_SHORT;
+                for (l = start; l < end; l++)
+                {
+                    if (enrgl < enrgr)
+                        sl[l] = 0;
+                    else
+                        sr[l] = 0;
+                }
+            }
+        }
+
+        channel->msInfo.ms_used[*sfcnt] = ms;
+        (*sfcnt)++;
+    }
+}
+#else
 static void stereo(CoderInfo *cl, CoderInfo *cr,
                    double *sl0, double *sr0, int *sfcnt,
                    int wstart, int wend, double phthr
@@ -247,11 +476,12 @@ static void midside(CoderInfo *coder, ChannelInfo *channel,
         (*sfcnt)++;
     }
 }
+#endif /* FAAC_FIXED_POINT */
 
 
 void AACstereo(CoderInfo *coder,
                ChannelInfo *channel,
-               double *s[MAX_CHANNELS],
+               real_t *s[MAX_CHANNELS],
                int maxchan,
                double quality,
                int mode
@@ -22,7 +22,7 @@
 
 void AACstereo(CoderInfo *coder,
                ChannelInfo *channel,
-               double *s[MAX_CHANNELS],
+               real_t *s[MAX_CHANNELS],
                int maxchan,
                double quality,
                int mode
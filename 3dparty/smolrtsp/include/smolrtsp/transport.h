@@ -82,6 +82,33 @@ SmolRTSP_Transport smolrtsp_transport_udp(int fd) SMOLRTSP_PRIV_MUST_USE;
 SmolRTSP_Transport smolrtsp_transport_udp_address(
     int fd, void *addr, size_t len) SMOLRTSP_PRIV_MUST_USE;
 
+/**
+ * Switches a UDP transport to batching: every following `transmit` only
+ * queues its datagram, and #smolrtsp_transport_udp_flush sends the queue with
+ * as few system calls as possible (`UDP_SEGMENT` generic segmentation offload
+ * where the kernel supports it, `sendmmsg` otherwise). A batch is also flushed
+ * when it holds 64 datagrams.
+ *
+ * Of each queued datagram, all I/O vectors but the last are copied (up to 32
+ * bytes in total, e.g. RTP and payload headers). The last one is referenced
+ * and must stay valid until the flush.
+ *
+ * @param[in] t A transport created by #smolrtsp_transport_udp or
+ * #smolrtsp_transport_udp_address.
+ *
+ * @return 0 on success, -1 if @p t is not a UDP transport.
+ */
+int smolrtsp_transport_udp_batch(SmolRTSP_Transport t);
+
+/**
+ * Sends the datagrams queued since #smolrtsp_transport_udp_batch and goes
+ * back to sending each datagram immediately.
+ *
+ * @return 0 on success, -1 if @p t is not a UDP transport or an I/O error
+ * occurred (and sets `errno` appropriately). The queue is emptied either way.
+ */
+int smolrtsp_transport_udp_flush(SmolRTSP_Transport t);
+
 /**
  * Creates a new datagram socket suitable for #smolrtsp_transport_udp.
  *
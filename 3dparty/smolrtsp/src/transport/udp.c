@@ -1,9 +1,15 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sendmmsg
+#endif
+
 #include <smolrtsp/transport.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -12,15 +18,41 @@
 
 #define MAX_RETRANSMITS 10
 
+// Datagrams a batch holds before it is flushed on its own.
+#define MAX_BATCH 64
+// Bytes of each batched datagram copied besides its last I/O vector.
+#define MAX_BATCH_HEADER 32
+// Largest payload of one GSO send (the UDP length field minus headroom).
+#define MAX_GSO_BYTES 65000
+
+// Generic segmentation offload for UDP, Linux 4.18+. Older C libraries lack
+// the definition; the kernel then rejects it and batches use sendmmsg().
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP IPPROTO_UDP
+#endif
+
 typedef struct {
     int fd;
     char addr[128];
     size_t len;
+
+    // Batching state, see smolrtsp_transport_udp_batch().
+    bool batching;
+    // 1 if UDP_SEGMENT worked, 0 if untried, -1 if unsupported.
+    int gso;
+    size_t count;
+    size_t sizes[MAX_BATCH];
+    struct iovec iov[MAX_BATCH][2];
+    uint8_t headers[MAX_BATCH][MAX_BATCH_HEADER];
 } SmolRTSP_UdpTransport;
 
 declImpl(SmolRTSP_Transport, SmolRTSP_UdpTransport);
 
 static int send_packet(SmolRTSP_UdpTransport *self, struct msghdr message);
+static int flush_batch(SmolRTSP_UdpTransport *self);
 static int
 new_sockaddr(struct sockaddr *addr, int af, const void *ip, uint16_t port);
 
@@ -31,6 +63,9 @@ SmolRTSP_Transport smolrtsp_transport_udp(int fd) {
     assert(self);
     self->fd = fd;
     self->len = 0;
+    self->batching = false;
+    self->gso = 0;
+    self->count = 0;
 
     return DYN(SmolRTSP_UdpTransport, SmolRTSP_Transport, self);
 }
@@ -45,6 +80,9 @@ smolrtsp_transport_udp_address(int fd, void *addr, size_t len) {
     self->fd = fd;
     self->len = len;
     memcpy(&self->addr, addr, len);
+    self->batching = false;
+    self->gso = 0;
+    self->count = 0;
 
     return DYN(SmolRTSP_UdpTransport, SmolRTSP_Transport, self);
 }
@@ -62,6 +100,35 @@ static int SmolRTSP_UdpTransport_transmit(VSelf, SmolRTSP_IoVecSlice bufs) {
     VSELF(SmolRTSP_UdpTransport);
     assert(self);
 
+    if (self->batching && bufs.len > 0) {
+        size_t header_len = 0;
+        for (size_t i = 0; i + 1 < bufs.len; i++)
+            header_len += bufs.ptr[i].iov_len;
+
+        if (header_len <= MAX_BATCH_HEADER) {
+            if (self->count == MAX_BATCH && flush_batch(self) == -1)
+                return -1;
+
+            uint8_t *header = self->headers[self->count];
+            size_t off = 0;
+            for (size_t i = 0; i + 1 < bufs.len; i++) {
+                memcpy(header + off, bufs.ptr[i].iov_base, bufs.ptr[i].iov_len);
+                off += bufs.ptr[i].iov_len;
+            }
+            self->iov[self->count][0] =
+                (struct iovec){.iov_base = header, .iov_len = header_len};
+            self->iov[self->count][1] = bufs.ptr[bufs.len - 1];
+            self->sizes[self->count] =
+                header_len + bufs.ptr[bufs.len - 1].iov_len;
+            self->count++;
+            return 0;
+        }
+
+        // Too large to batch: keep the datagram order and send it directly.
+        if (flush_batch(self) == -1)
+            return -1;
+    }
+
     const struct msghdr msg = {
         .msg_name = self->addr,
         .msg_namelen = self->len,
@@ -84,6 +151,150 @@ static bool SmolRTSP_UdpTransport_is_full(VSelf) {
 
 impl(SmolRTSP_Transport, SmolRTSP_UdpTransport);
 
+int smolrtsp_transport_udp_batch(SmolRTSP_Transport t) {
+    if (t.vptr != &VTABLE(SmolRTSP_UdpTransport, SmolRTSP_Transport)) {
+        return -1;
+    }
+
+    SmolRTSP_UdpTransport *self = t.self;
+    self->batching = true;
+    return 0;
+}
+
+int smolrtsp_transport_udp_flush(SmolRTSP_Transport t) {
+    if (t.vptr != &VTABLE(SmolRTSP_UdpTransport, SmolRTSP_Transport)) {
+        return -1;
+    }
+
+    SmolRTSP_UdpTransport *self = t.self;
+    self->batching = false;
+    return flush_batch(self);
+}
+
+// Number of datagrams from @p first that one GSO send can carry: equally
+// sized segments, optionally closed by a single shorter one.
+static size_t gso_run(const SmolRTSP_UdpTransport *self, size_t first) {
+    const size_t seg = self->sizes[first];
+    size_t n = 1, total = seg;
+
+    while (first + n < self->count && total + self->sizes[first + n] <= MAX_GSO_BYTES) {
+        const size_t size = self->sizes[first + n];
+        if (size > seg) {
+            break;
+        }
+        n++;
+        total += size;
+        if (size < seg) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+static int send_gso(SmolRTSP_UdpTransport *self, size_t first, size_t n) {
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof control);
+
+    struct msghdr msg = {
+        .msg_name = self->len ? self->addr : NULL,
+        .msg_namelen = self->len,
+        .msg_iov = &self->iov[first][0],
+        .msg_iovlen = 2 * n,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf,
+        .msg_flags = 0,
+    };
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    const uint16_t gso_size = (uint16_t)self->sizes[first];
+    memcpy(CMSG_DATA(cm), &gso_size, sizeof gso_size);
+
+    return sendmsg(self->fd, &msg, 0) == -1 ? -1 : 0;
+}
+
+static int send_mmsg(SmolRTSP_UdpTransport *self, size_t first, size_t n) {
+    struct mmsghdr msgs[MAX_BATCH];
+    for (size_t i = 0; i < n; i++) {
+        msgs[i].msg_hdr = (struct msghdr){
+            .msg_name = self->len ? self->addr : NULL,
+            .msg_namelen = self->len,
+            .msg_iov = self->iov[first + i],
+            .msg_iovlen = 2,
+            .msg_control = NULL,
+            .msg_controllen = 0,
+            .msg_flags = 0,
+        };
+        msgs[i].msg_len = 0;
+    }
+
+    size_t sent = 0;
+    while (sent < n) {
+        const int ret = sendmmsg(self->fd, msgs + sent, (unsigned int)(n - sent), 0);
+        if (ret > 0) {
+            sent += (size_t)ret;
+            continue;
+        }
+        if (ret == -1 && EMSGSIZE == errno) {
+            // Let the single-datagram path retry it, as unbatched sends do.
+            if (send_packet(self, msgs[sent].msg_hdr) == -1) {
+                return -1;
+            }
+            sent++;
+            continue;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+static int flush_batch(SmolRTSP_UdpTransport *self) {
+    int ret = 0;
+    size_t i = 0;
+
+    while (i < self->count) {
+        if (self->gso >= 0) {
+            const size_t run = gso_run(self, i);
+            if (run > 1) {
+                if (send_gso(self, i, run) == 0) {
+                    self->gso = 1;
+                    i += run;
+                    continue;
+                }
+                if (EINVAL == errno || ENOPROTOOPT == errno ||
+                    EOPNOTSUPP == errno || EIO == errno) {
+                    // No (usable) UDP GSO on this kernel or route.
+                    self->gso = -1;
+                } else {
+                    ret = -1;
+                    break;
+                }
+            } else {
+                if (send_mmsg(self, i, 1) == -1) {
+                    ret = -1;
+                    break;
+                }
+                i++;
+                continue;
+            }
+        }
+
+        if (send_mmsg(self, i, self->count - i) == -1) {
+            ret = -1;
+        }
+        break;
+    }
+
+    self->count = 0;
+    return ret;
+}
+
 static int send_packet(SmolRTSP_UdpTransport *self, struct msghdr message) {
     // Try to retransmit a packet several times on `EMSGSIZE`. The kernel
     // will fragment an IP packet because if `IP_PMTUDISC_WANT` is set.
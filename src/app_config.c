@@ -601,6 +601,19 @@ int save_app_config(void) {
     if (yaml_map_add_scalarf(fyd, rtsp, "port", "%d", app_config.rtsp_port)) goto EMIT_FAIL;
     if (!EMPTY(app_config.rtsp_bind))
         if (yaml_map_add_str(fyd, rtsp, "bind", app_config.rtsp_bind)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "max_clients", "%u", app_config.rtsp_max_clients)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "out_budget_kb", "%u", app_config.rtsp_out_budget_kb)) goto EMIT_FAIL;
+    if (yaml_map_add_str(fyd, rtsp, "drop_request_idr", app_config.rtsp_drop_request_idr ? "true" : "false")) goto EMIT_FAIL;
+    if (!EMPTY(app_config.rtsp_multicast_group))
+        if (yaml_map_add_str(fyd, rtsp, "multicast_group", app_config.rtsp_multicast_group)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "multicast_port", "%u", app_config.rtsp_multicast_port)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "multicast_ttl", "%u", app_config.rtsp_multicast_ttl)) goto EMIT_FAIL;
+    if (yaml_map_add_str(fyd, rtsp, "abr_enable", app_config.rtsp_abr_enable ? "true" : "false")) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "abr_min_kbps", "%u", app_config.rtsp_abr_min_kbps)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "abr_max_kbps", "%u", app_config.rtsp_abr_max_kbps)) goto EMIT_FAIL;
+    if (yaml_map_add_str(fyd, rtsp, "header_ext", app_config.rtsp_header_ext ? "true" : "false")) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "threads", "%u", app_config.rtsp_threads)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, rtsp, "nack_ms", "%u", app_config.rtsp_nack_ms)) goto EMIT_FAIL;
     if (yaml_map_add_str(fyd, rtsp, "enable_auth", app_config.rtsp_enable_auth ? "true" : "false")) goto EMIT_FAIL;
     if (yaml_map_add_str(fyd, rtsp, "auth_user", app_config.rtsp_auth_user)) goto EMIT_FAIL;
     if (yaml_map_add_str(fyd, rtsp, "auth_pass", app_config.rtsp_auth_pass)) goto EMIT_FAIL;
@@ -614,12 +627,30 @@ int save_app_config(void) {
     if (yaml_map_add_str(fyd, record, "filename", app_config.record_filename)) goto EMIT_FAIL;
     if (yaml_map_add_scalarf(fyd, record, "segment_duration", "%d", app_config.record_segment_duration)) goto EMIT_FAIL;
     if (yaml_map_add_scalarf(fyd, record, "segment_size", "%d", app_config.record_segment_size)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, record, "queue_kb", "%u", app_config.record_queue_kb)) goto EMIT_FAIL;
+    if (yaml_map_add_str(fyd, record, "drop_frames", app_config.record_drop_frames ? "true" : "false")) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, record, "preroll_s", "%u", app_config.record_preroll_s)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, record, "preroll_kb", "%u", app_config.record_preroll_kb)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, record, "min_free_mb", "%u", app_config.record_min_free_mb)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, record, "max_age_h", "%u", app_config.record_max_age_h)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, record, "sync_s", "%u", app_config.record_sync_s)) goto EMIT_FAIL;
+
+    // hls
+    struct fy_node *hls = fy_node_create_mapping(fyd);
+    if (!hls || yaml_map_add(fyd, root, "hls", hls)) goto EMIT_FAIL;
+    if (yaml_map_add_str(fyd, hls, "enable", app_config.hls_enable ? "true" : "false")) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, hls, "segment_ms", "%u", app_config.hls_segment_ms)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, hls, "part_ms", "%u", app_config.hls_part_ms)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, hls, "segments", "%u", app_config.hls_segments)) goto EMIT_FAIL;
 
     // stream
     struct fy_node *stream = fy_node_create_mapping(fyd);
     if (!stream || yaml_map_add(fyd, root, "stream", stream)) goto EMIT_FAIL;
     if (yaml_map_add_str(fyd, stream, "enable", app_config.stream_enable ? "true" : "false")) goto EMIT_FAIL;
     if (yaml_map_add_scalarf(fyd, stream, "udp_srcport", "%u", (unsigned int)app_config.stream_udp_srcport)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, stream, "pace_kbps", "%u", app_config.stream_pace_kbps)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, stream, "pace_burst_kb", "%u", app_config.stream_pace_burst_kb)) goto EMIT_FAIL;
+    if (yaml_map_add_scalarf(fyd, stream, "nack_ms", "%u", app_config.stream_nack_ms)) goto EMIT_FAIL;
     {
         struct fy_node *d = fy_node_create_sequence(fyd);
         bool any = false;
@@ -831,6 +862,18 @@ enum ConfigError parse_app_config(void) {
     app_config.rtsp_enable = false;
     app_config.rtsp_port = 554;
     app_config.rtsp_bind[0] = '\0';
+    app_config.rtsp_max_clients = 8;
+    app_config.rtsp_out_budget_kb = 4096;
+    app_config.rtsp_drop_request_idr = false;
+    app_config.rtsp_multicast_group[0] = '\0';
+    app_config.rtsp_multicast_port = 5004;
+    app_config.rtsp_multicast_ttl = 4;
+    app_config.rtsp_abr_enable = false;
+    app_config.rtsp_abr_min_kbps = 256;
+    app_config.rtsp_abr_max_kbps = 0;
+    app_config.rtsp_header_ext = false;
+    app_config.rtsp_threads = 1;
+    app_config.rtsp_nack_ms = 0;
     app_config.rtsp_enable_auth = false;
     app_config.rtsp_auth_user[0] = '\0';
     app_config.rtsp_auth_pass[0] = '\0';
@@ -841,10 +884,25 @@ enum ConfigError parse_app_config(void) {
     strcpy(app_config.record_path, "/mnt/sdcard/recordings");
     app_config.record_segment_duration = 0;
     app_config.record_segment_size = 0;
+    app_config.record_queue_kb = 2048;
+    app_config.record_drop_frames = true;
+    app_config.record_preroll_s = 0;
+    app_config.record_preroll_kb = 4096;
+    app_config.record_min_free_mb = 0;
+    app_config.record_max_age_h = 0;
+    app_config.record_sync_s = 5;
+
+    app_config.hls_enable = false;
+    app_config.hls_segment_ms = 2000;
+    app_config.hls_part_ms = 500;
+    app_config.hls_segments = 6;
 
     app_config.stream_enable = false;
     app_config.stream_udp_srcport = 0;
     *app_config.stream_dests[0] = '\0';
+    app_config.stream_pace_kbps = 0;
+    app_config.stream_pace_burst_kb = 16;
+    app_config.stream_nack_ms = 0;
 
     app_config.sensor_config[0] = 0;
     app_config.iq_config[0] = 0;
@@ -1149,6 +1207,13 @@ enum ConfigError parse_app_config(void) {
     yaml_get_string(fyd, "/record/filename", app_config.record_filename, sizeof(app_config.record_filename));
     yaml_get_int(fyd, "/record/segment_duration", 0, INT_MAX, &app_config.record_segment_duration);
     yaml_get_int(fyd, "/record/segment_size", 0, INT_MAX, &app_config.record_segment_size);
+    yaml_get_uint(fyd, "/record/queue_kb", 256, 65536, &app_config.record_queue_kb);
+    yaml_get_bool(fyd, "/record/drop_frames", &app_config.record_drop_frames);
+    yaml_get_uint(fyd, "/record/preroll_s", 0, 60, &app_config.record_preroll_s);
+    yaml_get_uint(fyd, "/record/preroll_kb", 256, 65536, &app_config.record_preroll_kb);
+    yaml_get_uint(fyd, "/record/min_free_mb", 0, 1048576, &app_config.record_min_free_mb);
+    yaml_get_uint(fyd, "/record/max_age_h", 0, 87600, &app_config.record_max_age_h);
+    yaml_get_uint(fyd, "/record/sync_s", 0, 3600, &app_config.record_sync_s);
 
     yaml_get_bool(fyd, "/rtsp/enable", &app_config.rtsp_enable);
     yaml_get_int(fyd, "/rtsp/port", 0, USHRT_MAX, &app_config.rtsp_port);
@@ -1156,16 +1221,49 @@ enum ConfigError parse_app_config(void) {
     if (err != CONFIG_OK && err != CONFIG_PARAM_NOT_FOUND)
         goto RET_ERR_YAML;
     if (app_config.rtsp_enable) {
+        yaml_get_uint(fyd, "/rtsp/max_clients", 1, 256, &app_config.rtsp_max_clients);
+        yaml_get_uint(fyd, "/rtsp/out_budget_kb", 256, 262144, &app_config.rtsp_out_budget_kb);
+        yaml_get_bool(fyd, "/rtsp/drop_request_idr", &app_config.rtsp_drop_request_idr);
+        yaml_get_string(fyd, "/rtsp/multicast_group", app_config.rtsp_multicast_group, sizeof(app_config.rtsp_multicast_group));
+        yaml_get_uint(fyd, "/rtsp/multicast_port", 1024, 65532, &app_config.rtsp_multicast_port);
+        yaml_get_uint(fyd, "/rtsp/multicast_ttl", 1, 255, &app_config.rtsp_multicast_ttl);
+        yaml_get_bool(fyd, "/rtsp/abr_enable", &app_config.rtsp_abr_enable);
+        // Only these HALs can change the encoder bitrate at runtime.
+        if (app_config.rtsp_abr_enable && plat != HAL_PLATFORM_V1 &&
+            plat != HAL_PLATFORM_V2 && plat != HAL_PLATFORM_V3 &&
+            plat != HAL_PLATFORM_V4 && plat != HAL_PLATFORM_RK &&
+            plat != HAL_PLATFORM_CVI) {
+            HAL_WARNING("app_config", "rtsp.abr_enable is not supported "
+                "on this platform, ignored\n");
+            app_config.rtsp_abr_enable = false;
+        }
+        yaml_get_uint(fyd, "/rtsp/abr_min_kbps", 32, 100000, &app_config.rtsp_abr_min_kbps);
+        yaml_get_uint(fyd, "/rtsp/abr_max_kbps", 0, 100000, &app_config.rtsp_abr_max_kbps);
+        yaml_get_bool(fyd, "/rtsp/header_ext", &app_config.rtsp_header_ext);
+        yaml_get_uint(fyd, "/rtsp/threads", 0, 16, &app_config.rtsp_threads);
+        yaml_get_uint(fyd, "/rtsp/nack_ms", 0, 2000, &app_config.rtsp_nack_ms);
         yaml_get_bool(fyd, "/rtsp/enable_auth", &app_config.rtsp_enable_auth);
         yaml_get_string(fyd, "/rtsp/auth_user", app_config.rtsp_auth_user, sizeof(app_config.rtsp_auth_user));
         yaml_get_string(fyd, "/rtsp/auth_pass", app_config.rtsp_auth_pass, sizeof(app_config.rtsp_auth_pass));
     }
 
+    yaml_get_bool(fyd, "/hls/enable", &app_config.hls_enable);
+    if (app_config.hls_enable) {
+        yaml_get_uint(fyd, "/hls/segment_ms", 500, 10000, &app_config.hls_segment_ms);
+        yaml_get_uint(fyd, "/hls/part_ms", 100, 2000, &app_config.hls_part_ms);
+        yaml_get_uint(fyd, "/hls/segments", 2, 15, &app_config.hls_segments);
+        if (app_config.hls_part_ms > app_config.hls_segment_ms)
+            app_config.hls_part_ms = app_config.hls_segment_ms;
+    }
+
     yaml_get_bool(fyd, "/stream/enable", &app_config.stream_enable);
     if (app_config.stream_enable) {
         int val = 0;
         if (yaml_get_int(fyd, "/stream/udp_srcport", 0, USHRT_MAX, &val) == CONFIG_OK)
             app_config.stream_udp_srcport = (unsigned short)val;
+        yaml_get_uint(fyd, "/stream/pace_kbps", 0, 1000000, &app_config.stream_pace_kbps);
+        yaml_get_uint(fyd, "/stream/pace_burst_kb", 2, 1024, &app_config.stream_pace_burst_kb);
+        yaml_get_uint(fyd, "/stream/nack_ms", 0, 2000, &app_config.stream_nack_ms);
 
         for (int i = 0; i < (int)(sizeof(app_config.stream_dests) / sizeof(app_config.stream_dests[0])); i++)
             app_config.stream_dests[i][0] = '\0';
@@ -97,6 +97,18 @@ struct AppConfig {
     char rtsp_auth_pass[32];
     int rtsp_port;
     char rtsp_bind[64];
+    unsigned int rtsp_max_clients;
+    unsigned int rtsp_out_budget_kb;
+    bool rtsp_drop_request_idr;
+    char rtsp_multicast_group[16];
+    unsigned int rtsp_multicast_port;
+    unsigned int rtsp_multicast_ttl;
+    bool rtsp_abr_enable;
+    unsigned int rtsp_abr_min_kbps;
+    unsigned int rtsp_abr_max_kbps;
+    bool rtsp_header_ext;
+    unsigned int rtsp_threads;
+    unsigned int rtsp_nack_ms;
 
     // [record]
     bool record_enable;
@@ -105,11 +117,36 @@ struct AppConfig {
     char record_path[128];
     int record_segment_duration;
     int record_segment_size;
+    // Fragments waiting for the writer thread may use up to queue_kb of RAM,
+    // past that non-keyframe fragments are dropped (or the encoder waits).
+    unsigned int record_queue_kb;
+    bool record_drop_frames;
+    // Pre-roll: the last preroll_s seconds (whole GOPs, at most preroll_kb of
+    // RAM) are kept around so a recording starts before its trigger.
+    unsigned int record_preroll_s;
+    unsigned int record_preroll_kb;
+    // Retention: oldest finished segments are deleted to keep at least
+    // min_free_mb free on the card and nothing older than max_age_h (0 = off).
+    unsigned int record_min_free_mb;
+    unsigned int record_max_age_h;
+    // Segments are fdatasync'ed at the first fragment boundary every sync_s.
+    unsigned int record_sync_s;
+
+    // [hls]
+    // Low-latency HLS served from RAM: IDR-aligned segments of ~segment_ms,
+    // split into parts of at most part_ms, keeping the last `segments` of them.
+    bool hls_enable;
+    unsigned int hls_segment_ms;
+    unsigned int hls_part_ms;
+    unsigned int hls_segments;
 
     // [stream]
     bool stream_enable;
     unsigned short stream_udp_srcport;
     char stream_dests[4][256];
+    unsigned int stream_pace_kbps;
+    unsigned int stream_pace_burst_kb;
+    unsigned int stream_nack_ms;
 
     // [audio]
     bool audio_enable;
@@ -0,0 +1,111 @@
+#include "mfra.h"
+
+enum BufError write_sidx(
+    struct BitBuf *ptr, const uint32_t track_id, const uint32_t timescale,
+    const uint64_t earliest_presentation_time, const uint64_t first_offset,
+    const struct SidxReference *refs, const uint16_t refs_count) {
+    enum BufError err;
+    uint32_t start_atom = ptr->offset;
+    err = put_u32_be(ptr, 0);
+    chk_err;
+    err = put_str4(ptr, "sidx");
+    chk_err;
+    err = put_u8(ptr, 1); // 1 version
+    chk_err;
+    err = put_u8(ptr, 0);
+    chk_err;
+    err = put_u8(ptr, 0);
+    chk_err;
+    err = put_u8(ptr, 0); // 3 flags
+    chk_err;
+    err = put_u32_be(ptr, track_id); // 4 reference_ID
+    chk_err;
+    err = put_u32_be(ptr, timescale); // 4 timescale
+    chk_err;
+    err = put_u64_be(ptr, earliest_presentation_time); // 8 earliest_presentation_time
+    chk_err;
+    err = put_u64_be(ptr, first_offset); // 8 first_offset
+    chk_err;
+    err = put_u16_be(ptr, 0); // 2 reserved
+    chk_err;
+    err = put_u16_be(ptr, refs_count); // 2 reference_count
+    chk_err;
+    for (uint16_t i = 0; i < refs_count; i++) {
+        // reference_type 0 (media), starts_with_SAP 1, SAP_type 1
+        err = put_u32_be(ptr, refs[i].size & 0x7FFFFFFF);
+        chk_err;
+        err = put_u32_be(ptr, refs[i].duration);
+        chk_err;
+        err = put_u32_be(ptr, 0x90000000);
+        chk_err;
+    }
+    err = put_u32_be_to_offset(ptr, start_atom, ptr->offset - start_atom);
+    chk_err;
+    return BUF_OK;
+}
+
+enum BufError write_tfra(
+    struct BitBuf *ptr, const uint32_t track_id,
+    const struct TfraEntry *entries, const uint32_t entries_count) {
+    enum BufError err;
+    uint32_t start_atom = ptr->offset;
+    err = put_u32_be(ptr, 0);
+    chk_err;
+    err = put_str4(ptr, "tfra");
+    chk_err;
+    err = put_u8(ptr, 1); // 1 version
+    chk_err;
+    err = put_u8(ptr, 0);
+    chk_err;
+    err = put_u8(ptr, 0);
+    chk_err;
+    err = put_u8(ptr, 0); // 3 flags
+    chk_err;
+    err = put_u32_be(ptr, track_id); // 4 track_ID
+    chk_err;
+    // traf, trun and sample numbers are all stored on a single byte
+    err = put_u32_be(ptr, 0);
+    chk_err;
+    err = put_u32_be(ptr, entries_count); // 4 number_of_entry
+    chk_err;
+    for (uint32_t i = 0; i < entries_count; i++) {
+        err = put_u64_be(ptr, entries[i].time);
+        chk_err;
+        err = put_u64_be(ptr, entries[i].moof_offset);
+        chk_err;
+        err = put_u8(ptr, 1); // traf_number
+        chk_err;
+        err = put_u8(ptr, 1); // trun_number
+        chk_err;
+        err = put_u8(ptr, 1); // sample_number
+        chk_err;
+    }
+    err = put_u32_be_to_offset(ptr, start_atom, ptr->offset - start_atom);
+    chk_err;
+    return BUF_OK;
+}
+
+enum BufError write_mfra(
+    struct BitBuf *ptr, const uint32_t track_id,
+    const struct TfraEntry *entries, const uint32_t entries_count) {
+    enum BufError err;
+    uint32_t start_atom = ptr->offset;
+    err = put_u32_be(ptr, 0);
+    chk_err;
+    err = put_str4(ptr, "mfra");
+    chk_err;
+    err = write_tfra(ptr, track_id, entries, entries_count);
+    chk_err;
+    err = put_u32_be(ptr, 16);
+    chk_err;
+    err = put_str4(ptr, "mfro");
+    chk_err;
+    err = put_u32_be(ptr, 0); // 4 version + flags
+    chk_err;
+    // mfro closes the file with the size of the whole mfra box
+    err = put_u32_be(ptr, ptr->offset + 4 - start_atom);
+    chk_err;
+    err = put_u32_be_to_offset(ptr, start_atom, ptr->offset - start_atom);
+    chk_err;
+    return BUF_OK;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "bitbuf.h"
+
+// Sidx/mfra boxes let readers seek inside a finished recording without
+// walking every moof of the file.
+#define SIDX_HEADER_SIZE 40
+#define SIDX_REFERENCE_SIZE 12
+
+struct SidxReference {
+    uint32_t size;
+    uint32_t duration;
+};
+
+struct TfraEntry {
+    uint64_t time;
+    uint64_t moof_offset;
+};
+
+enum BufError write_sidx(
+    struct BitBuf *ptr, const uint32_t track_id, const uint32_t timescale,
+    const uint64_t earliest_presentation_time, const uint64_t first_offset,
+    const struct SidxReference *refs, const uint16_t refs_count);
+enum BufError write_mfra(
+    struct BitBuf *ptr, const uint32_t track_id,
+    const struct TfraEntry *entries, const uint32_t entries_count);
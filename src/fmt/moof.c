@@ -39,9 +39,8 @@ write_mdat(struct BitBuf *ptr,
     chk_err;
     err = put_str4(ptr, "mdat");
     chk_err;
-    
-    err = put_u32_be(ptr, len_vid);
-    chk_err;
+
+    // Video samples are already stored as length-prefixed NAL units
     err = put(ptr, data_vid, len_vid);
     chk_err;
     err = put(ptr, data_aud, len_aud);
@@ -64,6 +63,10 @@ enum BufError write_moof(
     err = put_str4(ptr, "moof");
     chk_err;
 
+    // Forget the previous layout, a track missing from this fragment must not be patched
+    pos_audio_media_decode_time = 0;
+    pos_video_media_decode_time = 0;
+
     err = write_mfhd(ptr, sequence_number);
     chk_err;
     struct DataOffsetPos vid_offset = {0};
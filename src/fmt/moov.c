@@ -7,7 +7,7 @@ enum BufError write_mvhd(struct BitBuf *ptr, const struct MoovInfo *moov_info);
 enum BufError write_trak(struct BitBuf *ptr, const struct MoovInfo *moov_info, char is_audio);
 enum BufError write_tkhd(struct BitBuf *ptr, const struct MoovInfo *moov_info, char is_audio);
 enum BufError write_mdia(struct BitBuf *ptr, const struct MoovInfo *moov_info, char is_audio);
-enum BufError write_mdhd(struct BitBuf *ptr, const struct MoovInfo *moov_info);
+enum BufError write_mdhd(struct BitBuf *ptr, const struct MoovInfo *moov_info, char is_audio);
 enum BufError write_minf(struct BitBuf *ptr, const struct MoovInfo *moov_info, char is_audio);
 enum BufError write_dinf(struct BitBuf *ptr);
 enum BufError write_dref(struct BitBuf *ptr);
@@ -281,7 +281,7 @@ enum BufError write_mdia(struct BitBuf *ptr, const struct MoovInfo *moov_info, c
 
     err = put_str4(ptr, "mdia");
     chk_err;
-    err = write_mdhd(ptr, moov_info);
+    err = write_mdhd(ptr, moov_info, is_audio);
     chk_err;
     if (is_audio) {
         char *str = "SoundHandler";
@@ -301,7 +301,7 @@ enum BufError write_mdia(struct BitBuf *ptr, const struct MoovInfo *moov_info, c
     return BUF_OK;
 }
 
-enum BufError write_mdhd(struct BitBuf *ptr, const struct MoovInfo *moov_info) {
+enum BufError write_mdhd(struct BitBuf *ptr, const struct MoovInfo *moov_info, char is_audio) {
     enum BufError err;
     uint32_t start_atom = ptr->offset;
     err = put_u32_be(ptr, 0);
@@ -322,7 +322,9 @@ enum BufError write_mdhd(struct BitBuf *ptr, const struct MoovInfo *moov_info) {
     chk_err; // 4 creation_time
     err = put_u32_be(ptr, 0);
     chk_err; // 4 modification_time
-    err = put_u32_be(ptr, moov_info->timescale);
+    // Audio samples are counted in their own rate so AAC frame durations stay exact
+    err = put_u32_be(ptr, is_audio && moov_info->audio_samplerate ?
+        moov_info->audio_samplerate : moov_info->timescale);
     chk_err; // 4 timescale
     err = put_u32_be(ptr, 0);
     chk_err; // 4 duration
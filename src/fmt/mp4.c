@@ -1,6 +1,21 @@
+#include <time.h>
+
 #include "mp4.h"
 #include "../hal/types.h"
 
+// Audio access units waiting for the video fragment covering their capture time
+#define MP4_AUDIO_QUEUE 64
+#define MP4_AAC_FRAME_SAMPLES 1024
+// Audio decode time is snapped back onto the capture time past this drift (samples)
+#define MP4_AUDIO_RESYNC (2 * MP4_AAC_FRAME_SAMPLES)
+// Pack timestamps further than this from CLOCK_MONOTONIC use another base
+#define MP4_TS_RESYNC_US 1000000LL
+
+struct Mp4AudioUnit {
+    uint32_t size;
+    uint64_t ts_us;
+};
+
 uint32_t default_sample_size = 40000;
 
 unsigned int aud_samplerate = 0, aud_framesize = 0;
@@ -15,6 +30,13 @@ uint16_t buf_sps_len = 0;
 char buf_vps[128];
 uint16_t buf_vps_len = 0;
 struct BitBuf buf_aud;
+struct Mp4AudioUnit aud_units[MP4_AUDIO_QUEUE];
+uint32_t aud_units_count = 0, frag_aud_duration = 0;
+// Capture time of the fragment's first audio unit relative to its video frame
+static int64_t frag_aud_offset_us = 0;
+static bool frag_aud_timed = false;
+static int64_t vid_ts_offset = 0;
+struct BitBuf buf_vid;
 struct BitBuf buf_header;
 struct BitBuf buf_mdat;
 struct BitBuf buf_moof;
@@ -53,6 +75,7 @@ enum BufError create_header(char is_h265) {
     moov_info.vps_length = buf_vps_len;
 
     buf_aud.offset = 0;
+    aud_units_count = 0;
     buf_header.offset = 0;
     enum BufError err = write_header(&buf_header, &moov_info);
     chk_err return BUF_OK;
@@ -98,50 +121,161 @@ void mp4_set_vps(const char *nal_data, const uint32_t nal_len) {
     create_header(1);
 }
 
-enum BufError mp4_set_slice(const char *nal_data, const uint32_t nal_len,
-    char is_iframe) {
+static uint64_t mp4_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+// HAL pack timestamps are CLOCK_MONOTONIC microseconds on most SDKs, those
+// running on a base of their own are mapped over so audio and video compare.
+static uint64_t mp4_video_ts(const hal_vidpack *pack) {
+    const uint64_t now = mp4_clock_us();
+
+    if (!pack->timestamp)
+        return now;
+
+    const int64_t delta = (int64_t)(now - pack->timestamp);
+    if (llabs(delta - vid_ts_offset) > MP4_TS_RESYNC_US)
+        vid_ts_offset = llabs(delta) > MP4_TS_RESYNC_US ? delta : 0;
+    return pack->timestamp + vid_ts_offset;
+}
+
+static enum BufError mp4_add_slice(const char *nal_data, const uint32_t nal_len) {
     enum BufError err;
+    err = put_u32_be(&buf_vid, nal_len);
+    chk_err;
+    err = put(&buf_vid, nal_data, nal_len);
+    chk_err;
+    return BUF_OK;
+}
 
-    struct SampleInfo samples_info[2];
+static enum BufError mp4_build_fragment(char is_iframe, uint64_t vid_us) {
+    enum BufError err;
+
+    // Interleave by capture time: this fragment takes every audio unit that
+    // started before the end of the video frame, the rest waits for the next one.
+    const uint64_t frame_us = 1000000ULL / (vid_framerate > 0 ? vid_framerate : 30);
+    const uint64_t horizon = vid_us + frame_us;
+    struct SampleInfo samples_info[1 + MP4_AUDIO_QUEUE];
+    uint32_t aud_count = 0, aud_len = 0;
     memset(samples_info, 0, sizeof(samples_info));
-    samples_info[0].size = nal_len + 4; // add size of sample
+
+    samples_info[0].size = buf_vid.offset;
     samples_info[0].duration = default_sample_size;
     samples_info[0].flags = is_iframe ? 0 : 65536;
-    samples_info[1].size = buf_aud.offset;
-    if (aud_bitrate > 0) {
-        uint64_t timescale = (uint64_t)default_sample_size * vid_framerate;
-        samples_info[1].duration = (uint32_t)((uint64_t)buf_aud.offset * 8 *
-            timescale / (aud_bitrate * 1000));
-    } else {
-        samples_info[1].duration = default_sample_size;
+    while (aud_count < aud_units_count &&
+        (!aud_units[aud_count].ts_us || aud_units[aud_count].ts_us < horizon)) {
+        samples_info[1 + aud_count].size = aud_units[aud_count].size;
+        samples_info[1 + aud_count].duration = MP4_AAC_FRAME_SAMPLES;
+        aud_len += aud_units[aud_count].size;
+        aud_count++;
     }
+    frag_aud_duration = aud_count * MP4_AAC_FRAME_SAMPLES;
+    frag_aud_timed = aud_count && aud_units[0].ts_us;
+    if (frag_aud_timed)
+        frag_aud_offset_us = (int64_t)(aud_units[0].ts_us - vid_us);
 
     buf_moof.offset = 0;
     err = write_moof(
         &buf_moof, 0, 0, 0, default_sample_size, samples_info,
-        1, samples_info + 1, 1);
+        1, samples_info + 1, aud_count);
     chk_err;
 
     buf_mdat.offset = 0;
-    err = write_mdat(&buf_mdat, nal_data, nal_len, 
-        buf_aud.buf, buf_aud.offset);
+    err = write_mdat(&buf_mdat, buf_vid.buf, buf_vid.offset,
+        buf_aud.buf, aud_len);
     chk_err;
 
-    buf_aud.offset = 0;
+    // Keep whatever is left of the queue at the start of the buffer
+    if (aud_count) {
+        memmove(aud_units, aud_units + aud_count,
+            (aud_units_count - aud_count) * sizeof(*aud_units));
+        aud_units_count -= aud_count;
+        memmove(buf_aud.buf, buf_aud.buf + aud_len, buf_aud.offset - aud_len);
+        buf_aud.offset -= aud_len;
+    }
 
     return BUF_OK;
 }
 
-enum BufError mp4_ingest_audio(const char *data, const uint32_t len) {
+bool mp4_set_pack(hal_vidpack *pack, char is_h265, char *is_iframe) {
+    unsigned char *pack_data = pack->data + pack->offset;
+    bool has_slice = false;
+
+    *is_iframe = 0;
+    buf_vid.offset = 0;
+
+    for (int j = 0; j < pack->naluCnt; j++) {
+        const char *nal_data = (const char *)pack_data + pack->nalu[j].offset + 4;
+        const uint32_t nal_len = pack->nalu[j].length - 4;
+#ifdef DEBUG_VIDEO
+        printf("NAL: %s received in packet\n", nal_type_to_str(pack->nalu[j].type));
+#endif
+        if ((pack->nalu[j].type == NalUnitType_SPS || pack->nalu[j].type == NalUnitType_SPS_HEVC)
+            && pack->nalu[j].length >= 4 && pack->nalu[j].length <= UINT16_MAX)
+            mp4_set_sps(nal_data, nal_len, is_h265);
+        else if ((pack->nalu[j].type == NalUnitType_PPS || pack->nalu[j].type == NalUnitType_PPS_HEVC)
+            && pack->nalu[j].length <= UINT16_MAX)
+            mp4_set_pps(nal_data, nal_len, is_h265);
+        else if (pack->nalu[j].type == NalUnitType_VPS_HEVC && pack->nalu[j].length <= UINT16_MAX)
+            mp4_set_vps(nal_data, nal_len);
+        else if (pack->nalu[j].type == NalUnitType_CodedSliceIdr || pack->nalu[j].type == NalUnitType_CodedSliceAux) {
+            if (mp4_add_slice(nal_data, nal_len) != BUF_OK) return false;
+            has_slice = true;
+            *is_iframe = 1;
+        } else if (pack->nalu[j].type == NalUnitType_CodedSliceNonIdr) {
+            if (mp4_add_slice(nal_data, nal_len) != BUF_OK) return false;
+            has_slice = true;
+        }
+    }
+
+    // Parameter set packs carry no sample, nothing to send for them
+    if (!has_slice) return false;
+
+    return mp4_build_fragment(*is_iframe, mp4_video_ts(pack)) == BUF_OK;
+}
+
+enum BufError mp4_ingest_audio(const char *data, const uint32_t len, uint64_t ts_us) {
     enum BufError err;
+
+    // Nobody is pulling fragments fast enough, drop the oldest unit
+    if (aud_units_count == MP4_AUDIO_QUEUE) {
+        uint32_t drop = aud_units[0].size;
+        memmove(aud_units, aud_units + 1, (aud_units_count - 1) * sizeof(*aud_units));
+        aud_units_count--;
+        memmove(buf_aud.buf, buf_aud.buf + drop, buf_aud.offset - drop);
+        buf_aud.offset -= drop;
+    }
+
     err = put(&buf_aud, data, len);
     chk_err;
+    aud_units[aud_units_count].size = len;
+    aud_units[aud_units_count].ts_us = ts_us;
+    aud_units_count++;
 
     return BUF_OK;
 }
 
+void mp4_sync_audio(struct Mp4State *state) {
+    const uint32_t timescale = mp4_get_timescale();
+
+    if (!frag_aud_timed || !aud_samplerate || !timescale)
+        return;
+
+    // Where the fragment's audio belongs on this consumer's video timeline;
+    // snapping onto it absorbs units lost to queue overflows or capture resyncs.
+    int64_t target = (int64_t)(state->base_media_decode_time * aud_samplerate / timescale);
+    target += frag_aud_offset_us * (int64_t)aud_samplerate / 1000000;
+    if (target < 0)
+        target = 0;
+    if (llabs(target - (int64_t)state->base_audio_decode_time) > MP4_AUDIO_RESYNC)
+        state->base_audio_decode_time = target;
+}
+
 enum BufError mp4_set_state(struct Mp4State *state) {
     enum BufError err;
+    mp4_sync_audio(state);
     if (pos_sequence_number > 0)
         err = put_u32_be_to_offset(
             &buf_moof, pos_sequence_number, state->sequence_number);
@@ -149,16 +283,21 @@ enum BufError mp4_set_state(struct Mp4State *state) {
         &buf_moof, pos_base_data_offset, state->base_data_offset);
     chk_err if (pos_audio_media_decode_time > 0) err = put_u64_be_to_offset(
         &buf_moof, pos_audio_media_decode_time,
-        state->base_media_decode_time);
+        state->base_audio_decode_time);
     chk_err if (pos_video_media_decode_time > 0) err = put_u64_be_to_offset(
         &buf_moof, pos_video_media_decode_time,
         state->base_media_decode_time);
     chk_err state->sequence_number++;
     state->base_data_offset += buf_moof.offset + buf_mdat.offset;
     state->base_media_decode_time += state->default_sample_duration;
+    state->base_audio_decode_time += frag_aud_duration;
     return BUF_OK;
 }
 
+uint32_t mp4_get_timescale(void) {
+    return default_sample_size * vid_framerate;
+}
+
 enum BufError mp4_get_header(struct BitBuf *ptr) {
     ptr->buf = buf_header.buf;
     ptr->size = buf_header.size;
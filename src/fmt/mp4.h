@@ -7,9 +7,11 @@
 #include <string.h>
 
 #include "bitbuf.h"
+#include "mfra.h"
 #include "moof.h"
 #include "moov.h"
 #include "nal.h"
+#include "../hal/types.h"
 
 #ifndef MIN
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -23,6 +25,8 @@ struct Mp4State {
     uint32_t sequence_number;
     uint64_t base_data_offset;
     uint64_t base_media_decode_time;
+    // Audio track runs in its own timescale (sample rate)
+    uint64_t base_audio_decode_time;
     uint32_t default_sample_duration;
 
     uint32_t nals_count;
@@ -34,12 +38,20 @@ void mp4_set_config(short width, short height, char framerate, char acodec,
 void mp4_set_sps(const char *nal_data, const uint32_t nal_len, char is_h265);
 void mp4_set_pps(const char *nal_data, const uint32_t nal_len, char is_h265);
 void mp4_set_vps(const char *nal_data, const uint32_t nal_len);
-enum BufError mp4_set_slice(const char *nal_data, const uint32_t nal_len,
-    char is_iframe);
-enum BufError mp4_ingest_audio(const char *data, const uint32_t len);
-
+// Builds the moof/mdat pair for one encoded pack, returns false when the pack
+// holds no picture (parameter sets only) or the fragment could not be written.
+bool mp4_set_pack(hal_vidpack *pack, char is_h265, char *is_iframe);
+// Queues an AAC access unit captured at ts_us (CLOCK_MONOTONIC, 0 if unknown).
+enum BufError mp4_ingest_audio(const char *data, const uint32_t len, uint64_t ts_us);
+
+// Realigns the audio decode time of a consumer on the last fragment's capture
+// times, mp4_set_state() does it too, call it first to read the final times.
+void mp4_sync_audio(struct Mp4State *state);
 enum BufError mp4_set_state(struct Mp4State *state);
 
+// Timescale of the video track, the audio one runs at the sample rate.
+uint32_t mp4_get_timescale(void);
+
 enum BufError mp4_get_header(struct BitBuf *ptr);
 enum BufError mp4_get_moof(struct BitBuf *ptr);
 enum BufError mp4_get_mdat(struct BitBuf *ptr);
\ No newline at end of file
@@ -598,6 +598,30 @@ void v1_video_request_idr(char index)
     v1_venc.fnRequestIdr(index, 1);
 }
 
+int v1_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    v1_venc_chn channel;
+
+    if (ret = v1_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case V1_VENC_RATEMODE_H264CBR: channel.rate.h264Cbr.bitrate = bitrate; break;
+        case V1_VENC_RATEMODE_H264VBR: channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        case V1_VENC_RATEMODE_H264CBRv2: channel.rate.h264Cbr.bitrate = bitrate; break;
+        case V1_VENC_RATEMODE_H264VBRv2: channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        default:
+            HAL_ERROR("v1_venc", "Bitrate cannot be changed in this rate control mode!\n");
+    }
+
+    if (ret = v1_venc.fnSetChannelConfig(index, &channel))
+        HAL_DANGER("v1_venc", "Setting the bitrate of channel %d "
+            "failed with %#x!\n", index, ret);
+
+    return ret;
+}
+
 int v1_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
@@ -52,6 +52,7 @@ int v1_video_create(char index, hal_vidconfig *config);
 int v1_video_destroy(char index);
 int v1_video_destroy_all(void);
 void v1_video_request_idr(char index);
+int v1_video_set_bitrate(char index, unsigned int bitrate);
 int v1_video_snapshot_grab(char index, hal_jpegdata *jpeg);
 void *v1_video_thread(void);
 
@@ -53,6 +53,7 @@ int v2_video_create(char index, hal_vidconfig *config);
 int v2_video_destroy(char index);
 int v2_video_destroy_all(void);
 void v2_video_request_idr(char index);
+int v2_video_set_bitrate(char index, unsigned int bitrate);
 int v2_video_snapshot_grab(char index, hal_jpegdata *jpeg);
 void *v2_video_thread(void);
 
@@ -685,6 +685,32 @@ void v3_video_request_idr(char index)
     v3_venc.fnRequestIdr(index, 1);
 }
 
+int v3_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    v3_venc_chn channel;
+
+    if (ret = v3_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case V3_VENC_RATEMODE_H264CBR: channel.rate.h264Cbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H264VBR: channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H264AVBR: channel.rate.h264Avbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H265CBR: channel.rate.h265Cbr.bitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H265VBR: channel.rate.h265Vbr.maxBitrate = bitrate; break;
+        case V3_VENC_RATEMODE_H265AVBR: channel.rate.h265Avbr.bitrate = bitrate; break;
+        default:
+            HAL_ERROR("v3_venc", "Bitrate cannot be changed in this rate control mode!\n");
+    }
+
+    if (ret = v3_venc.fnSetChannelConfig(index, &channel))
+        HAL_DANGER("v3_venc", "Setting the bitrate of channel %d "
+            "failed with %#x!\n", index, ret);
+
+    return ret;
+}
+
 int v3_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
@@ -5713,6 +5713,32 @@ void v4_video_request_idr(char index)
     v4_venc.fnRequestIdr(index, 1);
 }
 
+int v4_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    v4_venc_chn channel;
+
+    if (ret = v4_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case V4_VENC_RATEMODE_H264CBR: channel.rate.h264Cbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H264VBR: channel.rate.h264Vbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H264AVBR: channel.rate.h264Avbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H265CBR: channel.rate.h265Cbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H265VBR: channel.rate.h265Vbr.maxBitrate = bitrate; break;
+        case V4_VENC_RATEMODE_H265AVBR: channel.rate.h265Avbr.maxBitrate = bitrate; break;
+        default:
+            HAL_ERROR("v4_venc", "Bitrate cannot be changed in this rate control mode!\n");
+    }
+
+    if (ret = v4_venc.fnSetChannelConfig(index, &channel))
+        HAL_DANGER("v4_venc", "Setting the bitrate of channel %d "
+            "failed with %#x!\n", index, ret);
+
+    return ret;
+}
+
 int v4_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
@@ -642,6 +642,48 @@ void rk_video_request_idr(char index)
     rk_venc.fnRequestIdr(index, 1);
 }
 
+int rk_video_set_bitrate(char index, unsigned int bitrate)
+{
+    int ret;
+    rk_venc_chn channel;
+
+    if (ret = rk_venc.fnGetChannelConfig(index, &channel))
+        return ret;
+
+    switch (channel.rate.mode) {
+        case RK_VENC_RATEMODE_H264CBR: channel.rate.h264Cbr.bitrate = bitrate; break;
+        case RK_VENC_RATEMODE_H264VBR:
+            channel.rate.h264Vbr.bitrate = bitrate;
+            channel.rate.h264Vbr.maxBitrate = bitrate;
+            channel.rate.h264Vbr.minBitrate = MIN(channel.rate.h264Vbr.minBitrate, bitrate);
+            break;
+        case RK_VENC_RATEMODE_H264AVBR:
+            channel.rate.h264Avbr.bitrate = bitrate;
+            channel.rate.h264Avbr.maxBitrate = bitrate;
+            channel.rate.h264Avbr.minBitrate = MIN(channel.rate.h264Avbr.minBitrate, bitrate);
+            break;
+        case RK_VENC_RATEMODE_H265CBR: channel.rate.h265Cbr.bitrate = bitrate; break;
+        case RK_VENC_RATEMODE_H265VBR:
+            channel.rate.h265Vbr.bitrate = bitrate;
+            channel.rate.h265Vbr.maxBitrate = bitrate;
+            channel.rate.h265Vbr.minBitrate = MIN(channel.rate.h265Vbr.minBitrate, bitrate);
+            break;
+        case RK_VENC_RATEMODE_H265AVBR:
+            channel.rate.h265Avbr.bitrate = bitrate;
+            channel.rate.h265Avbr.maxBitrate = bitrate;
+            channel.rate.h265Avbr.minBitrate = MIN(channel.rate.h265Avbr.minBitrate, bitrate);
+            break;
+        default:
+            HAL_ERROR("rk_venc", "Bitrate cannot be changed in this rate control mode!\n");
+    }
+
+    if (ret = rk_venc.fnSetChannelConfig(index, &channel))
+        HAL_DANGER("rk_venc", "Setting the bitrate of channel %d "
+            "failed with %#x!\n", index, ret);
+
+    return ret;
+}
+
 int rk_video_snapshot_grab(char index, hal_jpegdata *jpeg)
 {
     int ret;
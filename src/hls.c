@@ -0,0 +1,506 @@
+#include "hls.h"
+#include "media.h"
+#include "server.h"
+
+#define HLS_MAX_SEGMENTS 16
+#define HLS_MAX_PARTS 64
+#define HLS_MAX_WORKERS 16
+// Segmenter goes back to sleep when no playlist/segment was requested for this long.
+#define HLS_IDLE_TIMEOUT 30
+// How long hls_stop() waits for the request threads to finish.
+#define HLS_STOP_WAIT 5
+// Number of trailing segments whose parts are advertised in the playlist.
+#define HLS_PART_SEGMENTS 3
+#define HLS_PLAYLIST_SIZE (16 * 1024)
+
+struct HlsBlob {
+    int refs;
+    uint32_t len;
+    char data[];
+};
+
+struct HlsPart {
+    struct HlsBlob *blob;
+    uint32_t duration;
+    bool independent;
+};
+
+struct HlsSegment {
+    int msn;
+    bool complete;
+    uint32_t duration;
+    int part_count;
+    struct HlsPart parts[HLS_MAX_PARTS];
+};
+
+volatile char hlsOn = 0;
+
+static pthread_mutex_t hlsMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hlsCond = PTHREAD_COND_INITIALIZER;
+static struct HlsSegment hlsSegs[HLS_MAX_SEGMENTS];
+static struct HlsBlob *hlsInit;
+static struct Mp4State hlsState;
+static struct BitBuf hlsScratch;
+static uint32_t hlsScratchDur;
+static bool hlsScratchIndep;
+// Media sequence number of the segment being assembled, -1 while waiting for an IDR.
+static int hlsCurMsn = -1, hlsFirstMsn = 0, hlsNextMsn = 0;
+static uint32_t hlsTimescale = 1;
+// CLOCK_MONOTONIC seconds of the last request, wall clock steps don't pause us.
+static time_t hlsLastAccess = 0;
+static int hlsWorkers = 0;
+static bool hlsStopping = false;
+
+static time_t hls_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static inline int hls_window(void) {
+    int n = app_config.hls_segments;
+    if (n < 2) n = 2;
+    if (n > HLS_MAX_SEGMENTS - 1) n = HLS_MAX_SEGMENTS - 1;
+    return n;
+}
+
+static inline struct HlsSegment *hls_seg(int msn) {
+    return &hlsSegs[msn % HLS_MAX_SEGMENTS];
+}
+
+static struct HlsBlob *hls_blob_new(const char *data, uint32_t len) {
+    struct HlsBlob *blob = malloc(sizeof(*blob) + len);
+    if (!blob) return NULL;
+    blob->refs = 1;
+    blob->len = len;
+    memcpy(blob->data, data, len);
+    return blob;
+}
+
+// Must be called with hlsMtx held.
+static void hls_blob_unref(struct HlsBlob *blob) {
+    if (blob && --blob->refs <= 0)
+        free(blob);
+}
+
+static void hls_segment_clear(struct HlsSegment *seg) {
+    for (int i = 0; i < seg->part_count; i++)
+        hls_blob_unref(seg->parts[i].blob);
+    memset(seg, 0, sizeof(*seg));
+    seg->msn = -1;
+}
+
+static void hls_reset_locked(void) {
+    for (int i = 0; i < HLS_MAX_SEGMENTS; i++)
+        hls_segment_clear(&hlsSegs[i]);
+    hls_blob_unref(hlsInit);
+    hlsInit = NULL;
+    hlsScratch.offset = 0;
+    hlsScratchDur = 0;
+    hlsScratchIndep = false;
+    hlsCurMsn = -1;
+    hlsFirstMsn = hlsNextMsn = 0;
+    hlsState.header_sent = false;
+}
+
+static enum BufError hls_scratch_put(struct BitBuf *src) {
+    if (hlsScratch.offset + src->offset > hlsScratch.size) {
+        uint32_t size = hlsScratch.size ? hlsScratch.size : 64 * 1024;
+        while (size < hlsScratch.offset + src->offset)
+            size *= 2;
+        char *buf = realloc(hlsScratch.buf, size);
+        if (!buf) return BUF_MALLOC_ERROR;
+        hlsScratch.buf = buf;
+        hlsScratch.size = size;
+    }
+    return put(&hlsScratch, src->buf, src->offset);
+}
+
+static void hls_close_part_locked(bool last) {
+    if (hlsCurMsn < 0 || !hlsScratch.offset) return;
+
+    struct HlsSegment *seg = hls_seg(hlsCurMsn);
+    // Out of part slots: the remainder of this GOP becomes one longer part.
+    if (!last && seg->part_count >= HLS_MAX_PARTS - 1) return;
+
+    struct HlsBlob *blob = hls_blob_new(hlsScratch.buf, hlsScratch.offset);
+    if (!blob) {
+        HAL_DANGER("hls", "Failed to allocate a %u bytes part!\n", hlsScratch.offset);
+        return;
+    }
+    struct HlsPart *part = &seg->parts[seg->part_count++];
+    part->blob = blob;
+    part->duration = hlsScratchDur;
+    part->independent = hlsScratchIndep;
+    seg->duration += hlsScratchDur;
+
+    hlsScratch.offset = 0;
+    hlsScratchDur = 0;
+    hlsScratchIndep = false;
+    pthread_cond_broadcast(&hlsCond);
+}
+
+static void hls_close_segment_locked(void) {
+    if (hlsCurMsn < 0) return;
+    hls_close_part_locked(true);
+    hls_seg(hlsCurMsn)->complete = true;
+    hlsCurMsn = -1;
+    pthread_cond_broadcast(&hlsCond);
+}
+
+static void hls_open_segment_locked(void) {
+    int msn = hlsNextMsn++;
+    int window = hls_window();
+    while (hlsFirstMsn <= msn - window) {
+        struct HlsSegment *old = hls_seg(hlsFirstMsn);
+        if (old->msn == hlsFirstMsn)
+            hls_segment_clear(old);
+        hlsFirstMsn++;
+    }
+    struct HlsSegment *seg = hls_seg(msn);
+    hls_segment_clear(seg);
+    seg->msn = msn;
+    hlsCurMsn = msn;
+}
+
+static void hls_push_fragment_locked(char is_iframe) {
+    enum BufError err;
+    const uint32_t part_target = hlsTimescale * app_config.hls_part_ms / 1000;
+    const uint32_t seg_target = hlsTimescale * app_config.hls_segment_ms / 1000;
+    const uint32_t frag_dur = hlsState.default_sample_duration;
+
+    if (is_iframe) {
+        // Segments always start on an IDR; cut once the target duration is reached.
+        if (hlsCurMsn >= 0 && hls_seg(hlsCurMsn)->duration + hlsScratchDur >= seg_target)
+            hls_close_segment_locked();
+        if (hlsCurMsn < 0)
+            hls_open_segment_locked();
+    } else if (hlsCurMsn < 0)
+        return;
+
+    if (hlsScratch.offset && hlsScratchDur + frag_dur > part_target)
+        hls_close_part_locked(false);
+
+    err = mp4_set_state(&hlsState);
+    if (err != BUF_OK) return;
+
+    if (!hlsScratch.offset)
+        hlsScratchIndep = is_iframe;
+
+    struct BitBuf moof_buf, mdat_buf;
+    mp4_get_moof(&moof_buf);
+    mp4_get_mdat(&mdat_buf);
+    if (hls_scratch_put(&moof_buf) != BUF_OK || hls_scratch_put(&mdat_buf) != BUF_OK) {
+        HAL_DANGER("hls", "Failed to buffer a fragment, restarting the segment...\n");
+        hlsScratch.offset = 0;
+        hlsScratchDur = 0;
+        hls_close_segment_locked();
+        return;
+    }
+    hlsScratchDur += frag_dur;
+}
+
+void send_mp4_to_hls(char is_iframe) {
+    if (!hlsOn) return;
+
+    pthread_mutex_lock(&hlsMtx);
+    if (hls_now() - hlsLastAccess > HLS_IDLE_TIMEOUT) {
+        HAL_INFO("hls", "No viewers left, pausing the segmenter...\n");
+        hls_reset_locked();
+        hlsOn = 0;
+        // Blocked playlist reloads return right away instead of timing out.
+        pthread_cond_broadcast(&hlsCond);
+        pthread_mutex_unlock(&hlsMtx);
+        return;
+    }
+
+    if (!hlsState.header_sent) {
+        struct BitBuf header_buf;
+        mp4_get_header(&header_buf);
+        if (!header_buf.offset || !(hlsInit = hls_blob_new(header_buf.buf, header_buf.offset))) {
+            pthread_mutex_unlock(&hlsMtx);
+            return;
+        }
+
+        hlsState.sequence_number = 0;
+        hlsState.base_data_offset = 0;
+        hlsState.base_media_decode_time = 0;
+        hlsState.base_audio_decode_time = 0;
+        hlsState.header_sent = true;
+        hlsState.nals_count = 0;
+        hlsState.default_sample_duration = default_sample_size;
+        // Same timescale as the moov box, durations are in its units.
+        hlsTimescale = mp4_get_timescale();
+        if (!hlsTimescale) hlsTimescale = 1;
+    }
+
+    hls_push_fragment_locked(is_iframe);
+    pthread_mutex_unlock(&hlsMtx);
+}
+
+void hls_stop(void) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += HLS_STOP_WAIT;
+
+    pthread_mutex_lock(&hlsMtx);
+    hlsOn = 0;
+    hlsStopping = true;
+    // Wake the blocked requests and let every worker drop its blob references.
+    pthread_cond_broadcast(&hlsCond);
+    while (hlsWorkers > 0)
+        if (pthread_cond_timedwait(&hlsCond, &hlsMtx, &deadline) == ETIMEDOUT) {
+            HAL_WARNING("hls", "%d request(s) still sending, their parts stay referenced\n",
+                hlsWorkers);
+            break;
+        }
+    hls_reset_locked();
+    free(hlsScratch.buf);
+    memset(&hlsScratch, 0, sizeof(hlsScratch));
+    pthread_cond_broadcast(&hlsCond);
+    pthread_mutex_unlock(&hlsMtx);
+}
+
+// Returns true once the playlist covers segment msn (and its part, if >= 0).
+static bool hls_has_locked(int msn, int part) {
+    if (msn < hlsFirstMsn || msn >= hlsNextMsn) return false;
+    struct HlsSegment *seg = hls_seg(msn);
+    if (seg->msn != msn) return false;
+    if (part < 0) return seg->complete;
+    return seg->part_count > part;
+}
+
+static bool hls_wait_locked(int msn, int part) {
+    // Blocking requests give up after three target durations.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 3 * ((app_config.hls_segment_ms + 999) / 1000) + 1;
+
+    while (hlsOn && !hls_has_locked(msn, part))
+        if (pthread_cond_timedwait(&hlsCond, &hlsMtx, &deadline) == ETIMEDOUT)
+            break;
+    return hls_has_locked(msn, part);
+}
+
+static int hls_build_playlist_locked(char *buf, size_t size) {
+    double ts = (double)hlsTimescale;
+    double part_target = app_config.hls_part_ms / 1000.0;
+    uint32_t max_dur = app_config.hls_segment_ms * hlsTimescale / 1000;
+    int len = 0;
+
+    for (int msn = hlsFirstMsn; msn < hlsNextMsn; msn++)
+        if (hls_seg(msn)->msn == msn && hls_seg(msn)->duration > max_dur)
+            max_dur = hls_seg(msn)->duration;
+
+#define HLS_APPEND(...) \
+    do { \
+        int n = snprintf(buf + len, size - len, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= size - len) return -1; \
+        len += n; \
+    } while (0)
+
+    HLS_APPEND(
+        "#EXTM3U\n"
+        "#EXT-X-VERSION:9\n"
+        "#EXT-X-TARGETDURATION:%u\n"
+        "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n"
+        "#EXT-X-PART-INF:PART-TARGET=%.3f\n"
+        "#EXT-X-MEDIA-SEQUENCE:%d\n"
+        "#EXT-X-INDEPENDENT-SEGMENTS\n"
+        "#EXT-X-MAP:URI=\"init.mp4\"\n",
+        (unsigned int)((max_dur + hlsTimescale / 2) / hlsTimescale),
+        part_target * 3, part_target, hlsFirstMsn);
+
+    for (int msn = hlsFirstMsn; msn < hlsNextMsn; msn++) {
+        struct HlsSegment *seg = hls_seg(msn);
+        if (seg->msn != msn) continue;
+        if (msn >= hlsNextMsn - HLS_PART_SEGMENTS)
+            for (int p = 0; p < seg->part_count; p++)
+                HLS_APPEND("#EXT-X-PART:DURATION=%.5f,URI=\"part%d.%d.m4s\"%s\n",
+                    seg->parts[p].duration / ts, msn, p,
+                    seg->parts[p].independent ? ",INDEPENDENT=YES" : "");
+        if (seg->complete)
+            HLS_APPEND("#EXTINF:%.5f,\nseg%d.m4s\n", seg->duration / ts, msn);
+    }
+
+    if (hlsCurMsn >= 0)
+        HLS_APPEND("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part%d.%d.m4s\"\n",
+            hlsCurMsn, hls_seg(hlsCurMsn)->part_count);
+    else
+        HLS_APPEND("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part%d.0.m4s\"\n", hlsNextMsn);
+
+#undef HLS_APPEND
+    return len;
+}
+
+static void hls_send_blobs(int fd, const char *mime, struct HlsBlob **blobs, int count) {
+    char header[256];
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += blobs[i]->len;
+
+    int len = sprintf(header,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %zu\r\n"
+        "Cache-Control: max-age=60\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n\r\n", mime, total);
+    if (!send_to_fd(fd, header, len))
+        for (int i = 0; i < count; i++)
+            if (send_to_fd(fd, blobs[i]->data, blobs[i]->len) < 0)
+                break;
+    close_socket_fd(fd);
+
+    pthread_mutex_lock(&hlsMtx);
+    for (int i = 0; i < count; i++)
+        hls_blob_unref(blobs[i]);
+    pthread_mutex_unlock(&hlsMtx);
+}
+
+struct hlstask {
+    int client_fd;
+    char uri[64];
+    int msn, part;
+};
+
+static void *hls_request_thread(void *vargp) {
+    struct hlstask task = *((struct hlstask *)vargp);
+    const char *name = task.uri + strlen("/hls/");
+    struct HlsBlob *blobs[HLS_MAX_PARTS];
+    char *playlist = NULL;
+    int count = 0, code = 404, len = 0, msn, part;
+    free(vargp);
+
+    pthread_mutex_lock(&hlsMtx);
+    hlsLastAccess = hls_now();
+    if (!hlsOn && !hlsStopping) {
+        HAL_INFO("hls", "Starting the segmenter...\n");
+        hls_reset_locked();
+        hlsOn = 1;
+        request_idr();
+    }
+
+    if (EQUALS(name, "live.m3u8")) {
+        // Blocking playlist reload: hold the request until the asked part shows up,
+        // a plain reload only waits for the very first part after a cold start.
+        if (task.msn > hlsNextMsn + 1)
+            code = 400;
+        else if (!(task.msn >= 0 ? hls_wait_locked(task.msn, task.part) :
+            hls_wait_locked(hlsFirstMsn, 0)))
+            code = 503;
+        else if (!(playlist = malloc(HLS_PLAYLIST_SIZE)) ||
+            (len = hls_build_playlist_locked(playlist, HLS_PLAYLIST_SIZE)) < 0)
+            code = 500;
+    } else if (EQUALS(name, "init.mp4")) {
+        if (hls_wait_locked(hlsFirstMsn, 0) && hlsInit) {
+            blobs[count++] = hlsInit;
+            hlsInit->refs++;
+        }
+    } else if (sscanf(name, "part%d.%d.m4s", &msn, &part) == 2) {
+        // Preload hints point at the next part, wait for it like a blocking reload.
+        if (part >= 0 && msn >= hlsFirstMsn && msn <= hlsNextMsn &&
+            hls_wait_locked(msn, part)) {
+            blobs[count] = hls_seg(msn)->parts[part].blob;
+            blobs[count++]->refs++;
+        }
+    } else if (sscanf(name, "seg%d.m4s", &msn) == 1) {
+        if (hls_has_locked(msn, -1)) {
+            struct HlsSegment *seg = hls_seg(msn);
+            for (int p = 0; p < seg->part_count; p++) {
+                blobs[count] = seg->parts[p].blob;
+                blobs[count++]->refs++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&hlsMtx);
+
+    if (len > 0) {
+        char header[256];
+        int hlen = sprintf(header,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/vnd.apple.mpegurl\r\n"
+            "Content-Length: %d\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n\r\n", len);
+        if (!send_to_fd(task.client_fd, header, hlen))
+            send_to_fd(task.client_fd, playlist, len);
+        close_socket_fd(task.client_fd);
+    } else if (count)
+        hls_send_blobs(task.client_fd,
+            EQUALS(name, "init.mp4") ? "video/mp4" : "video/iso.segment", blobs, count);
+    else
+        send_http_error(task.client_fd, code);
+    free(playlist);
+
+    pthread_mutex_lock(&hlsMtx);
+    if (!--hlsWorkers && hlsStopping)
+        pthread_cond_broadcast(&hlsCond);
+    pthread_mutex_unlock(&hlsMtx);
+    return NULL;
+}
+
+void hls_handle_request(int client_fd, const char *uri, char *query) {
+    struct hlstask *task = calloc(1, sizeof(*task));
+    if (!task) {
+        send_http_error(client_fd, 500);
+        return;
+    }
+    task->client_fd = client_fd;
+    task->msn = task->part = -1;
+    strncpy(task->uri, uri, sizeof(task->uri) - 1);
+
+    if (!EMPTY(query)) {
+        char *remain;
+        while (query) {
+            char *value = split(&query, "&");
+            if (!value || !*value) continue;
+            char *key = split(&value, "=");
+            if (!key || !*key || !value || !*value) continue;
+            if (EQUALS(key, "_HLS_msn")) {
+                int result = strtol(value, &remain, 10);
+                if (remain != value && result >= 0)
+                    task->msn = result;
+            } else if (EQUALS(key, "_HLS_part")) {
+                int result = strtol(value, &remain, 10);
+                if (remain != value && result >= 0)
+                    task->part = result;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&hlsMtx);
+    if (hlsStopping) {
+        pthread_mutex_unlock(&hlsMtx);
+        send_http_error(client_fd, 503);
+        free(task);
+        return;
+    }
+    if (hlsWorkers >= HLS_MAX_WORKERS) {
+        pthread_mutex_unlock(&hlsMtx);
+        HAL_WARNING("hls", "Too many pending requests, rejecting...\n");
+        send_http_error(client_fd, 503);
+        free(task);
+        return;
+    }
+    hlsWorkers++;
+    pthread_mutex_unlock(&hlsMtx);
+
+    pthread_t thread_id;
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    size_t new_stacksize = 32 * 1024;
+    if (pthread_attr_setstacksize(&thread_attr, new_stacksize))
+        HAL_DANGER("hls", "Can't set stack size %zu\n", new_stacksize);
+    if (pthread_create(&thread_id, &thread_attr, hls_request_thread, task)) {
+        HAL_DANGER("hls", "Starting a request thread failed!\n");
+        send_http_error(client_fd, 500);
+        free(task);
+        pthread_mutex_lock(&hlsMtx);
+        hlsWorkers--;
+        pthread_mutex_unlock(&hlsMtx);
+    }
+    pthread_attr_destroy(&thread_attr);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "app_config.h"
+#include "fmt/mp4.h"
+#include "hal/macros.h"
+#include "hal/types.h"
+
+// Low-latency HLS (CMAF) output.
+// The segmenter keeps a RAM ring of IDR-aligned fMP4 segments split into
+// partial segments, and serves them together with the playlist straight from
+// memory. It only runs while somebody polled /hls/ in the last few seconds.
+extern volatile char hlsOn;
+
+void hls_stop(void);
+// Appends the fragment last built by mp4_set_pack() to the segment ring.
+void send_mp4_to_hls(char is_iframe);
+
+// Handles any /hls/ request on its own worker thread (blocking playlist
+// reloads and preload hints can wait for the encoder without stalling the
+// HTTP server). Takes ownership of client_fd.
+void hls_handle_request(int client_fd, const char *uri, char *query);
@@ -197,6 +197,11 @@ int main(int argc, char *argv[]) {
     if (app_config.stream_enable)
         start_streaming();
 
+    // Segments are repaired while the SDK comes up.
+    g_phase = "record_init";
+    if (app_config.record_enable)
+        record_init();
+
     g_phase = "start_sdk";
     HAL_INFO("main", "Starting SDK...\n");
     if (start_sdk())
@@ -237,8 +242,8 @@ int main(int argc, char *argv[]) {
         sleep(1);
     }
 
-    if (app_config.record_enable && app_config.record_continuous)
-        record_stop();
+    if (app_config.record_enable)
+        record_finish();
 
     if (app_config.rtsp_enable) {
         smolrtsp_server_stop();
@@ -253,6 +258,9 @@ int main(int argc, char *argv[]) {
 
     stop_sdk();
 
+    if (app_config.hls_enable)
+        hls_stop();
+
     if (app_config.stream_enable)
         stop_streaming();
 
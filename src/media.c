@@ -319,6 +319,12 @@ unsigned int aacPcmPos = 0;
 unsigned int aacChannels = 1;
 static PcmRing aacPcmStash;  // stash of incoming PCM (16-bit LE samples)
 
+// Capture clock of AAC access units (CLOCK_MONOTONIC, us). It advances by exactly
+// one frame per encoded block and only resyncs to the arrival time of the PCM when
+// both drift apart (capture gaps, mute flushes).
+#define AAC_TS_RESYNC_US 50000
+static uint64_t aacTsBase = 0, aacTsSamples = 0, aacTsPrev = 0;
+
 #if defined(DIVINUS_WITH_SPEEXDSP)
 // SpeexDSP preprocess state for AAC PCM path (optional).
 static struct {
@@ -629,14 +635,15 @@ static void *aenc_thread_aac(void) {
         }
         pthread_mutex_unlock(&aencMtx);
 
-        if (app_config.mp4_enable && (server_mp4_clients > 0 || recordOn)) {
+        if (app_config.mp4_enable && (server_mp4_clients > 0 || record_wanted() || hlsOn)) {
         pthread_mutex_lock(&mp4Mtx);
-        mp4_ingest_audio((char *)aac_send_buf, frame_len);
+        mp4_ingest_audio((char *)aac_send_buf, frame_len, ts_us);
         pthread_mutex_unlock(&mp4Mtx);
         }
 
+        // RTSP keeps its own sample-counting RTP clock for audio.
         if (app_config.rtsp_enable)
-            smolrtsp_push_aac(aac_send_buf, frame_len, ts_us);
+            smolrtsp_push_aac(aac_send_buf, frame_len, 0);
     }
     HAL_INFO("media", "Shutting down AAC encoding thread...\n");
     return NULL;
@@ -667,6 +674,23 @@ int save_audio_stream(hal_audframe *frame) {
         return save_audio_stream_aac(frame);
 }
 
+static uint64_t aac_capture_ts(uint64_t arrival_us, uint32_t queued_samples) {
+    const uint64_t srate = app_config.audio_srate ? app_config.audio_srate : 48000;
+    const uint64_t measured = arrival_us - queued_samples * 1000000ULL / srate;
+    uint64_t expected = aacTsBase + aacTsSamples * 1000000ULL / srate;
+
+    if (!aacTsBase || llabs((long long)(expected - measured)) > AAC_TS_RESYNC_US) {
+        aacTsBase = expected = measured;
+        aacTsSamples = 0;
+    }
+    aacTsSamples += aacInputSamples;
+
+    // FAAC hands out each frame one encode call late
+    uint64_t ts = aacTsPrev;
+    aacTsPrev = expected;
+    return ts;
+}
+
 static int save_audio_stream_aac(hal_audframe *frame) {
     if (!aacEnc || !aacPcm || !aacOut) {
         HAL_ERROR("media", "AAC path not initialized (enc=%p pcm=%p out=%p)\n",
@@ -693,6 +717,10 @@ static int save_audio_stream_aac(hal_audframe *frame) {
         }
     last_ts = frame->timestamp;
 
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint64_t arrival_us = (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+
     // Append to stash (16-bit LE samples, interleaved).
     unsigned int total_samples = samples_per_ch * channels;
     pthread_mutex_lock(&g_aac_pcm_mtx);
@@ -705,6 +733,13 @@ static int save_audio_stream_aac(hal_audframe *frame) {
     // Consume stash in blocks of aacInputSamples * channels (16-bit LE).
     const uint32_t need_samples = (uint32_t)aacInputSamples * channels;
     while (aacPcmStash.buf && aacPcmStash.len >= need_samples) {
+        // Everything still queued after this block's first sample arrived later than it.
+        uint32_t queued = aacPcmStash.len / channels;
+#if defined(DIVINUS_WITH_SPEEXDSP)
+        if (speex_aac.active)
+            queued += speex_aac.in.len;
+#endif
+        const uint64_t ts_us = aac_capture_ts(arrival_us, queued);
         if (!pcm_ring_read(&aacPcmStash, aacPcm, need_samples))
             break;
         pthread_mutex_unlock(&g_aac_pcm_mtx);
@@ -732,10 +767,6 @@ static int save_audio_stream_aac(hal_audframe *frame) {
         if (bytes > UINT16_MAX)
             bytes = UINT16_MAX;
 
-        // RTP timestamp from stash base
-        // Let RTSP layer derive timestamps from monotonic clock to avoid drift.
-        uint64_t ts_us = 0;
-
         pthread_mutex_lock(&aencMtx);
         if (!aacBuf.buf || aacBuf.size != AUDIO_ENC_BUF_MAX)
             (void)audio_ring_init(&aacBuf, AUDIO_ENC_BUF_MAX);
@@ -777,14 +808,22 @@ int save_video_stream(char index, hal_vidstream *stream) {
 
             const int have_h26x_clients = (server_h26x_clients > 0);
             const int have_mp4_clients = (server_mp4_clients > 0);
-            const int do_mp4 = (app_config.mp4_enable && (have_mp4_clients || recordOn));
+            const int do_mp4 = (app_config.mp4_enable && (have_mp4_clients || record_wanted() || hlsOn));
 
             if (do_mp4) {
                 pthread_mutex_lock(&mp4Mtx);
-                if (have_mp4_clients)
-                send_mp4_to_client(index, stream, isH265);
-                if (recordOn)
-                    send_mp4_to_record(stream, isH265);
+                // Mux each pack once, every consumer then only patches its own state.
+                for (unsigned int i = 0; i < stream->count; i++) {
+                    char isIframe;
+                    if (!mp4_set_pack(&stream->pack[i], isH265, &isIframe))
+                        continue;
+                    if (have_mp4_clients)
+                        send_mp4_to_client(index);
+                    if (record_wanted())
+                        send_mp4_to_record(isIframe);
+                    if (hlsOn)
+                        send_mp4_to_hls(isIframe);
+                }
                 pthread_mutex_unlock(&mp4Mtx);
                 
                 if (have_h26x_clients)
@@ -802,10 +841,7 @@ int save_video_stream(char index, hal_vidstream *stream) {
                         stream->pack[i].timestamp);
 
             if (app_config.stream_enable && udp_stream_has_clients())
-                for (int i = 0; i < stream->count; i++)
-                    udp_stream_send_nal(stream->pack[i].data + stream->pack[i].offset, 
-                        stream->pack[i].length - stream->pack[i].offset, 
-                        stream->pack[i].nalu[0].type == NalUnitType_CodedSliceIdr, isH265);
+                udp_stream_send_frame(stream, isH265);
             
             break;
         }
@@ -872,7 +908,7 @@ int start_streaming(void) {
 
     for (int i = 0; app_config.stream_dests[i] && *app_config.stream_dests[i]; i++) {
         if (STARTS_WITH(app_config.stream_dests[i], "udp://")) {
-            char *endptr, *hostptr, *portptr, dst[16];
+            char *endptr, *hostptr, *portptr, *optptr, dst[16];
             unsigned short port = 0;
             long val;
 
@@ -897,6 +933,13 @@ int start_streaming(void) {
                 strncpy(dst, hostptr, sizeof(dst) - 1);
                 dst[sizeof(dst) - 1] = '\0';
             }
+            if (optptr = strchr(dst, '?'))
+                *optptr = '\0';
+
+            // ?fec=L (row parity every L packets) or ?fec=LxD (SMPTE 2022-1 matrix)
+            unsigned int fec_cols = 0, fec_rows = 0;
+            if (optptr = strstr(app_config.stream_dests[i], "fec="))
+                sscanf(optptr + 4, "%ux%u", &fec_cols, &fec_rows);
 
             if (!udpOn) {
                 val = strtol(hostptr, &endptr, 10);
@@ -911,7 +954,7 @@ int start_streaming(void) {
                 }
             }
             
-            if (udp_stream_add_client(dst, port) != -1)
+            if (udp_stream_add_client(dst, port, MIN(fec_cols, 255), MIN(fec_rows, 255)) != -1)
                 HAL_INFO("media", "Starting streaming to %s...\n", app_config.stream_dests[i]);
         }
     }
@@ -956,6 +999,36 @@ void request_idr(void) {
     pthread_mutex_unlock(&chnMtx);
 }
 
+int media_set_video_bitrate(unsigned int kbps) {
+    int ret = EXIT_FAILURE;
+    signed char index = -1;
+    pthread_mutex_lock(&chnMtx);
+    for (int i = 0; i < chnCount; i++) {
+        if (!chnState[i].enable) continue;
+        if (chnState[i].payload != HAL_VIDCODEC_H264 &&
+            chnState[i].payload != HAL_VIDCODEC_H265) continue;
+        index = i;
+        break;
+    }
+    // Builds without any of these platforms leave kbps unused
+    (void)kbps;
+    if (index != -1) switch (plat) {
+#if defined(__ARM_PCS_VFP)
+        case HAL_PLATFORM_RK:  ret = rk_video_set_bitrate(index, kbps); break;
+#elif defined(__arm__) && !defined(__ARM_PCS_VFP)
+        case HAL_PLATFORM_V1:  ret = v1_video_set_bitrate(index, kbps); break;
+        case HAL_PLATFORM_V2:  ret = v2_video_set_bitrate(index, kbps); break;
+        case HAL_PLATFORM_V3:  ret = v3_video_set_bitrate(index, kbps); break;
+        case HAL_PLATFORM_V4:  ret = v4_video_set_bitrate(index, kbps); break;
+#elif defined(__riscv) || defined(__riscv__)
+        case HAL_PLATFORM_CVI: ret = cvi_video_set_bitrate(index, kbps); break;
+#endif
+        default: ret = EXIT_FAILURE; break;
+    }
+    pthread_mutex_unlock(&chnMtx);
+    return ret;
+}
+
 void set_grayscale(bool active) {
     pthread_mutex_lock(&chnMtx);
     switch (plat) {
@@ -26,6 +26,9 @@ int start_streaming(void);
 void stop_streaming(void);
 
 void request_idr(void);
+// Changes the target bitrate (kbps) of the H.26x stream at runtime without
+// touching the configuration. Fails on platforms or modes that lack it.
+int media_set_video_bitrate(unsigned int kbps);
 void set_grayscale(bool active);
 // Best-effort runtime orientation update. Returns 0 on success, non-zero otherwise.
 int media_set_isp_orientation(bool mirror, bool flip);
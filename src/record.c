@@ -1,148 +1,1503 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "record.h"
 
-static FILE *recordFile;
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "media.h"
+#include "server.h"
+
+// Data reaches the card in blocks of this size, always at aligned offsets.
+#define RECORD_WRITE_BLOCK (128 * 1024)
+#define RECORD_WRITE_ALIGN 4096
+// A partially filled block is written out after sitting idle for this long.
+#define RECORD_FLUSH_MS 1000
+// Room kept after the init segment for the sidx written when the file is
+// closed, enough for 338 references (GOPs are merged pairwise beyond that).
+#define RECORD_SIDX_SPACE 4096
+#define RECORD_MAX_PLAYBACKS 4
+// Retention is checked after every closed segment and at least this often.
+#define RECORD_RETENTION_PERIOD 60
+// Longest file name generated from the filename setting or time format,
+// the full path has room for it after the recording directory.
+#define RECORD_NAME_MAX 160
+
+enum RecordChunkType {
+    RECORD_CHUNK_DATA,
+    RECORD_CHUNK_HEADER,
+    RECORD_CHUNK_OPEN,
+    RECORD_CHUNK_CLOSE
+};
+
+struct RecordKey {
+    uint64_t time;
+    uint64_t offset;
+    long long ms;
+};
+
+struct RecordChunk {
+    struct RecordChunk *next;
+    // Next fragment in the pre-roll ring, which shares chunks with the queue.
+    struct RecordChunk *ring_next;
+    int refs;
+    char type;
+    char is_iframe;
+    // Set once the chunk was queued for a file, later files never replay it.
+    char filed;
+    uint32_t len;
+    // Where the moof fields the writer rewrites per file sit, 0 if absent.
+    uint32_t moof_len, pos_seq, pos_vtime, pos_atime;
+    // Decode times on the recorder's own continuous timeline, the writer
+    // rebases them on those of the RECORD_CHUNK_OPEN starting the file.
+    uint64_t vtime, atime;
+    uint32_t vdur;
+    // Video timescale of the file started by a RECORD_CHUNK_OPEN.
+    uint32_t timescale;
+    long long ts_ms;
+    // Fragment bytes, or the destination path for RECORD_CHUNK_OPEN.
+    char data[];
+};
+
+#define RECORD_MAX_MOOF 4096
+
+static pthread_mutex_t recordMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t recordCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t recordSpaceCond = PTHREAD_COND_INITIALIZER;
+static pthread_t recordThread;
+static bool recordThreadUp = false, recordThreadExit = false;
+static struct RecordChunk *recordHead, *recordTail;
+static size_t recordQueued;
+
+// Producer side, guarded by recordMtx.
 static struct Mp4State recordState;
-static int recordSize;
+static bool recordOpenPending, recordFileOpen, recordSkipping;
+static long long recordSize;
+static unsigned int recordDropped, recordDroppedTotal;
+static struct RecordChunk *recordRingHead, *recordRingTail;
+static size_t recordRingSize;
+
+// Writer side, only touched by the writer thread.
+static int recordFd = -1;
+static char *recordBuf;
+static size_t recordBufLen;
+static off_t recordOffset, recordAdvised;
+static struct timespec recordBufSince;
+static uint32_t recordFileSeq;
+static uint64_t recordFileVBase, recordFileABase;
+// Index of the file being written: wallclock start, keyframes and the like.
+static char recordFilePath[256];
+static long long recordFileWallMs, recordFileMonoMs, recordFileEndMs;
+static uint32_t recordFileTimescale, recordFileHeaderLen;
+static uint64_t recordFileVEnd;
+static struct RecordKey *recordKeys;
+static unsigned int recordKeyCount, recordKeyCap;
+
+static off_t recordFilePrealloc;
+static bool recordFileSidxSpace;
+static long long recordLastSync;
+
+static int recordPlaybacks = 0;
+
+static pthread_cond_t recordRetentionCond = PTHREAD_COND_INITIALIZER;
+static pthread_t recordRetentionThread;
+static bool recordRetentionUp = false;
+static void record_retention_start_locked(void);
+
+// Set while the startup repair borrows the writer's file state.
+static pthread_t recordRepairThread;
+static bool recordRepairUp = false, recordRepairing = false;
+static void record_repair(void);
+
 time_t recordStartTime = 0;
-char recordOn = 0, recordPath[256];
+char recordOn = 0, recordPath[sizeof(app_config.record_path) + RECORD_NAME_MAX];
+
+static struct RecordChunk *record_chunk_new(char type, const char *data, uint32_t len) {
+    struct RecordChunk *chunk = malloc(sizeof(*chunk) + len);
+    if (!chunk) return NULL;
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->refs = 1;
+    chunk->type = type;
+    chunk->len = len;
+    if (data) memcpy(chunk->data, data, len);
+    return chunk;
+}
+
+// Must be called with recordMtx held.
+static void record_chunk_unref(struct RecordChunk *chunk) {
+    if (chunk && --chunk->refs <= 0)
+        free(chunk);
+}
+
+// Must be called with recordMtx held.
+static void record_enqueue_locked(struct RecordChunk *chunk) {
+    if (recordTail) recordTail->next = chunk;
+    else recordHead = chunk;
+    recordTail = chunk;
+    recordQueued += chunk->len;
+    chunk->filed = 1;
+    pthread_cond_signal(&recordCond);
+}
 
-static void record_check_segment_size(int upcoming) {
-    if (app_config.record_segment_size <= 0) return;
-    if (recordSize + upcoming >= app_config.record_segment_size) {
-        record_stop();
-        record_start();
+static void record_write_out(size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = write(recordFd, recordBuf + done, len - done);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            HAL_DANGER("record", "Writing to the destination file failed (%s), "
+                "the rest of this segment is lost!\n", strerror(errno));
+            close(recordFd);
+            recordFd = -1;
+            recordBufLen = 0;
+            return;
+        }
+        done += ret;
     }
+    recordOffset += len;
+    memmove(recordBuf, recordBuf + len, recordBufLen - len);
+    recordBufLen -= len;
+
+#ifdef POSIX_FADV_DONTNEED
+    // Recordings are never read back by us, drop the pages that were most
+    // likely written back already so they don't crowd out the page cache.
+    if (recordOffset - recordAdvised > 2 * RECORD_WRITE_BLOCK) {
+        off_t upto = recordOffset - RECORD_WRITE_BLOCK;
+        posix_fadvise(recordFd, recordAdvised, upto - recordAdvised, POSIX_FADV_DONTNEED);
+        recordAdvised = upto;
+    }
+#endif
+}
+
+// Writes up to the last aligned offset, or all that is buffered when `all` is set.
+static void record_flush(bool all) {
+    if (recordFd < 0 || !recordBufLen) return;
+
+    off_t end = recordOffset + recordBufLen;
+    if (!all) end -= end % RECORD_WRITE_ALIGN;
+    if (end > recordOffset) record_write_out(end - recordOffset);
 }
 
-static void record_check_segment_duration() {
-    if (app_config.record_segment_duration <= 0) return;
+static void record_file_append(const char *data, size_t len) {
+    if (recordFd < 0) return;
 
-    time_t currentTime = time(NULL);
-    if (currentTime == (time_t)-1 || recordStartTime == (time_t)-1) return;
+    if (!recordBufLen)
+        clock_gettime(CLOCK_REALTIME, &recordBufSince);
 
-    if (currentTime - recordStartTime >= app_config.record_segment_duration) {
-        record_stop();
-        record_start();
+    while (len && recordFd >= 0) {
+        // A block cut short by a sync or an idle flush realigns the next one.
+        size_t block = RECORD_WRITE_BLOCK - recordOffset % RECORD_WRITE_ALIGN;
+        size_t n = block - recordBufLen;
+        if (n > len) n = len;
+        memcpy(recordBuf + recordBufLen, data, n);
+        recordBufLen += n;
+        data += n;
+        len -= n;
+        if (recordBufLen == block)
+            record_write_out(block);
     }
 }
 
-void record_start(void) {
-    if (recordOn) return;
+static inline uint64_t record_file_pos(void) {
+    return recordOffset + recordBufLen;
+}
+
+static long long record_clock_ms(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Fills the space reserved after the init segment with a sidx pointing at
+// every GOP, followed by whatever is left of the placeholder free box.
+static void record_write_sidx(uint64_t data_end) {
+    const unsigned int cap = (RECORD_SIDX_SPACE - SIDX_HEADER_SIZE) / SIDX_REFERENCE_SIZE;
+    struct SidxReference *refs;
+    struct BitBuf buf = {0};
+    unsigned int count = recordKeyCount;
+
+    if (!count || !recordFileHeaderLen || !recordFileSidxSpace) return;
+    if (!(refs = malloc(count * sizeof(*refs)))) return;
+
+    for (unsigned int i = 0; i < count; i++) {
+        const bool last = i + 1 == count;
+        refs[i].size = (last ? data_end : recordKeys[i + 1].offset) - recordKeys[i].offset;
+        refs[i].duration = (last ? recordFileVEnd : recordKeys[i + 1].time) - recordKeys[i].time;
+    }
+    while (count > cap) {
+        unsigned int merged = 0;
+        for (unsigned int i = 0; i < count; i += 2, merged++) {
+            refs[merged] = refs[i];
+            if (i + 1 < count) {
+                refs[merged].size += refs[i + 1].size;
+                refs[merged].duration += refs[i + 1].duration;
+            }
+        }
+        count = merged;
+    }
+
+    const uint32_t padding = RECORD_SIDX_SPACE - SIDX_HEADER_SIZE - count * SIDX_REFERENCE_SIZE;
+    if (write_sidx(&buf, 1, recordFileTimescale, recordKeys[0].time, padding,
+        refs, count) == BUF_OK && (!padding || (put_u32_be(&buf, padding) == BUF_OK &&
+        put_str4(&buf, "free") == BUF_OK))) {
+        if (pwrite(recordFd, buf.buf, buf.offset, recordFileHeaderLen) != buf.offset)
+            HAL_WARNING("record", "Failed to write the segment index of %s!\n", recordFilePath);
+    }
 
-    if (recordFile) {
-        HAL_DANGER("record", "Output file needs to be closed before initializing a new one.\n");
+    free(buf.buf);
+    free(refs);
+}
+
+static void record_write_mfra(void) {
+    struct TfraEntry *entries;
+    struct BitBuf buf = {0};
+
+    if (!recordKeyCount) return;
+    if (!(entries = malloc(recordKeyCount * sizeof(*entries)))) return;
+
+    for (unsigned int i = 0; i < recordKeyCount; i++) {
+        entries[i].time = recordKeys[i].time;
+        entries[i].moof_offset = recordKeys[i].offset;
+    }
+    if (write_mfra(&buf, 1, entries, recordKeyCount) == BUF_OK)
+        record_file_append(buf.buf, buf.offset);
+
+    free(buf.buf);
+    free(entries);
+}
+
+// Sidecar read back by the listing and playback endpoints, written to a
+// temporary name first so a half-written index never shows up.
+static void record_write_index(uint64_t data_end, uint64_t size) {
+    char path[sizeof(recordFilePath) + 8], temp[sizeof(path) + 4];
+    FILE *file;
+
+    snprintf(path, sizeof(path), "%s.idx", recordFilePath);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    if (!(file = fopen(temp, "w"))) {
+        HAL_WARNING("record", "Failed to write the index of %s!\n", recordFilePath);
         return;
     }
 
-    recordSize = 0;
-    recordState.header_sent = false;
-    recordStartTime = time(NULL);
+    fprintf(file, "start %lld\nend %lld\nsize %llu\nheader %u\ndata_end %llu\n",
+        recordFileWallMs, recordFileWallMs + recordFileEndMs, (unsigned long long)size,
+        recordFileHeaderLen, (unsigned long long)data_end);
+    for (unsigned int i = 0; i < recordKeyCount; i++)
+        fprintf(file, "key %lld %llu\n", recordKeys[i].ms,
+            (unsigned long long)recordKeys[i].offset);
 
-    if (EMPTY(app_config.record_path)) {
-        HAL_DANGER("record", "Destination path is not set!\n");
+    if (fclose(file) || rename(temp, path)) {
+        HAL_WARNING("record", "Failed to write the index of %s!\n", recordFilePath);
+        unlink(temp);
+    }
+}
+
+static void record_file_close(void) {
+    if (recordFd < 0) {
+        recordKeyCount = 0;
         return;
     }
 
-    strcpy(recordPath, app_config.record_path);
-    if (recordPath[strlen(recordPath) - 1] != '/')
-        strncat(recordPath, "/", sizeof(recordPath) - strlen(recordPath) - 1);
+    const uint64_t data_end = record_file_pos();
+    record_write_mfra();
+    const uint64_t size = record_file_pos();
+    record_flush(true);
+    if (recordFd >= 0) {
+        record_write_sidx(data_end);
+        // Give back the reserved blocks past the end that were not used.
+        if (recordFilePrealloc > (off_t)size && ftruncate(recordFd, size))
+            HAL_WARNING("record", "Failed to trim %s (%s)\n", recordFilePath, strerror(errno));
+        // The index must never describe data that is not on the card yet.
+        if (app_config.record_sync_s && fdatasync(recordFd))
+            HAL_WARNING("record", "Failed to sync %s (%s)\n", recordFilePath, strerror(errno));
+        close(recordFd);
+        recordFd = -1;
+        record_write_index(data_end, size);
 
-    if (!EMPTY(app_config.record_filename)) {
+        pthread_mutex_lock(&recordMtx);
+        pthread_cond_signal(&recordRetentionCond);
+        pthread_mutex_unlock(&recordMtx);
+    }
+    recordBufLen = 0;
+    recordKeyCount = 0;
+}
+
+// Expected size of a segment: the configured limit, or the peak encoder
+// bitrate over the configured duration.
+static off_t record_prealloc_size(void) {
+    if (app_config.record_segment_size > 0)
+        return app_config.record_segment_size;
+    if (app_config.record_segment_duration <= 0)
+        return 0;
+
+    long long kbps = app_config.mp4_bitrate * 5 / 4;
+    if (app_config.audio_enable)
+        kbps += app_config.audio_bitrate;
+    long long size = kbps * 1000 / 8 * app_config.record_segment_duration;
+    return size > INT_MAX ? INT_MAX : size;
+}
+
+static void record_file_open(const struct RecordChunk *chunk) {
+    const char *path = chunk->data;
+
+    record_file_close();
+
+    recordOffset = recordAdvised = 0;
+    recordBufLen = 0;
+    recordFileSeq = 0;
+    recordFileVBase = chunk->vtime;
+    recordFileABase = chunk->atime;
+    recordFileVEnd = 0;
+    recordFileHeaderLen = 0;
+    recordFileSidxSpace = false;
+    recordLastSync = record_clock_ms(CLOCK_MONOTONIC);
+    recordFileTimescale = chunk->timescale;
+    // The first fragment may come from the pre-roll, date the file after it.
+    recordFileMonoMs = chunk->ts_ms;
+    recordFileWallMs = record_clock_ms(CLOCK_REALTIME) -
+        (record_clock_ms(CLOCK_MONOTONIC) - chunk->ts_ms);
+    recordFileEndMs = 0;
+    strncpy(recordFilePath, path, sizeof(recordFilePath) - 1);
+    recordFilePath[sizeof(recordFilePath) - 1] = '\0';
+    if ((recordFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        HAL_DANGER("record", "Failed to open the destination file %s (%s)!\n",
+            path, strerror(errno));
+        return;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(recordFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // Reserving the whole segment upfront keeps it contiguous on FAT/exFAT
+    // instead of growing it one cluster chain link at a time. The size is
+    // left alone, extending it would make vfat zero-fill the whole segment.
+    recordFilePrealloc = 0;
+#ifdef FALLOC_FL_KEEP_SIZE
+    off_t prealloc = record_prealloc_size();
+    if (prealloc > 0) {
+        if (!fallocate(recordFd, FALLOC_FL_KEEP_SIZE, 0, prealloc))
+            recordFilePrealloc = prealloc;
+        else if (errno != EOPNOTSUPP)
+            HAL_WARNING("record", "Failed to preallocate %lld bytes for %s (%s)\n",
+                (long long)prealloc, path, strerror(errno));
+    }
+#endif
+}
+
+static void record_put_be(char *dst, uint64_t val, int bytes) {
+    while (bytes--) {
+        dst[bytes] = val & 0xFF;
+        val >>= 8;
+    }
+}
+
+// Rewrites the sequence number and decode times for the current file on a
+// copy of the moof, the chunk itself may still sit in the pre-roll ring.
+static void record_key_add(uint64_t time, uint64_t offset, long long ms) {
+    if (recordKeyCount == recordKeyCap) {
+        unsigned int cap = recordKeyCap ? recordKeyCap * 2 : 64;
+        struct RecordKey *keys = realloc(recordKeys, cap * sizeof(*keys));
+        if (!keys) return;
+        recordKeys = keys;
+        recordKeyCap = cap;
+    }
+
+    recordKeys[recordKeyCount].time = time;
+    recordKeys[recordKeyCount].offset = offset;
+    recordKeys[recordKeyCount++].ms = ms;
+}
+
+static void record_file_write_chunk(const struct RecordChunk *chunk) {
+    char moof[RECORD_MAX_MOOF];
+    const uint32_t moof_len = chunk->moof_len;
+
+    if (recordFd < 0) return;
+
+    if (chunk->is_iframe)
+        record_key_add(chunk->vtime - recordFileVBase, record_file_pos(),
+            chunk->ts_ms - recordFileMonoMs);
+    recordFileVEnd = chunk->vtime - recordFileVBase + chunk->vdur;
+    recordFileEndMs = chunk->ts_ms - recordFileMonoMs +
+        (recordFileTimescale ? (long long)chunk->vdur * 1000 / recordFileTimescale : 0);
+
+    if (!moof_len || moof_len > sizeof(moof)) {
+        record_file_append(chunk->data, chunk->len);
+        return;
+    }
+
+    memcpy(moof, chunk->data, moof_len);
+    if (chunk->pos_seq)
+        record_put_be(moof + chunk->pos_seq, recordFileSeq, 4);
+    if (chunk->pos_vtime)
+        record_put_be(moof + chunk->pos_vtime, chunk->vtime - recordFileVBase, 8);
+    if (chunk->pos_atime)
+        record_put_be(moof + chunk->pos_atime, chunk->atime - recordFileABase, 8);
+    recordFileSeq++;
+
+    record_file_append(moof, moof_len);
+    record_file_append(chunk->data + moof_len, chunk->len - moof_len);
+}
+
+static void record_file_write_header(const struct RecordChunk *chunk) {
+    char pad[256] = {0};
+
+    if (recordFd < 0) return;
+
+    record_file_append(chunk->data, chunk->len);
+    recordFileHeaderLen = chunk->len;
+    recordFileSidxSpace = true;
+
+    // Placeholder for the sidx, a free box until the file gets closed.
+    record_put_be(pad, RECORD_SIDX_SPACE, 4);
+    memcpy(pad + 4, "free", 4);
+    record_file_append(pad, sizeof(pad));
+    memset(pad, 0, 8);
+    for (int left = RECORD_SIDX_SPACE - sizeof(pad); left > 0; left -= sizeof(pad))
+        record_file_append(pad, left < (int)sizeof(pad) ? (size_t)left : sizeof(pad));
+}
+
+// Makes everything up to the end of the last fragment durable every sync_s
+// seconds, bounding what a power cut can take without syncing every frame.
+static void record_file_sync(void) {
+    if (recordFd < 0 || !app_config.record_sync_s) return;
+
+    long long now = record_clock_ms(CLOCK_MONOTONIC);
+    if (now - recordLastSync < app_config.record_sync_s * 1000LL) return;
+    recordLastSync = now;
+
+    record_flush(true);
+    if (recordFd >= 0 && fdatasync(recordFd))
+        HAL_WARNING("record", "Failed to sync %s (%s)\n", recordFilePath, strerror(errno));
+}
+
+static void *record_thread(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&recordMtx);
+    while (recordRepairing && !recordThreadExit)
+        pthread_cond_wait(&recordCond, &recordMtx);
+    while (1) {
+        struct RecordChunk *chunk = recordHead;
+        if (!chunk) {
+            if (recordThreadExit) break;
+            if (recordFd >= 0 && recordBufLen) {
+                struct timespec deadline = recordBufSince;
+                deadline.tv_sec += RECORD_FLUSH_MS / 1000;
+                deadline.tv_nsec += (RECORD_FLUSH_MS % 1000) * 1000000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                if (pthread_cond_timedwait(&recordCond, &recordMtx, &deadline) == ETIMEDOUT) {
+                    pthread_mutex_unlock(&recordMtx);
+                    record_flush(false);
+                    clock_gettime(CLOCK_REALTIME, &recordBufSince);
+                    pthread_mutex_lock(&recordMtx);
+                }
+            } else
+                pthread_cond_wait(&recordCond, &recordMtx);
+            continue;
+        }
+
+        if (!(recordHead = chunk->next)) recordTail = NULL;
+        recordQueued -= chunk->len;
+        pthread_cond_broadcast(&recordSpaceCond);
+        pthread_mutex_unlock(&recordMtx);
+
+        switch (chunk->type) {
+            case RECORD_CHUNK_HEADER: record_file_write_header(chunk); break;
+            case RECORD_CHUNK_OPEN:  record_file_open(chunk); break;
+            case RECORD_CHUNK_CLOSE: record_file_close(); break;
+            default:
+                record_file_write_chunk(chunk);
+                record_file_sync();
+                break;
+        }
+
+        pthread_mutex_lock(&recordMtx);
+        record_chunk_unref(chunk);
+    }
+    pthread_mutex_unlock(&recordMtx);
+
+    record_file_close();
+    return NULL;
+}
+
+// Must be called with recordMtx held.
+static int record_thread_start_locked(void) {
+    if (recordThreadUp) return EXIT_SUCCESS;
+
+    if (!recordBuf && !(recordBuf = malloc(RECORD_WRITE_BLOCK))) {
+        HAL_DANGER("record", "Failed to allocate the write buffer!\n");
+        return EXIT_FAILURE;
+    }
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    size_t stacksize;
+    pthread_attr_getstacksize(&thread_attr, &stacksize);
+    size_t new_stacksize = 32 * 1024;
+    if (pthread_attr_setstacksize(&thread_attr, new_stacksize))
+        HAL_DANGER("record", "Can't set stack size %zu\n", new_stacksize);
+    recordThreadExit = false;
+    if (pthread_create(&recordThread, &thread_attr, record_thread, NULL)) {
+        HAL_DANGER("record", "Starting the writer thread failed!\n");
+        pthread_attr_destroy(&thread_attr);
+        return EXIT_FAILURE;
+    }
+    if (pthread_attr_setstacksize(&thread_attr, stacksize))
+        HAL_DANGER("record", "Can't set stack size %zu\n", stacksize);
+    pthread_attr_destroy(&thread_attr);
+
+    recordThreadUp = true;
+    return EXIT_SUCCESS;
+}
+
+// Must be called with recordMtx held.
+static void record_make_path_locked(void) {
+    char tempName[RECORD_NAME_MAX];
+
+    if (!EMPTY(app_config.record_filename) && *app_config.record_filename == '/') {
         strncpy(recordPath, app_config.record_filename, sizeof(recordPath) - 1);
         recordPath[sizeof(recordPath) - 1] = '\0';
+        return;
+    }
+
+    if (!EMPTY(app_config.record_filename)) {
+        strncpy(tempName, app_config.record_filename, sizeof(tempName) - 1);
+        tempName[sizeof(tempName) - 1] = '\0';
     } else {
-        char tempName[160];
+        char nameFmt[RECORD_NAME_MAX];
         struct tm tm_buf, *tm_info = localtime_r(&recordStartTime, &tm_buf);
-        sprintf(tempName, "recording_%s.mp4", timefmt);
-        strftime(recordPath, sizeof(recordPath), tempName, tm_info);
+        snprintf(nameFmt, sizeof(nameFmt), "recording_%s.mp4", timefmt);
+        if (!tm_info || !strftime(tempName, sizeof(tempName), nameFmt, tm_info))
+            snprintf(tempName, sizeof(tempName), "recording_%lld.mp4", (long long)recordStartTime);
+    }
+
+    size_t len = strlen(app_config.record_path);
+    snprintf(recordPath, sizeof(recordPath), "%s%s%s", app_config.record_path,
+        len && app_config.record_path[len - 1] == '/' ? "" : "/", tempName);
+}
+
+void record_start(void) {
+    pthread_mutex_lock(&recordMtx);
+    if (recordOn) {
+        pthread_mutex_unlock(&recordMtx);
+        return;
+    }
+
+    if (EMPTY(app_config.record_path)) {
+        HAL_DANGER("record", "Destination path is not set!\n");
+        pthread_mutex_unlock(&recordMtx);
+        return;
     }
 
-    if (!(recordFile = fopen(recordPath, "wb"))) {
-        HAL_DANGER("record", "Failed to open the destination file!\n");
+    if (record_thread_start_locked()) {
+        pthread_mutex_unlock(&recordMtx);
         return;
     }
 
+    record_retention_start_locked();
+
+    recordStartTime = time(NULL);
+    recordOpenPending = true;
+    recordSkipping = false;
     recordOn = 1;
+    const bool have_preroll = recordRingHead != NULL;
+    pthread_mutex_unlock(&recordMtx);
+
+    // Files always begin with a keyframe, don't wait for the GOP to roll over
+    // unless the pre-roll already holds one.
+    if (!have_preroll)
+        request_idr();
 }
 
 void record_stop(void) {
-    if (!recordOn) return;
-
-    if (!recordFile) {
-        HAL_DANGER("record", "No output file is opened and ready to finalize!\n");
+    pthread_mutex_lock(&recordMtx);
+    if (!recordOn) {
+        pthread_mutex_unlock(&recordMtx);
         return;
     }
 
-    fclose(recordFile);
-    recordFile = NULL;
+    if (recordFileOpen) {
+        struct RecordChunk *chunk = record_chunk_new(RECORD_CHUNK_CLOSE, NULL, 0);
+        if (chunk) record_enqueue_locked(chunk);
+        recordFileOpen = false;
+    }
+    if (recordDroppedTotal)
+        HAL_WARNING("record", "%u fragments were dropped during this recording, "
+            "the card could not keep up\n", recordDroppedTotal);
+    recordDropped = recordDroppedTotal = 0;
 
     recordOn = 0;
+    recordOpenPending = false;
     recordStartTime = 0;
+    pthread_cond_broadcast(&recordSpaceCond);
+    pthread_mutex_unlock(&recordMtx);
+}
+
+void record_finish(void) {
+    record_stop();
+
+    if (recordRepairUp) {
+        pthread_join(recordRepairThread, NULL);
+        recordRepairUp = false;
+    }
+
+    pthread_mutex_lock(&recordMtx);
+    if (!recordThreadUp) {
+        pthread_mutex_unlock(&recordMtx);
+        return;
+    }
+    recordThreadExit = true;
+    pthread_cond_signal(&recordCond);
+    pthread_cond_signal(&recordRetentionCond);
+    pthread_mutex_unlock(&recordMtx);
+
+    pthread_join(recordThread, NULL);
+    if (recordRetentionUp)
+        pthread_join(recordRetentionThread, NULL);
+
+    pthread_mutex_lock(&recordMtx);
+    recordThreadUp = false;
+    recordRetentionUp = false;
+    pthread_mutex_unlock(&recordMtx);
+}
+
+// Must be called with recordMtx held. Returns false when the fragment has to
+// be dropped because the writer is too far behind.
+static bool record_reserve_locked(size_t len, char is_iframe) {
+    const size_t budget = (size_t)app_config.record_queue_kb * 1024;
+
+    if (!app_config.record_drop_frames) {
+        while (recordOn && recordQueued && recordQueued + len > budget)
+            pthread_cond_wait(&recordSpaceCond, &recordMtx);
+        return recordOn;
+    }
+
+    // Once a fragment is gone, everything up to the next keyframe is useless.
+    if (recordSkipping && !is_iframe) {
+        recordDropped++;
+        return false;
+    }
+    if (recordQueued && recordQueued + len > budget) {
+        if (!recordSkipping)
+            HAL_WARNING("record", "Card is too slow, dropping fragments "
+                "until the next keyframe\n");
+        recordSkipping = true;
+        recordDropped++;
+        return false;
+    }
+    if (recordSkipping) {
+        HAL_INFO("record", "Recording resumed after %u dropped fragments\n", recordDropped);
+        recordDroppedTotal += recordDropped;
+        recordDropped = 0;
+        recordSkipping = false;
+    }
+    return true;
+}
+
+static inline bool record_preroll_enabled(void) {
+    return app_config.record_enable && app_config.record_preroll_s > 0;
+}
+
+bool record_wanted(void) {
+    return recordOn || record_preroll_enabled();
+}
+
+// Must be called with recordMtx held.
+static void record_ring_drop_gop_locked(void) {
+    do {
+        struct RecordChunk *chunk = recordRingHead;
+        recordRingHead = chunk->ring_next;
+        recordRingSize -= chunk->len;
+        record_chunk_unref(chunk);
+    } while (recordRingHead && !recordRingHead->is_iframe);
+
+    if (!recordRingHead) recordRingTail = NULL;
 }
 
-void send_mp4_to_record(hal_vidstream *stream, char isH265) {
-    if (!recordOn) return;
+// Must be called with recordMtx held. Keeps whole GOPs only, starting with the
+// last keyframe that is at least preroll_s old, within the preroll_kb budget.
+static void record_ring_trim_locked(long long now_ms) {
+    const long long window = (long long)app_config.record_preroll_s * 1000;
+    const size_t budget = (size_t)app_config.record_preroll_kb * 1024;
 
-    if (!recordFile) {
-        HAL_DANGER("record", "No output file is opened for writing data!\n");
+    // Whatever is left from before a pause in the feed is no pre-roll anymore.
+    if (recordRingTail && now_ms - recordRingTail->ts_ms > 1000)
+        while (recordRingHead) record_ring_drop_gop_locked();
+
+    while (recordRingHead) {
+        struct RecordChunk *next = recordRingHead->ring_next;
+        while (next && !next->is_iframe)
+            next = next->ring_next;
+        if (recordRingSize <= budget && !(next && next->ts_ms <= now_ms - window))
+            break;
+        record_ring_drop_gop_locked();
+    }
+}
+
+// Must be called with recordMtx held.
+static void record_ring_push_locked(struct RecordChunk *chunk, long long now_ms) {
+    record_ring_trim_locked(now_ms);
+
+    // A GOP is worthless without its keyframe.
+    if (!recordRingHead && !chunk->is_iframe) return;
+
+    chunk->refs++;
+    if (recordRingTail) recordRingTail->ring_next = chunk;
+    else recordRingHead = chunk;
+    recordRingTail = chunk;
+    recordRingSize += chunk->len;
+}
+
+// Must be called with recordMtx held. Earliest keyframe of the ring that can
+// start a new file, skipping what an earlier file already holds, so that only
+// the first file after record_start() gets a pre-roll.
+static struct RecordChunk *record_ring_start_locked(void) {
+    struct RecordChunk *start = NULL;
+
+    for (struct RecordChunk *chunk = recordRingHead; chunk; chunk = chunk->ring_next) {
+        if (chunk->filed)
+            start = NULL;
+        else if (!start && chunk->is_iframe)
+            start = chunk;
+    }
+
+    return start;
+}
+
+void send_mp4_to_record(char is_iframe) {
+    struct BitBuf header_buf, moof_buf, mdat_buf;
+    struct RecordChunk *chunk = NULL, *start, *open, *header;
+    const bool preroll = record_preroll_enabled();
+    bool rotate = false;
+
+    pthread_mutex_lock(&recordMtx);
+    if (!preroll)
+        while (recordRingHead) record_ring_drop_gop_locked();
+    if (!recordOn && !preroll) goto unlock;
+
+    // Sequence number and decode times are rewritten per file by the writer,
+    // the recorder's own state just keeps a continuous timeline across files
+    // and over dropped fragments.
+    recordState.default_sample_duration = default_sample_size;
+    mp4_sync_audio(&recordState);
+    uint64_t vtime = recordState.base_media_decode_time;
+    uint64_t atime = recordState.base_audio_decode_time;
+    if (mp4_set_state(&recordState) != BUF_OK) goto unlock;
+    if (mp4_get_moof(&moof_buf) != BUF_OK) goto unlock;
+    if (mp4_get_mdat(&mdat_buf) != BUF_OK) goto unlock;
+
+    if (!(chunk = record_chunk_new(RECORD_CHUNK_DATA, NULL, moof_buf.offset + mdat_buf.offset))) {
+        HAL_DANGER("record", "Failed to allocate a %u bytes fragment!\n",
+            moof_buf.offset + mdat_buf.offset);
+        goto unlock;
+    }
+    memcpy(chunk->data, moof_buf.buf, moof_buf.offset);
+    memcpy(chunk->data + moof_buf.offset, mdat_buf.buf, mdat_buf.offset);
+    chunk->is_iframe = is_iframe;
+    chunk->moof_len = moof_buf.offset;
+    if (pos_sequence_number + 4 <= moof_buf.offset)
+        chunk->pos_seq = pos_sequence_number;
+    if (pos_video_media_decode_time + 8 <= moof_buf.offset)
+        chunk->pos_vtime = pos_video_media_decode_time;
+    if (pos_audio_media_decode_time + 8 <= moof_buf.offset)
+        chunk->pos_atime = pos_audio_media_decode_time;
+    chunk->vtime = vtime;
+    chunk->atime = atime;
+    chunk->vdur = recordState.base_media_decode_time - vtime;
+    chunk->ts_ms = record_clock_ms(CLOCK_MONOTONIC);
+
+    if (preroll)
+        record_ring_push_locked(chunk, chunk->ts_ms);
+    if (!recordOn) goto unlock;
+    // The first file waits for the startup repair, then begins with the
+    // pre-roll or the next keyframe.
+    if (recordRepairing) goto unlock;
+
+    // Segments are cut on keyframes only, so every file starts decodable.
+    if (is_iframe && recordFileOpen) {
+        time_t now = time(NULL);
+        if (app_config.record_segment_duration > 0 && now != (time_t)-1 &&
+            now - recordStartTime >= app_config.record_segment_duration)
+            rotate = true;
+        if (app_config.record_segment_size > 0 &&
+            recordSize >= app_config.record_segment_size)
+            rotate = true;
+    }
+    if (rotate) {
+        if ((open = record_chunk_new(RECORD_CHUNK_CLOSE, NULL, 0)))
+            record_enqueue_locked(open);
+        recordFileOpen = false;
+        recordOpenPending = true;
+        recordStartTime = time(NULL);
+    }
+
+    if (!recordOpenPending) {
+        if (!record_reserve_locked(chunk->len, is_iframe)) goto unlock;
+        record_enqueue_locked(chunk);
+        recordSize += chunk->len;
+        chunk = NULL;
+        goto unlock;
+    }
+
+    // A new file starts from the pre-roll if there is one, else on a keyframe.
+    start = preroll ? record_ring_start_locked() : NULL;
+    if (!start && !is_iframe) goto unlock;
+    if (mp4_get_header(&header_buf) != BUF_OK) goto unlock;
+
+    uint32_t len = header_buf.offset + RECORD_SIDX_SPACE;
+    if (start)
+        for (struct RecordChunk *c = start; c; c = c->ring_next)
+            len += c->len;
+    else
+        len += chunk->len;
+    if (!record_reserve_locked(len, 1)) goto unlock;
+
+    record_make_path_locked();
+    if (!(open = record_chunk_new(RECORD_CHUNK_OPEN, recordPath, strlen(recordPath) + 1)))
+        goto unlock;
+    if (!(header = record_chunk_new(RECORD_CHUNK_HEADER, header_buf.buf, header_buf.offset))) {
+        free(open);
+        goto unlock;
+    }
+    open->vtime = start ? start->vtime : chunk->vtime;
+    open->atime = start ? start->atime : chunk->atime;
+    open->ts_ms = start ? start->ts_ms : chunk->ts_ms;
+    open->timescale = mp4_get_timescale();
+    record_enqueue_locked(open);
+    record_enqueue_locked(header);
+    if (start) {
+        for (struct RecordChunk *c = start; c; c = c->ring_next) {
+            c->refs++;
+            record_enqueue_locked(c);
+        }
+        if (start != chunk)
+            HAL_INFO("record", "Recording starts with %lld ms of pre-roll\n",
+                chunk->ts_ms - start->ts_ms);
+    } else {
+        record_enqueue_locked(chunk);
+        chunk = NULL;
+    }
+    recordOpenPending = false;
+    recordFileOpen = true;
+    recordSize = len;
+
+unlock:
+    if (chunk) record_chunk_unref(chunk);
+    pthread_mutex_unlock(&recordMtx);
+}
+
+struct RecordIndex {
+    char file[128];
+    long long start_ms, end_ms;
+    unsigned long long size, data_end, seek_offset;
+    uint32_t header_len;
+    unsigned int keys;
+};
+
+static void record_join_path(char *dst, size_t size, const char *name) {
+    size_t len = strlen(app_config.record_path);
+    snprintf(dst, size, "%s%s%s", app_config.record_path,
+        len && app_config.record_path[len - 1] == '/' ? "" : "/", name);
+}
+
+// Parses the sidecar of a recording, when seek_ms is not negative also looks
+// up the last keyframe at or before that wallclock time.
+static bool record_index_read(const char *name, long long seek_ms, struct RecordIndex *idx) {
+    char path[384], line[96];
+    FILE *file;
+
+    record_join_path(path, sizeof(path), name);
+    if (!(file = fopen(path, "r"))) return false;
+
+    memset(idx, 0, sizeof(*idx));
+    snprintf(idx->file, sizeof(idx->file), "%.*s", (int)(strlen(name) - 4), name);
+    while (fgets(line, sizeof(line), file)) {
+        long long ms;
+        unsigned long long offset;
+        if (sscanf(line, "key %lld %llu", &ms, &offset) == 2) {
+            if (!idx->keys++ || (seek_ms >= 0 && idx->start_ms + ms <= seek_ms))
+                idx->seek_offset = offset;
+        } else if (sscanf(line, "start %lld", &idx->start_ms) != 1 &&
+            sscanf(line, "end %lld", &idx->end_ms) != 1 &&
+            sscanf(line, "size %llu", &idx->size) != 1 &&
+            sscanf(line, "header %u", &idx->header_len) != 1)
+            sscanf(line, "data_end %llu", &idx->data_end);
+    }
+    fclose(file);
+
+    return idx->header_len && idx->keys && idx->data_end > idx->seek_offset;
+}
+
+static int record_index_cmp(const void *a, const void *b) {
+    const struct RecordIndex *x = a, *y = b;
+    return (x->start_ms > y->start_ms) - (x->start_ms < y->start_ms);
+}
+
+// Collects the indexed recordings overlapping [from_ms, to_ms], oldest first.
+static int record_index_scan(long long from_ms, long long to_ms, long long seek_ms,
+    struct RecordIndex **list) {
+    struct RecordIndex *items = NULL, idx;
+    struct dirent *entry;
+    int count = 0, cap = 0;
+    DIR *dir;
+
+    *list = NULL;
+    if (EMPTY(app_config.record_path) || !(dir = opendir(app_config.record_path)))
+        return 0;
+
+    while ((entry = readdir(dir))) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || !EQUALS(entry->d_name + len - 4, ".idx")) continue;
+        if (!record_index_read(entry->d_name, seek_ms, &idx)) continue;
+        if (idx.end_ms < from_ms || idx.start_ms > to_ms) continue;
+        if (count == cap) {
+            struct RecordIndex *grown = realloc(items, (cap ? cap * 2 : 32) * sizeof(*items));
+            if (!grown) break;
+            items = grown;
+            cap = cap ? cap * 2 : 32;
+        }
+        items[count++] = idx;
+    }
+    closedir(dir);
+
+    if (count) qsort(items, count, sizeof(*items), record_index_cmp);
+    *list = items;
+    return count;
+}
+
+// Escapes a file name for a JSON string, dst takes up to 6 bytes per character.
+static void record_json_escape(char *dst, const char *src) {
+    for (; *src; src++) {
+        const unsigned char c = *src;
+        if (c == '"' || c == '\\') {
+            *dst++ = '\\';
+            *dst++ = c;
+        } else if (c < 0x20)
+            dst += sprintf(dst, "\\u%04x", c);
+        else
+            *dst++ = c;
+    }
+    *dst = '\0';
+}
+
+void record_send_listing(int client_fd, long long from, long long to) {
+    struct RecordIndex *list;
+    char name[sizeof(list->file) * 6];
+
+    // Keep the bounds in range once scaled to milliseconds
+    const long long lim = LLONG_MAX / 1000;
+    if (from < -lim) from = -lim;
+    else if (from > lim) from = lim;
+    if (to < -lim) to = -lim;
+    else if (to > lim) to = lim;
+
+    int count = record_index_scan(from * 1000, to * 1000, -1, &list);
+    // Worst case per entry: a fully escaped name plus the numbers
+    size_t size = 32 + count * (sizeof(name) + 128);
+    char *body = malloc(size), header[256];
+    int len = 0;
+
+    if (!body) {
+        free(list);
+        send_http_error(client_fd, 500);
         return;
     }
 
-    for (unsigned int i = 0; i < stream->count; ++i) {
-        hal_vidpack *pack = &stream->pack[i];
-        unsigned int pack_len = pack->length - pack->offset;
-        unsigned char *pack_data = pack->data + pack->offset;
+    len += sprintf(body, "{\"recordings\":[");
+    for (int i = 0; i < count && len < (int)size; i++) {
+        record_json_escape(name, list[i].file);
+        len += snprintf(body + len, size - len,
+            "%s{\"file\":\"%s\",\"start\":%lld,\"end\":%lld,\"size\":%llu,\"keyframes\":%u}",
+            i ? "," : "", name, list[i].start_ms / 1000,
+            (list[i].end_ms + 999) / 1000, list[i].size, list[i].keys);
+    }
+    if (len < (int)size)
+        len += snprintf(body + len, size - len, "]}");
+    if (len >= (int)size)
+        len = size - 1;
 
-        for (char j = 0; j < pack->naluCnt; j++) {
-            if ((pack->nalu[j].type == NalUnitType_SPS || pack->nalu[j].type == NalUnitType_SPS_HEVC) 
-                && pack->nalu[j].length >= 4 && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_sps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if ((pack->nalu[j].type == NalUnitType_PPS || pack->nalu[j].type == NalUnitType_PPS_HEVC)
-                && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_pps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if (pack->nalu[j].type == NalUnitType_VPS_HEVC && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_vps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4);
-            else if (pack->nalu[j].type == NalUnitType_CodedSliceIdr || pack->nalu[j].type == NalUnitType_CodedSliceAux)
-                mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 1);
-            else if (pack->nalu[j].type == NalUnitType_CodedSliceNonIdr)
-                mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 0);
+    int header_len = sprintf(header,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json;charset=UTF-8\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: close\r\n"
+        "\r\n", len);
+    if (!send_to_fd(client_fd, header, header_len))
+        send_to_fd(client_fd, body, len);
+    close_socket_fd(client_fd);
+    free(body);
+    free(list);
+}
+
+struct playbacktask {
+    int client_fd;
+    long long t;
+};
+
+static bool record_sendfile(int client_fd, int fd, off_t offset, unsigned long long len) {
+    while (len) {
+        ssize_t sent = sendfile(client_fd, fd, &offset, len > (1 << 20) ? (1 << 20) : len);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        len -= sent;
+    }
+    return true;
+}
+
+static void *record_playback_thread(void *vargp) {
+    struct playbacktask task = *((struct playbacktask *)vargp);
+    const long long seek_ms = task.t * 1000;
+    struct RecordIndex *list, *idx = NULL;
+    char path[384], header[256];
+    int count, fd;
+    free(vargp);
+
+    count = record_index_scan(seek_ms, seek_ms, seek_ms, &list);
+    for (int i = 0; i < count; i++)
+        if (list[i].start_ms <= seek_ms && seek_ms < list[i].end_ms) {
+            idx = &list[i];
+            break;
         }
 
-        static enum BufError err;
-        static char len_buf[50];
-        if (!recordState.header_sent) {
-            struct BitBuf header_buf;
-            err = mp4_get_header(&header_buf); chk_err_continue
-            record_check_segment_size(header_buf.offset);
-            recordSize += header_buf.offset;
-            fwrite(header_buf.buf, 1, header_buf.offset, recordFile);
-
-            recordState.sequence_number = 0;
-            recordState.base_data_offset = header_buf.offset;
-            recordState.base_media_decode_time = 0;
-            recordState.header_sent = true;
-            recordState.nals_count = 0;
-            recordState.default_sample_duration =
-                default_sample_size;
+    record_join_path(path, sizeof(path), idx ? idx->file : "");
+    if (!idx)
+        send_http_error(task.client_fd, 404);
+    else if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        send_http_error(task.client_fd, 404);
+    else {
+        // Init segment, then every fragment from the keyframe on, skipping
+        // the sidx and mfra that describe the original file layout.
+        const unsigned long long body = idx->header_len + idx->data_end - idx->seek_offset;
+        int len = sprintf(header,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: video/mp4\r\n"
+            "Content-Length: %llu\r\n"
+            "Connection: close\r\n"
+            "\r\n", body);
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, idx->seek_offset, idx->data_end - idx->seek_offset, POSIX_FADV_SEQUENTIAL);
+#endif
+        if (!send_to_fd(task.client_fd, header, len) &&
+            record_sendfile(task.client_fd, fd, 0, idx->header_len))
+            record_sendfile(task.client_fd, fd, idx->seek_offset, idx->data_end - idx->seek_offset);
+        close(fd);
+        close_socket_fd(task.client_fd);
+    }
+    free(list);
+
+    pthread_mutex_lock(&recordMtx);
+    recordPlaybacks--;
+    pthread_mutex_unlock(&recordMtx);
+    return NULL;
+}
+
+void record_handle_playback(int client_fd, long long t) {
+    struct playbacktask *task;
+
+    pthread_mutex_lock(&recordMtx);
+    if (recordPlaybacks >= RECORD_MAX_PLAYBACKS) {
+        pthread_mutex_unlock(&recordMtx);
+        send_http_error(client_fd, 503);
+        return;
+    }
+    recordPlaybacks++;
+    pthread_mutex_unlock(&recordMtx);
+
+    if (!(task = malloc(sizeof(*task)))) {
+        send_http_error(client_fd, 500);
+        pthread_mutex_lock(&recordMtx);
+        recordPlaybacks--;
+        pthread_mutex_unlock(&recordMtx);
+        return;
+    }
+    task->client_fd = client_fd;
+    task->t = t;
+
+    pthread_t thread_id;
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    size_t new_stacksize = 32 * 1024;
+    if (pthread_attr_setstacksize(&thread_attr, new_stacksize))
+        HAL_DANGER("record", "Can't set stack size %zu\n", new_stacksize);
+    if (pthread_create(&thread_id, &thread_attr, record_playback_thread, task)) {
+        HAL_DANGER("record", "Starting a playback thread failed!\n");
+        send_http_error(client_fd, 500);
+        free(task);
+        pthread_mutex_lock(&recordMtx);
+        recordPlaybacks--;
+        pthread_mutex_unlock(&recordMtx);
+    }
+    pthread_attr_destroy(&thread_attr);
+}
+
+static long long record_free_mb(void) {
+    struct statvfs st;
+    if (statvfs(app_config.record_path, &st)) return -1;
+    return (long long)st.f_bavail * st.f_frsize / (1024 * 1024);
+}
+
+// Deletes the oldest finished segments until both the free space and the
+// maximum age targets are met. Unindexed files are never touched.
+static void record_retention_run(void) {
+    const long long now_ms = record_clock_ms(CLOCK_REALTIME);
+    const long long max_age_ms = (long long)app_config.record_max_age_h * 3600 * 1000;
+    struct RecordIndex *list;
+    char path[384];
+    int count, removed = 0;
+
+    if (!app_config.record_min_free_mb && !app_config.record_max_age_h) return;
+
+    count = record_index_scan(LLONG_MIN, LLONG_MAX, -1, &list);
+    for (int i = 0; i < count; i++) {
+        const bool expired = max_age_ms && list[i].end_ms < now_ms - max_age_ms;
+        long long free_mb = app_config.record_min_free_mb ? record_free_mb() : -1;
+        const bool low = free_mb >= 0 && free_mb < app_config.record_min_free_mb;
+        if (!expired && !low) break;
+
+        record_join_path(path, sizeof(path), list[i].file);
+        if (unlink(path) && errno != ENOENT) {
+            HAL_WARNING("record", "Failed to delete %s (%s)\n", path, strerror(errno));
+            break;
         }
+        strncat(path, ".idx", sizeof(path) - strlen(path) - 1);
+        unlink(path);
+        removed++;
+    }
+    free(list);
+
+    if (removed)
+        HAL_INFO("record", "Retention removed %d old segment(s)\n", removed);
+    if (app_config.record_min_free_mb) {
+        long long free_mb = record_free_mb();
+        if (free_mb >= 0 && free_mb < app_config.record_min_free_mb)
+            HAL_WARNING("record", "Only %lld MB left on the card and nothing more to delete\n", free_mb);
+    }
+}
 
-        err = mp4_set_state(&recordState); chk_err_continue
-        {
-            struct BitBuf moof_buf;
-            err = mp4_get_moof(&moof_buf); chk_err_continue
-            record_check_segment_size(moof_buf.offset);
-            recordSize += moof_buf.offset;
-            fwrite(moof_buf.buf, 1, moof_buf.offset, recordFile);
+static void *record_retention_thread(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&recordMtx);
+    while (!recordThreadExit) {
+        pthread_mutex_unlock(&recordMtx);
+        record_retention_run();
+        pthread_mutex_lock(&recordMtx);
+        if (recordThreadExit) break;
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += RECORD_RETENTION_PERIOD;
+        pthread_cond_timedwait(&recordRetentionCond, &recordMtx, &deadline);
+    }
+    pthread_mutex_unlock(&recordMtx);
+
+    return NULL;
+}
+
+// Must be called with recordMtx held.
+static void record_retention_start_locked(void) {
+    if (recordRetentionUp) return;
+    if (!app_config.record_min_free_mb && !app_config.record_max_age_h) return;
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    size_t new_stacksize = 32 * 1024;
+    if (pthread_attr_setstacksize(&thread_attr, new_stacksize))
+        HAL_DANGER("record", "Can't set stack size %zu\n", new_stacksize);
+    if (pthread_create(&recordRetentionThread, &thread_attr, record_retention_thread, NULL))
+        HAL_DANGER("record", "Starting the retention thread failed!\n");
+    else
+        recordRetentionUp = true;
+    pthread_attr_destroy(&thread_attr);
+}
+
+static uint32_t record_get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t record_get_u64(const unsigned char *p) {
+    return (uint64_t)record_get_u32(p) << 32 | record_get_u32(p + 4);
+}
+
+static bool record_read_box(int fd, off_t offset, off_t end, uint32_t *size, char type[5]) {
+    unsigned char head[8];
+
+    if (offset + 8 > end || pread(fd, head, sizeof(head), offset) != sizeof(head))
+        return false;
+    *size = record_get_u32(head);
+    memcpy(type, head + 4, 4);
+    type[4] = '\0';
+
+    return *size >= 8 && offset + *size <= end;
+}
+
+// Iterates over the child boxes of buf, returning their payload.
+static const unsigned char *record_next_box(const unsigned char *buf, uint32_t len,
+    uint32_t *pos, const char *type, uint32_t *payload_len) {
+    while (*pos + 8 <= len) {
+        const unsigned char *box = buf + *pos;
+        uint32_t size = record_get_u32(box);
+        if (size < 8 || *pos + size > len) break;
+        *pos += size;
+        if (!memcmp(box + 4, type, 4)) {
+            *payload_len = size - 8;
+            return box + 8;
         }
-        {
-            struct BitBuf mdat_buf;
-            err = mp4_get_mdat(&mdat_buf); chk_err_continue
-            record_check_segment_size(mdat_buf.offset);
-            recordSize += mdat_buf.offset;
-            fwrite(mdat_buf.buf, 1, mdat_buf.offset, recordFile);
-            
+    }
+    return NULL;
+}
+
+// Timescale of track 1 (video) from the moov.
+static uint32_t record_parse_timescale(const unsigned char *moov, uint32_t len) {
+    const unsigned char *trak, *tkhd, *mdia, *mdhd;
+    uint32_t pos = 0, trak_len, sub, sub_len, mdia_len, mdhd_len;
+
+    while ((trak = record_next_box(moov, len, &pos, "trak", &trak_len))) {
+        sub = 0;
+        if (!(tkhd = record_next_box(trak, trak_len, &sub, "tkhd", &sub_len)) || sub_len < 16)
+            continue;
+        if (record_get_u32(tkhd + (tkhd[0] == 1 ? 20 : 12)) != 1)
+            continue;
+        sub = 0;
+        if (!(mdia = record_next_box(trak, trak_len, &sub, "mdia", &mdia_len)))
+            continue;
+        sub = 0;
+        if (!(mdhd = record_next_box(mdia, mdia_len, &sub, "mdhd", &mdhd_len)) || mdhd_len < 24)
+            return 0;
+        return record_get_u32(mdhd + (mdhd[0] == 1 ? 20 : 12));
+    }
+    return 0;
+}
+
+// Decode time and duration of the video run of a moof, false without one.
+static bool record_parse_moof(const unsigned char *moof, uint32_t len,
+    uint64_t *time, uint64_t *duration) {
+    const unsigned char *traf, *box;
+    uint32_t pos = 0, traf_len, sub, box_len;
+
+    while ((traf = record_next_box(moof, len, &pos, "traf", &traf_len))) {
+        uint32_t default_duration = 0, flags;
+
+        sub = 0;
+        if (!(box = record_next_box(traf, traf_len, &sub, "tfhd", &box_len)) || box_len < 8)
+            continue;
+        if (record_get_u32(box + 4) != 1) continue;
+        flags = record_get_u32(box) & 0xFFFFFF;
+        uint32_t at = 8 + (flags & 0x1 ? 8 : 0) + (flags & 0x2 ? 4 : 0);
+        if (flags & 0x8 && at + 4 <= box_len)
+            default_duration = record_get_u32(box + at);
+
+        sub = 0;
+        if (!(box = record_next_box(traf, traf_len, &sub, "tfdt", &box_len)) || box_len < 8)
+            return false;
+        *time = box[0] == 1 && box_len >= 12 ? record_get_u64(box + 4) : record_get_u32(box + 4);
+
+        sub = 0;
+        *duration = 0;
+        if (!(box = record_next_box(traf, traf_len, &sub, "trun", &box_len)) || box_len < 8)
+            return true;
+        flags = record_get_u32(box) & 0xFFFFFF;
+        uint32_t count = record_get_u32(box + 4);
+        at = 8 + (flags & 0x1 ? 4 : 0) + (flags & 0x4 ? 4 : 0);
+        uint32_t stride = (flags & 0x100 ? 4 : 0) + (flags & 0x200 ? 4 : 0) +
+            (flags & 0x400 ? 4 : 0) + (flags & 0x800 ? 4 : 0);
+        for (uint32_t i = 0; i < count; i++, at += stride) {
+            if (!(flags & 0x100))
+                *duration += default_duration;
+            else if (at + 4 <= box_len)
+                *duration += record_get_u32(box + at);
         }
+        return true;
+    }
+    return false;
+}
+
+// Whether the first NAL unit of a sample starts an H.264 or H.265 GOP.
+static bool record_is_keyframe(int fd, off_t sample) {
+    unsigned char head[5];
+
+    if (pread(fd, head, sizeof(head), sample) != sizeof(head)) return false;
+    if ((head[4] & 0x1F) == 5) return true;
+    const unsigned char type = (head[4] >> 1) & 0x3F;
+    return type >= 19 && type <= 21;
+}
+
+// Cuts an unindexed recording after its last complete moof/mdat pair and
+// closes it like the writer would have: mfra, sidx, trim and sidecar.
+static void record_repair_file(const char *name) {
+    unsigned char *box = NULL;
+    uint32_t size, timescale = 0, header_len = 0;
+    uint64_t vend = 0;
+    off_t pos = 0, cut = 0;
+    bool sidx_space = false;
+    struct stat st;
+    char path[384], type[5];
+    int fd;
+
+    record_join_path(path, sizeof(path), name);
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0) return;
+    if (fstat(fd, &st) || !record_read_box(fd, 0, st.st_size, &size, type) ||
+        !EQUALS(type, "ftyp")) {
+        close(fd);
+        return;
+    }
+
+    recordKeyCount = 0;
+    while (record_read_box(fd, pos, st.st_size, &size, type)) {
+        if (EQUALS(type, "ftyp")) {
+            pos += size;
+        } else if (EQUALS(type, "moov")) {
+            unsigned char *moov = size <= (1 << 20) ? malloc(size) : NULL;
+            if (moov && pread(fd, moov, size, pos) == size)
+                timescale = record_parse_timescale(moov + 8, size - 8);
+            free(moov);
+            pos += size;
+            header_len = pos;
+        } else if (EQUALS(type, "free") || EQUALS(type, "sidx")) {
+            if (pos == header_len && size == RECORD_SIDX_SPACE)
+                sidx_space = true;
+            pos += size;
+        } else if (EQUALS(type, "moof")) {
+            uint32_t mdat_size;
+            // Recordings from other writers lack the placeholder, leave them be
+            if (!sidx_space)
+                break;
+            char mdat_type[5];
+            uint64_t time, duration;
+            if (size > 65536 || !(box = realloc(box, size)) ||
+                pread(fd, box, size, pos) != size)
+                break;
+            if (!record_read_box(fd, pos + size, st.st_size, &mdat_size, mdat_type) ||
+                !EQUALS(mdat_type, "mdat"))
+                break;
+            if (record_parse_moof(box + 8, size - 8, &time, &duration)) {
+                if (record_is_keyframe(fd, pos + size + 8))
+                    record_key_add(time, pos, 0);
+                vend = time + duration;
+            }
+            pos += size + mdat_size;
+            cut = pos;
+        } else
+            break;
+    }
+    free(box);
+
+    if (!sidx_space) {
+        recordKeyCount = 0;
+        close(fd);
+        return;
+    }
+    if (!header_len || !timescale || !recordKeyCount) {
+        HAL_WARNING("record", "%s has no usable fragment, left as is\n", path);
+        recordKeyCount = 0;
+        close(fd);
+        return;
+    }
+
+    // Only the last write time survives a power cut, date the file after it.
+    const long long duration_ms = (vend - recordKeys[0].time) * 1000 / timescale;
+    for (unsigned int i = 0; i < recordKeyCount; i++)
+        recordKeys[i].ms = (recordKeys[i].time - recordKeys[0].time) * 1000 / timescale;
+    recordFd = fd;
+    recordOffset = recordAdvised = cut;
+    recordBufLen = 0;
+    recordFileHeaderLen = header_len;
+    recordFileSidxSpace = sidx_space;
+    recordFileTimescale = timescale;
+    recordFileVEnd = vend;
+    recordFilePrealloc = st.st_size;
+    recordFileEndMs = duration_ms;
+    recordFileWallMs = (long long)st.st_mtime * 1000 - duration_ms;
+    strncpy(recordFilePath, path, sizeof(recordFilePath) - 1);
+    recordFilePath[sizeof(recordFilePath) - 1] = '\0';
+
+    HAL_INFO("record", "Repairing %s, keeping %lld of %lld bytes\n",
+        path, (long long)cut, (long long)st.st_size);
+    if (lseek(fd, cut, SEEK_SET) != cut) {
+        recordFd = -1;
+        recordKeyCount = 0;
+        close(fd);
+        return;
     }
+    record_file_close();
+}
+
+// Runs once at startup, the writer stays off the file state that
+// record_repair_file() borrows until it is done.
+static void record_repair(void) {
+    struct dirent *entry;
+    char path[384];
+    DIR *dir;
 
-    record_check_segment_duration();
-}
\ No newline at end of file
+    if (EMPTY(app_config.record_path) || !(dir = opendir(app_config.record_path)))
+        return;
+
+    while ((entry = readdir(dir))) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || !EQUALS(entry->d_name + len - 4, ".mp4")) continue;
+
+        record_join_path(path, sizeof(path), entry->d_name);
+        strncat(path, ".idx", sizeof(path) - strlen(path) - 1);
+        if (!access(path, F_OK)) continue;
+        strncat(path, ".tmp", sizeof(path) - strlen(path) - 1);
+        unlink(path);
+
+        record_repair_file(entry->d_name);
+    }
+    closedir(dir);
+}
+
+static void *record_repair_thread(void *unused) {
+    (void)unused;
+
+    record_repair();
+
+    pthread_mutex_lock(&recordMtx);
+    recordRepairing = false;
+    const bool need_idr = recordOn && !recordRingHead;
+    pthread_cond_broadcast(&recordCond);
+    pthread_mutex_unlock(&recordMtx);
+
+    // Recording was started meanwhile and has no pre-roll to begin with.
+    if (need_idr)
+        request_idr();
+
+    return NULL;
+}
+
+void record_init(void) {
+    pthread_mutex_lock(&recordMtx);
+    if (recordRepairUp || EMPTY(app_config.record_path)) {
+        pthread_mutex_unlock(&recordMtx);
+        return;
+    }
+    if (!recordBuf && !(recordBuf = malloc(RECORD_WRITE_BLOCK))) {
+        HAL_DANGER("record", "Failed to allocate the write buffer!\n");
+        pthread_mutex_unlock(&recordMtx);
+        return;
+    }
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    size_t new_stacksize = 32 * 1024;
+    if (pthread_attr_setstacksize(&thread_attr, new_stacksize))
+        HAL_DANGER("record", "Can't set stack size %zu\n", new_stacksize);
+    recordRepairing = true;
+    if (pthread_create(&recordRepairThread, &thread_attr, record_repair_thread, NULL)) {
+        HAL_DANGER("record", "Starting the repair thread failed!\n");
+        recordRepairing = false;
+    } else
+        recordRepairUp = true;
+    pthread_attr_destroy(&thread_attr);
+    pthread_mutex_unlock(&recordMtx);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <time.h>
 
 #include "app_config.h"
@@ -7,6 +9,20 @@
 #include "hal/macros.h"
 #include "hal/types.h"
 
+// Whether fragments should be fed to send_mp4_to_record(), either for the
+// current recording or for the pre-roll ring.
+bool record_wanted(void);
+// Recovers the segments a power cut left without an index, in the
+// background. To be run once at startup, before the first record_start().
+void record_init(void);
 void record_start(void);
 void record_stop(void);
-void send_mp4_to_record(hal_vidstream *stream, char isH265);
\ No newline at end of file
+// Stops recording and waits for the writer thread to drain its queue.
+void record_finish(void);
+// Lists the indexed recordings overlapping [from, to] (epoch seconds) as JSON.
+void record_send_listing(int client_fd, long long from, long long to);
+// Streams the recording covering epoch second t, starting from the last
+// keyframe before it. Runs on its own thread, takes ownership of client_fd.
+void record_handle_playback(int client_fd, long long t);
+// Queues the fragment last built by mp4_set_pack() for the writer thread.
+void send_mp4_to_record(char is_iframe);
\ No newline at end of file
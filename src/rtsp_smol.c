@@ -25,16 +25,44 @@
 #include <sys/time.h>
 #include <unistd.h>
 
-#define MAX_CLIENTS 4
 #define VIDEO_PAYLOAD_TYPE 96
 #define VIDEO_CLOCK 90000
 #define AAC_PAYLOAD_TYPE 97
 #define DEFAULT_TCP_CHANNEL_RTP 0
 #define DEFAULT_TCP_CHANNEL_RTCP 1
+// Interval between RTCP sender reports of each track.
+#define RTCP_INTERVAL_S 5
+// Adaptive bitrate controller: evaluation period, age limit of the receiver
+// reports it trusts and calm periods required before stepping back up.
+#define ABR_INTERVAL_S 1
+#define ABR_RR_MAX_AGE_US (10 * 1000 * 1000ULL)
+#define ABR_CALM_TICKS 5
+// Seconds between the NTP epoch (1900) and the Unix epoch (1970).
+#define NTP_UNIX_OFFSET 2208988800ULL
 // Must match max_buffer passed to smolrtsp_transport_tcp(...) in setup_rtp_transport().
 #define RTSP_TCP_MAX_BUFFER (512 * 1024)
-// When TCP buffer is full, drain oldest interleaved frames down to this size.
-#define RTSP_TCP_TRIM_TARGET (RTSP_TCP_MAX_BUFFER / 2)
+// Smallest share of rtsp.out_budget_kb a session may be squeezed to; a new
+// session is only admitted while every session can still get this much.
+#define RTSP_TCP_MIN_BUFFER (64 * 1024)
+// Minimum spacing of the IDR requests issued when a session skips a GOP.
+#define DROP_IDR_INTERVAL_US (2 * 1000 * 1000ULL)
+// Frames waiting for each event loop, per media kind (power of two).
+#define FRAME_QUEUE_LEN 64
+// Upper bound of rtsp.threads.
+#define RTSP_MAX_LOOPS 16
+// RFC 8285 one-byte header extensions on the first packet of each video
+// frame (rtsp.header_ext): local IDs as announced with a=extmap, and the
+// largest extension block (4-byte header + padded elements).
+#define EXT_ID_ABS_CAPTURE_TIME 1
+#define EXT_ID_FRAME_MARKING 2
+#define EXT_URI_ABS_CAPTURE_TIME "http://www.webrtc.org/experiments/rtp-hdrext/abs-capture-time"
+#define EXT_URI_FRAME_MARKING "urn:ietf:params:rtp-hdrext:framemarking"
+#define RTP_EXT_MAX 16
+// NACK retransmission (rtsp.nack_ms): largest packet kept in the history,
+// and the share of the video bitrate plus burst retransmissions may use.
+#define RTX_PACKET_MAX (12 + RTP_EXT_MAX + 3 + SMOLRTSP_MAX_H265_NALU_SIZE)
+#define RTX_RATE_DIV 4
+#define RTX_BURST_PKTS 32
 
 // NAL unit types (H.264 / H.265) used for SDP parameter collection.
 #define H264_NAL_TYPE_SPS 7
@@ -57,31 +85,149 @@ static inline void reset_audio_ts(void);
 static inline uint8_t aac_samplerate_index(uint32_t srate);
 static inline uint16_t aac_audio_specific_config(void);
 static inline void aac_config_hex(char *dst, size_t dst_sz);
+static inline uint64_t monotonic_us(void);
 static void on_event_cb(struct bufferevent *bev, short events, void *ctx);
-static int trim_tcp_interleaved_oldest(struct bufferevent *bev, size_t target_len);
+static void on_wake_cb(evutil_socket_t fd, short what, void *arg);
 static size_t bev_output_len(struct bufferevent *bev);
 
 typedef struct SmolRtspClient SmolRtspClient;
 
+// Sent RTP packet kept for retransmission, slot seq % capacity.
+typedef struct {
+    uint16_t seq;
+    uint16_t len;
+    uint64_t sent_us;
+    uint8_t data[RTX_PACKET_MAX];
+} RtspRtxPacket;
+
+// Per-track RTP sender state of one session. Payloads are packetized once per
+// frame; only the sequence number, timestamp and SSRC are stamped per client.
+typedef struct {
+    SmolRTSP_Transport tx;
+    int active;
+    // Datagram socket owned by this track (closed with it), or -1.
+    int fd;
+    // Session receives this track through the shared multicast sender.
+    int multicast;
+
+    // RTCP sender side: SR transport (the odd UDP port or interleaved
+    // channel), counters and the NTP/RTP reference of the last packet.
+    SmolRTSP_Transport rtcp_tx;
+    int rtcp_active;
+    int rtcp_fd;
+    int rtcp_channel;
+    struct event *rtcp_ev;
+    uint32_t packets;
+    uint32_t octets;
+    uint32_t last_rtp_ts;
+    uint64_t last_send_us;
+
+    // Last receiver report about this track (RFC 3550 6.4.2).
+    int have_rr;
+    uint8_t rr_fraction_lost;
+    int32_t rr_cum_lost;
+    uint32_t rr_jitter;
+    uint32_t rr_rtt_us;
+    uint64_t rr_us;
+    uint8_t payload_ty;
+    uint32_t clock;
+    uint16_t seq;
+    uint32_t ssrc;
+    uint32_t ts_offset;
+
+    // NACK history (UDP unicast video with rtsp.nack_ms) and the token
+    // bucket limiting retransmissions, in bytes.
+    RtspRtxPacket *rtx;
+    size_t rtx_cap;
+    uint32_t rtx_tokens;
+    uint64_t rtx_refill_us;
+    uint32_t rtx_packets;
+} RtspTrack;
+
+// One RTP packet of the shared per-frame packet list. `hdr` holds the NAL
+// header (single NAL unit) or the FU indicator/header, `payload` points into
+// the encoder buffer.
+typedef struct {
+    const uint8_t *payload;
+    size_t payload_len;
+    uint8_t hdr[3];
+    uint8_t hdr_len;
+    uint8_t marker;
+} RtpPacketDesc;
+
+// Encoder threads hand frames to the event loops through one single-producer
+// single-consumer ring per loop and media kind, so they never wait on a lock
+// or a socket: publishing costs a copy, a few atomic accesses and at most one
+// wakeup per loop. Each frame is shared by all loops and freed by the last.
+typedef struct {
+    uint64_t ts_us;
+    // Wall clock of the capture as an NTP timestamp (video only).
+    uint64_t capture_ntp;
+    // Publication order, so the multicast sender is fed once per frame.
+    uint64_t id;
+    // RTP timestamp (audio only).
+    uint32_t rtp_ts;
+    int refs;
+    size_t len;
+    int is_h265;
+    uint8_t data[];
+} RtspFrame;
+
+typedef struct {
+    RtspFrame *slots[FRAME_QUEUE_LEN];
+    // head is only written by the producer, tail only by the loop thread.
+    unsigned int head;
+    unsigned int tail;
+    // Set by the producer when a frame had to be discarded.
+    int overflow;
+} RtspFrameQueue;
+
+// One event loop thread (rtsp.threads) and the sessions it accepted. A
+// session never moves; its state is guarded by the loop's mtx, which is
+// uncontended on the send path (other threads only take it for timers and
+// statistics).
+typedef struct {
+    int index;
+    struct event_base *base;
+    struct evconnlistener *listener;
+    struct event *rtcp_timer;
+    // Activated by the encoder threads when frames were queued.
+    struct event *wake_ev;
+    int wake_pending;
+    RtspFrameQueue video_q;
+    RtspFrameQueue audio_q;
+    pthread_t thread;
+    pthread_mutex_t mtx;
+    // Grows on demand up to rtsp.max_clients; entries are never freed while
+    // running, so libevent callbacks can keep pointing at them.
+    SmolRtspClient **clients;
+    int nclients;
+    // Rate limits of send_video(), touched only by the loop thread.
+    uint64_t last_full_log;
+    uint64_t last_idr_request;
+} RtspLoop;
+
 typedef struct Controller {
     SmolRtspClient *client;
 } Controller;
 
+static void frame_queues_flush(RtspLoop *l);
+
 static int g_client_count = 0;
 static uint64_t g_audio_ts_us = 0;
 static uint32_t g_audio_ts_raw = 0;
 
 typedef struct SmolRtspClient {
     uint64_t session_id;
+    RtspLoop *loop;
     struct bufferevent *bev;
     struct sockaddr_storage peer_addr;
     socklen_t peer_addr_len;
     Controller controller_state;
     SmolRTSP_Controller controller_iface;
     void *dispatch_ctx;
-    SmolRTSP_RtpTransport *video_rtp;
-    SmolRTSP_NalTransport *video_nal;
-    SmolRTSP_RtpTransport *audio_rtp;
+    RtspTrack video;
+    RtspTrack audio;
     SmolRTSP_ChannelPair channels;
     int playing;
     int alive;
@@ -89,19 +235,57 @@ typedef struct SmolRtspClient {
     int closing;
     // Prevent scheduling multiple deferred drops for same client.
     int drop_scheduled;
+
+    // Frame-aware video drop state of a congested interleaved session:
+    // skipping to the next IRAP, and the decision for the current access
+    // unit (RTP timestamp au_ts), so a frame is always sent or dropped whole.
+    int drop_until_irap;
+    int au_state;
+    uint32_t au_ts;
+    uint32_t au_slices;
+    uint32_t drops_frames;
+    uint32_t drops_nonref;
+    uint32_t drops_gops;
+    uint32_t drops_audio;
 } SmolRtspClient;
 
 typedef struct {
-    struct event_base *base;
-    struct evconnlistener *listener;
-    pthread_t loop_thread;
+    RtspLoop *loops;
+    int nloops;
+    // Without SO_REUSEPORT, loop 0 accepts alone and deals the connections
+    // out round-robin.
+    int handoff;
+    unsigned int next_loop;
+    // Runs on loop 0.
+    struct event *abr_timer;
+    // Bitrate currently applied by the controller (0 until its first run).
+    unsigned int abr_kbps;
+    int abr_calm;
+    // Guards the multicast sender, session admission and the SDP parameter
+    // sets. Taken after a loop's mtx, never before.
     pthread_mutex_t mtx;
-    SmolRtspClient clients[MAX_CLIENTS];
+    size_t out_budget;
+    // Shared multicast sender: one socket and one track per media kind, fed
+    // once per frame for every session set up with RTP/AVP;multicast.
+    struct {
+        int fd;
+        int refs;
+        RtspTrack video;
+        RtspTrack audio;
+        // Id of the last frame sent, whichever loop got to it first.
+        uint64_t video_id;
+        uint64_t audio_id;
+    } mcast;
+    uint64_t frame_id;
     int running;
 } SmolRtspServer;
 
 static SmolRtspServer g_srv;
 
+// Packet list of the NAL unit being sent, reused across calls by each loop.
+static __thread RtpPacketDesc *g_video_pkts;
+static __thread size_t g_video_pkts_cap;
+
 // Latest codec parameter sets, collected from the live bitstream.
 // Used to populate SDP (sprop-parameter-sets) so ffplay can decode immediately.
 static char g_h264_sps_b64[2048];
@@ -124,24 +308,422 @@ static uint64_t gen_session_id(void) {
     return (hi << 32) | lo;
 }
 
-static SmolRtspClient *alloc_client(void) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!g_srv.clients[i].alive && !g_srv.clients[i].closing) {
-            memset(&g_srv.clients[i], 0, sizeof(SmolRtspClient));
-            g_srv.clients[i].alive = 1;
-            g_client_count++;
-            return &g_srv.clients[i];
+static void mcast_release_locked(void);
+
+static void track_open(
+    RtspTrack *t, SmolRTSP_Transport tx, int fd, uint8_t payload_ty, uint32_t clock) {
+    t->tx = tx;
+    t->fd = fd;
+    t->payload_ty = payload_ty;
+    t->clock = clock;
+    t->seq = (uint16_t)rand();
+    t->ssrc = (uint32_t)rand();
+    t->ts_offset = (uint32_t)rand();
+    t->rtcp_active = 0;
+    t->rtcp_fd = -1;
+    t->rtcp_channel = -1;
+    t->rtcp_ev = NULL;
+    t->packets = t->octets = 0;
+    t->have_rr = 0;
+    t->rtx_packets = 0;
+    t->active = 1;
+}
+
+// Packets sent within rtsp.nack_ms at the configured bitrate, doubled for
+// keyframe bursts.
+static size_t rtx_capacity(void) {
+    const uint64_t bytes = (uint64_t)app_config.rtsp_nack_ms * app_config.mp4_bitrate / 8;
+    const size_t n = (size_t)(2 * bytes / SMOLRTSP_MAX_H264_NALU_SIZE) + RTX_BURST_PKTS;
+    return MIN(n, 2048);
+}
+
+// Starts keeping sent packets of a track for NACK retransmission.
+static void track_open_rtx(RtspTrack *t) {
+    const size_t cap = rtx_capacity();
+    t->rtx = calloc(cap, sizeof *t->rtx);
+    if (!t->rtx)
+        return;
+    t->rtx_cap = cap;
+    t->rtx_tokens = RTX_BURST_PKTS * RTX_PACKET_MAX;
+    t->rtx_refill_us = monotonic_us();
+}
+
+// Attaches the RTCP transport of an open track. @fd is an owned UDP socket
+// (watched for receiver reports when @ev is given) or -1.
+static void track_open_rtcp(
+    RtspTrack *t, SmolRTSP_Transport tx, int fd, int channel, struct event *ev) {
+    t->rtcp_tx = tx;
+    t->rtcp_fd = fd;
+    t->rtcp_channel = channel;
+    t->rtcp_ev = ev;
+    t->rtcp_active = 1;
+}
+
+static void track_close(RtspTrack *t) {
+    if (t->multicast) {
+        t->multicast = 0;
+        pthread_mutex_lock(&g_srv.mtx);
+        mcast_release_locked();
+        pthread_mutex_unlock(&g_srv.mtx);
+    }
+    free(t->rtx);
+    t->rtx = NULL;
+    if (!t->active)
+        return;
+    VCALL_SUPER(t->tx, SmolRTSP_Droppable, drop);
+    if (t->fd >= 0)
+        close(t->fd);
+    if (t->rtcp_active) {
+        // Only called from the event loop thread (or after it stopped), so
+        // freeing the read event never waits on a running callback.
+        if (t->rtcp_ev)
+            event_free(t->rtcp_ev);
+        VCALL_SUPER(t->rtcp_tx, SmolRTSP_Droppable, drop);
+        if (t->rtcp_fd >= 0)
+            close(t->rtcp_fd);
+        t->rtcp_active = 0;
+    }
+    t->active = 0;
+}
+
+static inline uint32_t rtp_clock_ts(uint64_t ts_us, uint32_t clock) {
+    return (uint32_t)(ts_us * clock / 1000000ULL);
+}
+
+// Stamps the session-specific RTP header (plus an optional header extension
+// block, ext_len <= RTP_EXT_MAX) in front of a shared packet and hands it to
+// the session's transport.
+static int track_send(RtspTrack *t, uint32_t ts, int marker,
+    const uint8_t *ext, size_t ext_len,
+    const uint8_t *hdr, size_t hdr_len, const uint8_t *payload, size_t payload_len) {
+    uint8_t rtp[12 + RTP_EXT_MAX];
+    const uint32_t rtp_ts = ts + t->ts_offset;
+    rtp[0] = ext_len ? 0x90 : 0x80;
+    rtp[1] = (uint8_t)((marker ? 0x80 : 0) | (t->payload_ty & 0x7F));
+    rtp[2] = (uint8_t)(t->seq >> 8);
+    rtp[3] = (uint8_t)t->seq;
+    rtp[4] = (uint8_t)(rtp_ts >> 24);
+    rtp[5] = (uint8_t)(rtp_ts >> 16);
+    rtp[6] = (uint8_t)(rtp_ts >> 8);
+    rtp[7] = (uint8_t)rtp_ts;
+    rtp[8] = (uint8_t)(t->ssrc >> 24);
+    rtp[9] = (uint8_t)(t->ssrc >> 16);
+    rtp[10] = (uint8_t)(t->ssrc >> 8);
+    rtp[11] = (uint8_t)t->ssrc;
+    if (ext_len)
+        memcpy(rtp + 12, ext, ext_len);
+
+    struct iovec iov[3] = {
+        {.iov_base = rtp, .iov_len = 12 + ext_len},
+        {.iov_base = (void *)hdr, .iov_len = hdr_len},
+        {.iov_base = (void *)payload, .iov_len = payload_len},
+    };
+    const SmolRTSP_IoVecSlice bufs = {.ptr = iov, .len = 3};
+    if (VCALL(t->tx, transmit, bufs) == -1)
+        return -1;
+    if (t->rtx) {
+        RtspRtxPacket *p = &t->rtx[t->seq % t->rtx_cap];
+        p->len = 0;
+        if (12 + ext_len + hdr_len + payload_len <= sizeof p->data) {
+            uint8_t *dst = p->data;
+            for (size_t i = 0; i < 3; i++) {
+                memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+                dst += iov[i].iov_len;
+            }
+            p->seq = t->seq;
+            p->len = (uint16_t)(dst - p->data);
+            p->sent_us = monotonic_us();
         }
     }
-    return NULL;
+    t->seq++;
+    // Remember when this RTP timestamp went out; SRs extrapolate from it.
+    if (rtp_ts != t->last_rtp_ts || !t->packets) {
+        t->last_rtp_ts = rtp_ts;
+        t->last_send_us = monotonic_us();
+    }
+    t->packets++;
+    t->octets += (uint32_t)(hdr_len + payload_len);
+    return 0;
 }
 
-static SmolRtspClient *find_client(uint64_t session_id) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (g_srv.clients[i].alive && g_srv.clients[i].session_id == session_id)
-            return &g_srv.clients[i];
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+        ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// Current wall clock as a 64-bit NTP timestamp.
+static uint64_t ntp_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const uint64_t frac = ((uint64_t)ts.tv_nsec << 32) / 1000000000ULL;
+    return (((uint64_t)ts.tv_sec + NTP_UNIX_OFFSET) << 32) | frac;
+}
+
+// Sends a compound RTCP packet (SR + SDES CNAME) for a track that has
+// already carried media. The RTP timestamp is extrapolated from the last
+// sent packet so that it matches the NTP time of the report.
+static void track_send_sr(RtspTrack *t) {
+    if (!t->active || !t->rtcp_active || !t->packets)
+        return;
+
+    static const char cname[] = "divinus";
+    uint8_t pkt[28 + 8 + sizeof cname + 4];
+    const uint64_t ntp = ntp_now();
+    const uint64_t elapsed = monotonic_us() - t->last_send_us;
+    const uint32_t rtp_ts =
+        t->last_rtp_ts + (uint32_t)(elapsed * t->clock / 1000000ULL);
+
+    pkt[0] = 0x80;
+    pkt[1] = 200;
+    pkt[2] = 0;
+    pkt[3] = 6;
+    put_be32(pkt + 4, t->ssrc);
+    put_be32(pkt + 8, (uint32_t)(ntp >> 32));
+    put_be32(pkt + 12, (uint32_t)ntp);
+    put_be32(pkt + 16, rtp_ts);
+    put_be32(pkt + 20, t->packets);
+    put_be32(pkt + 24, t->octets);
+
+    // SDES chunk: SSRC, CNAME item, END, padded to a 32-bit boundary.
+    size_t sdes = 28 + 8;
+    pkt[sdes++] = 1;
+    pkt[sdes++] = (uint8_t)(sizeof cname - 1);
+    memcpy(pkt + sdes, cname, sizeof cname - 1);
+    sdes += sizeof cname - 1;
+    pkt[sdes++] = 0;
+    while (sdes & 3)
+        pkt[sdes++] = 0;
+    const size_t sdes_words = (sdes - 28) / 4 - 1;
+    pkt[28] = 0x81;
+    pkt[29] = 202;
+    pkt[30] = (uint8_t)(sdes_words >> 8);
+    pkt[31] = (uint8_t)sdes_words;
+    put_be32(pkt + 32, t->ssrc);
+
+    struct iovec iov = {.iov_base = pkt, .iov_len = sdes};
+    const SmolRTSP_IoVecSlice bufs = {.ptr = &iov, .len = 1};
+    (void)VCALL(t->rtcp_tx, transmit, bufs);
+}
+
+static void track_apply_rr(RtspTrack *t, const uint8_t *blk, uint64_t arrival_ntp) {
+    t->rr_fraction_lost = blk[4];
+    // Cumulative loss is a signed 24-bit value.
+    int32_t lost = (int32_t)(((uint32_t)blk[5] << 16) | ((uint32_t)blk[6] << 8) | blk[7]);
+    if (lost & 0x800000)
+        lost -= 0x1000000;
+    t->rr_cum_lost = lost;
+    t->rr_jitter = get_be32(blk + 12);
+
+    // RTT = A - LSR - DLSR, all in 1/65536 s (middle 32 bits of NTP).
+    const uint32_t lsr = get_be32(blk + 16), dlsr = get_be32(blk + 20);
+    if (lsr) {
+        const uint32_t a = (uint32_t)(arrival_ntp >> 16);
+        const uint32_t rtt = a - lsr - dlsr;
+        if ((int32_t)rtt >= 0)
+            t->rr_rtt_us = (uint32_t)((uint64_t)rtt * 1000000ULL >> 16);
     }
-    return NULL;
+    t->rr_us = monotonic_us();
+    t->have_rr = 1;
+}
+
+// Walks a compound RTCP packet from a client and records the report blocks
+// (of RR or SR packets) that refer to one of its tracks. Caller holds mtx.
+// Resends one packet from the history if it is still recent and the
+// retransmission budget allows it.
+static void track_retransmit(RtspTrack *t, uint16_t seq, uint64_t now) {
+    const RtspRtxPacket *p = &t->rtx[seq % t->rtx_cap];
+    if (!p->len || p->seq != seq || now - p->sent_us > app_config.rtsp_nack_ms * 1000ULL)
+        return;
+    if (t->rtx_tokens < p->len)
+        return;
+    t->rtx_tokens -= p->len;
+
+    struct iovec iov = {.iov_base = (void *)p->data, .iov_len = p->len};
+    const SmolRTSP_IoVecSlice bufs = {.ptr = &iov, .len = 1};
+    if (VCALL(t->tx, transmit, bufs) == 0)
+        t->rtx_packets++;
+}
+
+// Generic NACK (RFC 4585 6.2.1): each FCI names a lost packet and a bitmask
+// of the 16 following ones.
+static void rtcp_handle_nack_locked(SmolRtspClient *c, const uint8_t *buf, size_t len) {
+    const uint32_t ssrc = get_be32(buf + 8);
+    RtspTrack *t = NULL;
+    if (c->video.active && c->video.rtx && ssrc == c->video.ssrc)
+        t = &c->video;
+    else if (c->audio.active && c->audio.rtx && ssrc == c->audio.ssrc)
+        t = &c->audio;
+    if (!t)
+        return;
+
+    const uint64_t now = monotonic_us();
+    const uint64_t rate = (uint64_t)app_config.mp4_bitrate * 1000 / 8 / RTX_RATE_DIV;
+    const uint64_t refill = (now - t->rtx_refill_us) * rate / 1000000ULL;
+    t->rtx_tokens = (uint32_t)MIN(t->rtx_tokens + refill, (uint64_t)RTX_BURST_PKTS * RTX_PACKET_MAX);
+    t->rtx_refill_us = now;
+
+    for (size_t off = 12; off + 4 <= len; off += 4) {
+        const uint16_t pid = (uint16_t)((buf[off] << 8) | buf[off + 1]);
+        const uint16_t blp = (uint16_t)((buf[off + 2] << 8) | buf[off + 3]);
+        track_retransmit(t, pid, now);
+        for (int bit = 0; bit < 16; bit++)
+            if (blp & (1u << bit))
+                track_retransmit(t, (uint16_t)(pid + bit + 1), now);
+    }
+}
+
+static void rtcp_handle_locked(SmolRtspClient *c, const uint8_t *buf, size_t len) {
+    const uint64_t arrival = ntp_now();
+    while (len >= 8) {
+        const uint8_t count = buf[0] & 0x1F, pt = buf[1];
+        const size_t pkt_len = ((size_t)((buf[2] << 8) | buf[3]) + 1) * 4;
+        if ((buf[0] >> 6) != 2 || pkt_len > len)
+            return;
+
+        if (pt == 205 && count == 1 && pkt_len >= 12)
+            rtcp_handle_nack_locked(c, buf, pkt_len);
+
+        size_t blk = 0;
+        if (pt == 201)
+            blk = 8;
+        else if (pt == 200)
+            blk = 28;
+        for (uint8_t i = 0; blk && i < count && blk + 24 <= pkt_len; i++, blk += 24) {
+            const uint32_t ssrc = get_be32(buf + blk);
+            if (c->video.active && ssrc == c->video.ssrc)
+                track_apply_rr(&c->video, buf + blk, arrival);
+            else if (c->audio.active && ssrc == c->audio.ssrc)
+                track_apply_rr(&c->audio, buf + blk, arrival);
+        }
+
+        buf += pkt_len;
+        len -= pkt_len;
+    }
+}
+
+// Output buffer a session may hold before its video starts being dropped:
+// an equal share of the global budget, within [MIN, MAX].
+static size_t session_out_limit(void) {
+    const int count = __atomic_load_n(&g_client_count, __ATOMIC_RELAXED);
+    const size_t n = count > 0 ? (size_t)count : 1;
+    size_t limit = g_srv.out_budget / n;
+    if (limit > RTSP_TCP_MAX_BUFFER)
+        limit = RTSP_TCP_MAX_BUFFER;
+    if (limit < RTSP_TCP_MIN_BUFFER)
+        limit = RTSP_TCP_MIN_BUFFER;
+    return limit;
+}
+
+// Returns the shared multicast track of @kind, opening the sender socket on
+// first use, and takes a reference for the calling session.
+static RtspTrack *mcast_acquire_locked(track_kind kind, uint8_t payload_ty, uint32_t clock) {
+    struct sockaddr_in dst = {.sin_family = AF_INET};
+    if (!inet_aton(app_config.rtsp_multicast_group, &dst.sin_addr) ||
+        !IN_MULTICAST(ntohl(dst.sin_addr.s_addr)))
+        return NULL;
+
+    if (!g_srv.mcast.refs) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0)
+            return NULL;
+        unsigned char ttl = (unsigned char)app_config.rtsp_multicast_ttl;
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof ttl);
+        struct in_addr iface;
+        if (!EMPTY(app_config.rtsp_bind) && inet_aton(app_config.rtsp_bind, &iface))
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof iface);
+        g_srv.mcast.fd = fd;
+        fprintf(stderr, "[rtsp] multicast sender started group=%s port=%u ttl=%u\n",
+                app_config.rtsp_multicast_group, app_config.rtsp_multicast_port,
+                app_config.rtsp_multicast_ttl);
+    }
+
+    RtspTrack *t = (kind == TRACK_VIDEO) ? &g_srv.mcast.video : &g_srv.mcast.audio;
+    if (!t->active) {
+        dst.sin_port = htons((uint16_t)(app_config.rtsp_multicast_port +
+            (kind == TRACK_VIDEO ? 0 : 2)));
+        track_open(t, smolrtsp_transport_udp_address(g_srv.mcast.fd, &dst, sizeof dst),
+            -1, payload_ty, clock);
+        // Sender reports go to the group as well, on the next port.
+        dst.sin_port = htons((uint16_t)(ntohs(dst.sin_port) + 1));
+        track_open_rtcp(t, smolrtsp_transport_udp_address(g_srv.mcast.fd, &dst, sizeof dst),
+            -1, -1, NULL);
+    }
+    g_srv.mcast.refs++;
+    return t;
+}
+
+static void mcast_release_locked(void) {
+    if (g_srv.mcast.refs <= 0 || --g_srv.mcast.refs > 0)
+        return;
+    track_close(&g_srv.mcast.video);
+    track_close(&g_srv.mcast.audio);
+    close(g_srv.mcast.fd);
+    g_srv.mcast.fd = -1;
+    fprintf(stderr, "[rtsp] multicast sender stopped\n");
+}
+
+// Takes a session slot on @l. Caller holds l->mtx.
+static SmolRtspClient *alloc_client(RtspLoop *l) {
+    SmolRtspClient *c = NULL;
+    pthread_mutex_lock(&g_srv.mtx);
+    const int count = __atomic_load_n(&g_client_count, __ATOMIC_RELAXED);
+    // Admission: the budget must still cover the minimum share of every
+    // session, the new one included.
+    if ((size_t)(count + 1) * RTSP_TCP_MIN_BUFFER > g_srv.out_budget) {
+        fprintf(stderr, "[rtsp] reject client: output budget %zu KiB exhausted by %d sessions\n",
+                g_srv.out_budget / 1024, count);
+        goto out;
+    }
+    if (count >= (int)app_config.rtsp_max_clients) {
+        fprintf(stderr, "[rtsp] reject client: max_clients=%u reached\n",
+                app_config.rtsp_max_clients);
+        goto out;
+    }
+
+    for (int i = 0; i < l->nclients; i++) {
+        if (!l->clients[i]->alive && !l->clients[i]->closing) {
+            c = l->clients[i];
+            break;
+        }
+    }
+    if (!c) {
+        // Slots still closing count too, the array stays bounded.
+        if (l->nclients >= (int)app_config.rtsp_max_clients) {
+            fprintf(stderr, "[rtsp] reject client: max_clients=%u reached\n",
+                    app_config.rtsp_max_clients);
+            goto out;
+        }
+        SmolRtspClient **grown =
+            realloc(l->clients, (l->nclients + 1) * sizeof *grown);
+        if (!grown)
+            goto out;
+        l->clients = grown;
+        c = malloc(sizeof *c);
+        if (!c)
+            goto out;
+        l->clients[l->nclients++] = c;
+    }
+
+    memset(c, 0, sizeof(SmolRtspClient));
+    c->alive = 1;
+    c->loop = l;
+    __atomic_add_fetch(&g_client_count, 1, __ATOMIC_RELAXED);
+out:
+    pthread_mutex_unlock(&g_srv.mtx);
+    return c;
+}
+
+// A session stopped counting against the output budget.
+static void client_count_dec(void) {
+    if (__atomic_sub_fetch(&g_client_count, 1, __ATOMIC_RELAXED) == 0)
+        reset_audio_ts();
 }
 
 static void drop_client(SmolRtspClient *c) {
@@ -149,20 +731,8 @@ static void drop_client(SmolRtspClient *c) {
     const int was_alive = c->alive;
     fprintf(stderr, "[rtsp] drop_client session=%llu alive=%d bev=%p\n",
             (unsigned long long)c->session_id, c->alive, (void *)c->bev);
-    if (c->video_nal) {
-        VTABLE(SmolRTSP_NalTransport, SmolRTSP_Droppable).drop(c->video_nal);
-        c->video_nal = NULL;
-        // NalTransport owns the underlying RTP transport and drops it as well.
-        c->video_rtp = NULL;
-    }
-    if (c->video_rtp) {
-        VTABLE(SmolRTSP_RtpTransport, SmolRTSP_Droppable).drop(c->video_rtp);
-        c->video_rtp = NULL;
-    }
-    if (c->audio_rtp) {
-        VTABLE(SmolRTSP_RtpTransport, SmolRTSP_Droppable).drop(c->audio_rtp);
-        c->audio_rtp = NULL;
-    }
+    track_close(&c->video);
+    track_close(&c->audio);
     if (c->bev) {
         bufferevent_free(c->bev);
         c->bev = NULL;
@@ -172,21 +742,27 @@ static void drop_client(SmolRtspClient *c) {
     c->alive = 0;
     c->closing = 0;
     c->drop_scheduled = 0;
-    if (was_alive) {
-        if (g_client_count > 0)
-            g_client_count--;
-        if (g_client_count == 0)
-            reset_audio_ts();
-    }
+    if (was_alive)
+        client_count_dec();
 }
 
 static void drop_client_deferred(evutil_socket_t fd, short what, void *arg) {
     (void)fd;
     (void)what;
     SmolRtspClient *c = arg;
-    pthread_mutex_lock(&g_srv.mtx);
+    RtspLoop *l = c->loop;
+    pthread_mutex_lock(&l->mtx);
     drop_client(c);
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_unlock(&l->mtx);
+}
+
+// Loop a bufferevent was created on (callbacks get various context pointers).
+static RtspLoop *loop_of_bev(struct bufferevent *bev) {
+    struct event_base *base = bufferevent_get_base(bev);
+    for (int i = 0; i < g_srv.nloops; i++)
+        if (g_srv.loops[i].base == base)
+            return &g_srv.loops[i];
+    return NULL;
 }
 
 static void on_write_close_cb(struct bufferevent *bev, void *ctx) {
@@ -198,10 +774,13 @@ static void on_write_close_cb(struct bufferevent *bev, void *ctx) {
     if (!out || evbuffer_get_length(out) != 0)
         return;
 
+    RtspLoop *l = loop_of_bev(bev);
+    if (!l)
+        return;
     SmolRtspClient *target = NULL;
-    pthread_mutex_lock(&g_srv.mtx);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        SmolRtspClient *c = &g_srv.clients[i];
+    pthread_mutex_lock(&l->mtx);
+    for (int i = 0; i < l->nclients; i++) {
+        SmolRtspClient *c = l->clients[i];
         if (c->bev == bev) {
             if (c->closing && !c->drop_scheduled)
                 target = c;
@@ -210,11 +789,11 @@ static void on_write_close_cb(struct bufferevent *bev, void *ctx) {
     }
     if (target)
         target->drop_scheduled = 1;
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_unlock(&l->mtx);
 
     if (target) {
         struct timeval tv = {.tv_sec = 0, .tv_usec = 0};
-        event_base_once(g_srv.base, -1, EV_TIMEOUT, drop_client_deferred, target, &tv);
+        event_base_once(l->base, -1, EV_TIMEOUT, drop_client_deferred, target, &tv);
     }
 }
 
@@ -225,31 +804,66 @@ static void Controller_drop(VSelf) {
 declImpl(SmolRTSP_Controller, Controller);
 declImpl(SmolRTSP_Droppable, Controller);
 
+// Receiver reports arriving on the RTCP socket of a UDP session.
+static void on_rtcp_read_cb(evutil_socket_t fd, short what, void *arg) {
+    (void)what;
+    SmolRtspClient *c = arg;
+    uint8_t buf[1500];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof buf, MSG_DONTWAIT)) > 0) {
+        pthread_mutex_lock(&c->loop->mtx);
+        rtcp_handle_locked(c, buf, (size_t)n);
+        pthread_mutex_unlock(&c->loop->mtx);
+    }
+}
+
+static uint16_t local_port(int fd) {
+    struct sockaddr_storage local;
+    socklen_t local_len = sizeof local;
+    if (getsockname(fd, (struct sockaddr *)&local, &local_len) != 0)
+        return 0;
+    if (local.ss_family == AF_INET)
+        return ntohs(((struct sockaddr_in *)&local)->sin_port);
+    if (local.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6 *)&local)->sin6_port);
+    return 0;
+}
+
 static int setup_rtp_transport(
     SmolRtspClient *c, SmolRTSP_Context *ctx, SmolRTSP_TransportConfig cfg,
     track_kind kind) {
     // Drop previous transport for this track (best-effort).
-    if (kind == TRACK_VIDEO) {
-        if (c->video_nal) {
-            VTABLE(SmolRTSP_NalTransport, SmolRTSP_Droppable).drop(c->video_nal);
-            c->video_nal = NULL;
-            // NalTransport owns the underlying RTP transport and drops it too.
-            c->video_rtp = NULL;
-        }
-        if (c->video_rtp) {
-            VTABLE(SmolRTSP_RtpTransport, SmolRTSP_Droppable).drop(c->video_rtp);
-            c->video_rtp = NULL;
-        }
-    } else {
-        if (c->audio_rtp) {
-            VTABLE(SmolRTSP_RtpTransport, SmolRTSP_Droppable).drop(c->audio_rtp);
-            c->audio_rtp = NULL;
-        }
-    }
+    RtspTrack *track = (kind == TRACK_VIDEO) ? &c->video : &c->audio;
+    track_close(track);
 
     uint8_t payload = (kind == TRACK_VIDEO) ? VIDEO_PAYLOAD_TYPE : AAC_PAYLOAD_TYPE;
     uint32_t clock = (kind == TRACK_VIDEO) ? VIDEO_CLOCK : audio_clock_hz();
 
+    if (cfg.multicast) {
+        pthread_mutex_lock(&g_srv.mtx);
+        const RtspTrack *shared = EMPTY(app_config.rtsp_multicast_group) ? NULL :
+            mcast_acquire_locked(kind, payload, clock);
+        pthread_mutex_unlock(&g_srv.mtx);
+        if (!shared) {
+            smolrtsp_respond(ctx, SMOLRTSP_STATUS_UNSUPPORTED_TRANSPORT, "Multicast unavailable");
+            return -1;
+        }
+        track->multicast = 1;
+
+        const unsigned port =
+            app_config.rtsp_multicast_port + (kind == TRACK_VIDEO ? 0 : 2);
+        smolrtsp_header(
+            ctx, SMOLRTSP_HEADER_TRANSPORT, "RTP/AVP;multicast;destination=%s;port=%u-%u;ttl=%u",
+            app_config.rtsp_multicast_group, port, port + 1, app_config.rtsp_multicast_ttl);
+
+        fprintf(stderr,
+            "[rtsp] setup track=%s session=%llu multicast %s:%u payload=%u clock=%u\n",
+            (kind == TRACK_VIDEO) ? "video" : "audio",
+            (unsigned long long)c->session_id,
+            app_config.rtsp_multicast_group, port, payload, clock);
+        return 0;
+    }
+
     if (cfg.lower == SmolRTSP_LowerTransport_TCP) {
         SmolRTSP_ChannelPair pair = {.rtp_channel = DEFAULT_TCP_CHANNEL_RTP,
             .rtcp_channel = DEFAULT_TCP_CHANNEL_RTCP};
@@ -270,14 +884,10 @@ static int setup_rtp_transport(
         SmolRTSP_Transport t =
             smolrtsp_transport_tcp(writer, pair.rtp_channel, RTSP_TCP_MAX_BUFFER /* max buffer */);
 
-        SmolRTSP_RtpTransport *rtp = SmolRTSP_RtpTransport_new(t, payload, clock);
-
-        if (kind == TRACK_VIDEO) {
-            c->video_rtp = rtp;
-            c->video_nal = SmolRTSP_NalTransport_new(rtp);
-        } else {
-            c->audio_rtp = rtp;
-        }
+        track_open(track, t, -1, payload, clock);
+        track_open_rtcp(track,
+            smolrtsp_transport_tcp(writer, pair.rtcp_channel, RTSP_TCP_MAX_BUFFER),
+            -1, pair.rtcp_channel, NULL);
 
         c->channels = pair;
         smolrtsp_header(
@@ -305,39 +915,35 @@ static int setup_rtp_transport(
                 return -1;
             }
 
-            // Best-effort RTCP socket (we don't send RTCP, but some clients expect a pair).
-            int rtcp_fd = smolrtsp_dgram_socket(af, ip, client_port->rtcp_port);
-            if (rtcp_fd != -1) {
-                close(rtcp_fd);
-            }
-
             SmolRTSP_Transport t = smolrtsp_transport_udp(rtp_fd);
-            SmolRTSP_RtpTransport *rtp = SmolRTSP_RtpTransport_new(t, payload, clock);
+            track_open(track, t, rtp_fd, payload, clock);
+            if (app_config.rtsp_nack_ms && kind == TRACK_VIDEO)
+                track_open_rtx(track);
 
-            if (kind == TRACK_VIDEO) {
-                c->video_rtp = rtp;
-                c->video_nal = SmolRTSP_NalTransport_new(rtp);
-            } else {
-                c->audio_rtp = rtp;
+            // RTCP socket, connected to the client's RTCP port: sender reports
+            // go out on it and receiver reports come back to it (best-effort).
+            uint16_t server_rtcp_port = 0;
+            int rtcp_fd = smolrtsp_dgram_socket(af, ip, client_port->rtcp_port);
+            if (rtcp_fd != -1) {
+                struct event *ev = event_new(
+                    c->loop->base, rtcp_fd, EV_READ | EV_PERSIST, on_rtcp_read_cb, c);
+                if (ev)
+                    event_add(ev, NULL);
+                track_open_rtcp(track, smolrtsp_transport_udp(rtcp_fd), rtcp_fd, -1, ev);
+                server_rtcp_port = local_port(rtcp_fd);
             }
 
-            // Include server_port using the ephemeral local port chosen for this socket.
-            struct sockaddr_storage local;
-            socklen_t local_len = sizeof local;
-            uint16_t server_rtp_port = 0;
-            if (getsockname(rtp_fd, (struct sockaddr *)&local, &local_len) == 0) {
-                if (local.ss_family == AF_INET)
-                    server_rtp_port = ntohs(((struct sockaddr_in *)&local)->sin_port);
-                else if (local.ss_family == AF_INET6)
-                    server_rtp_port = ntohs(((struct sockaddr_in6 *)&local)->sin6_port);
-            }
+            // Include server_port using the ephemeral local ports chosen for these sockets.
+            const uint16_t server_rtp_port = local_port(rtp_fd);
+            if (!server_rtcp_port)
+                server_rtcp_port = (uint16_t)(server_rtp_port + 1);
 
             if (server_rtp_port) {
                 smolrtsp_header(
                     ctx, SMOLRTSP_HEADER_TRANSPORT,
                     "RTP/AVP/UDP;unicast;client_port=%" PRIu16 "-%" PRIu16 ";server_port=%" PRIu16 "-%" PRIu16,
                     client_port->rtp_port, client_port->rtcp_port,
-                    server_rtp_port, (uint16_t)(server_rtp_port + 1));
+                    server_rtp_port, server_rtcp_port);
             } else {
                 smolrtsp_header(
                     ctx, SMOLRTSP_HEADER_TRANSPORT,
@@ -389,6 +995,17 @@ static void Controller_describe(VSelf, SmolRTSP_Context *ctx, const SmolRTSP_Req
         (SMOLRTSP_SDP_MEDIA, "video 0 RTP/AVP %d", VIDEO_PAYLOAD_TYPE),
         (SMOLRTSP_SDP_ATTR, "control:video"),
         (SMOLRTSP_SDP_ATTR, "rtpmap:%d %s/%d", VIDEO_PAYLOAD_TYPE, video_codec, VIDEO_CLOCK));
+    if (app_config.rtsp_header_ext) {
+        SMOLRTSP_SDP_DESCRIBE(
+            ret, w,
+            (SMOLRTSP_SDP_ATTR, "extmap:%d %s", EXT_ID_ABS_CAPTURE_TIME, EXT_URI_ABS_CAPTURE_TIME),
+            (SMOLRTSP_SDP_ATTR, "extmap:%d %s", EXT_ID_FRAME_MARKING, EXT_URI_FRAME_MARKING));
+    }
+    if (app_config.rtsp_nack_ms) {
+        SMOLRTSP_SDP_DESCRIBE(
+            ret, w,
+            (SMOLRTSP_SDP_ATTR, "rtcp-fb:%d nack", VIDEO_PAYLOAD_TYPE));
+    }
     // H.264 uses RFC6184 packetization-mode. For H.265 (RFC7798) this parameter
     // is not defined; omitting fmtp keeps clients happy.
     if (!app_config.mp4_codecH265) {
@@ -508,14 +1125,14 @@ static void Controller_setup(VSelf, SmolRTSP_Context *ctx, const SmolRTSP_Reques
         CharSlice99_primitive_ends_with(req->start_line.uri, CharSlice99_from_str("/audio"));
     const track_kind kind = is_audio ? TRACK_AUDIO : TRACK_VIDEO;
 
-    pthread_mutex_lock(&g_srv.mtx);
+    pthread_mutex_lock(&client->loop->mtx);
     if (!client->session_id)
         client->session_id = gen_session_id();
     if (setup_rtp_transport(client, ctx, cfg, kind) < 0) {
-        pthread_mutex_unlock(&g_srv.mtx);
+        pthread_mutex_unlock(&client->loop->mtx);
         return;
     }
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_unlock(&client->loop->mtx);
 
     smolrtsp_header(ctx, SMOLRTSP_HEADER_SESSION, "%llu;timeout=30", client->session_id);
     smolrtsp_respond_ok(ctx);
@@ -524,9 +1141,9 @@ static void Controller_setup(VSelf, SmolRTSP_Context *ctx, const SmolRTSP_Reques
 static void Controller_play(VSelf, SmolRTSP_Context *ctx, const SmolRTSP_Request *req) {
     (void)req;
     VSELF(Controller);
-    pthread_mutex_lock(&g_srv.mtx);
+    pthread_mutex_lock(&self->client->loop->mtx);
     self->client->playing = 1;
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_unlock(&self->client->loop->mtx);
     fprintf(stderr, "[rtsp] PLAY session=%llu\n", (unsigned long long)self->client->session_id);
     // Nudge encoder to send fresh IDR/SPS/PPS so new client can decode right away.
     request_idr();
@@ -541,16 +1158,14 @@ static void Controller_teardown(VSelf, SmolRTSP_Context *ctx, const SmolRTSP_Req
     // (smolrtsp_libevent_cb), because it will access the evbuffer after dispatch.
     smolrtsp_respond_ok(ctx);
 
-    pthread_mutex_lock(&g_srv.mtx);
+    RtspLoop *l = self->client->loop;
+    pthread_mutex_lock(&l->mtx);
     if (self->client) {
         SmolRtspClient *c = self->client;
         c->playing = 0;
         if (c->alive) {
             c->alive = 0;
-            if (g_client_count > 0)
-                g_client_count--;
-            if (g_client_count == 0)
-                reset_audio_ts();
+            client_count_dec();
         }
         c->closing = 1;
         if (c->bev) {
@@ -559,7 +1174,7 @@ static void Controller_teardown(VSelf, SmolRTSP_Context *ctx, const SmolRTSP_Req
             bufferevent_setcb(c->bev, NULL, on_write_close_cb, on_event_cb, c->dispatch_ctx);
         }
     }
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_unlock(&l->mtx);
 }
 
 static void Controller_unknown(VSelf, SmolRTSP_Context *ctx, const SmolRTSP_Request *req) {
@@ -582,64 +1197,6 @@ static void Controller_after(
         fprintf(stderr, "RTSP respond failed: %zd\n", ret);
 }
 
-// Drain oldest TCP interleaved ($ <ch> <len>) frames from the start of the
-// bufferevent output buffer until it shrinks to <= target_len.
-// Returns 0 if buffer is <= target_len or trimming succeeded; -1 if we cannot
-// safely trim (e.g. buffer doesn't begin with interleaved framing).
-static int trim_tcp_interleaved_oldest(struct bufferevent *bev, size_t target_len) {
-    if (!bev)
-        return -1;
-
-    bufferevent_lock(bev);
-    struct evbuffer *out = bufferevent_get_output(bev);
-    if (!out) {
-        bufferevent_unlock(bev);
-        return -1;
-    }
-
-    size_t len = evbuffer_get_length(out);
-    const size_t len_before = len;
-    if (len <= target_len) {
-        bufferevent_unlock(bev);
-        return 0;
-    }
-
-    unsigned char hdr[4];
-    if (evbuffer_copyout(out, hdr, sizeof hdr) != (ssize_t)sizeof hdr || hdr[0] != '$') {
-        bufferevent_unlock(bev);
-        return -1;
-    }
-
-    int drained_any = 0;
-    size_t drained_bytes = 0;
-    while (len > target_len) {
-        if (len < 4)
-            break;
-        if (evbuffer_copyout(out, hdr, sizeof hdr) != (ssize_t)sizeof hdr)
-            break;
-        if (hdr[0] != '$')
-            break;
-        const uint16_t payload_len = (uint16_t)(((uint16_t)hdr[2] << 8) | (uint16_t)hdr[3]);
-        const size_t frame_len = 4u + (size_t)payload_len;
-        if (frame_len <= 4 || frame_len > len) {
-            // Corrupt/partial framing: stop trimming to avoid desync.
-            break;
-        }
-        evbuffer_drain(out, frame_len);
-        drained_any = 1;
-        drained_bytes += frame_len;
-        len = evbuffer_get_length(out);
-    }
-
-    const size_t len_after = len;
-    bufferevent_unlock(bev);
-    if (drained_any) {
-        fprintf(stderr, "[rtsp] trim tcp output drained=%zu before=%zu after=%zu target=%zu\n",
-                drained_bytes, len_before, len_after, target_len);
-    }
-    return drained_any ? 0 : -1;
-}
-
 static size_t bev_output_len(struct bufferevent *bev) {
     if (!bev)
         return 0;
@@ -790,7 +1347,7 @@ static void update_sprop_h265_locked(const uint8_t *nal, size_t nal_len, uint8_t
 
 static inline void reset_audio_ts(void) {
     g_audio_ts_us = 0;
-    g_audio_ts_raw = 0;
+    __atomic_store_n(&g_audio_ts_raw, 0, __ATOMIC_RELAXED);
 }
 
 static void on_event_cb(struct bufferevent *bev, short events, void *ctx) {
@@ -800,10 +1357,13 @@ static void on_event_cb(struct bufferevent *bev, short events, void *ctx) {
             (events & BEV_EVENT_ERROR)   ? "ERROR" :
             (events & BEV_EVENT_TIMEOUT) ? "TIMEOUT" : "EOF";
         fprintf(stderr, "[rtsp] client event %s bev=%p\n", ev, (void *)bev);
+        RtspLoop *l = loop_of_bev(bev);
+        if (!l)
+            return;
         SmolRtspClient *target = NULL;
-        pthread_mutex_lock(&g_srv.mtx);
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            SmolRtspClient *c = &g_srv.clients[i];
+        pthread_mutex_lock(&l->mtx);
+        for (int i = 0; i < l->nclients; i++) {
+            SmolRtspClient *c = l->clients[i];
             if (!c->bev || c->bev != bev)
                 continue;
             if (!c->alive && !c->closing)
@@ -818,44 +1378,168 @@ static void on_event_cb(struct bufferevent *bev, short events, void *ctx) {
             const int was_alive = c->alive;
             c->alive = 0;
             c->closing = 1;
-            if (was_alive) {
-                if (g_client_count > 0)
-                    g_client_count--;
-                if (g_client_count == 0)
-                    reset_audio_ts();
-            }
+            if (was_alive)
+                client_count_dec();
             if (!c->drop_scheduled)
                 target = c;
             break;
         }
         if (target)
             target->drop_scheduled = 1;
-        pthread_mutex_unlock(&g_srv.mtx);
+        pthread_mutex_unlock(&l->mtx);
         if (target) {
             struct timeval tv = {.tv_sec = 0, .tv_usec = 0};
-            event_base_once(g_srv.base, -1, EV_TIMEOUT, drop_client_deferred, target, &tv);
+            event_base_once(l->base, -1, EV_TIMEOUT, drop_client_deferred, target, &tv);
         }
         // Do not propagate further; just return.
         return;
     }
 }
 
+// Splits interleaved binary frames ($ <ch> <len>) sent by the client, such as
+// RTCP receiver reports on channel 1/3, off the RTSP request stream before
+// handing the rest to the smolrtsp parser.
+static void on_read_cb(struct bufferevent *bev, void *arg) {
+    SmolRtspClient *c = arg;
+    struct evbuffer *in = bufferevent_get_input(bev);
+
+    for (;;) {
+        const size_t avail = evbuffer_get_length(in);
+        if (!avail || c->closing)
+            return;
+
+        unsigned char hdr[4];
+        if (evbuffer_copyout(in, hdr, 1) == 1 && hdr[0] == '$') {
+            if (avail < sizeof hdr || evbuffer_copyout(in, hdr, sizeof hdr) != (ssize_t)sizeof hdr)
+                return;
+            const size_t frame_len = ((size_t)hdr[2] << 8) | hdr[3];
+            if (avail < sizeof hdr + frame_len)
+                return;
+            evbuffer_drain(in, sizeof hdr);
+            const uint8_t *data = evbuffer_pullup(in, (ssize_t)frame_len);
+            if (data && frame_len) {
+                pthread_mutex_lock(&c->loop->mtx);
+                if ((c->video.active && c->video.rtcp_channel == hdr[1]) ||
+                    (c->audio.active && c->audio.rtcp_channel == hdr[1]))
+                    rtcp_handle_locked(c, data, frame_len);
+                pthread_mutex_unlock(&c->loop->mtx);
+            }
+            evbuffer_drain(in, frame_len);
+            continue;
+        }
+
+        smolrtsp_libevent_cb(bev, c->dispatch_ctx);
+        // Stop on a partial request; it is completed by the next read.
+        if (evbuffer_get_length(in) == avail)
+            return;
+    }
+}
+
+// Each loop reports for its own sessions, loop 0 for the multicast sender.
+static void rtcp_timer_cb(evutil_socket_t fd, short what, void *arg) {
+    (void)fd;
+    (void)what;
+    RtspLoop *l = arg;
+    pthread_mutex_lock(&l->mtx);
+    for (int i = 0; i < l->nclients; i++) {
+        SmolRtspClient *c = l->clients[i];
+        if (!c->alive || !c->playing)
+            continue;
+        track_send_sr(&c->video);
+        track_send_sr(&c->audio);
+    }
+    pthread_mutex_unlock(&l->mtx);
+    if (l->index)
+        return;
+    pthread_mutex_lock(&g_srv.mtx);
+    track_send_sr(&g_srv.mcast.video);
+    track_send_sr(&g_srv.mcast.audio);
+    pthread_mutex_unlock(&g_srv.mtx);
+}
+
+// Steps the encoder bitrate down while any session's output buffer is backing
+// up or its viewer reports loss, and back up after a few calm periods.
+static void abr_timer_cb(evutil_socket_t fd, short what, void *arg) {
+    (void)fd;
+    (void)what;
+    (void)arg;
+    const unsigned int max = app_config.rtsp_abr_max_kbps ?
+        app_config.rtsp_abr_max_kbps : (unsigned int)app_config.mp4_bitrate;
+    const unsigned int min = MIN(app_config.rtsp_abr_min_kbps, max);
+    const uint64_t now = monotonic_us();
+    size_t worst_depth = 0;
+    unsigned int worst_loss = 0;
+
+    const size_t limit = session_out_limit();
+    for (int k = 0; k < g_srv.nloops; k++) {
+        RtspLoop *l = &g_srv.loops[k];
+        pthread_mutex_lock(&l->mtx);
+        for (int i = 0; i < l->nclients; i++) {
+            SmolRtspClient *c = l->clients[i];
+            if (!c->alive || !c->playing)
+                continue;
+            // Interleaved tracks queue in the session's RTSP output buffer.
+            if ((c->video.active && c->video.fd < 0) || (c->audio.active && c->audio.fd < 0)) {
+                const size_t depth = bev_output_len(c->bev) * 100 / limit;
+                if (depth > worst_depth)
+                    worst_depth = depth;
+            }
+            if (c->video.active && c->video.have_rr && now - c->video.rr_us < ABR_RR_MAX_AGE_US &&
+                c->video.rr_fraction_lost > worst_loss)
+                worst_loss = c->video.rr_fraction_lost;
+        }
+        pthread_mutex_unlock(&l->mtx);
+    }
+
+    if (!g_srv.abr_kbps)
+        g_srv.abr_kbps = max;
+    unsigned int target = g_srv.abr_kbps;
+    // Loss is in 1/256 units: 13 ~ 5%, 3 ~ 1%.
+    if (worst_depth > 50 || worst_loss > 13) {
+        target = MAX(min, target * 3 / 4);
+        g_srv.abr_calm = 0;
+    } else if (worst_depth < 10 && worst_loss < 3) {
+        if (++g_srv.abr_calm >= ABR_CALM_TICKS && target < max) {
+            target = MIN(max, target + MAX(max / 10, 1));
+            g_srv.abr_calm = 0;
+        }
+    } else {
+        g_srv.abr_calm = 0;
+    }
+    if (target > max)
+        target = max;
+    if (target == g_srv.abr_kbps)
+        return;
+
+    if (media_set_video_bitrate(target)) {
+        fprintf(stderr, "[rtsp] abr: bitrate control unavailable, controller stopped\n");
+        event_del(g_srv.abr_timer);
+        return;
+    }
+    fprintf(stderr, "[rtsp] abr: bitrate %u -> %u kbps (buffer=%zu%% loss=%u/256)\n",
+            g_srv.abr_kbps, target, worst_depth, worst_loss);
+    g_srv.abr_kbps = target;
+}
+
 static void listener_cb(
     struct evconnlistener *listener, evutil_socket_t fd, struct sockaddr *sa,
     int socklen, void *arg) {
     (void)listener;
-    struct event_base *base = arg;
+    RtspLoop *l = arg;
+    // Only loop 0 listens in handoff mode, so next_loop has a single writer.
+    if (g_srv.handoff)
+        l = &g_srv.loops[g_srv.next_loop++ % (unsigned int)g_srv.nloops];
 
     struct bufferevent *bev =
-        bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
+        bufferevent_socket_new(l->base, fd, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
     if (!bev) {
         close(fd);
         return;
     }
 
-    pthread_mutex_lock(&g_srv.mtx);
-    SmolRtspClient *slot = alloc_client();
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_lock(&l->mtx);
+    SmolRtspClient *slot = alloc_client(l);
+    pthread_mutex_unlock(&l->mtx);
     if (!slot) {
         bufferevent_free(bev);
         return;
@@ -879,24 +1563,87 @@ static void listener_cb(
 
     struct timeval tv = {.tv_sec = 30, .tv_usec = 0};
     bufferevent_set_timeouts(bev, &tv, &tv);
-    bufferevent_setcb(bev, smolrtsp_libevent_cb, NULL, on_event_cb, slot->dispatch_ctx);
+    bufferevent_setcb(bev, on_read_cb, NULL, on_event_cb, slot);
     bufferevent_enable(bev, EV_READ | EV_WRITE);
 }
 
 static void *loop_fn(void *arg) {
-    SmolRtspServer *s = arg;
-    event_base_dispatch(s->base);
+    RtspLoop *l = arg;
+    event_base_dispatch(l->base);
+    free(g_video_pkts);
+    g_video_pkts = NULL;
+    g_video_pkts_cap = 0;
     return NULL;
 }
 
+// Sets up the event base of loop @index with its own listener on @sin: with
+// several loops every one binds the port with SO_REUSEPORT and the kernel
+// spreads the connections. Kernels without it (Linux < 3.9) get a single
+// listener on loop 0 that deals connections out.
+static int loop_init(RtspLoop *l, int index, const struct sockaddr_in *sin) {
+    l->index = index;
+    pthread_mutex_init(&l->mtx, NULL);
+    l->base = event_base_new();
+    if (!l->base)
+        return -1;
+
+    if (!g_srv.handoff) {
+        const unsigned int flags = LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE | LEV_OPT_THREADSAFE;
+        if (g_srv.nloops > 1)
+            l->listener = evconnlistener_new_bind(
+                l->base, listener_cb, l, flags | LEV_OPT_REUSEABLE_PORT, -1,
+                (const struct sockaddr *)sin, sizeof *sin);
+        if (!l->listener && index == 0)
+            l->listener = evconnlistener_new_bind(
+                l->base, listener_cb, l, flags, -1,
+                (const struct sockaddr *)sin, sizeof *sin);
+        if (!l->listener && index == 0)
+            return -1;
+        if (!l->listener) {
+            fprintf(stderr, "[rtsp] loop %d could not share the port, loop 0 hands connections out\n",
+                index);
+            // Loop 0 must accept alone, next_loop has no other writer.
+            for (int i = 1; i < index; i++) {
+                if (g_srv.loops[i].listener)
+                    evconnlistener_free(g_srv.loops[i].listener);
+                g_srv.loops[i].listener = NULL;
+            }
+            g_srv.handoff = 1;
+        } else if (g_srv.nloops > 1 && index == 0 &&
+            evutil_make_listen_socket_reuseable_port(evconnlistener_get_fd(l->listener))) {
+            fprintf(stderr, "[rtsp] SO_REUSEPORT unavailable, loop 0 accepts for all %d loops\n",
+                g_srv.nloops);
+            g_srv.handoff = 1;
+        }
+    }
+
+    const struct timeval rtcp_tv = {.tv_sec = RTCP_INTERVAL_S, .tv_usec = 0};
+    l->rtcp_timer = event_new(l->base, -1, EV_PERSIST, rtcp_timer_cb, l);
+    if (l->rtcp_timer)
+        event_add(l->rtcp_timer, &rtcp_tv);
+
+    l->wake_ev = event_new(l->base, -1, 0, on_wake_cb, l);
+    if (!l->wake_ev)
+        return -1;
+    return 0;
+}
+
 int smolrtsp_server_start(void) {
     srand(time(NULL));
     memset(&g_srv, 0, sizeof(g_srv));
     pthread_mutex_init(&g_srv.mtx, NULL);
+    g_srv.out_budget = (size_t)app_config.rtsp_out_budget_kb * 1024;
+    g_srv.mcast.fd = -1;
     evthread_use_pthreads();
 
-    g_srv.base = event_base_new();
-    if (!g_srv.base)
+    int nloops = (int)app_config.rtsp_threads;
+    if (!nloops) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nloops = cpus > 0 ? (int)cpus : 1;
+    }
+    g_srv.nloops = MIN(MAX(nloops, 1), RTSP_MAX_LOOPS);
+    g_srv.loops = calloc((size_t)g_srv.nloops, sizeof *g_srv.loops);
+    if (!g_srv.loops)
         return -1;
 
     struct sockaddr_in sin = {
@@ -914,16 +1661,25 @@ int smolrtsp_server_start(void) {
         }
     }
 
-    g_srv.listener = evconnlistener_new_bind(
-        g_srv.base, listener_cb, g_srv.base,
-        LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE | LEV_OPT_THREADSAFE, -1,
-        (struct sockaddr *)&sin, sizeof(sin));
-    if (!g_srv.listener)
-        return -1;
+    for (int i = 0; i < g_srv.nloops; i++)
+        if (loop_init(&g_srv.loops[i], i, &sin))
+            return -1;
+
+    if (app_config.rtsp_abr_enable) {
+        const struct timeval abr_tv = {.tv_sec = ABR_INTERVAL_S, .tv_usec = 0};
+        g_srv.abr_timer = event_new(g_srv.loops[0].base, -1, EV_PERSIST, abr_timer_cb, NULL);
+        if (g_srv.abr_timer)
+            event_add(g_srv.abr_timer, &abr_tv);
+    }
 
     g_srv.running = 1;
-    if (pthread_create(&g_srv.loop_thread, NULL, loop_fn, &g_srv))
-        return -1;
+    for (int i = 0; i < g_srv.nloops; i++) {
+        RtspLoop *l = &g_srv.loops[i];
+        if (pthread_create(&l->thread, NULL, loop_fn, l))
+            return -1;
+    }
+    if (g_srv.nloops > 1)
+        fprintf(stderr, "[rtsp] serving on %d event loops\n", g_srv.nloops);
 
     return 0;
 }
@@ -933,21 +1689,37 @@ void smolrtsp_server_stop(void) {
         return;
 
     g_srv.running = 0;
-    if (g_srv.base) {
-        event_base_loopbreak(g_srv.base);
+    for (int i = 0; i < g_srv.nloops; i++)
+        if (g_srv.loops[i].base)
+            event_base_loopbreak(g_srv.loops[i].base);
+    for (int i = 0; i < g_srv.nloops; i++)
+        if (g_srv.loops[i].thread)
+            pthread_join(g_srv.loops[i].thread, NULL);
+
+    if (g_srv.abr_timer)
+        event_free(g_srv.abr_timer);
+    for (int i = 0; i < g_srv.nloops; i++) {
+        RtspLoop *l = &g_srv.loops[i];
+        pthread_mutex_lock(&l->mtx);
+        for (int k = 0; k < l->nclients; k++) {
+            drop_client(l->clients[k]);
+            free(l->clients[k]);
+        }
+        free(l->clients);
+        pthread_mutex_unlock(&l->mtx);
+
+        if (l->rtcp_timer)
+            event_free(l->rtcp_timer);
+        if (l->wake_ev)
+            event_free(l->wake_ev);
+        frame_queues_flush(l);
+        if (l->listener)
+            evconnlistener_free(l->listener);
+        if (l->base)
+            event_base_free(l->base);
+        pthread_mutex_destroy(&l->mtx);
     }
-    if (g_srv.loop_thread)
-        pthread_join(g_srv.loop_thread, NULL);
-
-    pthread_mutex_lock(&g_srv.mtx);
-    for (int i = 0; i < MAX_CLIENTS; i++)
-        drop_client(&g_srv.clients[i]);
-    pthread_mutex_unlock(&g_srv.mtx);
-
-    if (g_srv.listener)
-        evconnlistener_free(g_srv.listener);
-    if (g_srv.base)
-        event_base_free(g_srv.base);
+    free(g_srv.loops);
     pthread_mutex_destroy(&g_srv.mtx);
     memset(&g_srv, 0, sizeof(g_srv));
 }
@@ -960,34 +1732,216 @@ static size_t skip_start_code(const uint8_t *buf, size_t len) {
     return 0;
 }
 
-int smolrtsp_push_video(const uint8_t *buf, size_t len, int is_h265, uint64_t ts_us) {
-    if (!g_srv.running || !buf || len < 2)
-        return -1;
+// Splits a NAL unit into its RTP packet list (single NAL unit or FU-A/FU
+// fragments, RFC 6184 5.8 / RFC 7798 4.4.3), mirroring SmolRTSP_NalTransport.
+// Returns the packet count, or 0 on failure. Caller holds g_srv.mtx.
+static size_t build_video_packets_locked(SmolRTSP_NalUnit nalu) {
+    const SmolRTSP_NalTransportConfig cfg = SmolRTSP_NalTransportConfig_default();
+    const size_t max_packet_size = MATCHES(nalu.header, SmolRTSP_NalHeader_H264)
+        ? cfg.max_h264_nalu_size : cfg.max_h265_nalu_size;
+    const size_t hdr_size = SmolRTSP_NalHeader_size(nalu.header);
+
+    if (hdr_size + nalu.payload.len <= max_packet_size) {
+        if (!g_video_pkts_cap) {
+            g_video_pkts = malloc(sizeof *g_video_pkts);
+            if (!g_video_pkts)
+                return 0;
+            g_video_pkts_cap = 1;
+        }
+        RtpPacketDesc *p = &g_video_pkts[0];
+        SmolRTSP_NalHeader_serialize(nalu.header, p->hdr);
+        p->hdr_len = (uint8_t)hdr_size;
+        p->payload = nalu.payload.ptr;
+        p->payload_len = nalu.payload.len;
+        p->marker = SmolRTSP_NalHeader_is_coded_slice_idr(nalu.header) ||
+            SmolRTSP_NalHeader_is_coded_slice_non_idr(nalu.header);
+        return 1;
+    }
 
-    size_t offset = skip_start_code(buf, len);
-    if (offset >= len)
-        return -1;
+    const size_t fu_size = SmolRTSP_NalHeader_fu_size(nalu.header);
+    if (max_packet_size <= fu_size || fu_size > sizeof g_video_pkts->hdr)
+        return 0;
+    const size_t frag = max_packet_size - fu_size;
+    const size_t count = (nalu.payload.len + frag - 1) / frag;
+    if (count > g_video_pkts_cap) {
+        RtpPacketDesc *grown = realloc(g_video_pkts, count * sizeof *grown);
+        if (!grown)
+            return 0;
+        g_video_pkts = grown;
+        g_video_pkts_cap = count;
+    }
 
-    // Collect codec parameter sets for SDP (best-effort).
-    // This helps clients like ffplay decode immediately (avoids "non-existing PPS").
+    for (size_t i = 0; i < count; i++) {
+        RtpPacketDesc *p = &g_video_pkts[i];
+        const size_t off = i * frag;
+        const int first = i == 0, last = i == count - 1;
+        SmolRTSP_NalHeader_write_fu_header(nalu.header, p->hdr, first, last);
+        p->hdr_len = (uint8_t)fu_size;
+        p->payload = nalu.payload.ptr + off;
+        p->payload_len = last ? nalu.payload.len - off : frag;
+        p->marker = last;
+    }
+    return count;
+}
+
+typedef enum {
+    VIDEO_NAL_OTHER,    // SEI, AUD...: follows the fate of its access unit
+    VIDEO_NAL_PARAM,    // VPS/SPS/PPS
+    VIDEO_NAL_IRAP,     // IDR (H.264) or IRAP (H.265) slice
+    VIDEO_NAL_REF,      // slice other frames may reference
+    VIDEO_NAL_NONREF    // slice no other frame references
+} video_nal_class;
+
+static video_nal_class classify_nal(const uint8_t *nal, int is_h265) {
     if (is_h265) {
-        if (len - offset >= 2) {
-            const uint8_t nal_type = (uint8_t)((buf[offset] >> 1) & 0x3F);
-            if (nal_type == H265_NAL_TYPE_VPS || nal_type == H265_NAL_TYPE_SPS || nal_type == H265_NAL_TYPE_PPS) {
-                pthread_mutex_lock(&g_srv.mtx);
-                update_sprop_h265_locked(buf + offset, len - offset, nal_type);
-                pthread_mutex_unlock(&g_srv.mtx);
-            }
-        }
-    } else {
-        const uint8_t nal_type = (uint8_t)(buf[offset] & 0x1F);
-        if (nal_type == H264_NAL_TYPE_SPS || nal_type == H264_NAL_TYPE_PPS) {
-            pthread_mutex_lock(&g_srv.mtx);
-            update_sprop_h264_locked(buf + offset, len - offset, nal_type);
-            pthread_mutex_unlock(&g_srv.mtx);
+        const uint8_t type = (uint8_t)((nal[0] >> 1) & 0x3F);
+        if (type >= H265_NAL_TYPE_VPS && type <= H265_NAL_TYPE_PPS)
+            return VIDEO_NAL_PARAM;
+        if (type >= 16 && type <= 23)
+            return VIDEO_NAL_IRAP;
+        // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and reserved sub-layer
+        // non-reference types are the even ones below 16.
+        if (type <= 14)
+            return (type & 1) ? VIDEO_NAL_REF : VIDEO_NAL_NONREF;
+        return VIDEO_NAL_OTHER;
+    }
+    const uint8_t type = (uint8_t)(nal[0] & 0x1F);
+    if (type == H264_NAL_TYPE_SPS || type == H264_NAL_TYPE_PPS)
+        return VIDEO_NAL_PARAM;
+    if (type == 5)
+        return VIDEO_NAL_IRAP;
+    if (type >= 1 && type <= 4)
+        return ((nal[0] >> 5) & 3) ? VIDEO_NAL_REF : VIDEO_NAL_NONREF;
+    return VIDEO_NAL_OTHER;
+}
+
+enum {
+    AU_NONE,
+    AU_KEEP,
+    AU_DROP,
+    AU_CANDIDATE    // may hold the IRAP a session is waiting for
+};
+
+static void video_au_drop(SmolRtspClient *c) {
+    if (c->au_state == AU_DROP)
+        return;
+    c->au_state = AU_DROP;
+    c->drops_frames++;
+}
+
+// Decides whether a NAL unit is withheld from a session whose output buffer
+// is backing up. The decision is taken once per access unit, keyed on its RTP
+// timestamp. Above half of its share, non-reference frames are dropped whole;
+// above the share, everything is dropped up to the next access unit holding
+// an IRAP slice, so the viewer always gets decodable video at a lower frame
+// rate. Sets *want_idr when the encoder should be asked for an early IDR.
+// Caller holds mtx.
+static int video_drop_locked(
+    SmolRtspClient *c, video_nal_class cls, uint32_t ts, size_t limit, int *want_idr) {
+    const size_t out_len = bev_output_len(c->bev);
+    const int slice = cls == VIDEO_NAL_IRAP || cls == VIDEO_NAL_REF || cls == VIDEO_NAL_NONREF;
+
+    if (c->au_state == AU_NONE || ts != c->au_ts) {
+        c->au_ts = ts;
+        c->au_slices = 0;
+        c->au_state = AU_KEEP;
+        if (c->drop_until_irap) {
+            if (out_len > limit)
+                video_au_drop(c);
+            else
+                c->au_state = AU_CANDIDATE;
+        } else if (out_len > limit) {
+            c->drop_until_irap = 1;
+            c->drops_gops++;
+            if (app_config.rtsp_drop_request_idr)
+                *want_idr = 1;
+            fprintf(stderr, "[rtsp] video congested, skipping to next keyframe session=%llu len=%zu max=%zu\n",
+                    (unsigned long long)c->session_id, out_len, limit);
+            video_au_drop(c);
         }
+    } else if (c->drop_until_irap && c->au_state == AU_KEEP) {
+        // Frames were lost in the middle of this one, nothing more of it helps
+        video_au_drop(c);
     }
 
+    if (c->au_state == AU_CANDIDATE) {
+        // Parameter sets go through, the access unit only if it is an IRAP
+        if (cls == VIDEO_NAL_IRAP) {
+            c->drop_until_irap = 0;
+            c->au_state = AU_KEEP;
+            fprintf(stderr, "[rtsp] video resumed at keyframe session=%llu dropped=%u\n",
+                    (unsigned long long)c->session_id, c->drops_frames);
+        } else if (slice)
+            video_au_drop(c);
+        else
+            return cls != VIDEO_NAL_PARAM;
+    } else if (c->au_state == AU_KEEP && !c->au_slices &&
+        cls == VIDEO_NAL_NONREF && out_len > limit / 2) {
+        // Judged on the first slice, so a frame is never split
+        c->drops_nonref++;
+        video_au_drop(c);
+    }
+
+    if (c->au_state == AU_DROP)
+        return 1;
+    if (slice)
+        c->au_slices++;
+    return 0;
+}
+
+// Runs on the event loop thread for every queued video NAL unit.
+// Builds the header extension block announced in the SDP: abs-capture-time
+// (64-bit NTP wall clock of the capture) and a frame marking byte with the
+// S(tart), E(nd), I(ndependent) and D(iscardable) flags. Returns its length.
+static size_t build_video_ext(uint8_t *ext, uint64_t capture_ntp, int end,
+    video_nal_class cls) {
+    ext[0] = 0xBE;
+    ext[1] = 0xDE;
+    ext[2] = 0;
+    ext[3] = 3; // 32-bit words following the header
+    ext[4] = (EXT_ID_ABS_CAPTURE_TIME << 4) | (8 - 1);
+    for (int i = 0; i < 8; i++)
+        ext[5 + i] = (uint8_t)(capture_ntp >> (56 - 8 * i));
+    ext[13] = (EXT_ID_FRAME_MARKING << 4) | (1 - 1);
+    ext[14] = 0x80 | (end ? 0x40 : 0) |
+        ((cls == VIDEO_NAL_IRAP || cls == VIDEO_NAL_PARAM) ? 0x20 : 0) |
+        (cls == VIDEO_NAL_NONREF ? 0x10 : 0);
+    ext[15] = 0; // padding
+    return RTP_EXT_MAX;
+}
+
+// Sends the shared packet list of one NAL unit. UDP transports collect the
+// packets and push them out with a single sendmmsg()/GSO call; the payloads
+// live in the queued frame, which outlasts the flush. The header extension,
+// if any, only goes on the packet that opens a new frame on this track.
+static int track_send_video_locked(RtspTrack *t, uint32_t ts, size_t npkts,
+    const uint8_t *ext, size_t ext_len) {
+    if (t->packets && ts + t->ts_offset == t->last_rtp_ts)
+        ext_len = 0;
+    const int batched = smolrtsp_transport_udp_batch(t->tx) == 0;
+    int ret = 0;
+    for (size_t p = 0; p < npkts && ret == 0; p++) {
+        const RtpPacketDesc *d = &g_video_pkts[p];
+        ret = track_send(t, ts, d->marker, ext, p ? 0 : ext_len,
+            d->hdr, d->hdr_len, d->payload, d->payload_len);
+    }
+    if (batched && smolrtsp_transport_udp_flush(t->tx) == -1)
+        ret = -1;
+    return ret;
+}
+
+// Runs on each event loop thread for every queued video NAL unit.
+static int send_video(RtspLoop *l, const RtspFrame *f) {
+    const uint8_t *buf = f->data;
+    const size_t len = f->len;
+    const int is_h265 = f->is_h265;
+    if (!g_srv.running || len < 2)
+        return -1;
+
+    size_t offset = skip_start_code(buf, len);
+    if (offset >= len)
+        return -1;
+
     SmolRTSP_NalUnit nalu;
     if (is_h265) {
         if (len - offset < 2) {
@@ -1005,73 +1959,90 @@ int smolrtsp_push_video(const uint8_t *buf, size_t len, int is_h265, uint64_t ts
             (uint8_t *)(buf + offset + 1), (uint8_t *)(buf + len));
     }
 
-    // If upstream timestamp is missing/zero, use monotonic time (us) so RTP
-    // timestamps advance and clients don't report excessive reordering/drops.
-    if (!ts_us)
-        ts_us = monotonic_us();
-    SmolRTSP_RtpTimestamp ts = SmolRTSP_RtpTimestamp_SysClockUs(ts_us);
+    const uint32_t ts = rtp_clock_ts(f->ts_us, VIDEO_CLOCK);
+    const video_nal_class cls = classify_nal(buf + offset, is_h265);
+    uint8_t ext[RTP_EXT_MAX];
+    size_t ext_len = 0;
 
-    pthread_mutex_lock(&g_srv.mtx);
+    pthread_mutex_lock(&l->mtx);
+    const size_t limit = session_out_limit();
+    size_t npkts = 0;
     int sent = 0;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        SmolRtspClient *c = &g_srv.clients[i];
-        if (!c->alive || !c->video_nal || !c->playing)
+    int want_mcast = 0;
+    int want_idr = 0;
+    for (int i = 0; i < l->nclients; i++) {
+        SmolRtspClient *c = l->clients[i];
+        if (!c->alive || !c->playing)
             continue;
+        if (c->video.multicast) {
+            want_mcast = 1;
+            continue;
+        }
+        if (!c->video.active)
+            continue;
+        // Packetize lazily on the first receiving session, then share the list.
+        if (!npkts && !(npkts = build_video_packets_locked(nalu)))
+            break;
+        if (app_config.rtsp_header_ext && !ext_len)
+            ext_len = build_video_ext(ext, f->capture_ntp, npkts == 1 && g_video_pkts[0].marker, cls);
         // IMPORTANT: In RTSP/TCP interleaved mode, audio/video share one output buffer.
         // Under poor TCP conditions video can starve audio. Prefer keeping audio alive:
-        // if output is congested, drop VIDEO packets (do not enqueue them).
-        const size_t out_len = bev_output_len(c->bev);
-        if (out_len > RTSP_TCP_MAX_BUFFER) {
-            // TCP output is congested; drop oldest interleaved frames to recover.
-            // If we can't trim safely, fall back to dropping newest video.
-            if (trim_tcp_interleaved_oldest(c->bev, RTSP_TCP_TRIM_TARGET) < 0) {
-                static uint64_t last_log = 0;
-                uint64_t now = monotonic_us();
-                if (now - last_log > 1000 * 1000ULL) {
-                    fprintf(stderr,
-                        "[rtsp] video drop: tcp buffer full (no trim) session=%llu len=%zu max=%u target=%u\n",
-                        (unsigned long long)c->session_id, out_len,
-                        (unsigned)RTSP_TCP_MAX_BUFFER, (unsigned)RTSP_TCP_TRIM_TARGET);
-                    last_log = now;
-                }
-                continue;
-            }
-        }
+        // if output is congested, drop whole VIDEO frames (never part of one).
+        if (video_drop_locked(c, cls, ts, limit, &want_idr))
+            continue;
 
-        if (SmolRTSP_NalTransport_is_full(c->video_nal)) {
-            static uint64_t last_log = 0;
+        if (VCALL(c->video.tx, is_full)) {
             uint64_t now = monotonic_us();
-            if (now - last_log > 1000 * 1000ULL) {
+            if (now - l->last_full_log > 1000 * 1000ULL) {
                 const size_t cur = bev_output_len(c->bev);
                 fprintf(stderr,
                     "[rtsp] video drop: transport full session=%llu len=%zu max=%u\n",
                     (unsigned long long)c->session_id, cur, (unsigned)RTSP_TCP_MAX_BUFFER);
-                last_log = now;
+                l->last_full_log = now;
             }
+            // Whatever follows would reference this frame.
+            c->drop_until_irap = 1;
             continue;
         }
-        int ret = SmolRTSP_NalTransport_send_packet(c->video_nal, ts, nalu);
-        if (ret < 0) {
+        if (track_send_video_locked(&c->video, ts, npkts, ext, ext_len) < 0) {
             // Best-effort send; skip on error.
             continue;
         }
         sent++;
     }
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_unlock(&l->mtx);
+
+    if (want_mcast) {
+        // Every loop serving a multicast viewer gets here; the first one
+        // feeds the shared sender.
+        pthread_mutex_lock(&g_srv.mtx);
+        if (g_srv.mcast.video.active && f->id > g_srv.mcast.video_id &&
+            (npkts || (npkts = build_video_packets_locked(nalu)))) {
+            g_srv.mcast.video_id = f->id;
+            if (app_config.rtsp_header_ext && !ext_len)
+                ext_len = build_video_ext(ext, f->capture_ntp, npkts == 1 && g_video_pkts[0].marker, cls);
+            track_send_video_locked(&g_srv.mcast.video, ts, npkts, ext, ext_len);
+        }
+        pthread_mutex_unlock(&g_srv.mtx);
+    }
+
+    if (want_idr) {
+        const uint64_t now = monotonic_us();
+        if (now - l->last_idr_request > DROP_IDR_INTERVAL_US) {
+            l->last_idr_request = now;
+            request_idr();
+        }
+    }
     return 0;
 }
 
-int smolrtsp_push_aac(const uint8_t *buf, size_t len, uint64_t ts_us) {
-    if (!g_srv.running || !buf || !len)
+// Runs on each event loop thread for every queued AAC frame.
+static int send_aac(RtspLoop *l, const RtspFrame *f) {
+    const uint8_t *buf = f->data;
+    const size_t len = f->len;
+    const uint32_t ts = f->rtp_ts;
+    if (!g_srv.running || !len)
         return -1;
-    SmolRTSP_RtpTimestamp ts;
-    if (!ts_us) {
-        uint32_t raw = g_audio_ts_raw;
-        g_audio_ts_raw += audio_ts_step();
-        ts = SmolRTSP_RtpTimestamp_Raw(raw);
-    } else {
-        ts = SmolRTSP_RtpTimestamp_SysClockUs(ts_us);
-    }
 
     // RFC 3640 AU headers: 16-bit AU-headers-length, then one AU header (size/offset).
     uint8_t au_header_section[4] = {0};
@@ -1083,31 +2054,250 @@ int smolrtsp_push_aac(const uint8_t *buf, size_t len, uint64_t ts_us) {
     au_header_section[2] = (uint8_t)((au >> 8) & 0xFF);
     au_header_section[3] = (uint8_t)(au & 0xFF);
 
-    U8Slice99 hdr = U8Slice99_new(au_header_section, sizeof au_header_section);
-    U8Slice99 payload = U8Slice99_from_ptrdiff((uint8_t *)buf, (uint8_t *)(buf + len));
-
-    pthread_mutex_lock(&g_srv.mtx);
+    pthread_mutex_lock(&l->mtx);
+    const size_t limit = session_out_limit();
     int sent = 0;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        SmolRtspClient *c = &g_srv.clients[i];
-        if (!c->alive || !c->audio_rtp || !c->playing)
+    int want_mcast = 0;
+    for (int i = 0; i < l->nclients; i++) {
+        SmolRtspClient *c = l->clients[i];
+        if (!c->alive || !c->playing)
+            continue;
+        if (c->audio.multicast) {
+            want_mcast = 1;
+            continue;
+        }
+        if (!c->audio.active)
+            continue;
+        // Queued data is never trimmed (that would cut video frames apart);
+        // video backs off first, audio is only dropped past the session's share.
+        if (VCALL(c->audio.tx, is_full) || bev_output_len(c->bev) > limit) {
+            c->drops_audio++;
             continue;
-        if (SmolRTSP_RtpTransport_is_full(c->audio_rtp)) {
-            // Prefer freshest: drop oldest queued interleaved frames, then send new.
-            if (trim_tcp_interleaved_oldest(c->bev, RTSP_TCP_TRIM_TARGET) < 0) {
-                fprintf(stderr,
-                    "[rtsp] audio drop: buffer full (no trim) session=%llu len=%zu\n",
-                    (unsigned long long)c->session_id, bev_output_len(c->bev));
-                continue; // can't trim safely -> drop newest
-            }
         }
-        int ret = SmolRTSP_RtpTransport_send_packet(
-            c->audio_rtp, ts, true, hdr, payload);
+        int ret = track_send(&c->audio, ts, 1, NULL, 0,
+            au_header_section, sizeof au_header_section, buf, len);
         if (ret < 0)
             continue;
         sent++;
     }
-    pthread_mutex_unlock(&g_srv.mtx);
+    pthread_mutex_unlock(&l->mtx);
+
+    if (want_mcast) {
+        pthread_mutex_lock(&g_srv.mtx);
+        if (g_srv.mcast.audio.active && f->id > g_srv.mcast.audio_id) {
+            g_srv.mcast.audio_id = f->id;
+            track_send(&g_srv.mcast.audio, ts, 1, NULL, 0,
+                au_header_section, sizeof au_header_section, buf, len);
+        }
+        pthread_mutex_unlock(&g_srv.mtx);
+    }
 
     return 0;
 }
+
+static int frame_queue_push(RtspLoop *l, RtspFrameQueue *q, RtspFrame *f) {
+    const unsigned int head = q->head;
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= FRAME_QUEUE_LEN) {
+        __atomic_store_n(&q->overflow, 1, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    q->slots[head % FRAME_QUEUE_LEN] = f;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+    if (!__atomic_exchange_n(&l->wake_pending, 1, __ATOMIC_ACQ_REL))
+        event_active(l->wake_ev, EV_READ, 0);
+    return 0;
+}
+
+static RtspFrame *frame_queue_pop(RtspFrameQueue *q) {
+    const unsigned int tail = q->tail;
+    if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+        return NULL;
+    RtspFrame *f = q->slots[tail % FRAME_QUEUE_LEN];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return f;
+}
+
+static RtspFrame *frame_new(const uint8_t *buf, size_t len) {
+    RtspFrame *f = malloc(sizeof *f + len);
+    if (!f)
+        return NULL;
+    memset(f, 0, sizeof *f);
+    f->len = len;
+    memcpy(f->data, buf, len);
+    f->id = __atomic_add_fetch(&g_srv.frame_id, 1, __ATOMIC_RELAXED);
+    return f;
+}
+
+static void frame_release(RtspFrame *f) {
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(f);
+}
+
+// Queues one frame on every loop. The frame belongs to the loops afterwards,
+// even when none of them had room for it.
+static int frame_publish(RtspFrame *f, int audio) {
+    int taken = 0;
+    f->refs = g_srv.nloops;
+    for (int i = 0; i < g_srv.nloops; i++) {
+        RtspLoop *l = &g_srv.loops[i];
+        if (frame_queue_push(l, audio ? &l->audio_q : &l->video_q, f) == 0)
+            taken++;
+        else
+            frame_release(f);
+    }
+    return taken ? 0 : -1;
+}
+
+static void frame_queues_flush(RtspLoop *l) {
+    RtspFrame *f;
+    while ((f = frame_queue_pop(&l->video_q)))
+        frame_release(f);
+    while ((f = frame_queue_pop(&l->audio_q)))
+        frame_release(f);
+    l->video_q.overflow = l->audio_q.overflow = 0;
+    l->wake_pending = 0;
+}
+
+static void on_wake_cb(evutil_socket_t fd, short what, void *arg) {
+    (void)fd;
+    (void)what;
+    RtspLoop *l = arg;
+    __atomic_store_n(&l->wake_pending, 0, __ATOMIC_SEQ_CST);
+
+    // A lost video frame breaks the references of what follows it: let every
+    // session of this loop resume at the next keyframe.
+    if (__atomic_exchange_n(&l->video_q.overflow, 0, __ATOMIC_ACQ_REL)) {
+        fprintf(stderr, "[rtsp] loop %d: video queue overflow, resyncing sessions at next keyframe\n",
+            l->index);
+        pthread_mutex_lock(&l->mtx);
+        for (int i = 0; i < l->nclients; i++)
+            if (l->clients[i]->alive)
+                l->clients[i]->drop_until_irap = 1;
+        pthread_mutex_unlock(&l->mtx);
+    }
+    if (__atomic_exchange_n(&l->audio_q.overflow, 0, __ATOMIC_ACQ_REL))
+        fprintf(stderr, "[rtsp] loop %d: audio queue overflow, frames dropped\n", l->index);
+
+    RtspFrame *f;
+    while ((f = frame_queue_pop(&l->video_q))) {
+        send_video(l, f);
+        frame_release(f);
+    }
+    while ((f = frame_queue_pop(&l->audio_q))) {
+        send_aac(l, f);
+        frame_release(f);
+    }
+}
+
+int smolrtsp_push_video(const uint8_t *buf, size_t len, int is_h265, uint64_t ts_us) {
+    if (!g_srv.running || !buf || len < 2)
+        return -1;
+    // If upstream timestamp is missing/zero, use monotonic time (us) so RTP
+    // timestamps advance and clients don't report excessive reordering/drops.
+    const uint64_t now = monotonic_us();
+    if (!ts_us)
+        ts_us = now;
+
+    const size_t offset = skip_start_code(buf, len);
+    if (offset >= len)
+        return -1;
+    // Collect codec parameter sets for SDP (best-effort).
+    // This helps clients like ffplay decode immediately (avoids "non-existing PPS").
+    if (is_h265) {
+        if (len - offset >= 2) {
+            const uint8_t nal_type = (uint8_t)((buf[offset] >> 1) & 0x3F);
+            if (nal_type == H265_NAL_TYPE_VPS || nal_type == H265_NAL_TYPE_SPS || nal_type == H265_NAL_TYPE_PPS) {
+                pthread_mutex_lock(&g_srv.mtx);
+                update_sprop_h265_locked(buf + offset, len - offset, nal_type);
+                pthread_mutex_unlock(&g_srv.mtx);
+            }
+        }
+    } else {
+        const uint8_t nal_type = (uint8_t)(buf[offset] & 0x1F);
+        if (nal_type == H264_NAL_TYPE_SPS || nal_type == H264_NAL_TYPE_PPS) {
+            pthread_mutex_lock(&g_srv.mtx);
+            update_sprop_h264_locked(buf + offset, len - offset, nal_type);
+            pthread_mutex_unlock(&g_srv.mtx);
+        }
+    }
+
+    RtspFrame *f = frame_new(buf, len);
+    if (!f)
+        return -1;
+    f->ts_us = ts_us;
+    f->is_h265 = is_h265;
+    if (app_config.rtsp_header_ext) {
+        // The HAL stamps frames on the monotonic clock: back-date the wall
+        // clock by the frame's age, unless the stamp is clearly on another base.
+        const uint64_t age_us = (ts_us <= now && now - ts_us < 1000000ULL) ? now - ts_us : 0;
+        f->capture_ntp = ntp_now() - ((age_us << 32) / 1000000ULL);
+    }
+    return frame_publish(f, 0);
+}
+
+int smolrtsp_push_aac(const uint8_t *buf, size_t len, uint64_t ts_us) {
+    if (!g_srv.running || !buf || !len)
+        return -1;
+    RtspFrame *f = frame_new(buf, len);
+    if (!f)
+        return -1;
+    f->ts_us = ts_us;
+    if (!ts_us)
+        f->rtp_ts = __atomic_fetch_add(&g_audio_ts_raw, audio_ts_step(), __ATOMIC_RELAXED);
+    else
+        f->rtp_ts = rtp_clock_ts(ts_us, audio_clock_hz());
+    return frame_publish(f, 1);
+}
+
+static int track_status_json(char *buf, size_t len, const char *name, const RtspTrack *t) {
+    if (!t->active && !t->multicast)
+        return snprintf(buf, len, "\"%s\":null", name);
+    if (!t->have_rr)
+        return snprintf(buf, len, "\"%s\":{\"packets\":%u,\"octets\":%u}",
+            name, t->packets, t->octets);
+    return snprintf(buf, len,
+        "\"%s\":{\"packets\":%u,\"octets\":%u,\"loss\":%.1f,\"lost\":%d,"
+        "\"jitter_ms\":%.1f,\"rtt_ms\":%.1f,\"retransmits\":%u}",
+        name, t->packets, t->octets, t->rr_fraction_lost * 100.0 / 256,
+        t->rr_cum_lost, t->clock ? t->rr_jitter * 1000.0 / t->clock : 0.0,
+        t->rr_rtt_us / 1000.0, t->rtx_packets);
+}
+
+size_t smolrtsp_status_json(char *buf, size_t len) {
+    if (len < 3)
+        return 0;
+    size_t used = 0;
+    buf[used++] = '[';
+    for (int k = 0; g_srv.running && k < g_srv.nloops; k++) {
+        RtspLoop *l = &g_srv.loops[k];
+        pthread_mutex_lock(&l->mtx);
+        for (int i = 0; i < l->nclients; i++) {
+            const SmolRtspClient *c = l->clients[i];
+            if (!c->alive)
+                continue;
+            char entry[768], video[224], audio[224];
+            track_status_json(video, sizeof video, "video", &c->video);
+            track_status_json(audio, sizeof audio, "audio", &c->audio);
+            const char *transport =
+                (c->video.multicast || c->audio.multicast) ? "multicast" :
+                (c->video.fd > 0 || c->audio.fd > 0) ? "udp" : "tcp";
+            const int n = snprintf(entry, sizeof entry,
+                "%s{\"session\":\"%llu\",\"transport\":\"%s\",\"playing\":%s,%s,%s,"
+                "\"dropped\":{\"frames\":%u,\"nonref\":%u,\"gops\":%u,\"audio\":%u}}",
+                used > 1 ? "," : "", (unsigned long long)c->session_id, transport,
+                c->playing ? "true" : "false", video, audio,
+                c->drops_frames, c->drops_nonref, c->drops_gops, c->drops_audio);
+            // Keep the array well-formed when the caller's buffer runs out.
+            if (n < 0 || (size_t)n >= sizeof entry || used + (size_t)n + 2 > len)
+                break;
+            memcpy(buf + used, entry, (size_t)n);
+            used += (size_t)n;
+        }
+        pthread_mutex_unlock(&l->mtx);
+    }
+    buf[used++] = ']';
+    buf[used] = '\0';
+    return used;
+}
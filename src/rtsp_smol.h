@@ -8,7 +8,14 @@ int smolrtsp_server_start(void);
 void smolrtsp_server_stop(void);
 
 // Push encoded elementary streams into all active RTSP sessions.
+// The data is copied and queued; packetization and sending happen on the
+// RTSP event loop thread, so these never block on clients.
 // Video buffer should be a single NALU with start code (H.264/H.265).
 int smolrtsp_push_video(const uint8_t *buf, size_t len, int is_h265, uint64_t ts_us);
 // AAC-LC elementary stream; timestamp in microseconds (if unavailable pass 0).
 int smolrtsp_push_aac(const uint8_t *buf, size_t len, uint64_t ts_us);
+
+// Writes a JSON array describing the live RTSP sessions (RTP counters and,
+// once a receiver report arrived, loss/jitter/RTT per track). Never writes
+// more than len bytes including the terminator; returns the length written.
+size_t smolrtsp_status_json(char *buf, size_t len);
@@ -92,7 +92,7 @@ static bool decode_cfg_pin_for_log(int cfg, int *pin_out) {
     return true;
 }
 
-static void close_socket_fd(int sockFd) {
+void close_socket_fd(int sockFd) {
     shutdown(sockFd, SHUT_RDWR);
     close(sockFd);
 }
@@ -217,90 +217,66 @@ void send_h26x_to_client(char index, hal_vidstream *stream) {
     }
 }
 
-void send_mp4_to_client(char index, hal_vidstream *stream, char isH265) {
+void send_mp4_to_client(char index) {
     if (server_mp4_clients <= 0)
         return;
 
-    for (unsigned int i = 0; i < stream->count; ++i) {
-        hal_vidpack *pack = &stream->pack[i];
-        unsigned int pack_len = pack->length - pack->offset;
-        unsigned char *pack_data = pack->data + pack->offset;
-
-        for (char j = 0; j < pack->naluCnt; j++) {
-#ifdef DEBUG_VIDEO
-            printf("NAL: %s received in packet %d\n", nal_type_to_str(pack->nalu[j].type), i);
-            printf("     starts at %p, ends at %p\n", pack_data + pack->nalu[j].offset, pack_data + pack->nalu[j].offset + pack->nalu[j].length);
-#endif
-            if ((pack->nalu[j].type == NalUnitType_SPS || pack->nalu[j].type == NalUnitType_SPS_HEVC) 
-                && pack->nalu[j].length >= 4 && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_sps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if ((pack->nalu[j].type == NalUnitType_PPS || pack->nalu[j].type == NalUnitType_PPS_HEVC)
-                && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_pps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, isH265);
-            else if (pack->nalu[j].type == NalUnitType_VPS_HEVC && pack->nalu[j].length <= UINT16_MAX)
-                mp4_set_vps(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4);
-            else if (pack->nalu[j].type == NalUnitType_CodedSliceIdr || pack->nalu[j].type == NalUnitType_CodedSliceAux)
-                mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 1);
-            else if (pack->nalu[j].type == NalUnitType_CodedSliceNonIdr)
-                mp4_set_slice(pack_data + pack->nalu[j].offset + 4, pack->nalu[j].length - 4, 0);
+    static enum BufError err;
+    static char len_buf[50];
+    pthread_mutex_lock(&client_fds_mutex);
+    for (unsigned int i = 0; i < MAX_CLIENTS; ++i) {
+        if (client_fds[i].sockFd < 0) continue;
+        if (client_fds[i].type != STREAM_MP4) continue;
+
+        if (!client_fds[i].mp4.header_sent) {
+            struct BitBuf header_buf;
+            err = mp4_get_header(&header_buf);
+            chk_err_continue ssize_t len_size =
+                sprintf(len_buf, "%zX\r\n", header_buf.offset);
+            if (send_to_client(i, len_buf, len_size) < 0)
+                continue; // send <SIZE>\r\n
+            if (send_to_client(i, header_buf.buf, header_buf.offset) < 0)
+                continue; // send <DATA>
+            if (send_to_client(i, "\r\n", 2) < 0)
+                continue; // send \r\n
+
+            client_fds[i].mp4.sequence_number = 0;
+            client_fds[i].mp4.base_data_offset = header_buf.offset;
+            client_fds[i].mp4.base_media_decode_time = 0;
+            client_fds[i].mp4.base_audio_decode_time = 0;
+            client_fds[i].mp4.header_sent = true;
+            client_fds[i].mp4.nals_count = 0;
+            client_fds[i].mp4.default_sample_duration =
+                default_sample_size;
         }
 
-        static enum BufError err;
-        static char len_buf[50];
-        pthread_mutex_lock(&client_fds_mutex);
-        for (unsigned int i = 0; i < MAX_CLIENTS; ++i) {
-            if (client_fds[i].sockFd < 0) continue;
-            if (client_fds[i].type != STREAM_MP4) continue;
-
-            if (!client_fds[i].mp4.header_sent) {
-                struct BitBuf header_buf;
-                err = mp4_get_header(&header_buf);
-                chk_err_continue ssize_t len_size =
-                    sprintf(len_buf, "%zX\r\n", header_buf.offset);
-                if (send_to_client(i, len_buf, len_size) < 0)
-                    continue; // send <SIZE>\r\n
-                if (send_to_client(i, header_buf.buf, header_buf.offset) < 0)
-                    continue; // send <DATA>
-                if (send_to_client(i, "\r\n", 2) < 0)
-                    continue; // send \r\n
-
-                client_fds[i].mp4.sequence_number = 0;
-                client_fds[i].mp4.base_data_offset = header_buf.offset;
-                client_fds[i].mp4.base_media_decode_time = 0;
-                client_fds[i].mp4.header_sent = true;
-                client_fds[i].mp4.nals_count = 0;
-                client_fds[i].mp4.default_sample_duration =
-                    default_sample_size;
-            }
-
-            err = mp4_set_state(&client_fds[i].mp4);
-            chk_err_continue {
-                struct BitBuf moof_buf;
-                err = mp4_get_moof(&moof_buf);
-                chk_err_continue ssize_t len_size =
-                    sprintf(len_buf, "%zX\r\n", (ssize_t)moof_buf.offset);
-                if (send_to_client(i, len_buf, len_size) < 0)
-                    continue; // send <SIZE>\r\n
-                if (send_to_client(i, moof_buf.buf, moof_buf.offset) < 0)
-                    continue; // send <DATA>
-                if (send_to_client(i, "\r\n", 2) < 0)
-                    continue; // send \r\n
-            }
-            {
-                struct BitBuf mdat_buf;
-                err = mp4_get_mdat(&mdat_buf);
-                chk_err_continue ssize_t len_size =
-                    sprintf(len_buf, "%zX\r\n", (ssize_t)mdat_buf.offset);
-                if (send_to_client(i, len_buf, len_size) < 0)
-                    continue; // send <SIZE>\r\n
-                if (send_to_client(i, mdat_buf.buf, mdat_buf.offset) < 0)
-                    continue; // send <DATA>
-                if (send_to_client(i, "\r\n", 2) < 0)
-                    continue; // send \r\n
-            }
+        err = mp4_set_state(&client_fds[i].mp4);
+        chk_err_continue {
+            struct BitBuf moof_buf;
+            err = mp4_get_moof(&moof_buf);
+            chk_err_continue ssize_t len_size =
+                sprintf(len_buf, "%zX\r\n", (ssize_t)moof_buf.offset);
+            if (send_to_client(i, len_buf, len_size) < 0)
+                continue; // send <SIZE>\r\n
+            if (send_to_client(i, moof_buf.buf, moof_buf.offset) < 0)
+                continue; // send <DATA>
+            if (send_to_client(i, "\r\n", 2) < 0)
+                continue; // send \r\n
+        }
+        {
+            struct BitBuf mdat_buf;
+            err = mp4_get_mdat(&mdat_buf);
+            chk_err_continue ssize_t len_size =
+                sprintf(len_buf, "%zX\r\n", (ssize_t)mdat_buf.offset);
+            if (send_to_client(i, len_buf, len_size) < 0)
+                continue; // send <SIZE>\r\n
+            if (send_to_client(i, mdat_buf.buf, mdat_buf.offset) < 0)
+                continue; // send <DATA>
+            if (send_to_client(i, "\r\n", 2) < 0)
+                continue; // send \r\n
         }
-        pthread_mutex_unlock(&client_fds_mutex);
     }
+    pthread_mutex_unlock(&client_fds_mutex);
 }
 
 void send_pcm_to_client(hal_audframe *frame) {
@@ -796,6 +772,11 @@ void respond_request(http_request_t *req) {
         return;
     }
 
+    if (app_config.mp4_enable && app_config.hls_enable && STARTS_WITH(req->uri, "/hls/")) {
+        hls_handle_request(req->clntFd, req->uri, req->query);
+        return;
+    }
+
     if (app_config.jpeg_enable && EQUALS(req->uri, "/mjpeg")) {
         int respLen = sprintf(response,
             "HTTP/1.0 200 OK\r\n"
@@ -1753,6 +1734,56 @@ void respond_request(http_request_t *req) {
         return;
     }
 
+    if (EQUALS(req->uri, "/api/recordings")) {
+        long long from = 0, to = LLONG_MAX / 1000;
+        if (!EMPTY(req->query)) {
+            char *remain;
+            while (req->query) {
+                char *value = split(&req->query, "&");
+                if (!value || !*value) continue;
+                unescape_uri(value);
+                char *key = split(&value, "=");
+                if (!key || !*key || !value || !*value) continue;
+                if (EQUALS(key, "from")) {
+                    long long result = strtoll(value, &remain, 10);
+                    if (remain != value)
+                        from = result;
+                }
+                else if (EQUALS(key, "to")) {
+                    long long result = strtoll(value, &remain, 10);
+                    if (remain != value)
+                        to = result;
+                }
+            }
+        }
+        record_send_listing(req->clntFd, from, to);
+        return;
+    }
+
+    if (EQUALS(req->uri, "/api/playback")) {
+        long long t = -1;
+        if (!EMPTY(req->query)) {
+            char *remain;
+            while (req->query) {
+                char *value = split(&req->query, "&");
+                if (!value || !*value) continue;
+                unescape_uri(value);
+                char *key = split(&value, "=");
+                if (!key || !*key || !value || !*value) continue;
+                if (EQUALS(key, "t")) {
+                    long long result = strtoll(value, &remain, 10);
+                    if (remain != value)
+                        t = result;
+                }
+            }
+        }
+        if (t < 0)
+            send_http_error(req->clntFd, 400);
+        else
+            record_handle_playback(req->clntFd, t);
+        return;
+    }
+
     if (EQUALS(req->uri, "/api/status")) {
         struct sysinfo si;
         sysinfo(&si);
@@ -1772,9 +1803,14 @@ void respond_request(http_request_t *req) {
             "Connection: close\r\n"
             "\r\n"
             "{\"chip\":\"%s\",\"loadavg\":[%.2f,%.2f,%.2f],\"memory\":\"%s\","
-            "\"sensor\":\"%s\",\"temp\":\"%.1f\u00B0C\",\"uptime\":\"%s\"}",
+            "\"sensor\":\"%s\",\"temp\":\"%.1f\u00B0C\",\"uptime\":\"%s\"",
             chip, si.loads[0] / 65536.0, si.loads[1] / 65536.0, si.loads[2] / 65536.0, 
             memory, sensor, hal_temperature_read(), uptime);
+        if (app_config.rtsp_enable) {
+            respLen += sprintf(response + respLen, ",\"rtsp\":");
+            respLen += smolrtsp_status_json(response + respLen, sizeof(response) - respLen - 1);
+        }
+        respLen += sprintf(response + respLen, "}");
         send_and_close(req->clntFd, response, respLen);
         return;
     }
@@ -18,6 +18,7 @@
 #include "fmt/mp4.h"
 #include "fmt/nal.h"
 #include "hal/types.h"
+#include "hls.h"
 #include "jpeg.h"
 #include "media.h"
 #include "network.h"
@@ -32,10 +33,15 @@ extern time_t recordStartTime;
 int start_server();
 int stop_server();
 
+void close_socket_fd(int sockFd);
+int send_to_fd(int fd, char *buf, ssize_t size);
+void send_http_error(int fd, int code);
+
 void send_jpeg_to_client(char index, char *buf, ssize_t size);
 void send_mjpeg_to_client(char index, char *buf, ssize_t size);
 void send_h26x_to_client(char index, hal_vidstream *stream);
-void send_mp4_to_client(char index, hal_vidstream *stream, char isH265);
+// Sends the fragment last built by mp4_set_pack() to every MP4 client.
+void send_mp4_to_client(char index);
 void send_pcm_to_client(hal_audframe *frame);
 
 // Fast-path hints for media pipeline: avoid locking/sending when no such clients exist.
@@ -1,13 +1,96 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "stream.h"
 
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP IPPROTO_UDP
+#endif
+
 static struct udp_stream_ctx *g_udp_ctx = NULL;
 
 static unsigned long long get_timestamp_us();
+static unsigned long long get_monotonic_us(void);
 static void *udp_client_manager_thread(void *data);
+static void *udp_pacer_thread(void *data);
+static void udp_wake_manager(struct udp_stream_ctx *ctx);
 static int add_rtp_header(unsigned char *packet, int pay_size,
     unsigned short seq, unsigned int tstamp,
     unsigned int ssrc, int marker, int pay_type);
 
+/**
+ * (Re)arms a destination slot, starting at the next packet of the ring
+ */
+static void udp_client_activate(struct udp_stream_ctx *ctx, udp_client_t *c,
+    const struct sockaddr_in *addr, time_t now) {
+    free(c->fec);
+    *c = (udp_client_t){
+        .addr = *addr,
+        .active = 1,
+        .ssrc = rand(),
+        .seq = rand() & 0xFFFF,
+        .tstamp = rand(),
+        .last_act = now,
+        .cursor = ctx->ring_head,
+        .start = ctx->ring_head,
+        .tokens = ctx->pace_burst,
+        .rtx_tokens = NACK_BURST_PKTS * sizeof(((udp_packet_t *)0)->data),
+        .refill_us = get_monotonic_us(),
+        .rtx_refill_us = get_monotonic_us()
+    };
+    add_rtp_header(c->hdr, 1, 0, 0, c->ssrc, 0, 96);
+}
+
+/**
+ * Picks the lookup bucket of a destination address
+ */
+static unsigned int udp_client_hash(const struct sockaddr_in *addr) {
+    const unsigned int key = addr->sin_addr.s_addr ^ addr->sin_port;
+    return (key * 2654435761u) >> (32 - UDP_HASH_BITS);
+}
+
+/**
+ * Looks up an active destination by address
+ * @return Client ID or -1 if unknown
+ */
+static int udp_client_find(struct udp_stream_ctx *ctx,
+    const struct sockaddr_in *addr) {
+    for (int i = ctx->hash[udp_client_hash(addr)]; i >= 0; i = ctx->clients[i].next)
+        if (ctx->clients[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            ctx->clients[i].addr.sin_port == addr->sin_port)
+            return i;
+    return -1;
+}
+
+/**
+ * Finds a free destination slot
+ * @return Client ID or -1 if the table is full
+ */
+static int udp_client_slot(struct udp_stream_ctx *ctx) {
+    if (ctx->client_count >= UDP_MAX_CLIENTS) return -1;
+    for (int i = 0; i < UDP_MAX_CLIENTS; i++)
+        if (!ctx->clients[i].active) return i;
+    return -1;
+}
+
+static void udp_client_link(struct udp_stream_ctx *ctx, int id) {
+    int *head = &ctx->hash[udp_client_hash(&ctx->clients[id].addr)];
+    ctx->clients[id].next = *head;
+    *head = id;
+}
+
+static void udp_client_unlink(struct udp_stream_ctx *ctx, int id) {
+    int *link = &ctx->hash[udp_client_hash(&ctx->clients[id].addr)];
+    while (*link >= 0 && *link != id)
+        link = &ctx->clients[*link].next;
+    if (*link == id) *link = ctx->clients[id].next;
+}
+
 int udp_stream_has_clients(void) {
     if (!g_udp_ctx) return 0;
     pthread_mutex_lock(&g_udp_ctx->mutex);
@@ -33,12 +116,40 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
     g_udp_ctx->running = 0;
     g_udp_ctx->client_count = 0;
     g_udp_ctx->is_mcast = 0;
-
-    if (pthread_mutex_init(&g_udp_ctx->mutex, NULL)) {
+    g_udp_ctx->socket_fd = -1;
+    g_udp_ctx->rtcp_fd = -1;
+    g_udp_ctx->timer_fd = -1;
+    g_udp_ctx->wake_fd = -1;
+    for (int i = 0; i < UDP_HASH_SIZE; i++)
+        g_udp_ctx->hash[i] = -1;
+
+    // Without an explicit rate, leave the encoder enough headroom to flush
+    // a keyframe within a few frame intervals
+    unsigned int kbps = app_config.stream_pace_kbps;
+    if (!kbps)
+        kbps = MAX(app_config.mp4_bitrate * 3, 1024);
+    g_udp_ctx->pace_rate = kbps * 1000 / 8;
+    g_udp_ctx->pace_burst = MAX(app_config.stream_pace_burst_kb * 1024,
+        RTP_HEADER_SIZE + MAX_UDP_PACKET_SIZE);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&g_udp_ctx->mutex, NULL) ||
+        pthread_cond_init(&g_udp_ctx->pacer_cond, &cattr)) {
+        pthread_condattr_destroy(&cattr);
         free(g_udp_ctx);
         g_udp_ctx = NULL;
         HAL_ERROR("stream", "Failed to initialize mutex!\n");
     }
+    pthread_condattr_destroy(&cattr);
+
+    if (!(g_udp_ctx->ring = malloc(UDP_RING_PKTS * sizeof(*g_udp_ctx->ring))) ||
+        !(g_udp_ctx->tx = malloc(UDP_BATCH * sizeof(*g_udp_ctx->tx))) ||
+        !(g_udp_ctx->fec_tx = malloc(UDP_FEC_BATCH * sizeof(*g_udp_ctx->fec_tx)))) {
+        HAL_DANGER("stream", "Failed to allocate the packet ring!\n");
+        goto error;
+    }
 
     if ((g_udp_ctx->socket_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         HAL_DANGER("stream", "Failed to create UDP socket: %s\n", strerror(errno));
@@ -55,6 +166,10 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
         g_udp_ctx->is_mcast = 1;
         g_udp_ctx->mcast_addr = inet_addr(mcast_addr);
 
+        struct sockaddr_in group = {.sin_family = AF_INET,
+            .sin_addr.s_addr = g_udp_ctx->mcast_addr, .sin_port = htons(g_udp_ctx->port)};
+        udp_client_activate(g_udp_ctx, &g_udp_ctx->mcast, &group, time(NULL));
+
         int ttl = 32;
         if (setsockopt(g_udp_ctx->socket_fd, IPPROTO_IP, IP_MULTICAST_TTL,
                       &ttl, sizeof(ttl)) < 0)
@@ -73,14 +188,51 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
     fcntl(g_udp_ctx->socket_fd, F_SETFL,
           fcntl(g_udp_ctx->socket_fd, F_GETFL, 0) | O_NONBLOCK);
 
+    if ((g_udp_ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+        (g_udp_ctx->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        HAL_DANGER("stream", "Failed to create the client manager events: %s\n", strerror(errno));
+        goto error;
+    }
+
+    // Receivers send their RTCP feedback to the next port
+    if (app_config.stream_nack_ms) {
+        g_udp_ctx->rtx_rate = MAX(app_config.mp4_bitrate * 1000 / 8 / NACK_RATE_DIV, 8192);
+        addr.sin_port = htons(g_udp_ctx->port + 1);
+        if (!(g_udp_ctx->rtx_tx = malloc(NACK_BURST_PKTS * sizeof(*g_udp_ctx->rtx_tx)))) {
+            HAL_DANGER("stream", "Failed to allocate the retransmission buffer!\n");
+            goto error;
+        }
+        if ((g_udp_ctx->rtcp_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+            bind(g_udp_ctx->rtcp_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            HAL_WARNING("stream", "No RTCP socket on port %d, NACKs are ignored: %s\n",
+                g_udp_ctx->port + 1, strerror(errno));
+            if (g_udp_ctx->rtcp_fd >= 0) close(g_udp_ctx->rtcp_fd);
+            g_udp_ctx->rtcp_fd = -1;
+        } else {
+            fcntl(g_udp_ctx->rtcp_fd, F_SETFL,
+                  fcntl(g_udp_ctx->rtcp_fd, F_GETFL, 0) | O_NONBLOCK);
+        }
+    }
+
     g_udp_ctx->running = 1;
+    if (pthread_create(&g_udp_ctx->pacer, NULL,
+                      udp_pacer_thread, g_udp_ctx) != 0) {
+        HAL_DANGER("stream", "Failed to create UDP pacer thread!\n");
+        goto error;
+    }
     if (pthread_create(&g_udp_ctx->thread, NULL,
                       udp_client_manager_thread, g_udp_ctx) != 0) {
         HAL_DANGER("stream", "Failed to create UDP client manager thread!\n");
+        pthread_mutex_lock(&g_udp_ctx->mutex);
+        g_udp_ctx->running = 0;
+        pthread_cond_signal(&g_udp_ctx->pacer_cond);
+        pthread_mutex_unlock(&g_udp_ctx->mutex);
+        pthread_join(g_udp_ctx->pacer, NULL);
         goto error;
     }
 
-    HAL_INFO("stream", "UDP streaming initialized on port %d\n", g_udp_ctx->port);
+    HAL_INFO("stream", "UDP streaming initialized on port %d, paced at %u kbit/s\n",
+        g_udp_ctx->port, kbps);
     if (g_udp_ctx->is_mcast) {
         char ip_str[INET_ADDRSTRLEN];
         struct in_addr addr;
@@ -94,6 +246,14 @@ int udp_stream_init(unsigned short port, const char *mcast_addr) {
 error:
     if (g_udp_ctx) {
         if (g_udp_ctx->socket_fd >= 0) close(g_udp_ctx->socket_fd);
+        if (g_udp_ctx->rtcp_fd >= 0) close(g_udp_ctx->rtcp_fd);
+        if (g_udp_ctx->timer_fd >= 0) close(g_udp_ctx->timer_fd);
+        if (g_udp_ctx->wake_fd >= 0) close(g_udp_ctx->wake_fd);
+        free(g_udp_ctx->ring);
+        free(g_udp_ctx->tx);
+        free(g_udp_ctx->fec_tx);
+        free(g_udp_ctx->rtx_tx);
+        pthread_cond_destroy(&g_udp_ctx->pacer_cond);
         pthread_mutex_destroy(&g_udp_ctx->mutex);
         free(g_udp_ctx);
         g_udp_ctx = NULL;
@@ -108,11 +268,27 @@ error:
 void udp_stream_close() {
     if (!g_udp_ctx) return;
 
+    pthread_mutex_lock(&g_udp_ctx->mutex);
     g_udp_ctx->running = 0;
+    pthread_cond_signal(&g_udp_ctx->pacer_cond);
+    pthread_mutex_unlock(&g_udp_ctx->mutex);
+    udp_wake_manager(g_udp_ctx);
     pthread_join(g_udp_ctx->thread, NULL);
+    pthread_join(g_udp_ctx->pacer, NULL);
 
     close(g_udp_ctx->socket_fd);
-
+    if (g_udp_ctx->rtcp_fd >= 0) close(g_udp_ctx->rtcp_fd);
+    close(g_udp_ctx->timer_fd);
+    close(g_udp_ctx->wake_fd);
+
+    for (int i = 0; i < UDP_MAX_CLIENTS; i++)
+        free(g_udp_ctx->clients[i].fec);
+    free(g_udp_ctx->mcast.fec);
+    free(g_udp_ctx->ring);
+    free(g_udp_ctx->tx);
+    free(g_udp_ctx->fec_tx);
+    free(g_udp_ctx->rtx_tx);
+    pthread_cond_destroy(&g_udp_ctx->pacer_cond);
     pthread_mutex_destroy(&g_udp_ctx->mutex);
 
     free(g_udp_ctx);
@@ -121,13 +297,42 @@ void udp_stream_close() {
     HAL_INFO("stream", "UDP streaming closed\n");
 }
 
+/**
+ * Sets up XOR forward error correction for a destination
+ * @param media Address the media packets are sent to
+ * @param cols Number of columns L, i.e. row parity every L packets (0 = off)
+ * @param rows Number of rows D for column parity (0 = row parity only)
+ * @return FEC state or NULL if disabled or invalid
+ */
+static udp_fec_t *udp_fec_new(const struct sockaddr_in *media,
+    unsigned char cols, unsigned char rows) {
+    if (cols < 2 || cols > FEC_MAX_COLS || rows == 1 || rows > FEC_MAX_ROWS)
+        return NULL;
+
+    udp_fec_t *fec = calloc(1, sizeof(*fec) + (rows ? cols : 0) * sizeof(fec->col[0]));
+    if (!fec) return NULL;
+
+    fec->cols = cols;
+    fec->rows = rows;
+    fec->row_seq = rand() & 0xFFFF;
+    fec->col_seq = rand() & 0xFFFF;
+    fec->col_addr = *media;
+    fec->col_addr.sin_port = htons(ntohs(media->sin_port) + 2);
+    fec->row_addr = *media;
+    fec->row_addr.sin_port = htons(ntohs(media->sin_port) + 4);
+    return fec;
+}
+
 /**
  * Adds a new UDP client
  * @param host Client hostname or IP address
  * @param port Client port
+ * @param fec_cols FEC row length L, 0 disables FEC
+ * @param fec_rows FEC column depth D, 0 for row parity only
  * @return Client ID or -1 on error
  */
-int udp_stream_add_client(const char *host, unsigned short port) {
+int udp_stream_add_client(const char *host, unsigned short port,
+    unsigned char fec_cols, unsigned char fec_rows) {
     if (!g_udp_ctx) return -1;
 
     struct sockaddr_in addr;
@@ -140,42 +345,49 @@ int udp_stream_add_client(const char *host, unsigned short port) {
         return -1;
     }
 
-    pthread_mutex_lock(&g_udp_ctx->mutex);
+    udp_fec_t *fec = NULL;
+    if (fec_cols && !(fec = udp_fec_new(&addr, fec_cols, fec_rows)))
+        HAL_WARNING("stream", "Ignoring invalid FEC setting %ux%u for %s\n",
+            fec_cols, fec_rows, host);
 
-    for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-        if (!g_udp_ctx->clients[i].active) continue;
+    pthread_mutex_lock(&g_udp_ctx->mutex);
 
-        if (g_udp_ctx->clients[i].addr.sin_addr.s_addr == addr.sin_addr.s_addr &&
-            g_udp_ctx->clients[i].addr.sin_port == addr.sin_port) {
-            g_udp_ctx->clients[i].last_act = time(NULL);
-            pthread_mutex_unlock(&g_udp_ctx->mutex);
-            return i;
-        }
+    // The group itself is the multicast destination
+    if (g_udp_ctx->is_mcast && addr.sin_addr.s_addr == g_udp_ctx->mcast_addr && fec) {
+        free(g_udp_ctx->mcast.fec);
+        g_udp_ctx->mcast.fec = udp_fec_new(&g_udp_ctx->mcast.addr, fec_cols, fec_rows);
     }
 
-    for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-        if (g_udp_ctx->clients[i].active) continue;
+    int i;
+    if ((i = udp_client_find(g_udp_ctx, &addr)) >= 0) {
+        g_udp_ctx->clients[i].last_act = time(NULL);
+        pthread_mutex_unlock(&g_udp_ctx->mutex);
+        free(fec);
+        return i;
+    }
 
-        g_udp_ctx->clients[i] = (udp_client_t){
-            .addr = addr,
-            .active = 1,
-            .ssrc = rand(),
-            .seq = rand() & 0xFFFF,
-            .tstamp = rand(),
-            .last_act = time(NULL)
-        };
+    if ((i = udp_client_slot(g_udp_ctx)) >= 0) {
+        udp_client_activate(g_udp_ctx, &g_udp_ctx->clients[i], &addr, time(NULL));
+        udp_client_link(g_udp_ctx, i);
+        g_udp_ctx->clients[i].fec = fec;
 
         g_udp_ctx->client_count++;
 
-        HAL_INFO("stream", "Added UDP client %s:%d (ID %d)\n",
-            host, port, i);
+        if (fec)
+            HAL_INFO("stream", "Added UDP client %s:%d (ID %d) with %ux%u FEC\n",
+                host, port, i, fec->cols, fec->rows);
+        else
+            HAL_INFO("stream", "Added UDP client %s:%d (ID %d)\n",
+                host, port, i);
 
         pthread_mutex_unlock(&g_udp_ctx->mutex);
+        udp_wake_manager(g_udp_ctx);
         return i;
     }
 
     HAL_DANGER("stream", "Maximum number of UDP clients reached!\n");
     pthread_mutex_unlock(&g_udp_ctx->mutex);
+    free(fec);
     return -1;
 }
 
@@ -195,6 +407,7 @@ void udp_stream_remove_client(int client_id) {
         uint16_t port = ntohs(addr->sin_port);
 
         inet_ntop(AF_INET, &addr->sin_addr, ip_str, INET_ADDRSTRLEN);
+        udp_client_unlink(g_udp_ctx, client_id);
         g_udp_ctx->clients[client_id].active = 0;
         g_udp_ctx->client_count--;
 
@@ -206,234 +419,665 @@ void udp_stream_remove_client(int client_id) {
 }
 
 /**
- * Send a RTP-encapsulated NAL unit to all clients
- * @param nal_data NAL unit data
- * @param nal_size Size of the NAL unit
- * @param is_keyframe Indicates if the NAL unit is a keyframe
- * @param is_h265 Indicates if the NAL unit is using the H.265 codec
+ * Packetizes a NAL unit into the shared ring (single NAL unit packet or
+ * FU-A/FU fragments, RFC 6184 5.8 / RFC 7798 4.4.3)
+ * @return Ring index of the last packet written
+ */
+static unsigned int udp_ring_nal(struct udp_stream_ctx *ctx,
+    const unsigned char *nal, unsigned int nal_size, unsigned int tstamp,
+    int is_h265) {
+    udp_packet_t *pkt;
+
+    if (nal_size <= MAX_UDP_PACKET_SIZE) {
+        pkt = &ctx->ring[ctx->ring_head % UDP_RING_PKTS];
+        *pkt = (udp_packet_t){.len = RTP_HEADER_SIZE + nal_size, .tstamp = tstamp};
+        memcpy(pkt->data + RTP_HEADER_SIZE, nal, nal_size);
+        return ctx->ring_head++;
+    }
+
+    // FU indicator (H.264) or payload header (H.265), then the FU header
+    unsigned char fu[3];
+    unsigned int nal_header_size, fu_size;
+    if (is_h265) {
+        fu[0] = (nal[0] & 0x81) | (49 << 1);
+        fu[1] = nal[1];
+        fu[2] = (nal[0] >> 1) & 0x3F;
+        nal_header_size = 2;
+        fu_size = 3;
+    } else {
+        fu[0] = (nal[0] & 0xE0) | 28;
+        fu[1] = nal[0] & 0x1F;
+        nal_header_size = 1;
+        fu_size = 2;
+    }
+
+    const unsigned int chunk = MAX_UDP_PACKET_SIZE - fu_size;
+    const unsigned char *frag_ptr = nal + nal_header_size;
+    unsigned int remaining = nal_size - nal_header_size;
+
+    for (int is_first = 1; remaining > 0; is_first = 0) {
+        const unsigned int payload_size = remaining > chunk ? chunk : remaining;
+        const int is_last = payload_size == remaining;
+
+        pkt = &ctx->ring[ctx->ring_head++ % UDP_RING_PKTS];
+        *pkt = (udp_packet_t){.len = RTP_HEADER_SIZE + fu_size + payload_size,
+            .tstamp = tstamp};
+        memcpy(pkt->data + RTP_HEADER_SIZE, fu, fu_size);
+        pkt->data[RTP_HEADER_SIZE + fu_size - 1] |=
+            (is_first ? 0x80 : 0) | (is_last ? 0x40 : 0);
+        memcpy(pkt->data + RTP_HEADER_SIZE + fu_size, frag_ptr, payload_size);
+
+        frag_ptr += payload_size;
+        remaining -= payload_size;
+    }
+
+    return ctx->ring_head - 1;
+}
+
+/**
+ * Send an encoded access unit to all clients as RTP
+ * The packets are built once here, the pacer thread puts them on the wire
+ * @param stream Access unit, one NAL unit per pack
+ * @param is_h265 Indicates if the stream is using the H.265 codec
  * @return EXIT_SUCCESS or EXIT_FAILURE
  */
-int udp_stream_send_nal(const char *nal_data, int nal_size,
-    int is_keyframe, int is_h265) {
-    if (!g_udp_ctx || !nal_data || nal_size <= 0) return EXIT_FAILURE;
+int udp_stream_send_frame(hal_vidstream *stream, char is_h265) {
+    if (!g_udp_ctx || !stream || !stream->count) return EXIT_FAILURE;
 
-    static unsigned char packet[MAX_UDP_PACKET_SIZE + RTP_HEADER_SIZE];
-    int payload_type = 96;
-    int total_clients = 0;
+    // One timestamp per access unit, on the 90 kHz clock of the capture time
+    unsigned long long ts_us = stream->pack[0].timestamp;
+    if (!ts_us) ts_us = get_monotonic_us();
+    const unsigned int tstamp = (unsigned int)(ts_us * (RTP_VIDEO_CLOCK / 1000) / 1000);
+    int last = -1;
 
     pthread_mutex_lock(&g_udp_ctx->mutex);
-    total_clients = g_udp_ctx->client_count;
-    pthread_mutex_unlock(&g_udp_ctx->mutex);
 
-    if (total_clients == 0 && !g_udp_ctx->is_mcast) return EXIT_SUCCESS;
+    for (unsigned int i = 0; i < stream->count; i++) {
+        const unsigned char *nal = stream->pack[i].data + stream->pack[i].offset;
+        unsigned int nal_size = stream->pack[i].length - stream->pack[i].offset;
 
-    if (nal_size + RTP_HEADER_SIZE <= MAX_UDP_PACKET_SIZE) {
-        pthread_mutex_lock(&g_udp_ctx->mutex);
+        // Annex B start code
+        while (nal_size > 3 && !nal[0] && !nal[1] && (nal[2] == 1 || (!nal[2] && nal[3] == 1))) {
+            const unsigned int sc = nal[2] == 1 ? 3 : 4;
+            nal += sc;
+            nal_size -= sc;
+        }
+        if (nal_size < (is_h265 ? 3 : 2)) continue;
 
-        if (g_udp_ctx->is_mcast) {
-            struct sockaddr_in mcast_addr;
-            memset(&mcast_addr, 0, sizeof(mcast_addr));
-            mcast_addr.sin_family = AF_INET;
-            mcast_addr.sin_addr.s_addr = g_udp_ctx->mcast_addr;
-            mcast_addr.sin_port = htons(g_udp_ctx->port);
+        last = (int)udp_ring_nal(g_udp_ctx, nal, nal_size, tstamp, is_h265);
+    }
 
-            int packet_size = add_rtp_header(packet, nal_size, 0, 0, 0,
-                                          is_keyframe, payload_type);
+    if (last >= 0) {
+        g_udp_ctx->ring[last % UDP_RING_PKTS].marker = 1;
+        pthread_cond_signal(&g_udp_ctx->pacer_cond);
+    }
 
-            memcpy(packet + RTP_HEADER_SIZE, nal_data, nal_size);
-            packet_size += nal_size;
+    pthread_mutex_unlock(&g_udp_ctx->mutex);
 
-            sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                 (struct sockaddr*)&mcast_addr, sizeof(mcast_addr));
-        } else {
-            for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-                if (!g_udp_ctx->clients[i].active) continue;
+    return EXIT_SUCCESS;
+}
 
-                int packet_size = add_rtp_header(packet, nal_size,
-                    g_udp_ctx->clients[i].seq++, g_udp_ctx->clients[i].tstamp,
-                    g_udp_ctx->clients[i].ssrc, is_keyframe, payload_type);
+/**
+ * Writes the RTP header of one destination into a copy of a ring packet
+ */
+static inline void udp_fill_header(const udp_client_t *c, udp_packet_t *pkt,
+    unsigned short seq) {
+    const unsigned int tstamp = pkt->tstamp + c->tstamp;
+
+    memcpy(pkt->data, c->hdr, RTP_HEADER_SIZE);
+    pkt->data[1] |= pkt->marker ? 0x80 : 0x00;
+    pkt->data[2] = seq >> 8;
+    pkt->data[3] = seq & 0xFF;
+    pkt->data[4] = tstamp >> 24;
+    pkt->data[5] = (tstamp >> 16) & 0xFF;
+    pkt->data[6] = (tstamp >> 8) & 0xFF;
+    pkt->data[7] = tstamp & 0xFF;
+}
 
-                memcpy(packet + RTP_HEADER_SIZE, nal_data, nal_size);
-                packet_size += nal_size;
+/**
+ * Hands packets of one destination to the kernel: runs of equally sized
+ * fragments as a single UDP GSO send where supported, sendmmsg() otherwise
+ * @return Number of packets consumed, fewer than count if the socket is full
+ */
+static int udp_send_batch(struct udp_stream_ctx *ctx, struct sockaddr_in *addr,
+    const udp_packet_t *pkts, int count) {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    int done = 0;
+
+    for (int i = 0; i < count; i++)
+        iov[i] = (struct iovec){.iov_base = (void *)pkts[i].data, .iov_len = pkts[i].len};
+
+    while (done < count) {
+        // Same-size segments, optionally closed by a single shorter one
+        const unsigned short seg = pkts[done].len;
+        unsigned int total = seg;
+        int run = 1;
+        while (ctx->gso >= 0 && done + run < count && pkts[done + run].len <= seg &&
+               total + pkts[done + run].len <= UDP_GSO_BYTES) {
+            total += pkts[done + run].len;
+            if (pkts[done + run++].len < seg) break;
+        }
 
-                sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                    (struct sockaddr*)&g_udp_ctx->clients[i].addr,
-                    sizeof(struct sockaddr_in));
+        if (run > 1) {
+            union {
+                char buf[CMSG_SPACE(sizeof(uint16_t))];
+                struct cmsghdr align;
+            } control;
+            memset(&control, 0, sizeof(control));
+            struct msghdr msg = {.msg_name = addr, .msg_namelen = sizeof(*addr),
+                .msg_iov = iov + done, .msg_iovlen = run,
+                .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+            struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            const uint16_t gso_size = seg;
+            memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+
+            if (sendmsg(ctx->socket_fd, &msg, 0) >= 0) {
+                ctx->gso = 1;
+                done += run;
+                continue;
             }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                return done;
+            if (errno == EINVAL || errno == ENOPROTOOPT ||
+                errno == EOPNOTSUPP || errno == EIO) {
+                HAL_INFO("stream", "UDP GSO unavailable, batching with sendmmsg\n");
+                ctx->gso = -1;
+                continue;
+            }
+            // Lost on the way out, like a failed sendto()
+            done += run;
+            continue;
         }
 
-        pthread_mutex_unlock(&g_udp_ctx->mutex);
-    } else {
-        int nal_header_size = is_h265 ? 2 : 1;
-        unsigned char nal_type;
+        // A lone packet between GSO runs, or everything left without GSO
+        const int n = ctx->gso >= 0 ? 1 : count - done;
+        for (int i = 0; i < n; i++)
+            msgs[i].msg_hdr = (struct msghdr){.msg_name = addr,
+                .msg_namelen = sizeof(*addr), .msg_iov = iov + done + i, .msg_iovlen = 1};
 
-        if (is_h265) {
-            nal_type = nal_data[0] & 0x3F;
-        } else {
-            nal_type = nal_data[0] & 0x1F;
+        const int ret = sendmmsg(ctx->socket_fd, msgs, n, 0);
+        if (ret > 0) {
+            done += ret;
+            continue;
         }
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            return done;
+        done++;
+    }
+
+    return done;
+}
 
-        int fragments = (nal_size - nal_header_size + MAX_UDP_PACKET_SIZE - 1) /
-                        (MAX_UDP_PACKET_SIZE - 2);
-        int bytes_left = nal_size - nal_header_size;
-        const char *data_ptr = nal_data + nal_header_size;
+/**
+ * Folds a media packet (RTP payload and recoverable header fields) into
+ * an FEC accumulator
+ */
+static void udp_fec_add(udp_fec_acc_t *acc, const udp_packet_t *pkt, int first) {
+    const unsigned char *rtp = pkt->data;
+    const unsigned short size = pkt->len - RTP_HEADER_SIZE;
+    const unsigned int tstamp = (rtp[4] << 24) | (rtp[5] << 16) | (rtp[6] << 8) | rtp[7];
+
+    if (first) {
+        acc->sn_base = (rtp[2] << 8) | rtp[3];
+        acc->len_rec = size;
+        acc->pt_rec = rtp[1] & 0x7F;
+        acc->ts_rec = tstamp;
+        acc->size = size;
+        memcpy(acc->payload, rtp + RTP_HEADER_SIZE, size);
+        return;
+    }
 
-        pthread_mutex_lock(&g_udp_ctx->mutex);
+    acc->len_rec ^= size;
+    acc->pt_rec ^= rtp[1] & 0x7F;
+    acc->ts_rec ^= tstamp;
+    if (size > acc->size) {
+        memset(acc->payload + acc->size, 0, size - acc->size);
+        acc->size = size;
+    }
+    for (unsigned int i = 0; i < size; i++)
+        acc->payload[i] ^= rtp[RTP_HEADER_SIZE + i];
+}
 
-        for (int i = 0; i < UDP_MAX_CLIENTS || g_udp_ctx->is_mcast; i++) {
-            if (g_udp_ctx->is_mcast || g_udp_ctx->clients[i].active) {
-                unsigned char fu_indicator, fu_header;
-                int is_first = 1;
-                int remaining = bytes_left;
-                const char *frag_ptr = data_ptr;
-                unsigned short seq = g_udp_ctx->is_mcast ? 0 : g_udp_ctx->clients[i].seq;
-                unsigned int ssrc = g_udp_ctx->is_mcast ? 0 : g_udp_ctx->clients[i].ssrc;
-                unsigned int tstamp = g_udp_ctx->is_mcast ? 0 : g_udp_ctx->clients[i].tstamp;
-
-                for (int frag = 0; frag < fragments; frag++) {
-                    int is_last = (frag == fragments - 1);
-                    int payload_size = (is_last) ? remaining : (MAX_UDP_PACKET_SIZE - 2);
-
-                    if (is_h265) {
-                        fu_indicator = (nal_data[0] & 0x81) | (49 << 1); // FU type=49
-                        fu_header = (is_first ? 0x80 : 0) | (is_last ? 0x40 : 0) | nal_type;
-                    } else {
-                        fu_indicator = (nal_data[0] & 0xE0) | 28; // FU-A type=28
-                        fu_header = (is_first ? 0x80 : 0) | (is_last ? 0x40 : 0) | nal_type;
-                    }
-
-                    int packet_size = add_rtp_header(packet, payload_size + 2, seq++,
-                                                  tstamp, ssrc,
-                                                  is_keyframe && is_last, payload_type);
-
-                    packet[RTP_HEADER_SIZE] = fu_indicator;
-                    packet[RTP_HEADER_SIZE + 1] = fu_header;
-
-                    memcpy(packet + RTP_HEADER_SIZE + 2, frag_ptr, payload_size);
-                    packet_size += payload_size + 2;
-
-                    frag_ptr += payload_size;
-                    remaining -= payload_size;
-                    is_first = 0;
-
-                    if (g_udp_ctx->is_mcast) {
-                        struct sockaddr_in mcast_addr;
-                        memset(&mcast_addr, 0, sizeof(mcast_addr));
-                        mcast_addr.sin_family = AF_INET;
-                        mcast_addr.sin_addr.s_addr = g_udp_ctx->mcast_addr;
-                        mcast_addr.sin_port = htons(g_udp_ctx->port);
-
-                        sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                             (struct sockaddr*)&mcast_addr, sizeof(mcast_addr));
-                    } else {
-                        sendto(g_udp_ctx->socket_fd, packet, packet_size, 0,
-                             (struct sockaddr*)&g_udp_ctx->clients[i].addr,
-                             sizeof(struct sockaddr_in));
-                    }
-
-                    usleep(100);
-                }
-
-                if (!g_udp_ctx->is_mcast) {
-                    g_udp_ctx->clients[i].seq = seq;
-                }
-            }
+/**
+ * Builds one SMPTE 2022-1 FEC packet
+ * @return Bytes to send
+ */
+static unsigned int udp_fec_build(const udp_client_t *c, const udp_fec_acc_t *acc,
+    const struct sockaddr_in *addr, unsigned short seq, int is_row,
+    unsigned char offset, unsigned char na, udp_fec_packet_t *out) {
+    unsigned char *hdr = out->data + RTP_HEADER_SIZE;
+
+    add_rtp_header(out->data, 1, seq, acc->ts_rec, c->ssrc, 0, 96);
+    hdr[0] = acc->sn_base >> 8;
+    hdr[1] = acc->sn_base & 0xFF;
+    hdr[2] = acc->len_rec >> 8;
+    hdr[3] = acc->len_rec & 0xFF;
+    hdr[4] = 0x80 | acc->pt_rec; // E=1, no mask
+    hdr[5] = hdr[6] = hdr[7] = 0;
+    hdr[8] = acc->ts_rec >> 24;
+    hdr[9] = (acc->ts_rec >> 16) & 0xFF;
+    hdr[10] = (acc->ts_rec >> 8) & 0xFF;
+    hdr[11] = acc->ts_rec & 0xFF;
+    hdr[12] = is_row ? 0x40 : 0x00; // D, XOR type, index 0
+    hdr[13] = offset;
+    hdr[14] = na;
+    hdr[15] = 0;
+    memcpy(hdr + FEC_HEADER_SIZE, acc->payload, acc->size);
+
+    out->addr = *addr;
+    out->len = RTP_HEADER_SIZE + FEC_HEADER_SIZE + acc->size;
+    return out->len;
+}
+
+/**
+ * Counts the parity packets completed by the media packet at a matrix
+ * position, then moves the position past it
+ */
+static int udp_fec_emits(const udp_fec_t *fec, unsigned int *count) {
+    const unsigned int size = fec->rows ? fec->cols * fec->rows : fec->cols;
+    const int emits = (*count % fec->cols == fec->cols - 1u) +
+        (fec->rows && *count / fec->cols == fec->rows - 1u);
+
+    *count = (*count + 1) % size;
+    return emits;
+}
+
+/**
+ * Accounts a media packet just sent to a destination in its FEC matrix,
+ * appending the row and column parity packets it completes to out
+ * @return Bytes of FEC to send
+ */
+static unsigned int udp_fec_feed(udp_client_t *c, const udp_packet_t *pkt,
+    udp_fec_packet_t *out, int *count) {
+    udp_fec_t *fec = c->fec;
+    const unsigned short seq = (pkt->data[2] << 8) | pkt->data[3];
+    const unsigned int size = fec->rows ? fec->cols * fec->rows : fec->cols;
+    unsigned int sent = 0;
+
+    // Parity only covers consecutive packets: restart after a gap
+    if (fec->count && seq != fec->next_seq)
+        fec->count = 0;
+    fec->next_seq = seq + 1;
+
+    const unsigned int col = fec->count % fec->cols, row = fec->count / fec->cols;
+    udp_fec_add(&fec->row, pkt, col == 0);
+    if (fec->rows)
+        udp_fec_add(&fec->col[col], pkt, row == 0);
+
+    if (col == fec->cols - 1u)
+        sent += udp_fec_build(c, &fec->row, &fec->row_addr, fec->row_seq++,
+            1, 1, fec->cols, &out[(*count)++]);
+    if (fec->rows && row == fec->rows - 1u)
+        sent += udp_fec_build(c, &fec->col[col], &fec->col_addr, fec->col_seq++,
+            0, fec->cols, fec->rows, &out[(*count)++]);
+
+    fec->count = (fec->count + 1) % size;
+    return sent;
+}
 
-            if (g_udp_ctx->is_mcast) break;
+/**
+ * Sends what the token bucket of a destination allows. Called with the
+ * stream lock held; the batch is copied out of the ring with its headers
+ * so the lock is released while the kernel takes it
+ * @return Microseconds until the next packet may leave, 0 if it caught up
+ */
+static unsigned long long udp_pace_client(struct udp_stream_ctx *ctx,
+    udp_client_t *c, unsigned long long now) {
+    if (c->cursor == ctx->ring_head) return 0;
+
+    // Packets overwritten before this destination got them still use up
+    // their sequence numbers so the receiver sees the loss
+    if (ctx->ring_head - c->cursor > UDP_RING_PKTS) {
+        const unsigned int lost = ctx->ring_head - UDP_RING_PKTS - c->cursor;
+        if (!c->dropped) {
+            char ip_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &c->addr.sin_addr, ip_str, INET_ADDRSTRLEN);
+            HAL_WARNING("stream", "Pacer fell behind for %s:%d, dropping packets\n",
+                ip_str, ntohs(c->addr.sin_port));
         }
+        c->seq += lost;
+        c->dropped += lost;
+        c->cursor += lost;
+    }
 
-        pthread_mutex_unlock(&g_udp_ctx->mutex);
+    c->tokens += (double)(now - c->refill_us) * ctx->pace_rate / 1000000.0;
+    if (c->tokens > ctx->pace_burst) c->tokens = ctx->pace_burst;
+    c->refill_us = now;
+
+    while (c->cursor != ctx->ring_head) {
+        struct sockaddr_in addr = c->addr;
+        const unsigned int cursor = c->cursor, ssrc = c->ssrc;
+        const udp_fec_t *fec = c->fec;
+        double budget = c->tokens;
+        int count = 0, fec_count = 0, fec_room = UDP_FEC_BATCH;
+        unsigned int fec_pos = 0;
+
+        if (fec)
+            fec_pos = fec->count && c->seq != fec->next_seq ? 0 : fec->count;
+
+        for (unsigned int pos = cursor; count < UDP_BATCH && pos != ctx->ring_head; pos++) {
+            const udp_packet_t *pkt = &ctx->ring[pos % UDP_RING_PKTS];
+            udp_packet_t *tx = &ctx->tx[count];
+            if (budget < pkt->len) break;
+            if (fec && (fec_room -= udp_fec_emits(fec, &fec_pos)) < 0) break;
+            tx->len = pkt->len;
+            tx->marker = pkt->marker;
+            tx->tstamp = pkt->tstamp;
+            memcpy(tx->data + RTP_HEADER_SIZE, pkt->data + RTP_HEADER_SIZE,
+                pkt->len - RTP_HEADER_SIZE);
+            udp_fill_header(c, tx, c->seq + count);
+            budget -= pkt->len;
+            count++;
+        }
+
+        if (!count) {
+            const udp_packet_t *pkt = &ctx->ring[c->cursor % UDP_RING_PKTS];
+            return (unsigned long long)((pkt->len - c->tokens) * 1000000.0 / ctx->pace_rate) + 1;
+        }
+
+        pthread_mutex_unlock(&ctx->mutex);
+        const int sent = udp_send_batch(ctx, &addr, ctx->tx, count);
+        pthread_mutex_lock(&ctx->mutex);
+
+        // The slot was dropped or handed to another destination meanwhile
+        if (!c->active || c->ssrc != ssrc || c->cursor != cursor) return 0;
+
+        // A matrix set up meanwhile starts with the next batch
+        for (int i = 0; i < sent; i++) {
+            c->tokens -= ctx->tx[i].len;
+            if (c->fec && c->fec == fec)
+                c->tokens -= udp_fec_feed(c, &ctx->tx[i], ctx->fec_tx, &fec_count);
+        }
+        c->seq += sent;
+        c->cursor += sent;
+
+        if (fec_count) {
+            pthread_mutex_unlock(&ctx->mutex);
+            for (int i = 0; i < fec_count; i++)
+                sendto(ctx->socket_fd, ctx->fec_tx[i].data, ctx->fec_tx[i].len, 0,
+                    (const struct sockaddr *)&ctx->fec_tx[i].addr, sizeof(ctx->fec_tx[i].addr));
+            pthread_mutex_lock(&ctx->mutex);
+            if (!c->active || c->ssrc != ssrc) return 0;
+        }
+
+        // Socket buffer full, try again shortly
+        if (sent < count) return 1000;
     }
 
-    pthread_mutex_lock(&g_udp_ctx->mutex);
-    for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-        if (!g_udp_ctx->clients[i].active) continue;
-        g_udp_ctx->clients[i].tstamp += 3000;
+    if (c->dropped) {
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &c->addr.sin_addr, ip_str, INET_ADDRSTRLEN);
+        HAL_WARNING("stream", "Dropped %u packets for %s:%d\n",
+            c->dropped, ip_str, ntohs(c->addr.sin_port));
+        c->dropped = 0;
     }
-    pthread_mutex_unlock(&g_udp_ctx->mutex);
 
-    return EXIT_SUCCESS;
+    return 0;
 }
 
 /**
- * Thread handler for managing UDP clients (inactivity check)
+ * Thread handler draining the destination queues at the configured rate
  */
-static void *udp_client_manager_thread(void *data) {
+static void *udp_pacer_thread(void *data) {
     struct udp_stream_ctx *ctx = (struct udp_stream_ctx *)data;
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    char buffer[1024];
-    int recv_len;
-    time_t now;
 
+    pthread_mutex_lock(&ctx->mutex);
     while (ctx->running) {
-        now = time(NULL);
+        unsigned long long now = get_monotonic_us(), wait_us = 0, next;
+
+        // In multicast mode the group is the only destination
+        if (ctx->is_mcast && (next = udp_pace_client(ctx, &ctx->mcast, now)))
+            wait_us = next;
+        for (int i = 0; i < UDP_MAX_CLIENTS && !ctx->is_mcast; i++) {
+            if (!ctx->clients[i].active) continue;
+            if ((next = udp_pace_client(ctx, &ctx->clients[i], now)) &&
+                (!wait_us || next < wait_us))
+                wait_us = next;
+        }
+
+        if (!wait_us) {
+            pthread_cond_wait(&ctx->pacer_cond, &ctx->mutex);
+            continue;
+        }
+
+        unsigned long long until = now + wait_us;
+        struct timespec ts = {.tv_sec = until / 1000000,
+            .tv_nsec = (until % 1000000) * 1000};
+        pthread_cond_timedwait(&ctx->pacer_cond, &ctx->mutex, &ts);
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return NULL;
+}
+
+/**
+ * Queues a copy of a packet a destination reported lost for resending, if
+ * the ring still holds it, it is recent enough and the retransmission
+ * budget allows
+ */
+static void udp_retransmit(struct udp_stream_ctx *ctx, udp_client_t *c,
+    unsigned short seq, int *count) {
+    const unsigned short behind = c->seq - seq;
+    const unsigned int pos = c->cursor - behind;
+
+    if (!behind || behind > c->cursor - c->start ||
+        ctx->ring_head - pos > UDP_RING_PKTS)
+        return;
+
+    const udp_packet_t *pkt = &ctx->ring[pos % UDP_RING_PKTS];
+    const unsigned int newest = ctx->ring[(ctx->ring_head - 1) % UDP_RING_PKTS].tstamp;
+    if (newest - pkt->tstamp > app_config.stream_nack_ms * (RTP_VIDEO_CLOCK / 1000) ||
+        c->rtx_tokens < pkt->len || *count >= NACK_BURST_PKTS)
+        return;
+
+    udp_rtx_packet_t *rtx = &ctx->rtx_tx[(*count)++];
+    rtx->addr = c->addr;
+    rtx->pkt.len = pkt->len;
+    rtx->pkt.marker = pkt->marker;
+    rtx->pkt.tstamp = pkt->tstamp;
+    memcpy(rtx->pkt.data + RTP_HEADER_SIZE, pkt->data + RTP_HEADER_SIZE,
+        pkt->len - RTP_HEADER_SIZE);
+    udp_fill_header(c, &rtx->pkt, seq);
+    c->rtx_tokens -= pkt->len;
+}
+
+/**
+ * Handles a generic NACK (RFC 4585 6.2.1) naming lost packets of a
+ * destination by SSRC
+ */
+static void udp_handle_nack(struct udp_stream_ctx *ctx, const unsigned char *rtcp,
+    unsigned int len, int *count) {
+    const unsigned int ssrc = (rtcp[8] << 24) | (rtcp[9] << 16) | (rtcp[10] << 8) | rtcp[11];
+    udp_client_t *c = NULL;
+
+    if (ctx->is_mcast) {
+        if (ctx->mcast.ssrc == ssrc) c = &ctx->mcast;
+    } else {
+        for (int i = 0; i < UDP_MAX_CLIENTS && !c; i++)
+            if (ctx->clients[i].active && ctx->clients[i].ssrc == ssrc)
+                c = &ctx->clients[i];
+    }
+    if (!c) return;
+
+    const unsigned long long now = get_monotonic_us();
+    const double burst = NACK_BURST_PKTS * sizeof(((udp_packet_t *)0)->data);
+    c->rtx_tokens += (double)(now - c->rtx_refill_us) * ctx->rtx_rate / 1000000.0;
+    if (c->rtx_tokens > burst) c->rtx_tokens = burst;
+    c->rtx_refill_us = now;
+
+    for (unsigned int off = 12; off + 4 <= len; off += 4) {
+        const unsigned short pid = (rtcp[off] << 8) | rtcp[off + 1];
+        const unsigned short blp = (rtcp[off + 2] << 8) | rtcp[off + 3];
+
+        udp_retransmit(ctx, c, pid, count);
+        for (int bit = 0; bit < 16; bit++)
+            if (blp & (1 << bit))
+                udp_retransmit(ctx, c, pid + bit + 1, count);
+    }
+}
+
+/**
+ * Reads the RTCP packets waiting on the feedback socket, the packets they
+ * ask for are copied under the lock and resent after releasing it
+ */
+static void udp_rtcp_drain(struct udp_stream_ctx *ctx) {
+    unsigned char buf[1500];
+    ssize_t n;
+
+    while ((n = recv(ctx->rtcp_fd, buf, sizeof(buf), 0)) > 0) {
+        const unsigned char *rtcp = buf;
+        size_t left = n;
+        int count = 0;
 
         pthread_mutex_lock(&ctx->mutex);
-        for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-            if (ctx->clients[i].active) {
-                if (difftime(now, ctx->clients[i].last_act) > 60) {
-                    ctx->clients[i].active = 0;
-                    ctx->client_count--;
-
-                    char ip_str[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &ctx->clients[i].addr.sin_addr,
-                             ip_str, INET_ADDRSTRLEN);
-                    HAL_INFO("stream", "Removed inactive UDP client %s:%d (ID %d)\n",
-                           ip_str, ntohs(ctx->clients[i].addr.sin_port), i);
-                }
-            }
+        while (left >= 4) {
+            const size_t len = (((rtcp[2] << 8) | rtcp[3]) + 1) * 4;
+            if ((rtcp[0] >> 6) != 2 || len > left) break;
+            // RTPFB, FMT 1
+            if (rtcp[1] == 205 && (rtcp[0] & 0x1F) == 1 && len >= 12)
+                udp_handle_nack(ctx, rtcp, len, &count);
+            rtcp += len;
+            left -= len;
         }
         pthread_mutex_unlock(&ctx->mutex);
 
-        recv_len = recvfrom(ctx->socket_fd, buffer, sizeof(buffer), 0,
-                           (struct sockaddr *)&client_addr, &addr_len);
+        for (int i = 0; i < count; i++)
+            sendto(ctx->socket_fd, ctx->rtx_tx[i].pkt.data, ctx->rtx_tx[i].pkt.len, 0,
+                (const struct sockaddr *)&ctx->rtx_tx[i].addr, sizeof(ctx->rtx_tx[i].addr));
+    }
+}
 
-        if (recv_len > 0) {
-            pthread_mutex_lock(&ctx->mutex);
+/**
+ * Arms the expiration timer for the destination that went silent first,
+ * or disarms it when there is none
+ */
+static void udp_arm_expiry(struct udp_stream_ctx *ctx) {
+    struct itimerspec its = {0};
+    time_t oldest = 0;
+
+    pthread_mutex_lock(&ctx->mutex);
+    for (int i = 0; i < UDP_MAX_CLIENTS; i++)
+        if (ctx->clients[i].active &&
+            (!oldest || ctx->clients[i].last_act < oldest))
+            oldest = ctx->clients[i].last_act;
+    pthread_mutex_unlock(&ctx->mutex);
+
+    if (oldest) {
+        const time_t left = oldest + UDP_CLIENT_TIMEOUT + 1 - time(NULL);
+        its.it_value.tv_sec = left > 0 ? left : 1;
+    }
+    timerfd_settime(ctx->timer_fd, 0, &its, NULL);
+}
 
-            int client_found = 0;
-            for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-                if (!ctx->clients[i].active) continue;
+/**
+ * Drops the destinations that have been silent for too long
+ */
+static void udp_expire_clients(struct udp_stream_ctx *ctx) {
+    const time_t now = time(NULL);
 
-                if (ctx->clients[i].addr.sin_addr.s_addr == client_addr.sin_addr.s_addr &&
-                    ctx->clients[i].addr.sin_port == client_addr.sin_port) {
-                    ctx->clients[i].last_act = now;
-                    client_found = 1;
-                    break;
-                }
-            }
+    pthread_mutex_lock(&ctx->mutex);
+    for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
+        if (!ctx->clients[i].active ||
+            difftime(now, ctx->clients[i].last_act) <= UDP_CLIENT_TIMEOUT)
+            continue;
 
-            if (!client_found && ctx->client_count < UDP_MAX_CLIENTS) {
-                for (int i = 0; i < UDP_MAX_CLIENTS; i++) {
-                    if (ctx->clients[i].active) continue;
-
-                    ctx->clients[i].addr = client_addr;
-                    ctx->clients[i].active = 1;
-                    ctx->clients[i].ssrc = rand();
-                    ctx->clients[i].seq = rand() & 0xFFFF;
-                    ctx->clients[i].tstamp = rand();
-                    ctx->clients[i].last_act = now;
-
-                    ctx->client_count++;
-
-                    char ip_str[INET_ADDRSTRLEN];
-                    inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, INET_ADDRSTRLEN);
-                    HAL_INFO("stream", "Auto-added UDP client %s:%d (ID %d)\n",
-                        ip_str, ntohs(client_addr.sin_port), i);
-                    break;
-                }
-            }
+        udp_client_unlink(ctx, i);
+        ctx->clients[i].active = 0;
+        ctx->client_count--;
 
-            pthread_mutex_unlock(&ctx->mutex);
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &ctx->clients[i].addr.sin_addr,
+                 ip_str, INET_ADDRSTRLEN);
+        HAL_INFO("stream", "Removed inactive UDP client %s:%d (ID %d)\n",
+               ip_str, ntohs(ctx->clients[i].addr.sin_port), i);
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+/**
+ * Reads the datagrams waiting on the streaming socket, refreshing known
+ * destinations and adding new senders as receivers
+ */
+static void udp_accept_clients(struct udp_stream_ctx *ctx) {
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    char buffer[1024];
+
+    while (recvfrom(ctx->socket_fd, buffer, sizeof(buffer), 0,
+                   (struct sockaddr *)&client_addr, &addr_len) >= 0) {
+        const time_t now = time(NULL);
+        int i;
+
+        addr_len = sizeof(client_addr);
+        pthread_mutex_lock(&ctx->mutex);
+
+        if ((i = udp_client_find(ctx, &client_addr)) >= 0) {
+            ctx->clients[i].last_act = now;
+        } else if ((i = udp_client_slot(ctx)) >= 0) {
+            // Starts at the next packet of the ring, i.e. the next frame
+            udp_client_activate(ctx, &ctx->clients[i], &client_addr, now);
+            udp_client_link(ctx, i);
+            ctx->client_count++;
+
+            char ip_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, INET_ADDRSTRLEN);
+            HAL_INFO("stream", "Auto-added UDP client %s:%d (ID %d)\n",
+                ip_str, ntohs(client_addr.sin_port), i);
+        }
+
+        pthread_mutex_unlock(&ctx->mutex);
+    }
+}
+
+/**
+ * Thread handler for managing UDP clients, sleeping until a receiver
+ * writes to us, sends RTCP feedback or one of them expires
+ */
+static void *udp_client_manager_thread(void *data) {
+    struct udp_stream_ctx *ctx = (struct udp_stream_ctx *)data;
+    struct pollfd pfd[] = {
+        {.fd = ctx->socket_fd, .events = POLLIN},
+        {.fd = ctx->rtcp_fd, .events = POLLIN},
+        {.fd = ctx->timer_fd, .events = POLLIN},
+        {.fd = ctx->wake_fd, .events = POLLIN}
+    };
+    uint64_t ticks;
+
+    while (ctx->running) {
+        udp_arm_expiry(ctx);
+
+        if (poll(pfd, sizeof(pfd) / sizeof(*pfd), -1) < 0) {
+            if (errno == EINTR) continue;
+            HAL_DANGER("stream", "Client manager poll failed: %s\n", strerror(errno));
+            break;
         }
 
-        usleep(500000);
+        if (pfd[3].revents & POLLIN)
+            read(ctx->wake_fd, &ticks, sizeof(ticks));
+        if (pfd[2].revents & POLLIN &&
+            read(ctx->timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks))
+            udp_expire_clients(ctx);
+        if (pfd[0].revents & POLLIN)
+            udp_accept_clients(ctx);
+        if (pfd[1].revents & POLLIN)
+            udp_rtcp_drain(ctx);
     }
 
     return NULL;
 }
 
+/**
+ * Interrupts the client manager so it re-evaluates its timer or exits
+ */
+static void udp_wake_manager(struct udp_stream_ctx *ctx) {
+    const uint64_t one = 1;
+    write(ctx->wake_fd, &one, sizeof(one));
+}
+
 /**
  * Prefixes the RTP header to a given packet
  */
@@ -465,6 +1109,15 @@ static int add_rtp_header(unsigned char *packet, int pay_size,
     return RTP_HEADER_SIZE;
 }
 
+/**
+ * Obtains a monotonic timestamp in microseconds (pacer clock)
+ */
+static unsigned long long get_monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /**
  * Obtains a timestamp in microseconds
  */
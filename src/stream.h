@@ -4,45 +4,146 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include "app_config.h"
 #include "hal/support.h"
 
 #define MAX_UDP_PACKET_SIZE 1400
 #define UDP_DEFAULT_PORT 5600
 #define RTP_HEADER_SIZE 12
-#define UDP_MAX_CLIENTS 8
+#define UDP_MAX_CLIENTS 64
+// Buckets of the address lookup table (power of two)
+#define UDP_HASH_BITS 7
+#define UDP_HASH_SIZE (1 << UDP_HASH_BITS)
+// Destinations that stay silent for this long are dropped
+#define UDP_CLIENT_TIMEOUT 60
+// Packets kept for the pacer, shared by all destinations (a large IDR fits)
+#define UDP_RING_PKTS 512
+#define RTP_VIDEO_CLOCK 90000
+// Packets handed to the kernel per sendmmsg()/GSO call
+#define UDP_BATCH 64
+#define UDP_GSO_BYTES 65000
+// SMPTE 2022-1 FEC: column parity on port + 2, row parity on port + 4
+#define FEC_HEADER_SIZE 16
+#define FEC_MAX_COLS 20
+#define FEC_MAX_ROWS 20
+// NACK retransmissions (RTCP on port + 1): share of the video bitrate and
+// burst they may use per destination
+#define NACK_RATE_DIV 4
+#define NACK_BURST_PKTS 32
+// Parity packets one paced batch may complete, the batch is cut short so
+// they fit
+#define UDP_FEC_BATCH 16
+
+// RTP packet built once per access unit; the header is filled in for each
+// destination right before sending
+typedef struct {
+    unsigned short len;
+    unsigned char marker;
+    unsigned int tstamp;
+    unsigned char data[RTP_HEADER_SIZE + MAX_UDP_PACKET_SIZE];
+} udp_packet_t;
+
+// XOR of the media packets protected by one FEC packet
+typedef struct {
+    unsigned short sn_base;
+    unsigned short len_rec;
+    unsigned char pt_rec;
+    unsigned int ts_rec;
+    unsigned short size;
+    unsigned char payload[MAX_UDP_PACKET_SIZE];
+} udp_fec_acc_t;
+
+// Parity packet built under the stream lock and sent by the pacer after
+typedef struct {
+    struct sockaddr_in addr;
+    unsigned short len;
+    unsigned char data[RTP_HEADER_SIZE + FEC_HEADER_SIZE + MAX_UDP_PACKET_SIZE];
+} udp_fec_packet_t;
+
+// Retransmission copied out of the ring under the stream lock and sent by
+// the client manager after
+typedef struct {
+    struct sockaddr_in addr;
+    udp_packet_t pkt;
+} udp_rtx_packet_t;
+
+// FEC matrix of L columns by D rows (D = 0: row parity only, 1 in L)
+typedef struct {
+    unsigned char cols, rows;
+    unsigned int count;
+    unsigned short next_seq;
+    unsigned short row_seq, col_seq;
+    struct sockaddr_in row_addr, col_addr;
+    udp_fec_acc_t row;
+    udp_fec_acc_t col[];
+} udp_fec_t;
 
 typedef struct {
     struct sockaddr_in addr;
     int active;
+    // Next slot in the same hash bucket, -1 ends the chain
+    int next;
     unsigned int ssrc;
     unsigned short seq;
     unsigned int tstamp;
     time_t last_act;
+    // RTP header with the constant fields of this destination
+    unsigned char hdr[RTP_HEADER_SIZE];
+    // Position in the shared ring and token bucket, owned by the pacer
+    unsigned int cursor, start;
+    double tokens, rtx_tokens;
+    unsigned long long refill_us, rtx_refill_us;
+    unsigned int dropped;
+    udp_fec_t *fec;
 } udp_client_t;
 
 struct udp_stream_ctx {
     int socket_fd;
+    int rtcp_fd;
+    // Wakes the client manager for expirations and table changes
+    int timer_fd;
+    int wake_fd;
     unsigned short port;
     volatile int running;
     pthread_t thread;
+    pthread_t pacer;
     pthread_mutex_t mutex;
+    pthread_cond_t pacer_cond;
     udp_client_t clients[UDP_MAX_CLIENTS];
+    int hash[UDP_HASH_SIZE];
     int client_count;
     char is_mcast;
     unsigned int mcast_addr;
+    udp_client_t mcast;
+    udp_packet_t *ring;
+    unsigned int ring_head;
+    // Copies of one paced batch, sent once the pacer released the lock
+    udp_packet_t *tx;
+    udp_fec_packet_t *fec_tx;
+    // Retransmissions answering one RTCP datagram, owned by the manager
+    udp_rtx_packet_t *rtx_tx;
+    // 1 if UDP_SEGMENT worked, 0 if untried, -1 if unsupported
+    int gso;
+    unsigned int pace_rate;
+    unsigned int pace_burst;
+    unsigned int rtx_rate;
 };
 
 int udp_stream_init(unsigned short port, const char *mcast_addr);
 void udp_stream_close(void);
-int udp_stream_add_client(const char *host, unsigned short port);
+int udp_stream_add_client(const char *host, unsigned short port,
+    unsigned char fec_cols, unsigned char fec_rows);
 void udp_stream_remove_client(int client_id);
 int udp_stream_has_clients(void);
-int udp_stream_send_nal(const char *nal_data, int nal_size, int is_keyframe, int is_h265);
\ No newline at end of file
+int udp_stream_send_frame(hal_vidstream *stream, char is_h265);
\ No newline at end of file
@@ -0,0 +1,981 @@
+// faac_compare: quality and cost of the fixed-point FAAC build against the
+// float one.
+//
+// Encodes the same synthetic signals (speech-like harmonics, chords, noise,
+// clicks, a full-scale square wave and a sine after silence) with both
+// builds of the bundled libfaac, configured the way media.c does it, and
+// reports for each build the bitrate, the encode CPU time and the SNR of the
+// decoded stream against the source, then the SNR of the fixed-point output
+// against the float one.
+//
+// Build:  make -C src faac_compare
+// Usage:  ./faac_compare [seconds]   (at least 4, default 6)
+//
+// The make rule links libfaac twice, once with FAAC_FIXED_POINT, and renames
+// the encoder entry points to float_faacEnc* and fixed_faacEnc*. The streams
+// are decoded by the small AAC-LC decoder below, which covers what FAAC
+// writes (long and short windows, M/S, intensity stereo, PNS) but not TNS,
+// so TNS is off for both builds as it is in the fixed-point one.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <faac.h>
+
+#include "huffdata.h"
+
+#define FRAME_LEN 1024
+#define SHORT_LEN 128
+#define MAX_CH 2
+#define MAX_SFB 51
+#define SF_OFFSET 100
+
+// FAAC returns nothing for the frame it primes with, so the decoded stream
+// leads the source by one frame.
+#define DECODED_LAG (-FRAME_LEN)
+
+enum {
+    ID_SCE = 0,
+    ID_CPE = 1,
+    ID_CCE = 2,
+    ID_LFE = 3,
+    ID_DSE = 4,
+    ID_PCE = 5,
+    ID_FIL = 6,
+    ID_END = 7
+};
+
+enum {
+    ONLY_LONG = 0,
+    LONG_START = 1,
+    EIGHT_SHORT = 2,
+    LONG_STOP = 3
+};
+
+enum {
+    HCB_ZERO = 0,
+    HCB_ESC = 11,
+    HCB_NOISE = 13,
+    HCB_INTENSITY2 = 14,
+    HCB_INTENSITY = 15
+};
+
+#define FAAC_API(p) \
+    faacEncHandle p##_faacEncOpen(unsigned long, unsigned int, unsigned long *, unsigned long *); \
+    faacEncConfigurationPtr p##_faacEncGetCurrentConfiguration(faacEncHandle); \
+    int p##_faacEncSetConfiguration(faacEncHandle, faacEncConfigurationPtr); \
+    int p##_faacEncEncode(faacEncHandle, int32_t *, unsigned int, unsigned char *, unsigned int); \
+    int p##_faacEncClose(faacEncHandle);
+
+FAAC_API(float)
+FAAC_API(fixed)
+
+typedef struct {
+    const char *name;
+    faacEncHandle (*open)(unsigned long, unsigned int, unsigned long *, unsigned long *);
+    faacEncConfigurationPtr (*get_config)(faacEncHandle);
+    int (*set_config)(faacEncHandle, faacEncConfigurationPtr);
+    int (*encode)(faacEncHandle, int32_t *, unsigned int, unsigned char *, unsigned int);
+    int (*close)(faacEncHandle);
+} Encoder;
+
+#define ENCODER(p) { #p, p##_faacEncOpen, p##_faacEncGetCurrentConfiguration, \
+    p##_faacEncSetConfiguration, p##_faacEncEncode, p##_faacEncClose }
+
+static const Encoder g_encoders[2] = { ENCODER(float), ENCODER(fixed) };
+
+typedef enum { SIG_MIX, SIG_SQUARE, SIG_ONSET } SignalKind;
+
+static const struct {
+    const char *label;
+    SignalKind kind;
+    unsigned int rate;
+    int channels;
+    unsigned int kbps;
+} g_cases[] = {
+    { "8k mono 24k", SIG_MIX, 8000, 1, 24 },
+    { "16k mono 32k", SIG_MIX, 16000, 1, 32 },
+    { "48k stereo 128k", SIG_MIX, 48000, 2, 128 },
+    { "full-scale square", SIG_SQUARE, 48000, 2, 128 },
+    { "silence -> sine", SIG_ONSET, 48000, 2, 128 },
+};
+
+// ---------------------------------------------------------------------------
+// Test signals
+
+static uint32_t g_rng = 1;
+
+static double uniform(void) {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 17;
+    g_rng ^= g_rng << 5;
+    return g_rng / 4294967296.0;
+}
+
+// Approximately normal, sum of four uniforms scaled to unit variance.
+static double gauss(void) {
+    return (uniform() + uniform() + uniform() + uniform() - 2.0) * sqrt(3.0);
+}
+
+static short clip16(double v) {
+    if (v > 32767.0) return 32767;
+    if (v < -32768.0) return -32768;
+    return (short)lrint(v);
+}
+
+static short *make_signal(SignalKind kind, unsigned int rate, int channels, size_t frames) {
+    short *pcm = calloc(frames * channels, sizeof(*pcm));
+    double *mono = calloc(frames, sizeof(*mono));
+    if (!pcm || !mono) {
+        free(pcm);
+        free(mono);
+        return NULL;
+    }
+
+    g_rng = 1;
+    double phase = 0;
+    for (size_t i = 0; i < frames; i++) {
+        double t = (double)i / rate;
+        switch (kind) {
+        case SIG_MIX: {
+            // Voice-like harmonics with vibrato and syllable envelope for two
+            // seconds, then a chord for two seconds, over a noise floor.
+            double f0 = 140 + 40 * sin(2 * M_PI * 0.7 * t);
+            phase += 2 * M_PI * f0 / rate;
+            double v;
+            if (fmod(t, 4.0) < 2.0) {
+                double voice = 0;
+                for (int k = 1; k < 20 && k * f0 < rate / 2; k++)
+                    voice += sin(k * phase) / k;
+                double env = sin(2 * M_PI * 3 * t);
+                v = voice * (0.5 + 0.5 * env * env) * 0.3;
+            } else {
+                static const double chord[] = { 261.6, 329.6, 392.0, 523.3, 1046.5 };
+                v = 0;
+                for (int k = 0; k < 5; k++)
+                    v += sin(2 * M_PI * chord[k] * t);
+                v *= 0.4 / 5;
+            }
+            mono[i] += v + gauss() * 0.05;
+            // A decaying noise burst three times a second.
+            if (i % (rate / 3) == 0)
+                for (size_t j = 0; j < 400 && i + j < frames; j++)
+                    mono[i + j] += exp(-(double)j / 60) * gauss() * 0.3;
+            break;
+        }
+        case SIG_SQUARE:
+            mono[i] = fmod(t * 440, 1.0) < 0.5 ? 1.0 : -1.0;
+            break;
+        case SIG_ONSET:
+            mono[i] = t < 2.0 ? 0 : 0.5 * sin(2 * M_PI * 1000 * t);
+            break;
+        }
+    }
+
+    double scale = kind == SIG_SQUARE ? 32767 : 20000;
+    for (size_t i = 0; i < frames; i++) {
+        pcm[i * channels] = clip16(mono[i] * scale);
+        if (channels > 1) {
+            double r = i >= 37 ? mono[i - 37] * 0.8 : 0;
+            if (kind == SIG_MIX)
+                r += gauss() * 0.02;
+            pcm[i * channels + 1] = clip16(r * scale);
+        }
+    }
+    free(mono);
+    return pcm;
+}
+
+// ---------------------------------------------------------------------------
+// AAC-LC decoder
+
+typedef struct {
+    const uint8_t *buf;
+    size_t bits;
+    size_t pos;
+} BitReader;
+
+static uint32_t get_bits(BitReader *br, int n) {
+    uint32_t v = 0;
+    while (n-- > 0) {
+        int bit = 0;
+        if (br->pos < br->bits)
+            bit = (br->buf[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+        v = (v << 1) | bit;
+        br->pos++;
+    }
+    return v;
+}
+
+// Codewords grouped by length, so that a lookup only scans the codewords of
+// the length read so far.
+typedef struct {
+    uint32_t code[289];
+    uint16_t index[289];
+    int start[34];
+} HuffTable;
+
+static HuffTable g_spectral[12];
+static HuffTable g_scalefactor;
+
+static void huff_build(HuffTable *t, const uint32_t *len, const uint32_t *code, int size) {
+    int n = 0;
+    for (int l = 1; l <= 32; l++) {
+        t->start[l] = n;
+        for (int i = 0; i < size; i++) {
+            if (len[i] != (uint32_t)l)
+                continue;
+            t->code[n] = code[i];
+            t->index[n++] = i;
+        }
+    }
+    t->start[33] = n;
+}
+
+static int huff_decode(BitReader *br, const HuffTable *t) {
+    uint32_t code = 0;
+    for (int l = 1; l <= 32; l++) {
+        code = (code << 1) | get_bits(br, 1);
+        for (int i = t->start[l]; i < t->start[l + 1]; i++)
+            if (t->code[i] == code)
+                return t->index[i];
+        if (br->pos > br->bits)
+            break;
+    }
+    return -1;
+}
+
+static const struct {
+    const hcode16_t *book;
+    int size;
+    int dim;
+    int mod;
+    int offset; // non-zero for signed books
+} g_books[12] = {
+    { NULL, 0, 0, 0, 0 },
+    { book01, 81, 4, 3, 1 },
+    { book02, 81, 4, 3, 1 },
+    { book03, 81, 4, 3, 0 },
+    { book04, 81, 4, 3, 0 },
+    { book05, 81, 2, 9, 4 },
+    { book06, 81, 2, 9, 4 },
+    { book07, 64, 2, 8, 0 },
+    { book08, 64, 2, 8, 0 },
+    { book09, 169, 2, 13, 0 },
+    { book10, 169, 2, 13, 0 },
+    { book11, 289, 2, 17, 0 },
+};
+
+static void huff_init(void) {
+    uint32_t len[289], code[289];
+    for (int b = 1; b < 12; b++) {
+        for (int i = 0; i < g_books[b].size; i++) {
+            len[i] = g_books[b].book[i].len;
+            code[i] = g_books[b].book[i].data;
+        }
+        huff_build(&g_spectral[b], len, code, g_books[b].size);
+    }
+    for (int i = 0; i < 121; i++) {
+        len[i] = book12[i].len;
+        code[i] = book12[i].data;
+    }
+    huff_build(&g_scalefactor, len, code, 121);
+}
+
+// Scalefactor band widths (ISO/IEC 14496-3 4.5.4), as in libfaac frame.c.
+static const struct {
+    unsigned int rate;
+    int num_long;
+    int num_short;
+    uint8_t long_width[MAX_SFB];
+    uint8_t short_width[15];
+} g_bands[] = {
+    { 44100, 49, 14,
+        { 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 8, 8, 8, 8, 8, 8, 8,
+          12, 12, 12, 12, 16, 16, 20, 20, 24, 24, 28, 28, 32, 32, 32, 32, 32, 32,
+          32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 96 },
+        { 4, 4, 4, 4, 4, 8, 8, 8, 12, 12, 12, 16, 16, 16 } },
+    { 32000, 51, 14,
+        { 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 8, 8, 8, 8,
+          8, 8, 8, 12, 12, 12, 12, 16, 16, 20, 20, 24, 24, 28,
+          28, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32,
+          32, 32, 32, 32, 32, 32, 32, 32, 32 },
+        { 4, 4, 4, 4, 4, 8, 8, 8, 12, 12, 12, 16, 16, 16 } },
+    { 22050, 47, 15,
+        { 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 8, 8, 8, 8, 8, 8, 8,
+          8, 8, 8, 12, 12, 12, 12, 16, 16, 16, 20, 20, 24, 24, 28, 28, 32,
+          36, 36, 40, 44, 48, 52, 52, 64, 64, 64, 64, 64 },
+        { 4, 4, 4, 4, 4, 4, 4, 8, 8, 8, 12, 12, 16, 16, 20 } },
+    { 11025, 43, 15,
+        { 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 12, 12, 12,
+          12, 12, 12, 12, 12, 12, 16, 16, 16, 16, 20, 20, 20, 24,
+          24, 28, 28, 32, 36, 40, 40, 44, 48, 52, 56, 60, 64, 64, 64 },
+        { 4, 4, 4, 4, 4, 4, 4, 4, 8, 8, 12, 12, 16, 20, 20 } },
+    { 8000, 40, 15,
+        { 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 16,
+          16, 16, 16, 16, 16, 16, 20, 20, 20, 20, 24, 24, 24, 28,
+          28, 32, 36, 36, 40, 44, 48, 52, 56, 60, 64, 80 },
+        { 4, 4, 4, 4, 4, 4, 4, 8, 8, 8, 8, 12, 16, 20, 20 } },
+};
+
+typedef struct {
+    int window_sequence;
+    int window_shape;
+    int max_sfb;
+    int num_groups;
+    int group_len[8];
+} IcsInfo;
+
+typedef struct {
+    IcsInfo info;
+    int global_gain;
+    uint8_t book[8][MAX_SFB];
+    int sf[8][MAX_SFB];
+    float spec[FRAME_LEN];
+} Ics;
+
+typedef struct {
+    int num_long, num_short;
+    int long_offset[MAX_SFB + 1];
+    int short_offset[16];
+    int channels;
+    uint32_t noise_state;
+    int prev_shape[MAX_CH];
+    float overlap[MAX_CH][FRAME_LEN];
+    Ics ics[MAX_CH];
+    int ms_used[8][MAX_SFB];
+    int ms_present;
+} Decoder;
+
+static int decoder_init(Decoder *d, unsigned int rate, int channels) {
+    int b = -1;
+    if (rate >= 44100) b = 0;
+    else if (rate >= 32000) b = 1;
+    else if (rate >= 22050) b = 2;
+    else if (rate >= 11025) b = 3;
+    else if (rate >= 8000) b = 4;
+    if (b < 0 || channels < 1 || channels > MAX_CH)
+        return -1;
+
+    memset(d, 0, sizeof(*d));
+    d->num_long = g_bands[b].num_long;
+    d->num_short = g_bands[b].num_short;
+    for (int i = 0; i < d->num_long; i++)
+        d->long_offset[i + 1] = d->long_offset[i] + g_bands[b].long_width[i];
+    for (int i = 0; i < d->num_short; i++)
+        d->short_offset[i + 1] = d->short_offset[i] + g_bands[b].short_width[i];
+    d->channels = channels;
+    d->noise_state = 0x1f2e3d4c;
+    return 0;
+}
+
+static int read_ics_info(BitReader *br, const Decoder *d, IcsInfo *info) {
+    get_bits(br, 1); // reserved
+    info->window_sequence = get_bits(br, 2);
+    info->window_shape = get_bits(br, 1);
+    if (info->window_sequence == EIGHT_SHORT) {
+        info->max_sfb = get_bits(br, 4);
+        uint32_t grouping = get_bits(br, 7);
+        info->num_groups = 1;
+        info->group_len[0] = 1;
+        for (int w = 0; w < 7; w++) {
+            if (grouping & (1 << (6 - w)))
+                info->group_len[info->num_groups - 1]++;
+            else
+                info->group_len[info->num_groups++] = 1;
+        }
+        return info->max_sfb > d->num_short ? -1 : 0;
+    }
+    info->max_sfb = get_bits(br, 6);
+    info->num_groups = 1;
+    info->group_len[0] = 1;
+    if (get_bits(br, 1)) // predictor_data_present, not in AAC-LC
+        return -1;
+    return info->max_sfb > d->num_long ? -1 : 0;
+}
+
+static int read_section_data(BitReader *br, Ics *ics) {
+    const IcsInfo *info = &ics->info;
+    int bits = info->window_sequence == EIGHT_SHORT ? 3 : 5;
+    int esc = (1 << bits) - 1;
+
+    for (int g = 0; g < info->num_groups; g++) {
+        int k = 0;
+        while (k < info->max_sfb) {
+            int book = get_bits(br, 4);
+            int len = 0, inc;
+            if (book == 12)
+                return -1;
+            do {
+                inc = get_bits(br, bits);
+                len += inc;
+            } while (inc == esc && br->pos <= br->bits);
+            if (k + len > info->max_sfb)
+                return -1;
+            while (len-- > 0)
+                ics->book[g][k++] = book;
+        }
+    }
+    return 0;
+}
+
+static int read_scalefactors(BitReader *br, Ics *ics) {
+    const IcsInfo *info = &ics->info;
+    int sf = ics->global_gain;
+    int is_pos = 0;
+    int noise = ics->global_gain - 90;
+    int first_noise = 1;
+
+    for (int g = 0; g < info->num_groups; g++) {
+        for (int k = 0; k < info->max_sfb; k++) {
+            int book = ics->book[g][k];
+            int diff;
+            if (book == HCB_ZERO) {
+                ics->sf[g][k] = 0;
+                continue;
+            }
+            if (book == HCB_NOISE && first_noise) {
+                first_noise = 0;
+                noise += (int)get_bits(br, 9) - 256;
+                ics->sf[g][k] = noise;
+                continue;
+            }
+            if ((diff = huff_decode(br, &g_scalefactor)) < 0)
+                return -1;
+            diff -= 60;
+            if (book == HCB_INTENSITY || book == HCB_INTENSITY2)
+                ics->sf[g][k] = is_pos += diff;
+            else if (book == HCB_NOISE)
+                ics->sf[g][k] = noise += diff;
+            else
+                ics->sf[g][k] = sf += diff;
+        }
+    }
+    return 0;
+}
+
+static float dequant(int q, int sf) {
+    float v = powf((float)abs(q), 4.0f / 3.0f) * powf(2.0f, 0.25f * (sf - SF_OFFSET));
+    return q < 0 ? -v : v;
+}
+
+static int read_spectral_data(BitReader *br, const Decoder *d, Ics *ics) {
+    const IcsInfo *info = &ics->info;
+    int is_short = info->window_sequence == EIGHT_SHORT;
+    const int *offset = is_short ? d->short_offset : d->long_offset;
+    int q[8 * 96];
+    int win = 0;
+
+    memset(ics->spec, 0, sizeof(ics->spec));
+    for (int g = 0; g < info->num_groups; g++) {
+        int glen = info->group_len[g];
+        for (int k = 0; k < info->max_sfb; k++) {
+            int book = ics->book[g][k];
+            int width = offset[k + 1] - offset[k];
+            int n = width * glen;
+            if (book == HCB_ZERO || book >= HCB_NOISE)
+                continue;
+
+            int dim = g_books[book].dim, mod = g_books[book].mod;
+            for (int i = 0; i < n; i += dim) {
+                int idx = huff_decode(br, &g_spectral[book]);
+                if (idx < 0)
+                    return -1;
+                for (int j = dim - 1; j >= 0; j--) {
+                    q[i + j] = idx % mod - g_books[book].offset;
+                    idx /= mod;
+                }
+                if (g_books[book].offset)
+                    continue;
+                for (int j = 0; j < dim; j++)
+                    if (q[i + j] && get_bits(br, 1))
+                        q[i + j] = -q[i + j];
+                if (book != HCB_ESC)
+                    continue;
+                for (int j = 0; j < dim; j++) {
+                    if (abs(q[i + j]) != 16)
+                        continue;
+                    int prefix = 0;
+                    while (get_bits(br, 1) && prefix < 9)
+                        prefix++;
+                    int v = (1 << (prefix + 4)) + get_bits(br, prefix + 4);
+                    q[i + j] = q[i + j] < 0 ? -v : v;
+                }
+            }
+
+            // Coefficients of a group come band by band, window by window.
+            for (int w = 0; w < glen; w++)
+                for (int i = 0; i < width; i++)
+                    ics->spec[(win + w) * SHORT_LEN * is_short + offset[k] + i] =
+                        dequant(q[w * width + i], ics->sf[g][k]);
+        }
+        win += glen;
+    }
+    return br->pos > br->bits ? -1 : 0;
+}
+
+static int read_ics(BitReader *br, Decoder *d, Ics *ics, int common_window) {
+    ics->global_gain = get_bits(br, 8);
+    if (!common_window && read_ics_info(br, d, &ics->info) < 0)
+        return -1;
+    if (read_section_data(br, ics) < 0 || read_scalefactors(br, ics) < 0)
+        return -1;
+    // pulse_data_present, tns_data_present, gain_control_data_present: FAAC
+    // writes no pulses and gain control is not part of AAC-LC.
+    if (get_bits(br, 1) || get_bits(br, 1) || get_bits(br, 1))
+        return -1;
+    return read_spectral_data(br, d, ics);
+}
+
+static float noise_value(Decoder *d) {
+    d->noise_state = d->noise_state * 1664525u + 1013904223u;
+    return (float)(int32_t)d->noise_state;
+}
+
+// Fills the PNS bands of a channel; with correlated noise the right channel
+// reuses the values the left one drew.
+static void apply_noise(Decoder *d, Ics *ics, const Ics *left) {
+    const IcsInfo *info = &ics->info;
+    int is_short = info->window_sequence == EIGHT_SHORT;
+    const int *offset = is_short ? d->short_offset : d->long_offset;
+    int win = 0;
+
+    for (int g = 0; g < info->num_groups; g++) {
+        for (int k = 0; k < info->max_sfb; k++) {
+            if (ics->book[g][k] != HCB_NOISE)
+                continue;
+            int shared = left && left->book[g][k] == HCB_NOISE && d->ms_used[g][k];
+            for (int w = 0; w < info->group_len[g]; w++) {
+                float *s = ics->spec + (win + w) * SHORT_LEN * is_short + offset[k];
+                int width = offset[k + 1] - offset[k];
+                float energy = 0;
+                for (int i = 0; i < width; i++) {
+                    if (shared)
+                        s[i] = left->spec[s - ics->spec + i];
+                    else
+                        s[i] = noise_value(d);
+                    energy += s[i] * s[i];
+                }
+                float scale = powf(2.0f, 0.25f * ics->sf[g][k]) / sqrtf(energy);
+                for (int i = 0; i < width; i++)
+                    s[i] *= scale;
+            }
+        }
+        win += info->group_len[g];
+    }
+}
+
+static void apply_stereo(Decoder *d, Ics *l, Ics *r) {
+    const IcsInfo *info = &l->info;
+    int is_short = info->window_sequence == EIGHT_SHORT;
+    const int *offset = is_short ? d->short_offset : d->long_offset;
+    int win = 0;
+
+    for (int g = 0; g < info->num_groups; g++) {
+        for (int k = 0; k < info->max_sfb; k++) {
+            int book = r->book[g][k];
+            int intensity = book == HCB_INTENSITY || book == HCB_INTENSITY2;
+            int ms = d->ms_used[g][k];
+            if (!intensity && (!ms || book == HCB_NOISE || l->book[g][k] == HCB_NOISE))
+                continue;
+
+            float scale = 0;
+            if (intensity) {
+                scale = powf(0.5f, 0.25f * r->sf[g][k]);
+                if ((book == HCB_INTENSITY2) != (ms && d->ms_present == 1))
+                    scale = -scale;
+            }
+            for (int w = 0; w < info->group_len[g]; w++) {
+                int base = (win + w) * SHORT_LEN * is_short + offset[k];
+                for (int i = 0; i < offset[k + 1] - offset[k]; i++) {
+                    float a = l->spec[base + i], b = r->spec[base + i];
+                    if (intensity) {
+                        r->spec[base + i] = a * scale;
+                    } else {
+                        l->spec[base + i] = a + b;
+                        r->spec[base + i] = a - b;
+                    }
+                }
+            }
+        }
+        win += info->group_len[g];
+    }
+}
+
+// Rising halves of the windows, [shape][long/short].
+static float g_window_long[2][FRAME_LEN];
+static float g_window_short[2][SHORT_LEN];
+
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void kbd_window(float *w, int half, double alpha) {
+    double kernel[FRAME_LEN + 1], total = 0, acc = 0;
+    for (int j = 0; j <= half; j++) {
+        double x = (2.0 * j - half) / half;
+        kernel[j] = bessel_i0(M_PI * alpha * sqrt(1.0 - x * x));
+        total += kernel[j];
+    }
+    for (int n = 0; n < half; n++) {
+        acc += kernel[n];
+        w[n] = (float)sqrt(acc / total);
+    }
+}
+
+static void window_init(void) {
+    for (int n = 0; n < FRAME_LEN; n++)
+        g_window_long[0][n] = (float)sin(M_PI / (2 * FRAME_LEN) * (n + 0.5));
+    for (int n = 0; n < SHORT_LEN; n++)
+        g_window_short[0][n] = (float)sin(M_PI / (2 * SHORT_LEN) * (n + 0.5));
+    kbd_window(g_window_long[1], FRAME_LEN, 4);
+    kbd_window(g_window_short[1], SHORT_LEN, 6);
+}
+
+// In-place radix-2 complex FFT, n up to FRAME_LEN / 2.
+static void fft(float *re, float *im, int n) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        double a = -2 * M_PI / len;
+        for (int k = 0; k < len / 2; k++) {
+            float wr = (float)cos(a * k), wi = (float)sin(a * k);
+            for (int i = k; i < n; i += len) {
+                int j = i + len / 2;
+                float tr = re[j] * wr - im[j] * wi;
+                float ti = re[j] * wi + im[j] * wr;
+                re[j] = re[i] - tr;
+                im[j] = im[i] - ti;
+                re[i] += tr;
+                im[i] += ti;
+            }
+        }
+    }
+}
+
+// out[0..2m) = 1/m * sum_k in[k] cos(pi/m (n + 1/2 + m/2)(k + 1/2)), the
+// inverse MDCT of m coefficients, built on a DCT-IV done with an FFT of m/2.
+static void imdct(const float *in, float *out, int m) {
+    float re[FRAME_LEN / 2], im[FRAME_LEN / 2], y[FRAME_LEN];
+    int h = m / 2;
+
+    for (int n = 0; n < h; n++) {
+        double a = -M_PI * (4 * n + 1) / (4.0 * m);
+        float c = (float)cos(a), s = (float)sin(a);
+        float xr = in[2 * n], xi = in[m - 1 - 2 * n];
+        re[n] = xr * c - xi * s;
+        im[n] = xr * s + xi * c;
+    }
+    fft(re, im, h);
+    for (int k = 0; k < h; k++) {
+        double a = -M_PI * k / m;
+        float c = (float)cos(a), s = (float)sin(a);
+        float ur = re[k] * c - im[k] * s;
+        float ui = re[k] * s + im[k] * c;
+        y[2 * k] = ur;
+        y[m - 1 - 2 * k] = -ui;
+    }
+
+    for (int n = 0; n < 2 * m; n++) {
+        int j = n + h;
+        float v = j < m ? y[j] : j < 2 * m ? -y[2 * m - 1 - j] : -y[j - 2 * m];
+        out[n] = v / m;
+    }
+}
+
+static void filterbank(Decoder *d, int ch, float *out) {
+    const IcsInfo *info = &d->ics[ch].info;
+    const float *spec = d->ics[ch].spec;
+    const float *lp = g_window_long[d->prev_shape[ch]], *lc = g_window_long[info->window_shape];
+    const float *sp = g_window_short[d->prev_shape[ch]], *sc = g_window_short[info->window_shape];
+    float buf[2 * FRAME_LEN], t[2 * SHORT_LEN];
+    const int flat = (FRAME_LEN - SHORT_LEN) / 2;
+
+    if (info->window_sequence == EIGHT_SHORT) {
+        memset(buf, 0, sizeof(buf));
+        for (int w = 0; w < 8; w++) {
+            const float *rise = w ? sc : sp;
+            imdct(spec + w * SHORT_LEN, t, SHORT_LEN);
+            for (int n = 0; n < SHORT_LEN; n++) {
+                buf[flat + w * SHORT_LEN + n] += t[n] * rise[n];
+                buf[flat + w * SHORT_LEN + SHORT_LEN + n] += t[SHORT_LEN + n] * sc[SHORT_LEN - 1 - n];
+            }
+        }
+    } else {
+        imdct(spec, buf, FRAME_LEN);
+        for (int n = 0; n < FRAME_LEN; n++) {
+            if (info->window_sequence != LONG_STOP)
+                buf[n] *= lp[n];
+            else if (n < flat)
+                buf[n] = 0;
+            else if (n < flat + SHORT_LEN)
+                buf[n] *= sp[n - flat];
+
+            float *r = &buf[FRAME_LEN + n];
+            if (info->window_sequence != LONG_START)
+                *r *= lc[FRAME_LEN - 1 - n];
+            else if (n >= flat + SHORT_LEN)
+                *r = 0;
+            else if (n >= flat)
+                *r *= sc[SHORT_LEN - 1 - (n - flat)];
+        }
+    }
+
+    for (int n = 0; n < FRAME_LEN; n++) {
+        out[n] = buf[n] + d->overlap[ch][n];
+        d->overlap[ch][n] = buf[FRAME_LEN + n];
+    }
+    d->prev_shape[ch] = info->window_shape;
+}
+
+// Decodes one raw_data_block into FRAME_LEN interleaved samples per channel.
+static int decode_frame(Decoder *d, const uint8_t *data, size_t len, float *pcm) {
+    BitReader br = { data, len * 8, 0 };
+    int ch = 0;
+    int id;
+
+    while ((id = get_bits(&br, 3)) != ID_END) {
+        if (br.pos > br.bits)
+            return -1;
+        switch (id) {
+        case ID_SCE:
+            get_bits(&br, 4);
+            if (ch >= d->channels || read_ics(&br, d, &d->ics[ch], 0) < 0)
+                return -1;
+            memset(d->ms_used, 0, sizeof(d->ms_used));
+            apply_noise(d, &d->ics[ch], NULL);
+            ch++;
+            break;
+        case ID_CPE: {
+            get_bits(&br, 4);
+            if (ch + 2 > d->channels)
+                return -1;
+            Ics *l = &d->ics[ch], *r = &d->ics[ch + 1];
+            int common = get_bits(&br, 1);
+            memset(d->ms_used, 0, sizeof(d->ms_used));
+            d->ms_present = 0;
+            if (common) {
+                if (read_ics_info(&br, d, &l->info) < 0)
+                    return -1;
+                r->info = l->info;
+                d->ms_present = get_bits(&br, 2);
+                for (int g = 0; g < l->info.num_groups; g++)
+                    for (int k = 0; k < l->info.max_sfb; k++)
+                        d->ms_used[g][k] = d->ms_present == 2 ||
+                            (d->ms_present == 1 && get_bits(&br, 1));
+            }
+            if (read_ics(&br, d, l, common) < 0 || read_ics(&br, d, r, common) < 0)
+                return -1;
+            apply_noise(d, l, NULL);
+            apply_noise(d, r, l);
+            if (common)
+                apply_stereo(d, l, r);
+            ch += 2;
+            break;
+        }
+        case ID_FIL: {
+            int count = get_bits(&br, 4);
+            if (count == 15)
+                count += get_bits(&br, 8) - 1;
+            br.pos += count * 8;
+            break;
+        }
+        case ID_DSE: {
+            get_bits(&br, 4);
+            int align = get_bits(&br, 1);
+            int count = get_bits(&br, 8);
+            if (count == 255)
+                count += get_bits(&br, 8);
+            if (align)
+                br.pos = (br.pos + 7) & ~(size_t)7;
+            br.pos += count * 8;
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    if (ch != d->channels)
+        return -1;
+
+    float out[FRAME_LEN];
+    for (int c = 0; c < ch; c++) {
+        filterbank(d, c, out);
+        for (int n = 0; n < FRAME_LEN; n++)
+            pcm[n * ch + c] = out[n];
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Encode, decode and compare
+
+typedef struct {
+    size_t bytes;
+    double cpu_s;
+    float *pcm;
+    size_t frames;
+} Result;
+
+static double cpu_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run_encoder(const Encoder *enc, const short *pcm, size_t frames,
+    unsigned int rate, int channels, unsigned int kbps, Result *res) {
+    unsigned long in_samples, max_out;
+    faacEncHandle h = enc->open(rate, channels, &in_samples, &max_out);
+    if (!h)
+        return -1;
+
+    faacEncConfigurationPtr cfg = enc->get_config(h);
+    cfg->aacObjectType = LOW;
+    cfg->mpegVersion = MPEG4;
+    cfg->useTns = 0;
+    cfg->allowMidside = channels > 1;
+    cfg->outputFormat = 0;
+    cfg->bandWidth = 0;
+    cfg->quantqual = 0;
+    cfg->bitRate = kbps * 1000 / channels;
+    cfg->inputFormat = FAAC_INPUT_16BIT;
+    if (!enc->set_config(h, cfg)) {
+        enc->close(h);
+        return -1;
+    }
+
+    Decoder dec;
+    if (decoder_init(&dec, rate, channels) < 0) {
+        enc->close(h);
+        return -1;
+    }
+
+    size_t total = frames * channels, pos = 0;
+    size_t cap = (total / (FRAME_LEN * channels) + 8) * FRAME_LEN * channels;
+    unsigned char *out = malloc(max_out);
+    memset(res, 0, sizeof(*res));
+    res->pcm = calloc(cap, sizeof(float));
+    if (!out || !res->pcm) {
+        free(out);
+        enc->close(h);
+        return -1;
+    }
+
+    int ret = 0;
+    for (;;) {
+        unsigned int n = pos < total ? (unsigned int)(total - pos < in_samples ? total - pos : in_samples) : 0;
+        double t0 = cpu_now();
+        int bytes = enc->encode(h, n ? (int32_t *)(pcm + pos) : NULL, n, out, max_out);
+        res->cpu_s += cpu_now() - t0;
+        pos += n;
+        if (bytes < 0) {
+            ret = -1;
+            break;
+        }
+        if (bytes == 0) {
+            if (!n)
+                break;
+            continue;
+        }
+        res->bytes += bytes;
+        if ((res->frames + FRAME_LEN) * channels > cap ||
+            decode_frame(&dec, out, bytes, res->pcm + res->frames * channels) < 0) {
+            fprintf(stderr, "%s: cannot decode frame %zu\n", enc->name, res->frames / FRAME_LEN);
+            ret = -1;
+            break;
+        }
+        res->frames += FRAME_LEN;
+    }
+
+    free(out);
+    enc->close(h);
+    return ret;
+}
+
+static double snr_db(double signal, double noise) {
+    if (noise <= 0)
+        return 99.99;
+    return 10 * log10(signal / noise);
+}
+
+static double source_snr(const short *ref, size_t frames, const Result *res, int channels) {
+    double sig = 0, err = 0;
+    size_t begin = -DECODED_LAG;
+    size_t end = res->frames + begin < frames ? res->frames + begin : frames;
+    for (size_t i = begin * channels; i < end * channels; i++) {
+        double e = ref[i] - res->pcm[i - begin * channels];
+        sig += (double)ref[i] * ref[i];
+        err += e * e;
+    }
+    return snr_db(sig, err);
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 6;
+    if (argc > 2 || seconds < 4) {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    huff_init();
+    window_init();
+
+    printf("%-18s %-30s %-30s %s\n", "signal", "float", "fixed", "fixed vs float");
+    int failed = 0;
+    for (size_t c = 0; c < sizeof(g_cases) / sizeof(g_cases[0]); c++) {
+        unsigned int rate = g_cases[c].rate;
+        int channels = g_cases[c].channels;
+        size_t frames = (size_t)(seconds * rate);
+        short *pcm = make_signal(g_cases[c].kind, rate, channels, frames);
+        Result res[2];
+        memset(res, 0, sizeof(res));
+        if (!pcm) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        printf("%-18s", g_cases[c].label);
+        int ok = 1;
+        for (int e = 0; e < 2 && ok; e++)
+            ok = run_encoder(&g_encoders[e], pcm, frames, rate, channels, g_cases[c].kbps, &res[e]) == 0;
+        if (ok) {
+            for (int e = 0; e < 2; e++)
+                printf(" %6.2f dB %6.1f kb/s %6.3f s", source_snr(pcm, frames, &res[e], channels),
+                    res[e].bytes * 8 / seconds / 1000, res[e].cpu_s);
+
+            double sig = 0, err = 0;
+            size_t n = (res[0].frames < res[1].frames ? res[0].frames : res[1].frames) * channels;
+            for (size_t i = 0; i < n; i++) {
+                double d = res[0].pcm[i] - res[1].pcm[i];
+                sig += (double)res[0].pcm[i] * res[0].pcm[i];
+                err += d * d;
+            }
+            printf(" %6.2f dB\n", snr_db(sig, err));
+        } else {
+            printf(" encode failed\n");
+            failed = 1;
+        }
+        for (int e = 0; e < 2; e++)
+            free(res[e].pcm);
+        free(pcm);
+    }
+    return failed;
+}
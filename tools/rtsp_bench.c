@@ -0,0 +1,769 @@
+// rtsp_bench: RTSP load generator for soak and capacity tests.
+//
+// Opens N concurrent sessions against a divinus instance running on the same
+// host (DESCRIBE, SETUP of every track, PLAY), receives the RTP over TCP
+// interleaved channels and/or UDP, and reports for each session the bitrate,
+// frame rate, packet loss, sequence gaps, interarrival jitter (RFC 3550
+// A.8) and the latency from PLAY to the end of the first frame. Some sessions
+// can be throttled to emulate slow readers.
+//
+// Build:  make -C src rtsp_bench
+// Usage:  ./rtsp_bench [-n sessions] [-t tcp|udp|mix] [-s slow] [-r kbps]
+//                      [-d seconds] [-i seconds] [-p port] [-V] [url]
+//
+// The server must be reachable on a loopback address; the default URL is
+// rtsp://127.0.0.1:554/. Only the standard C library and POSIX are used.
+
+#define _GNU_SOURCE // memmem
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_TRACKS 2
+#define RECV_BUF_SIZE (256 * 1024)
+#define RESPONSE_TIMEOUT_S 5
+#define KEEPALIVE_INTERVAL_US (20 * 1000000ULL)
+// Kernel receive buffer of throttled UDP sessions, so that they lose packets
+// instead of queueing seconds of video.
+#define SLOW_UDP_RCVBUF (64 * 1024)
+
+typedef struct {
+    char control[320];
+    int is_video;
+    uint32_t clock;
+    // TCP interleaved channel of RTP (RTCP is channel + 1).
+    int channel;
+    // UDP only.
+    int rtp_fd;
+    int rtcp_fd;
+
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t frames;
+    // Sequence tracking (RFC 3550 A.1, without probation).
+    int have_seq;
+    uint16_t max_seq;
+    uint32_t base_seq;
+    uint32_t cycles;
+    uint64_t gaps;
+    uint64_t late;
+    // Interarrival jitter, in RTP clock units.
+    int have_transit;
+    int64_t transit;
+    double jitter;
+    uint64_t first_frame_us;
+} BenchTrack;
+
+typedef struct {
+    int id;
+    int tcp;
+    int slow;
+    int fd;
+    int failed;
+    int cseq;
+    char session[128];
+    BenchTrack tracks[MAX_TRACKS];
+    int ntracks;
+
+    uint8_t *buf;
+    size_t len;
+
+    // Slow reader token bucket, in bytes.
+    double tokens;
+    uint64_t refill_us;
+
+    uint64_t play_us;
+    uint64_t keepalive_us;
+} BenchSession;
+
+static volatile sig_atomic_t g_stop;
+
+static char g_url[256] = "rtsp://127.0.0.1:554/";
+static struct sockaddr_in g_server;
+static struct in_addr g_local;
+static unsigned int g_udp_port = 50000;
+static int g_video_only;
+static double g_slow_bps = 256 * 1000 / 8;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    g_stop = 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] [rtsp://127.0.0.1:554/]\n"
+        "  -n N        concurrent sessions (default: 1)\n"
+        "  -t MODE     transport: tcp, udp or mix (alternating) (default: tcp)\n"
+        "  -s N        throttle the first N sessions as slow readers (default: 0)\n"
+        "  -r KBPS     read rate of slow sessions, in kbit/s (default: 256)\n"
+        "  -d SECONDS  test duration, 0 until interrupted (default: 30)\n"
+        "  -i SECONDS  interval of the progress line, 0 to disable (default: 5)\n"
+        "  -p PORT     first UDP client port (default: 50000)\n"
+        "  -V          only set up the video track\n",
+        prog);
+}
+
+// Resolves the URL host and insists on a loopback address.
+static int parse_url(void) {
+    if (strncasecmp(g_url, "rtsp://", 7)) {
+        fprintf(stderr, "Not an rtsp:// URL: %s\n", g_url);
+        return -1;
+    }
+    const char *host = g_url + 7;
+    const char *end = host + strcspn(host, ":/");
+    char name[256];
+    if (end == host || (size_t)(end - host) >= sizeof name) {
+        fprintf(stderr, "Missing host in %s\n", g_url);
+        return -1;
+    }
+    memcpy(name, host, (size_t)(end - host));
+    name[end - host] = '\0';
+    const int port = (*end == ':') ? atoi(end + 1) : 554;
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM}, *res;
+    if (getaddrinfo(name, NULL, &hints, &res)) {
+        fprintf(stderr, "Cannot resolve %s\n", name);
+        return -1;
+    }
+    memcpy(&g_server, res->ai_addr, sizeof g_server);
+    freeaddrinfo(res);
+    g_server.sin_port = htons((uint16_t)port);
+
+    if ((ntohl(g_server.sin_addr.s_addr) >> 24) != 127) {
+        fprintf(stderr, "%s is not a loopback address, rtsp_bench only runs on localhost\n", name);
+        return -1;
+    }
+
+    // Drop a trailing slash so that control URLs join cleanly.
+    const size_t len = strlen(g_url);
+    if (len > 7 && g_url[len - 1] == '/')
+        g_url[len - 1] = '\0';
+    return 0;
+}
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        const ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Length of the RTSP response at the start of the receive buffer (headers and
+// body), 0 while incomplete. *status receives the status code.
+static size_t response_length(const BenchSession *s, int *status, size_t *body_off) {
+    const char *p = (const char *)s->buf;
+    const char *hdr_end = memmem(p, s->len, "\r\n\r\n", 4);
+    if (!hdr_end)
+        return 0;
+    const size_t hdr_len = (size_t)(hdr_end - p) + 4;
+    size_t body_len = 0;
+    for (const char *line = p; line < hdr_end;) {
+        const char *eol = memmem(line, (size_t)(hdr_end + 2 - line), "\r\n", 2);
+        if (!strncasecmp(line, "Content-Length:", 15))
+            body_len = strtoul(line + 15, NULL, 10);
+        line = eol + 2;
+    }
+    if (s->len < hdr_len + body_len)
+        return 0;
+    if (status)
+        *status = (s->len > 12 && !strncmp(p, "RTSP/1.0 ", 9)) ? atoi(p + 9) : 0;
+    if (body_off)
+        *body_off = hdr_len;
+    return hdr_len + body_len;
+}
+
+static void consume(BenchSession *s, size_t n) {
+    memmove(s->buf, s->buf + n, s->len - n);
+    s->len -= n;
+}
+
+static const char *find_header(const char *resp, size_t len, const char *name) {
+    const size_t name_len = strlen(name);
+    for (const char *line = resp; line && line < resp + len;) {
+        if (!strncasecmp(line, name, name_len) && line[name_len] == ':') {
+            line += name_len + 1;
+            while (*line == ' ')
+                line++;
+            return line;
+        }
+        line = memmem(line, (size_t)(resp + len - line), "\r\n", 2);
+        if (line)
+            line += 2;
+    }
+    return NULL;
+}
+
+// Sends a request and waits for its response, which is copied (NUL
+// terminated) into resp. Interleaved RTP arriving meanwhile is dropped.
+static int rtsp_request(BenchSession *s, const char *method, const char *url,
+    const char *extra, char *resp, size_t resp_size) {
+    char req[1024];
+    const int n = snprintf(req, sizeof req,
+        "%s %s RTSP/1.0\r\nCSeq: %d\r\nUser-Agent: rtsp_bench\r\n%s%s%s%s\r\n",
+        method, url, ++s->cseq,
+        s->session[0] ? "Session: " : "", s->session, s->session[0] ? "\r\n" : "",
+        extra ? extra : "");
+    if (n < 0 || (size_t)n >= sizeof req || send_all(s->fd, req, (size_t)n))
+        return -1;
+
+    const uint64_t deadline = now_us() + RESPONSE_TIMEOUT_S * 1000000ULL;
+    for (;;) {
+        while (s->len && s->buf[0] == '$') {
+            if (s->len < 4)
+                break;
+            const size_t frame = 4 + (((size_t)s->buf[2] << 8) | s->buf[3]);
+            if (s->len < frame)
+                break;
+            consume(s, frame);
+        }
+        int status = 0;
+        size_t body_off = 0;
+        const size_t total = (s->len && s->buf[0] == 'R') ?
+            response_length(s, &status, &body_off) : 0;
+        if (total) {
+            const size_t copy = total < resp_size ? total : resp_size - 1;
+            memcpy(resp, s->buf, copy);
+            resp[copy] = '\0';
+            consume(s, total);
+            return status;
+        }
+        if (now_us() > deadline || s->len == RECV_BUF_SIZE)
+            return -1;
+
+        struct pollfd pfd = {.fd = s->fd, .events = POLLIN};
+        if (poll(&pfd, 1, 100) < 0 && errno != EINTR)
+            return -1;
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+        const ssize_t got = recv(s->fd, s->buf + s->len, RECV_BUF_SIZE - s->len, 0);
+        if (got <= 0)
+            return -1;
+        s->len += (size_t)got;
+    }
+}
+
+// Fills the session's track list from the media sections of the SDP.
+static void parse_sdp(BenchSession *s, const char *sdp) {
+    BenchTrack *t = NULL;
+    for (const char *line = sdp; *line;) {
+        const size_t len = strcspn(line, "\r\n");
+        if (!strncmp(line, "m=", 2)) {
+            t = NULL;
+            const int is_video = !strncmp(line + 2, "video", 5);
+            if (s->ntracks < MAX_TRACKS && (is_video || !g_video_only)) {
+                t = &s->tracks[s->ntracks++];
+                memset(t, 0, sizeof *t);
+                t->is_video = is_video;
+                t->clock = 90000;
+                t->rtp_fd = t->rtcp_fd = -1;
+            }
+        } else if (t && !strncmp(line, "a=rtpmap:", 9)) {
+            const char *slash = memchr(line, '/', len);
+            if (slash)
+                t->clock = (uint32_t)strtoul(slash + 1, NULL, 10);
+        } else if (t && !strncmp(line, "a=control:", 10)) {
+            const size_t clen = len - 10;
+            if (!strncasecmp(line + 10, "rtsp://", 7))
+                snprintf(t->control, sizeof t->control, "%.*s", (int)clen, line + 10);
+            else
+                snprintf(t->control, sizeof t->control, "%s/%.*s", g_url, (int)clen, line + 10);
+        }
+        line += len;
+        line += strspn(line, "\r\n");
+    }
+}
+
+static int bind_udp(int port) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr = g_local,
+        .sin_port = htons((uint16_t)port)};
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr)) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Binds an RTP/RTCP port pair for a UDP track, walking up from g_udp_port.
+static int open_udp_pair(BenchTrack *t, int slow) {
+    for (; g_udp_port + 1 < 65536; g_udp_port += 2) {
+        t->rtp_fd = bind_udp((int)g_udp_port);
+        if (t->rtp_fd < 0)
+            continue;
+        t->rtcp_fd = bind_udp((int)g_udp_port + 1);
+        if (t->rtcp_fd < 0) {
+            close(t->rtp_fd);
+            t->rtp_fd = -1;
+            continue;
+        }
+        if (slow) {
+            const int size = SLOW_UDP_RCVBUF;
+            setsockopt(t->rtp_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+        }
+        const int port = (int)g_udp_port;
+        g_udp_port += 2;
+        return port;
+    }
+    return -1;
+}
+
+static int session_start(BenchSession *s) {
+    char resp[4096], extra[256];
+
+    s->buf = malloc(RECV_BUF_SIZE);
+    s->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (!s->buf || s->fd < 0 ||
+        connect(s->fd, (struct sockaddr *)&g_server, sizeof g_server)) {
+        fprintf(stderr, "[%d] connect: %s\n", s->id, strerror(errno));
+        return -1;
+    }
+    if (s->slow) {
+        // A small window makes the server see the slow reader quickly.
+        const int size = 32 * 1024;
+        setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+    }
+    if (!g_local.s_addr) {
+        struct sockaddr_in local;
+        socklen_t len = sizeof local;
+        getsockname(s->fd, (struct sockaddr *)&local, &len);
+        g_local = local.sin_addr;
+    }
+
+    int status = rtsp_request(s, "DESCRIBE", g_url, "Accept: application/sdp\r\n",
+        resp, sizeof resp);
+    if (status != 200) {
+        fprintf(stderr, "[%d] DESCRIBE failed (%d)\n", s->id, status);
+        return -1;
+    }
+    const char *body = strstr(resp, "\r\n\r\n");
+    parse_sdp(s, body ? body + 4 : "");
+    if (!s->ntracks) {
+        fprintf(stderr, "[%d] no media in SDP\n", s->id);
+        return -1;
+    }
+
+    for (int i = 0; i < s->ntracks; i++) {
+        BenchTrack *t = &s->tracks[i];
+        if (!t->control[0])
+            snprintf(t->control, sizeof t->control, "%s", g_url);
+        if (s->tcp) {
+            t->channel = 2 * i;
+            snprintf(extra, sizeof extra,
+                "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n",
+                t->channel, t->channel + 1);
+        } else {
+            const int port = open_udp_pair(t, s->slow);
+            if (port < 0) {
+                fprintf(stderr, "[%d] no free UDP port pair\n", s->id);
+                return -1;
+            }
+            snprintf(extra, sizeof extra,
+                "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n", port, port + 1);
+        }
+        status = rtsp_request(s, "SETUP", t->control, extra, resp, sizeof resp);
+        if (status != 200) {
+            fprintf(stderr, "[%d] SETUP %s failed (%d)\n", s->id, t->control, status);
+            return -1;
+        }
+        const char *session = find_header(resp, strlen(resp), "Session");
+        if (session && !s->session[0])
+            snprintf(s->session, sizeof s->session, "%.*s",
+                (int)strcspn(session, ";\r\n"), session);
+    }
+
+    s->play_us = now_us();
+    status = rtsp_request(s, "PLAY", g_url, "Range: npt=0.000-\r\n", resp, sizeof resp);
+    if (status != 200) {
+        fprintf(stderr, "[%d] PLAY failed (%d)\n", s->id, status);
+        return -1;
+    }
+    s->keepalive_us = now_us();
+    s->refill_us = now_us();
+    fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+static void parse_tcp(BenchSession *s, uint64_t now);
+
+static void track_rtp(BenchSession *s, BenchTrack *t, const uint8_t *p, size_t len,
+    uint64_t now) {
+    if (len < 12 || (p[0] >> 6) != 2)
+        return;
+    const uint16_t seq = (uint16_t)((p[2] << 8) | p[3]);
+    const uint32_t ts = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) |
+        ((uint32_t)p[6] << 8) | p[7];
+
+    t->packets++;
+    t->bytes += len;
+    if (!t->have_seq) {
+        t->have_seq = 1;
+        t->base_seq = seq;
+        t->max_seq = seq;
+    } else {
+        const uint16_t delta = (uint16_t)(seq - t->max_seq);
+        if (delta == 0 || delta >= 0x8000) {
+            // Duplicate or out of order.
+            t->late++;
+        } else {
+            if (delta > 1)
+                t->gaps++;
+            if (seq < t->max_seq)
+                t->cycles += 65536;
+            t->max_seq = seq;
+        }
+    }
+
+    const int64_t arrival = (int64_t)(now * t->clock / 1000000ULL);
+    const int64_t transit = arrival - (int64_t)ts;
+    if (t->have_transit) {
+        int64_t d = (int64_t)(int32_t)(uint32_t)(transit - t->transit);
+        if (d < 0)
+            d = -d;
+        t->jitter += ((double)d - t->jitter) / 16.0;
+    }
+    t->transit = transit;
+    t->have_transit = 1;
+
+    if (p[1] & 0x80) {
+        t->frames++;
+        if (!t->first_frame_us)
+            t->first_frame_us = now - s->play_us;
+    }
+}
+
+static uint64_t track_expected(const BenchTrack *t) {
+    if (!t->have_seq)
+        return 0;
+    return (uint64_t)t->cycles + t->max_seq - t->base_seq + 1;
+}
+
+static uint64_t track_lost(const BenchTrack *t) {
+    const uint64_t expected = track_expected(t);
+    const uint64_t received = t->packets - t->late;
+    return expected > received ? expected - received : 0;
+}
+
+// Walks the interleaved stream: RTP/RTCP frames and keepalive responses.
+static void parse_tcp(BenchSession *s, uint64_t now) {
+    size_t off = 0;
+    while (off < s->len) {
+        const uint8_t *p = s->buf + off;
+        const size_t avail = s->len - off;
+        if (p[0] == '$') {
+            if (avail < 4)
+                break;
+            const size_t len = ((size_t)p[2] << 8) | p[3];
+            if (avail < 4 + len)
+                break;
+            for (int i = 0; i < s->ntracks; i++)
+                if (s->tracks[i].channel == p[1])
+                    track_rtp(s, &s->tracks[i], p + 4, len, now);
+            off += 4 + len;
+        } else if (p[0] == 'R') {
+            consume(s, off);
+            off = 0;
+            const size_t total = response_length(s, NULL, NULL);
+            if (!total)
+                break;
+            off = total;
+        } else {
+            // Lost framing: resynchronize on the next '$'.
+            off++;
+        }
+    }
+    consume(s, off);
+}
+
+static void session_read(BenchSession *s, int fd, uint64_t now) {
+    size_t room;
+    if (fd == s->fd) {
+        room = RECV_BUF_SIZE - s->len;
+        if (s->slow && room > (size_t)s->tokens)
+            room = (size_t)s->tokens;
+        if (!room)
+            return;
+        const ssize_t n = recv(fd, s->buf + s->len, room, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            fprintf(stderr, "[%d] connection closed by server\n", s->id);
+            s->failed = 1;
+            return;
+        }
+        if (n > 0) {
+            s->len += (size_t)n;
+            if (s->slow)
+                s->tokens -= (double)n;
+            parse_tcp(s, now);
+        }
+        return;
+    }
+
+    for (int i = 0; i < s->ntracks; i++) {
+        BenchTrack *t = &s->tracks[i];
+        if (fd == t->rtcp_fd) {
+            uint8_t rtcp[1500];
+            while (recv(fd, rtcp, sizeof rtcp, 0) > 0)
+                ;
+        } else if (fd == t->rtp_fd) {
+            uint8_t pkt[2048];
+            ssize_t n;
+            while ((!s->slow || s->tokens > 0) &&
+                (n = recv(fd, pkt, sizeof pkt, 0)) > 0) {
+                track_rtp(s, t, pkt, (size_t)n, now);
+                if (s->slow)
+                    s->tokens -= (double)n;
+            }
+        }
+    }
+}
+
+static void session_keepalive(BenchSession *s, uint64_t now) {
+    if (now - s->keepalive_us < KEEPALIVE_INTERVAL_US)
+        return;
+    s->keepalive_us = now;
+    // The response is skipped by parse_tcp().
+    char req[512];
+    const int n = snprintf(req, sizeof req,
+        "OPTIONS %s RTSP/1.0\r\nCSeq: %d\r\nSession: %s\r\n\r\n",
+        g_url, ++s->cseq, s->session);
+    if (n > 0 && (size_t)n < sizeof req)
+        send(s->fd, req, (size_t)n, MSG_NOSIGNAL);
+}
+
+static void session_stop(BenchSession *s) {
+    if (s->fd >= 0 && !s->failed && s->session[0]) {
+        char req[512];
+        const int n = snprintf(req, sizeof req,
+            "TEARDOWN %s RTSP/1.0\r\nCSeq: %d\r\nSession: %s\r\n\r\n",
+            g_url, ++s->cseq, s->session);
+        if (n > 0 && (size_t)n < sizeof req)
+            send(s->fd, req, (size_t)n, MSG_NOSIGNAL);
+    }
+    if (s->fd >= 0)
+        close(s->fd);
+    for (int i = 0; i < s->ntracks; i++) {
+        if (s->tracks[i].rtp_fd >= 0)
+            close(s->tracks[i].rtp_fd);
+        if (s->tracks[i].rtcp_fd >= 0)
+            close(s->tracks[i].rtcp_fd);
+    }
+    free(s->buf);
+}
+
+// One line with the aggregate rate since the previous call.
+static void report_progress(BenchSession *sessions, int n, uint64_t start, uint64_t now) {
+    static uint64_t last_bytes, last_us;
+    uint64_t bytes = 0, packets = 0, lost = 0;
+    double jitter_ms = 0;
+    int alive = 0;
+    for (int i = 0; i < n; i++) {
+        if (sessions[i].failed)
+            continue;
+        alive++;
+        for (int k = 0; k < sessions[i].ntracks; k++) {
+            const BenchTrack *t = &sessions[i].tracks[k];
+            bytes += t->bytes;
+            packets += t->packets;
+            lost += track_lost(t);
+            if (t->clock && t->jitter * 1000.0 / t->clock > jitter_ms)
+                jitter_ms = t->jitter * 1000.0 / t->clock;
+        }
+    }
+    const double secs = (double)(now - (last_us ? last_us : start)) / 1e6;
+    printf("%6.1fs sessions=%d/%d rate=%.0f kbps loss=%.2f%% worst_jitter=%.1f ms\n",
+        (double)(now - start) / 1e6, alive, n,
+        secs > 0 ? (bytes - last_bytes) * 8 / secs / 1000 : 0.0,
+        packets + lost ? lost * 100.0 / (double)(packets + lost) : 0.0, jitter_ms);
+    fflush(stdout);
+    last_bytes = bytes;
+    last_us = now;
+}
+
+static void report_final(BenchSession *sessions, int n, uint64_t end) {
+    printf("\n%-4s %-5s %-4s %-5s %9s %7s %9s %7s %6s %6s %9s %11s\n",
+        "id", "trans", "slow", "track", "kbps", "fps", "packets", "lost", "loss%",
+        "gaps", "jitter_ms", "first_ms");
+    for (int i = 0; i < n; i++) {
+        const BenchSession *s = &sessions[i];
+        const double secs = s->play_us ? (double)(end - s->play_us) / 1e6 : 0;
+        for (int k = 0; k < s->ntracks; k++) {
+            const BenchTrack *t = &s->tracks[k];
+            const uint64_t lost = track_lost(t);
+            char first[16];
+            if (t->first_frame_us)
+                snprintf(first, sizeof first, "%.1f", t->first_frame_us / 1000.0);
+            else
+                snprintf(first, sizeof first, "-");
+            printf("%-4d %-5s %-4s %-5s %9.0f %7.1f %9llu %7llu %6.2f %6llu %9.1f %11s%s\n",
+                s->id, s->tcp ? "tcp" : "udp", s->slow ? "yes" : "no",
+                t->is_video ? "video" : "audio",
+                secs > 0 ? t->bytes * 8 / secs / 1000 : 0.0,
+                secs > 0 && t->is_video ? t->frames / secs : 0.0,
+                (unsigned long long)t->packets, (unsigned long long)lost,
+                t->packets + lost ? lost * 100.0 / (double)(t->packets + lost) : 0.0,
+                (unsigned long long)t->gaps,
+                t->clock ? t->jitter * 1000.0 / t->clock : 0.0, first,
+                s->failed ? " (failed)" : "");
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int count = 1, slow = 0, duration = 30, interval = 5;
+    const char *mode = "tcp";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:s:r:d:i:p:Vh")) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 't': mode = optarg; break;
+            case 's': slow = atoi(optarg); break;
+            case 'r': g_slow_bps = atof(optarg) * 1000 / 8; break;
+            case 'd': duration = atoi(optarg); break;
+            case 'i': interval = atoi(optarg); break;
+            case 'p': g_udp_port = (unsigned int)atoi(optarg); break;
+            case 'V': g_video_only = 1; break;
+            default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+        snprintf(g_url, sizeof g_url, "%s", argv[optind]);
+    if (count < 1 || slow < 0 || duration < 0 || interval < 0 || g_slow_bps <= 0 ||
+        (strcmp(mode, "tcp") && strcmp(mode, "udp") && strcmp(mode, "mix"))) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (parse_url())
+        return EXIT_FAILURE;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    BenchSession *sessions = calloc((size_t)count, sizeof *sessions);
+    struct pollfd *pfds = calloc((size_t)count * (1 + 2 * MAX_TRACKS), sizeof *pfds);
+    BenchSession **owners = calloc((size_t)count * (1 + 2 * MAX_TRACKS), sizeof *owners);
+    if (!sessions || !pfds || !owners) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < count; i++) {
+        sessions[i].id = i;
+        sessions[i].fd = -1;
+    }
+
+    const uint64_t start = now_us();
+    const uint64_t end = duration ? start + (uint64_t)duration * 1000000ULL : 0;
+    uint64_t next_report = start + (uint64_t)interval * 1000000ULL;
+    int started = 0, next = 0;
+
+    while (!g_stop) {
+        uint64_t now = now_us();
+        if (end && now >= end)
+            break;
+
+        // Sessions are set up one per iteration, so that the ones already
+        // playing keep being read and their first frame latency stays honest.
+        if (next < count) {
+            BenchSession *s = &sessions[next];
+            s->tcp = !strcmp(mode, "tcp") || (!strcmp(mode, "mix") && !(next & 1));
+            s->slow = next < slow;
+            if (session_start(s)) {
+                s->failed = 1;
+            } else {
+                started++;
+                if (s->len)
+                    parse_tcp(s, now_us());
+            }
+            if (++next == count)
+                printf("%d/%d sessions playing from %s\n", started, count, g_url);
+            now = now_us();
+        }
+
+        nfds_t nfds = 0;
+        for (int i = 0; i < next; i++) {
+            BenchSession *s = &sessions[i];
+            if (s->failed)
+                continue;
+            if (s->slow) {
+                s->tokens += g_slow_bps * (double)(now - s->refill_us) / 1e6;
+                // Allow bursts of at most 100 ms worth of data.
+                if (s->tokens > g_slow_bps / 10)
+                    s->tokens = g_slow_bps / 10;
+                s->refill_us = now;
+            }
+            const short events = (!s->slow || s->tokens > 0) ? POLLIN : 0;
+            session_keepalive(s, now);
+            pfds[nfds] = (struct pollfd){.fd = s->fd, .events = events};
+            owners[nfds++] = s;
+            for (int k = 0; k < s->ntracks; k++) {
+                if (s->tracks[k].rtp_fd < 0)
+                    continue;
+                pfds[nfds] = (struct pollfd){.fd = s->tracks[k].rtp_fd, .events = events};
+                owners[nfds++] = s;
+                pfds[nfds] = (struct pollfd){.fd = s->tracks[k].rtcp_fd, .events = POLLIN};
+                owners[nfds++] = s;
+            }
+        }
+        if (!nfds) {
+            if (next < count)
+                continue;
+            fprintf(stderr, "No session left\n");
+            break;
+        }
+
+        const int ready = poll(pfds, nfds, next < count ? 0 : slow ? 10 : 100);
+        if (ready < 0 && errno != EINTR)
+            break;
+        now = now_us();
+        for (nfds_t i = 0; ready > 0 && i < nfds; i++)
+            if (pfds[i].revents && !owners[i]->failed)
+                session_read(owners[i], pfds[i].fd, now);
+
+        if (interval && now >= next_report) {
+            report_progress(sessions, count, start, now);
+            next_report += (uint64_t)interval * 1000000ULL;
+        }
+    }
+
+    const uint64_t stop = now_us();
+    report_final(sessions, next, stop);
+    for (int i = 0; i < next; i++)
+        session_stop(&sessions[i]);
+    free(owners);
+    free(pfds);
+    free(sessions);
+    return started ? EXIT_SUCCESS : EXIT_FAILURE;
+}